@@ -26,7 +26,10 @@
 #include <ui/GraphicBuffer.h>
 #include <ui/Rect.h>
 
+#include <cutils/atomic.h>
+
 #include <utils/String8.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 #include <utils/threads.h>
 
@@ -151,6 +154,15 @@ public:
     virtual status_t queueBuffer(int buf,
             const QueueBufferInput& input, QueueBufferOutput* output);
 
+    // queueAndDequeueBuffer queues buf and hands the producer its next
+    // buffer in the same call when the lock-free dequeue path can: a free
+    // buffer that needs no allocation. Otherwise *nextBuf is
+    // INVALID_BUFFER_SLOT and the producer calls dequeueBuffer later.
+    virtual status_t queueAndDequeueBuffer(int buf,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* nextBuf, uint32_t width, uint32_t height,
+            uint32_t format, uint32_t usage);
+
     virtual void cancelBuffer(int buf);
 
     // setSynchronousMode set whether dequeueBuffer is synchronous or
@@ -204,7 +216,8 @@ public:
            mScalingMode(NATIVE_WINDOW_SCALING_MODE_FREEZE),
            mTimestamp(0),
            mFrameNumber(0),
-           mBuf(INVALID_BUFFER_SLOT) {
+           mBuf(INVALID_BUFFER_SLOT),
+           mQueueTime(0) {
 	           mCrop.makeInvalid();
 	         }
         // mGraphicBuffer points to the buffer allocated for this slot or is NULL
@@ -229,6 +242,10 @@ public:
 
         // mBuf is the slot index of this buffer
         int mBuf;
+
+        // mQueueTime is the systemTime() at which queueBuffer queued this
+        // frame. Unlike mTimestamp it isn't chosen by the producer.
+        int64_t mQueueTime;
 	};
 
     // The following public functions is the consumer facing interface
@@ -293,7 +310,94 @@ public:
     // setTransformHint bakes in rotation to buffers so overlays can be used
     status_t setTransformHint(uint32_t hint);
 
+    // setLockFreeEnabled enables or disables the lock-free paths of
+    // dequeueBuffer, queueBuffer, cancelBuffer, acquireBuffer and
+    // releaseBuffer. They are enabled by default, disabling them is only
+    // useful for comparing against the locked paths and for debugging.
+    status_t setLockFreeEnabled(bool enabled);
+
+    // setAdaptiveMode enables or disables the adaptive queue depth of
+    // synchronous mode. Producers normally run ahead of the consumer by as
+    // many frames as there are buffers, each of them a latch period of
+    // latency. In adaptive mode dequeueBuffer blocks while the consumer has
+    // enough frames queued: one when the producer renders a frame in less
+    // than half of the consumer's latch period, which acquireBuffer
+    // measures, and one more for each further half period it takes, so that
+    // it doesn't miss a latch. Asynchronous mode isn't affected.
+    status_t setAdaptiveMode(bool enabled);
+
 private:
+    // Lock holds mMutex and keeps the lock-free paths out while it's held,
+    // so that everything can be read and changed as if they didn't exist.
+    // All the methods that don't run lock-free use it instead of a
+    // Mutex::Autolock.
+    class Lock {
+    public:
+        Lock(const BufferQueue& bq);
+        ~Lock();
+    private:
+        const BufferQueue& mBQ;
+    };
+    friend class Lock;
+
+    // excludeLockFreePathsLocked waits until no lock-free path runs and
+    // keeps new ones from starting, it's called with mMutex held. It yields
+    // a few times, then releases mMutex and sleeps until the lock-free path
+    // exits, so that it can't starve a lower priority thread running one.
+    void excludeLockFreePathsLocked() const;
+
+    // waitLocked waits on mDequeueCondition, letting the lock-free paths
+    // run in the meantime.
+    void waitLocked() const;
+
+    // enterLockFreePath starts a lock-free path on the producer or the
+    // consumer side, given by busy. It fails when a Lock is held, when
+    // the lock-free paths are disabled, or when another thread already runs
+    // one on the same side, the caller then takes the locked path instead.
+    // exitLockFreePath ends it, and wakes the threads sleeping in
+    // excludeLockFreePathsLocked().
+    bool enterLockFreePath(volatile int32_t* busy);
+    void exitLockFreePath(volatile int32_t* busy);
+
+    // wakeWaiters wakes the threads in waitLocked() after a lock-free path
+    // changed the state of a slot, it's called after exitLockFreePath().
+    void wakeWaiters();
+
+    // waitForFence waits for the consumer to be done with a buffer that is
+    // being dequeued, and destroys the fence. It's called without the lock.
+    void waitForFence(EGLDisplay dpy, EGLSyncKHR fence) const;
+
+    // adaptiveQueueDepth returns the number of queued frames at which
+    // dequeueBuffer blocks in adaptive mode, or NUM_BUFFER_SLOTS as long as
+    // the consumer's latch period isn't known.
+    int adaptiveQueueDepth() const;
+
+    // isQueueFull returns whether dequeueBuffer must wait for the consumer
+    // to latch a frame before handing out a buffer in adaptive mode. It's
+    // called by the producer, with a Lock held or in a lock-free path.
+    bool isQueueFull() const;
+
+    // recordDequeue, recordQueue and recordAcquire update the frame pacing
+    // statistics when buf is dequeued, queued and acquired. Like the other
+    // fields of the slot, the times belong to the side that owns it.
+    void recordDequeue(int buf);
+    void recordQueue(int buf);
+    void recordAcquire(int buf);
+
+    // tryDequeueBuffer, tryQueueBuffer, tryCancelBuffer, tryAcquireBuffer
+    // and tryReleaseBuffer are the lock-free paths. They only handle the
+    // common cases and return false when the locked path must be taken,
+    // which handles all the others and reports the errors.
+    bool tryDequeueBuffer(int *buf, uint32_t width, uint32_t height,
+            uint32_t format, uint32_t usage, EGLDisplay* dpy,
+            EGLSyncKHR* fence);
+    bool tryQueueBuffer(int buf, int64_t timestamp, const Rect& crop,
+            int scalingMode, uint32_t transform, QueueBufferOutput* output,
+            sp<ConsumerListener>* listener);
+    bool tryCancelBuffer(int buf);
+    bool tryAcquireBuffer(BufferItem *buffer, status_t* err);
+    bool tryReleaseBuffer(int buf, EGLDisplay display, EGLSyncKHR fence);
+
     // freeBufferLocked frees the resources (both GraphicBuffer and EGLImage)
     // for the given slot.
     void freeBufferLocked(int index);
@@ -330,7 +434,9 @@ private:
           mFrameNumber(0),
           mFence(EGL_NO_SYNC_KHR),
           mAcquireCalled(false),
-          mNeedsCleanupOnRelease(false) {
+          mNeedsCleanupOnRelease(false),
+          mDequeueTime(0),
+          mQueueTime(0) {
             mCrop.makeInvalid();
         }
 
@@ -377,8 +483,14 @@ private:
             ACQUIRED = 3
         };
 
-        // mBufferState is the current state of this buffer slot.
-        BufferState mBufferState;
+        // mBufferState is the current state of this buffer slot. The
+        // lock-free paths change it with atomic operations, and only the
+        // side that owns the slot in its current state changes it: the
+        // producer moves it from FREE to DEQUEUED and from DEQUEUED to
+        // QUEUED or FREE, the consumer from QUEUED to ACQUIRED and from
+        // ACQUIRED to FREE. The other fields of the slot belong to the same
+        // side as its state.
+        volatile int32_t mBufferState;
 
         // mRequestBufferCalled is used for validating that the client did
         // call requestBuffer() when told to do so. Technically this is not
@@ -412,6 +524,11 @@ private:
 
         // Indicates whether this buffer needs to be cleaned up by consumer
         bool mNeedsCleanupOnRelease;
+
+        // mDequeueTime and mQueueTime are the times the buffer was last
+        // dequeued and queued, for the frame pacing statistics.
+        nsecs_t mDequeueTime;
+        nsecs_t mQueueTime;
     };
 
     // mSlots is the array of buffer slots that must be mirrored on the client
@@ -481,8 +598,45 @@ private:
     // mDequeueCondition condition used for dequeueBuffer in synchronous mode
     mutable Condition mDequeueCondition;
 
-    // mQueue is a FIFO of queued buffers used in synchronous mode
-    typedef Vector<int> Fifo;
+    // Fifo holds the QUEUED slots in the order they were queued. The
+    // producer's lock-free paths push to it while the consumer's pop from
+    // it: the ring's tail is only written by the producer and its head only
+    // by the consumer, and a slot is never in it twice so it can't
+    // overflow. In asynchronous mode only the most recent buffer is kept,
+    // in a single word both sides exchange atomically. The other methods
+    // are only called with a Lock held.
+    class Fifo {
+    public:
+        Fifo();
+
+        size_t size() const;
+        bool isEmpty() const { return size() == 0; }
+
+        // push adds buf at the end, in synchronous mode
+        void push(int buf);
+
+        // replace makes buf the only buffer queued in asynchronous mode
+        // and returns the buffer it replaced, or INVALID_BUFFER_SLOT
+        int replace(int buf);
+
+        // pop removes the oldest buffer, or returns INVALID_BUFFER_SLOT
+        int pop();
+
+        // itemAt returns the index-th oldest buffer
+        int itemAt(size_t index) const;
+
+        // commitLatest moves the asynchronous mode buffer to the end of
+        // the ring, for switching to synchronous mode
+        void commitLatest();
+
+        void clear();
+
+    private:
+        int32_t mRing[NUM_BUFFER_SLOTS];
+        volatile int32_t mHead;     // number of buffers popped from mRing
+        volatile int32_t mTail;     // number of buffers pushed to mRing
+        volatile int32_t mLatest;   // the asynchronous mode buffer
+    };
     Fifo mQueue;
 
     // mAbandoned indicates that the BufferQueue will no longer be used to
@@ -519,9 +673,59 @@ private:
     // mTransformHint is used to optimize for screen rotations
     uint32_t mTransformHint;
 
+    // mLockFree is false when the lock-free paths are disabled
+    bool mLockFree;
+
+    // mLocked is 1 while a Lock keeps the lock-free paths out
+    mutable volatile int32_t mLocked;
+
+    // mProducerBusy and mConsumerBusy are 1 while the producer or the
+    // consumer runs a lock-free path
+    volatile int32_t mProducerBusy;
+    volatile int32_t mConsumerBusy;
+
+    // mWaiters is the number of threads in waitLocked()
+    mutable volatile int32_t mWaiters;
+
+    // mExcluders is the number of threads in excludeLockFreePathsLocked()
+    // that stopped spinning and wait on mExcludeCondition for a lock-free
+    // path to finish
+    mutable volatile int32_t mExcluders;
+    mutable Condition mExcludeCondition;
+
+    // the number of dequeue, queue, cancel, acquire and release operations
+    // that took the lock-free paths on each side, and the locked paths
+    uint32_t mProducerLockFreeOps;
+    uint32_t mConsumerLockFreeOps;
+    uint32_t mLockedOps;
+
+    // mBatchedDequeues is the number of buffers queueAndDequeueBuffer
+    // handed out along with a queue
+    volatile int32_t mBatchedDequeues;
+
 #ifdef QCOM_HARDWARE
     qBufGeometry mNextBufferInfo;
 #endif
+
+    // mAdaptiveMode is true when the queue depth adapts to the consumer
+    bool mAdaptiveMode;
+
+    // the frame pacing statistics, moving averages in nanoseconds:
+    // mLatchPeriod is the time between two frames acquired by the consumer,
+    // mRenderTime the time the producer keeps a buffer dequeued and
+    // mLatchLatency the time a frame waits between queueBuffer and
+    // acquireBuffer. mLatchPeriod and mLatchLatency are written by the
+    // consumer, mRenderTime by the producer.
+    volatile int32_t mLatchPeriod;
+    volatile int32_t mRenderTime;
+    volatile int32_t mLatchLatency;
+
+    // mLastLatchTime is the time the consumer acquired the last frame
+    nsecs_t mLastLatchTime;
+
+    // mPacedDequeues is the number of dequeues that waited for the
+    // consumer in adaptive mode
+    uint32_t mPacedDequeues;
 };
 // ----------------------------------------------------------------------------
 }; // namespace android
@@ -41,6 +41,13 @@ public:
 #ifdef QCOM_HARDWARE
     virtual void setGraphicBufferSize(int size) = 0;
 #endif
+
+    /* Give back a GraphicBuffer created by createGraphicBuffer() that the
+     * client doesn't use anymore. A later createGraphicBuffer() with the
+     * same parameters may return it instead of allocating a new one. The
+     * client must not access the buffer after this call.
+     */
+    virtual void recycleGraphicBuffer(const sp<GraphicBuffer>& buffer) = 0;
 };
 
 // ----------------------------------------------------------------------------
@@ -34,6 +34,7 @@ namespace android {
 // ----------------------------------------------------------------------------
 
 class ComposerState;
+class GraphicBuffer;
 class IDisplayEventConnection;
 class IMemoryHeap;
 
@@ -96,6 +97,10 @@ public:
         eElectronBeamAnimationOff = 0x10
     };
 
+    enum {
+        eNumCaptureBuffers = 3
+    };
+
     /* create connection with surface flinger, requires
      * ACCESS_SURFACE_FLINGER permission
      */
@@ -144,6 +149,43 @@ public:
 
     /* return an IDisplayEventConnection */
     virtual sp<IDisplayEventConnection> createDisplayEventConnection() = 0;
+
+    /* Capture the specified screen into buffer, without copying the
+     * pixels. buffer belongs to the caller: it must be RGBA_8888, allocated
+     * with GRALLOC_USAGE_HW_RENDER, and no larger than the screen, which is
+     * scaled to its size. The capture is rendered asynchronously; *fence
+     * must be passed to waitForScreenCapture() before reading buffer.
+     * Requires READ_FRAME_BUFFER permission, and will fail if there is a
+     * secure window on screen.
+     */
+    virtual status_t captureScreenToBuffer(DisplayID dpy,
+            const sp<GraphicBuffer>& buffer, int32_t* fence,
+            uint32_t minLayerZ, uint32_t maxLayerZ) = 0;
+
+    /* Wait until the capture captureScreenToBuffer() returned fence for is
+     * in the caller's buffer. Like the tokens of asynchronous captures
+     * below, a fence can only be waited for once, by the process that
+     * requested the capture, and only until eNumCaptureBuffers more
+     * captures have been recorded.
+     * Requires READ_FRAME_BUFFER permission.
+     */
+    virtual status_t waitForScreenCapture(int32_t fence) = 0;
+
+    /* Asynchronous screen capture. captureScreenAsync() records a capture
+     * of the specified screen and returns a token without waiting for the
+     * GPU; collectScreenCapture() then returns the pixels, typically one
+     * frame later. A token can only be collected once, by the process that
+     * requested the capture, and only until eNumCaptureBuffers more
+     * captures have been recorded.
+     * Both require READ_FRAME_BUFFER permission, captureScreenAsync() will
+     * fail if there is a secure window on screen.
+     */
+    virtual status_t captureScreenAsync(DisplayID dpy, int32_t* token,
+            uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ) = 0;
+    virtual status_t collectScreenCapture(int32_t token,
+            sp<IMemoryHeap>* heap,
+            uint32_t* width, uint32_t* height, PixelFormat* format) = 0;
 };
 
 // ----------------------------------------------------------------------------
@@ -169,6 +211,10 @@ public:
         SET_DISPLAYPROP,
         GET_DISPLAYPROP,
 #endif
+        CAPTURE_SCREEN_TO_BUFFER,
+        CAPTURE_SCREEN_ASYNC,
+        COLLECT_SCREEN_CAPTURE,
+        WAIT_FOR_SCREEN_CAPTURE,
     };
 
     virtual status_t    onTransact( uint32_t code,
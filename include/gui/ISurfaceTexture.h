@@ -186,6 +186,20 @@ protected:
     virtual uint32_t getParameter(uint32_t cmd) = 0;
 #endif
 
+    // queueAndDequeueBuffer queues slot like queueBuffer, then dequeues the
+    // next buffer for the client in the same call, so that a producer which
+    // dequeues right after queuing makes one round trip per frame instead of
+    // two. The dequeue never blocks and never allocates: *outSlot is set to
+    // a slot whose buffer already has the requested geometry, format and
+    // usage and that doesn't need requestBuffer unless the client's mirror
+    // of it is empty, or to -1 if no such buffer is available right now, in
+    // which case the client calls dequeueBuffer later as usual. The return
+    // value is that of the queue.
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage) = 0;
+
 };
 
 // ----------------------------------------------------------------------------
@@ -124,6 +124,15 @@ public:
     // documented by the source.
     int64_t getTimestamp();
 
+    // getFrameNumber retrieves the frame number of the texture image set by
+    // the most recent call to updateTexImage. Frame numbers are assigned by
+    // the BufferQueue in queueBuffer order, starting at 1.
+    uint64_t getFrameNumber();
+
+    // getQueueTime retrieves the systemTime() at which the texture image set
+    // by the most recent call to updateTexImage was queued.
+    int64_t getQueueTime();
+
     // setFrameAvailableListener sets the listener object that will be notified
     // when a new frame becomes available.
     void setFrameAvailableListener(const sp<FrameAvailableListener>& listener);
@@ -189,6 +198,7 @@ public:
     status_t setConsumerUsageBits(uint32_t usage);
     status_t setTransformHint(uint32_t hint);
     virtual status_t setSynchronousMode(bool enabled);
+    status_t setAdaptiveMode(bool enabled);
 
     // getBufferQueue returns the BufferQueue object to which this
     // SurfaceTexture is connected.
@@ -250,6 +260,29 @@ private:
     friend class Layer;
     status_t updateTexImage(BufferRejecter* rejecter);
 
+    // latchTexImage does the part of updateTexImage that doesn't need an
+    // OpenGL ES context: it acquires the next buffer, runs the rejecter on
+    // it, creates its EGLImage and computes its transform matrix. It can be
+    // called from any thread, as long as updateTexImage was called once
+    // since the SurfaceTexture was attached. The next updateTexImage then
+    // binds the latched buffer rather than acquiring one.
+    // Also TEMPORARY and for SurfaceFlinger only.
+    status_t latchTexImage(BufferRejecter* rejecter);
+
+    // acquireBufferLocked acquires the next buffer from the BufferQueue and
+    // updates its slot. If the rejecter refuses the buffer, it is released
+    // right away and *rejected is set to true.
+    //
+    // This method must be called with mMutex locked.
+    status_t acquireBufferLocked(BufferRejecter* rejecter, EGLDisplay dpy,
+            BufferQueue::BufferItem* item, bool* rejected);
+
+    // releaseLatchedBufferLocked gives back the buffer latched by
+    // latchTexImage if updateTexImage didn't bind it.
+    //
+    // This method must be called with mMutex locked.
+    void releaseLatchedBufferLocked();
+
     // createImage creates a new EGLImage from a GraphicBuffer.
     EGLImageKHR createImage(EGLDisplay dpy,
             const sp<GraphicBuffer>& graphicBuffer);
@@ -266,6 +299,12 @@ private:
     // to compute this matrix and stores it in mCurrentTransformMatrix.
     void computeCurrentTransformMatrix();
 
+    // computeTransformMatrix computes the transform matrix of a buffer
+    // displayed with the given crop and transform.
+    static void computeTransformMatrix(float outTransform[16],
+            const sp<GraphicBuffer>& buf, const Rect& cropRect,
+            uint32_t transform, bool filtering);
+
     // syncForReleaseLocked performs the synchronization needed to release the
     // current slot from an OpenGL ES context.  If needed it will set the
     // current slot's fence to guard against a producer accessing the buffer
@@ -304,6 +343,12 @@ private:
     // gets set each time updateTexImage is called.
     int64_t mCurrentTimestamp;
 
+    // mCurrentFrameNumber and mCurrentQueueTime are the frame number and the
+    // queue time of the current texture. They get set each time
+    // updateTexImage is called.
+    uint64_t mCurrentFrameNumber;
+    int64_t mCurrentQueueTime;
+
     uint32_t mDefaultWidth, mDefaultHeight;
 
     // mFilteringEnabled indicates whether the transform matrix is computed for
@@ -408,6 +453,18 @@ private:
     // attachToContext.
     bool mAttached;
 
+    // mLatchState tells whether latchTexImage acquired a buffer that the
+    // next updateTexImage must bind (LATCH_BUFFER), or one that was
+    // rejected (LATCH_REJECTED), in which case updateTexImage doesn't
+    // acquire another one. mLatchedItem is the buffer, and
+    // mLatchedTransformMatrix its transform matrix, as computed with
+    // mLatchedFiltering.
+    enum { LATCH_NONE, LATCH_BUFFER, LATCH_REJECTED };
+    int mLatchState;
+    BufferQueue::BufferItem mLatchedItem;
+    float mLatchedTransformMatrix[16];
+    bool mLatchedFiltering;
+
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables of SurfaceTexture objects. It must be locked whenever the
     // member variables are accessed.
@@ -132,9 +132,25 @@ private:
     void freeAllBuffers();
     int getSlotFromBufferLocked(android_native_buffer_t* buffer) const;
 
+    // cancelPrefetchedBufferLocked gives the buffer the last queue dequeued
+    // back to the server, when the next dequeueBuffer can't use it.
+    void cancelPrefetchedBufferLocked();
+
+    // expirePrefetchedBuffer gives the prefetched buffer back to the server
+    // once it's too old for dequeueBuffer to use, so that a producer that
+    // stopped rendering doesn't keep it dequeued. PrefetchReaper calls it
+    // a while after the queue.
+    void expirePrefetchedBuffer();
+
+    class PrefetchReaper;
+
     struct BufferSlot {
         sp<GraphicBuffer> buffer;
+        // dirtyRegion is the area drawn the last time the buffer was locked
         Region dirtyRegion;
+        // staleRegion is the area drawn in the other buffers since this one
+        // was posted, that lock copies back from the front buffer
+        Region staleRegion;
     };
 
     // mSurfaceTexture is the interface to the surface texture server. All
@@ -209,6 +225,22 @@ private:
     // one buffer behind the producer.
     mutable bool mConsumerRunningBehind;
 
+    // mQueueAndDequeue is whether queueBuffer also dequeues the next buffer,
+    // with ISurfaceTexture::queueAndDequeueBuffer. It's set when the last
+    // dequeueBuffer came right after a queueBuffer, as eglSwapBuffers or a
+    // camera preview loop do, and cleared when it didn't.
+    bool mQueueAndDequeue;
+
+    // mPrefetchedSlot is the slot ISurfaceTexture::queueAndDequeueBuffer
+    // dequeued along with the last queue, which the next dequeueBuffer
+    // returns without calling the server, or -1.
+    int mPrefetchedSlot;
+
+    // mQueueTime is when the last queueBuffer returned. A prefetched buffer
+    // is only used for a little while after that, the server may have
+    // changed the default size or format of the buffers since.
+    nsecs_t mQueueTime;
+
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables of SurfaceTexture objects. It must be locked whenever the
     // member variables are accessed.
@@ -219,9 +251,6 @@ private:
     sp<GraphicBuffer>           mPostedBuffer;
     bool                        mConnectedToCpu;
 
-    // must be accessed from lock/unlock thread only
-    Region mDirtyRegion;
-
     // mReqExtUsage is a flag set by app to mark a layer for display on
     // external panels only. Depending on the value of this flag mReqUsage
     // will be ORed with existing values.
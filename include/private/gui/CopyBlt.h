@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_PRIVATE_COPY_BLT_H
+#define ANDROID_GUI_PRIVATE_COPY_BLT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ui/Region.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * The copy of a region of pixels between two buffers of the same format,
+ * used by SurfaceTextureClient::lock() to bring the back buffer up to date
+ * with the front buffer.
+ *
+ * Dirty rectangles are mostly narrow, and a memcpy() call per row of a few
+ * dozen bytes costs more than the copy itself. The vectorized copy inlines
+ * the rows: those narrower than 16 bytes a pixel at a time, in the size of
+ * the pixels of the format, the wider ones with 16-byte loads and stores
+ * (NEON on ARM, SSE2 on x86). Rows wide enough for memcpy() to run at full
+ * speed are still left to it.
+ *
+ * The implementation is picked once, at first use, like the region
+ * operations. The scalar one is a memcpy() per row.
+ */
+struct CopyBlt {
+    const char* name;
+
+    // copies h rows of size bytes, that are dbpr bytes apart in dst and
+    // sbpr bytes apart in src. bpp is the size of a pixel.
+    void (*copyRect)(uint8_t* dst, size_t dbpr, uint8_t const* src,
+            size_t sbpr, size_t size, size_t h, size_t bpp);
+
+    // rows of at least this many bytes go to memcpy(), which is as fast
+    // as the inlined copy from there on
+    enum { MEMCPY_THRESHOLD = 64 };
+
+    // the implementation in use
+    static const CopyBlt& get();
+
+    // whether this CPU has a vectorized implementation
+    static bool isAvailable();
+
+    // switches between the vectorized and the scalar implementation, for
+    // benchmarks and tests. returns whether the vectorized one is in use.
+    static bool setEnabled(bool enabled);
+};
+
+// copies the pixels of reg from src to dst. The strides are in pixels and
+// bpp is the size of a pixel in bytes.
+void copyBltRegion(uint8_t* dst, size_t dstStride,
+        uint8_t const* src, size_t srcStride, size_t bpp, const Region& reg);
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_PRIVATE_COPY_BLT_H
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_PRIVATE_REGION_DEBUG_H
+#define ANDROID_UI_PRIVATE_REGION_DEBUG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * Instrumentation of Region's memory usage, for benchmarks.
+ */
+struct RegionDebug {
+    // heap allocations (and moving reallocations) made by Region so far,
+    // in all threads.
+    static uint32_t getHeapAllocationCount();
+
+    // with storage reuse disabled, region operations build their lists of
+    // rectangles on the heap and a region that becomes a rectangle frees
+    // its storage, like they used to. only affects the regions computed
+    // afterwards.
+    static void setStorageReuseEnabled(bool enabled);
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_UI_PRIVATE_REGION_DEBUG_H
@@ -23,6 +23,24 @@
 namespace android {
 // ----------------------------------------------------------------------------
 
+/*
+ * Returns how many rectangles at the start of the array belong to the same
+ * band as the first one. RegionSimd.h provides a vectorized version for Rect.
+ */
+template<typename RECT>
+inline size_t region_band_length(RECT const* rects, size_t count)
+{
+    if (!count) {
+        return 0;
+    }
+    const typename RECT::value_type top = rects->top;
+    size_t n = 1;
+    while (n < count && rects[n].top == top) {
+        n++;
+    }
+    return n;
+}
+
 template<typename RECT>
 class region_operator
 {
@@ -199,13 +217,10 @@ private:
             // got to next span
             size_t count = reg.count;
             RECT const * rects = reg.rects;
-            RECT const * const end = rects + count;
-            const int top = rects->top;
-            while (rects != end && rects->top == top) {
-                rects++;
-                count--;
-            }
-            if (rects != end) {
+            const size_t n = region_band_length(rects, count);
+            rects += n;
+            count -= n;
+            if (count) {
                 aTop    = rects->top    + reg.dy;
                 aBottom = rects->bottom + reg.dy;
             } else {
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_PRIVATE_REGION_SIMD_H
+#define ANDROID_UI_PRIVATE_REGION_SIMD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ui/Rect.h>
+
+#include <private/ui/RegionHelper.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * The data-parallel parts of the region operators: finding the end of a
+ * band, comparing two bands for coalescing, and offsetting rectangles.
+ * Merging the spans themselves is inherently serial and stays scalar.
+ *
+ * The implementation is picked once, at first use, depending on what the
+ * CPU supports (NEON on ARM, SSE2 on x86). The inline helpers below keep
+ * short runs of rectangles -- the vast majority of bands -- on the scalar
+ * path, where calling through the table would cost more than it saves.
+ */
+struct RegionSimd {
+    const char* name;
+    size_t (*bandLength)(Rect const* rects, size_t count);
+    bool (*bandsMatch)(Rect const* lhs, Rect const* rhs, size_t count);
+    void (*setBottom)(Rect* rects, size_t count, int32_t bottom);
+    void (*translate)(Rect* rects, size_t count, int32_t dx, int32_t dy);
+
+    enum { THRESHOLD = 8 };
+
+    // the implementation in use
+    static const RegionSimd& get();
+
+    // whether this CPU has a vectorized implementation
+    static bool isAvailable();
+
+    // switches between the vectorized and the scalar implementation, for
+    // benchmarks and tests. returns whether the vectorized one is in use.
+    static bool setEnabled(bool enabled);
+};
+
+template<>
+inline size_t region_band_length<Rect>(Rect const* rects, size_t count)
+{
+    if (count < RegionSimd::THRESHOLD) {
+        if (!count) {
+            return 0;
+        }
+        const int32_t top = rects->top;
+        size_t n = 1;
+        while (n < count && rects[n].top == top) {
+            n++;
+        }
+        return n;
+    }
+    return RegionSimd::get().bandLength(rects, count);
+}
+
+// true if both bands have the same horizontal extents
+inline bool region_bands_match(Rect const* lhs, Rect const* rhs, size_t count)
+{
+    if (count < RegionSimd::THRESHOLD) {
+        while (count) {
+            if ((lhs->left != rhs->left) || (lhs->right != rhs->right)) {
+                return false;
+            }
+            lhs++, rhs++, count--;
+        }
+        return true;
+    }
+    return RegionSimd::get().bandsMatch(lhs, rhs, count);
+}
+
+inline void region_set_bottom(Rect* rects, size_t count, int32_t bottom)
+{
+    if (count < RegionSimd::THRESHOLD) {
+        while (count) {
+            rects->bottom = bottom;
+            rects++, count--;
+        }
+        return;
+    }
+    RegionSimd::get().setBottom(rects, count, bottom);
+}
+
+inline void region_translate(Rect* rects, size_t count, int32_t dx, int32_t dy)
+{
+    if (count < RegionSimd::THRESHOLD) {
+        while (count) {
+            rects->left   += dx;
+            rects->top    += dy;
+            rects->right  += dx;
+            rects->bottom += dy;
+            rects++, count--;
+        }
+        return;
+    }
+    RegionSimd::get().translate(rects, count, dx, dy);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_UI_PRIVATE_REGION_SIMD_H
@@ -27,6 +27,7 @@
 
 #include <ui/ANativeObjectBase.h>
 #include <ui/Rect.h>
+#include <ui/Region.h>
 
 #ifdef SAMSUNG_HDMI_SUPPORT
 #include "SecHdmiClient.h"
@@ -64,6 +65,15 @@ public:
     status_t setUpdateRectangle(const Rect& updateRect);
     status_t compositionComplete();
 
+    // Damage tracking. The buffers are used round-robin and keep their
+    // content, so the next back buffer only needs to be repainted where
+    // the screen changed since it was last posted.
+    // setFrameDamage() gives the region that changes in the frame about
+    // to be posted. A frame posted without it invalidates all buffers.
+    void setFrameDamage(const Region& damage);
+    // returns false if the next back buffer's content is unknown
+    bool getBackBufferDamage(Region* outDamage) const;
+
     void dump(String8& result);
 
     // for debugging only
@@ -95,6 +105,11 @@ private:
 #ifdef SAMSUNG_HDMI_SUPPORT
     SecHdmiClient *mHdmiClient;
 #endif
+
+    // the damage tracking state, kept out of the class so that its layout
+    // only grows by a pointer, after the existing fields
+    struct DamageState;
+    DamageState* mDamage;
 };
     
 // ---------------------------------------------------------------------------
@@ -77,6 +77,12 @@ public:
     const   Region      intersect(const Region& rhs) const;
     const   Region      subtract(const Region& rhs) const;
 
+            // this = lhs op rhs. unlike the operators above these reuse
+            // this region's storage instead of returning a new Region.
+            Region&     setMerge(const Region& lhs, const Region& rhs);
+            Region&     setIntersect(const Region& lhs, const Region& rhs);
+            Region&     setSubtract(const Region& lhs, const Region& rhs);
+
             // these translate rhs first
             Region&     translateSelf(int dx, int dy);
             Region&     orSelf(const Region& rhs, int dx, int dy);
@@ -157,7 +163,10 @@ private:
     static void translate(Region& dst, const Region& reg, int dx, int dy);
 
     static bool validate(const Region& reg, const char* name);
-    
+
+    void setRects(const Rect& bounds, Rect const* rects, size_t count);
+    void releaseStorage();
+
     Rect            mBounds;
     Vector<Rect>    mStorage;
 };
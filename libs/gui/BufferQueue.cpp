@@ -21,9 +21,13 @@
 #define GL_GLEXT_PROTOTYPES
 #define EGL_EGLEXT_PROTOTYPES
 
+#include <sched.h>
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+#include <cutils/atomic-inline.h>
+
 #include <gui/BufferQueue.h>
 #include <gui/ISurfaceComposer.h>
 #include <private/gui/ComposerService.h>
@@ -89,6 +93,22 @@ static const char* scalingModeName(int scalingMode) {
     }
 }
 
+// the frame pacing statistics ignore longer intervals, a producer or a
+// consumer that was idle says nothing about its pace
+static const nsecs_t MAX_PACING_INTERVAL = ms2ns(100);
+
+// movingAverage moves avg an eighth of the way to sample, or starts it at
+// sample
+static int32_t movingAverage(int32_t avg, nsecs_t sample) {
+    if (sample < 0) {
+        sample = 0;
+    }
+    if (!avg) {
+        return int32_t(sample);
+    }
+    return avg + int32_t((sample - avg) / 8);
+}
+
 #ifdef QCOM_HARDWARE
 /*
  * Checks if memory needs to be reallocated for this buffer.
@@ -184,7 +204,23 @@ BufferQueue::BufferQueue(  bool allowSynchronousMode, int bufferCount ) :
     mBufferHasBeenQueued(false),
     mDefaultBufferFormat(0),
     mConsumerUsageBits(0),
-    mTransformHint(0)
+    mTransformHint(0),
+    mLockFree(true),
+    mLocked(0),
+    mProducerBusy(0),
+    mConsumerBusy(0),
+    mWaiters(0),
+    mExcluders(0),
+    mProducerLockFreeOps(0),
+    mConsumerLockFreeOps(0),
+    mLockedOps(0),
+    mBatchedDequeues(0),
+    mAdaptiveMode(false),
+    mLatchPeriod(0),
+    mRenderTime(0),
+    mLatchLatency(0),
+    mLastLatchTime(0),
+    mPacedDequeues(0)
 {
     // Choose a name using the PID and a process-unique ID.
     mConsumerName = String8::format("unnamed-%d-%d", getpid(), createProcessUniqueId());
@@ -240,39 +276,55 @@ status_t BufferQueue::setBufferCountServerLocked(int bufferCount) {
 }
 
 bool BufferQueue::isSynchronousMode() const {
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     return mSynchronousMode;
 }
 
 void BufferQueue::setConsumerName(const String8& name) {
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mConsumerName = name;
 }
 
 status_t BufferQueue::setDefaultBufferFormat(uint32_t defaultFormat) {
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mDefaultBufferFormat = defaultFormat;
     return OK;
 }
 
 status_t BufferQueue::setConsumerUsageBits(uint32_t usage) {
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mConsumerUsageBits = usage;
     return OK;
 }
 
 status_t BufferQueue::setTransformHint(uint32_t hint) {
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mTransformHint = hint;
     return OK;
 }
 
+status_t BufferQueue::setLockFreeEnabled(bool enabled) {
+    Lock lock(*this);
+    mLockFree = enabled;
+    return OK;
+}
+
+status_t BufferQueue::setAdaptiveMode(bool enabled) {
+    ST_LOGV("setAdaptiveMode: enabled=%d", enabled);
+    Lock lock(*this);
+    if (mAdaptiveMode != enabled) {
+        mAdaptiveMode = enabled;
+        mDequeueCondition.broadcast();
+    }
+    return OK;
+}
+
 status_t BufferQueue::setBufferCount(int bufferCount) {
     ST_LOGV("setBufferCount: count=%d", bufferCount);
 
     sp<ConsumerListener> listener;
     {
-        Mutex::Autolock lock(mMutex);
+        Lock lock(*this);
 
         if (mAbandoned) {
             ST_LOGE("setBufferCount: SurfaceTexture has been abandoned!");
@@ -327,7 +379,7 @@ status_t BufferQueue::setBufferCount(int bufferCount) {
 #ifdef QCOM_HARDWARE
 status_t BufferQueue::setBuffersSize(int size) {
     ST_LOGV("setBuffersSize: size=%d", size);
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mGraphicBufferAlloc->setGraphicBufferSize(size);
     return NO_ERROR;
 }
@@ -374,7 +426,7 @@ uint32_t BufferQueue::getParameter(uint32_t cmd)
 int BufferQueue::query(int what, int* outValue)
 {
     ATRACE_CALL();
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mAbandoned) {
         ST_LOGE("query: SurfaceTexture has been abandoned!");
@@ -409,7 +461,7 @@ int BufferQueue::query(int what, int* outValue)
 status_t BufferQueue::requestBuffer(int slot, sp<GraphicBuffer>* buf) {
     ATRACE_CALL();
     ST_LOGV("requestBuffer: slot=%d", slot);
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     if (mAbandoned) {
         ST_LOGE("requestBuffer: SurfaceTexture has been abandoned!");
         return NO_INIT;
@@ -438,8 +490,9 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
     EGLDisplay dpy = EGL_NO_DISPLAY;
     EGLSyncKHR fence = EGL_NO_SYNC_KHR;
 
-    { // Scope for the lock
-        Mutex::Autolock lock(mMutex);
+    if (!tryDequeueBuffer(outBuf, w, h, format, usage, &dpy, &fence)) {
+        Lock lock(*this);
+        mLockedOps++;
 
         if (format == 0) {
             format = mDefaultBufferFormat;
@@ -450,6 +503,7 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
         int found = -1;
         int foundSync = -1;
         int dequeuedCount = 0;
+        bool paced = false;
         bool tryAgain = true;
         while (tryAgain) {
             if (mAbandoned) {
@@ -481,7 +535,7 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
 
             if (!mQueue.isEmpty() && numberOfBuffersNeedsToChange) {
                 // wait for the FIFO to drain
-                mDequeueCondition.wait(mMutex);
+                waitLocked();
                 // NOTE: we continue here because we need to reevaluate our
                 // whole state (eg: we could be abandoned or disconnected)
                 continue;
@@ -497,6 +551,16 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
                 returnFlags |= ISurfaceTexture::RELEASE_ALL_BUFFERS;
             }
 
+            // in adaptive mode, wait until the consumer needs another frame
+            if (isQueueFull()) {
+                if (!paced) {
+                    paced = true;
+                    mPacedDequeues++;
+                }
+                waitLocked();
+                continue;
+            }
+
             // look for a free buffer to give to the client
             found = INVALID_BUFFER_SLOT;
             foundSync = INVALID_BUFFER_SLOT;
@@ -557,7 +621,7 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
             // if no buffer is found, wait for a buffer to be released
             tryAgain = found == INVALID_BUFFER_SLOT;
             if (tryAgain) {
-                mDequeueCondition.wait(mMutex);
+                waitLocked();
             }
         }
 
@@ -632,6 +696,13 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
                 mPixelFormat = format;
             }
 
+            // the slot was FREE, nobody uses its old buffer anymore unless
+            // the GPU is still reading it. it may come back the next time
+            // we need that size and format.
+            if (buffer != NULL && mSlots[buf].mFence == EGL_NO_SYNC_KHR) {
+                mGraphicBufferAlloc->recycleGraphicBuffer(buffer);
+            }
+
             mSlots[buf].mAcquireCalled = false;
             mSlots[buf].mGraphicBuffer = graphicBuffer;
             mSlots[buf].mRequestBufferCalled = false;
@@ -644,8 +715,18 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
         dpy = mSlots[buf].mEglDisplay;
         fence = mSlots[buf].mFence;
         mSlots[buf].mFence = EGL_NO_SYNC_KHR;
+        recordDequeue(buf);
     }  // end lock scope
 
+    waitForFence(dpy, fence);
+
+    ST_LOGV("dequeueBuffer: returning slot=%d buf=%p flags=%#x", *outBuf,
+            mSlots[*outBuf].mGraphicBuffer->handle, returnFlags);
+
+    return returnFlags;
+}
+
+void BufferQueue::waitForFence(EGLDisplay dpy, EGLSyncKHR fence) const {
     if (fence != EGL_NO_SYNC_KHR) {
         EGLint result = eglClientWaitSyncKHR(dpy, fence, 0, 1000000000);
         // If something goes wrong, log the error, but return the buffer without
@@ -658,17 +739,12 @@ status_t BufferQueue::dequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
         }
         eglDestroySyncKHR(dpy, fence);
     }
-
-    ST_LOGV("dequeueBuffer: returning slot=%d buf=%p flags=%#x", *outBuf,
-            mSlots[*outBuf].mGraphicBuffer->handle, returnFlags);
-
-    return returnFlags;
 }
 
 #ifdef QCOM_HARDWARE
 status_t BufferQueue::updateBuffersGeometry(int w, int h, int f) {
     ST_LOGV("updateBuffersGeometry: w=%d h=%d f=%d", w, h, f);
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mNextBufferInfo.set(w, h, f);
     return NO_ERROR;
 }
@@ -677,7 +753,7 @@ status_t BufferQueue::updateBuffersGeometry(int w, int h, int f) {
 status_t BufferQueue::setSynchronousMode(bool enabled) {
     ATRACE_CALL();
     ST_LOGV("setSynchronousMode: enabled=%d", enabled);
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mAbandoned) {
         ST_LOGE("setSynchronousMode: SurfaceTexture has been abandoned!");
@@ -700,6 +776,11 @@ status_t BufferQueue::setSynchronousMode(bool enabled) {
         // empty here
         // - if the client set the number of buffers, we're guaranteed that
         // we have at least 3 (because we don't allow less)
+        // - if we're going to synchronous mode, the buffer queued in
+        // asynchronous mode is now the head of the FIFO
+        if (enabled) {
+            mQueue.commitLatest();
+        }
         mSynchronousMode = enabled;
         mDequeueCondition.broadcast();
     }
@@ -725,8 +806,10 @@ status_t BufferQueue::queueBuffer(int buf,
 
     sp<ConsumerListener> listener;
 
-    { // scope for the lock
-        Mutex::Autolock lock(mMutex);
+    if (!tryQueueBuffer(buf, timestamp, crop, scalingMode, transform, output,
+            &listener)) {
+        Lock lock(*this);
+        mLockedOps++;
         if (mAbandoned) {
             ST_LOGE("queueBuffer: SurfaceTexture has been abandoned!");
             return NO_INIT;
@@ -765,26 +848,22 @@ status_t BufferQueue::queueBuffer(int buf,
 
         if (mSynchronousMode) {
             // In synchronous mode we queue all buffers in a FIFO.
-            mQueue.push_back(buf);
+            mQueue.push(buf);
 
             // Synchronous mode always signals that an additional frame should
             // be consumed.
             listener = mConsumerListener;
         } else {
             // In asynchronous mode we only keep the most recent buffer.
-            if (mQueue.empty()) {
-                mQueue.push_back(buf);
-
+            const int front = mQueue.replace(buf);
+            if (front == INVALID_BUFFER_SLOT) {
                 // Asynchronous mode only signals that a frame should be
                 // consumed if no previous frame was pending. If a frame were
                 // pending then the consumer would have already been notified.
                 listener = mConsumerListener;
             } else {
-                Fifo::iterator front(mQueue.begin());
                 // buffer currently queued is freed
-                mSlots[*front].mBufferState = BufferSlot::FREE;
-                // and we record the new buffer index in the queued list
-                *front = buf;
+                mSlots[front].mBufferState = BufferSlot::FREE;
             }
         }
 
@@ -807,6 +886,7 @@ status_t BufferQueue::queueBuffer(int buf,
         mSlots[buf].mScalingMode = scalingMode;
         mFrameCounter++;
         mSlots[buf].mFrameNumber = mFrameCounter;
+        recordQueue(buf);
 
         mBufferHasBeenQueued = true;
         mDequeueCondition.broadcast();
@@ -824,10 +904,39 @@ status_t BufferQueue::queueBuffer(int buf,
     return OK;
 }
 
+status_t BufferQueue::queueAndDequeueBuffer(int buf,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* nextBuf, uint32_t w, uint32_t h, uint32_t format, uint32_t usage) {
+    ATRACE_CALL();
+    *nextBuf = INVALID_BUFFER_SLOT;
+
+    // the frame goes to the consumer first, the dequeue must not delay it
+    status_t err = queueBuffer(buf, input, output);
+    if (err != NO_ERROR || (w && !h) || (!w && h)) {
+        return err;
+    }
+
+    // only what the lock-free path can hand out, waiting for a buffer or
+    // allocating one is left to the producer's next dequeueBuffer, which
+    // may not come before the state of the queue changed
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    EGLSyncKHR fence = EGL_NO_SYNC_KHR;
+    if (tryDequeueBuffer(nextBuf, w, h, format, usage, &dpy, &fence)) {
+        waitForFence(dpy, fence);
+        android_atomic_inc(&mBatchedDequeues);
+        ST_LOGV("queueAndDequeueBuffer: returning slot=%d", *nextBuf);
+    }
+    return err;
+}
+
 void BufferQueue::cancelBuffer(int buf) {
     ATRACE_CALL();
     ST_LOGV("cancelBuffer: slot=%d", buf);
-    Mutex::Autolock lock(mMutex);
+    if (tryCancelBuffer(buf)) {
+        return;
+    }
+    Lock lock(*this);
+    mLockedOps++;
 
     if (mAbandoned) {
         ST_LOGW("cancelBuffer: BufferQueue has been abandoned!");
@@ -851,7 +960,7 @@ void BufferQueue::cancelBuffer(int buf) {
 status_t BufferQueue::connect(int api, QueueBufferOutput* output) {
     ATRACE_CALL();
     ST_LOGV("connect: api=%d", api);
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mAbandoned) {
         ST_LOGE("connect: BufferQueue has been abandoned!");
@@ -879,6 +988,8 @@ status_t BufferQueue::connect(int api, QueueBufferOutput* output) {
                 err = -EINVAL;
             } else {
                 mConnectedApi = api;
+                // a new producer has a pace of its own
+                mRenderTime = 0;
                 output->inflate(mDefaultWidth, mDefaultHeight, mTransformHint,
                         mQueue.size());
             }
@@ -901,7 +1012,7 @@ status_t BufferQueue::disconnect(int api) {
     sp<ConsumerListener> listener;
 
     { // Scope for the lock
-        Mutex::Autolock lock(mMutex);
+        Lock lock(*this);
 
         if (mAbandoned) {
             // it is not really an error to disconnect after the surface
@@ -955,14 +1066,12 @@ void BufferQueue::dump(String8& result) const
 void BufferQueue::dump(String8& result, const char* prefix,
         char* buffer, size_t SIZE) const
 {
-    Mutex::Autolock _l(mMutex);
+    Lock lock(*this);
 
     String8 fifo;
-    int fifoSize = 0;
-    Fifo::const_iterator i(mQueue.begin());
-    while (i != mQueue.end()) {
-       snprintf(buffer, SIZE, "%02d ", *i++);
-       fifoSize++;
+    const int fifoSize = mQueue.size();
+    for (int i=0 ; i<fifoSize ; i++) {
+       snprintf(buffer, SIZE, "%02d ", mQueue.itemAt(i));
        fifo.append(buffer);
     }
 
@@ -973,6 +1082,28 @@ void BufferQueue::dump(String8& result, const char* prefix,
             mDefaultHeight, mPixelFormat, fifoSize, fifo.string());
     result.append(buffer);
 
+    snprintf(buffer, SIZE,
+            "%s lock-free=%d, operations: producer lock-free=%u, "
+            "consumer lock-free=%u, locked=%u, batched dequeues=%d\n",
+            prefix, mLockFree, mProducerLockFreeOps, mConsumerLockFreeOps,
+            mLockedOps, mBatchedDequeues);
+    result.append(buffer);
+
+    // the number of frames the producer may queue ahead of the consumer
+    int queueDepth = mSynchronousMode ? mBufferCount - 1 : 1;
+    if (mSynchronousMode && mAdaptiveMode &&
+            adaptiveQueueDepth() < queueDepth) {
+        queueDepth = adaptiveQueueDepth();
+    }
+    snprintf(buffer, SIZE,
+            "%s adaptive=%d, queue depth=%d, latch period=%.2fms, "
+            "render time=%.2fms, queue-to-latch latency=%.2fms, "
+            "paced dequeues=%u\n",
+            prefix, mAdaptiveMode, queueDepth, mLatchPeriod / 1000000.0,
+            mRenderTime / 1000000.0, mLatchLatency / 1000000.0,
+            mPacedDequeues);
+    result.append(buffer);
+
 
     struct {
         const char * operator()(int state) const {
@@ -1013,6 +1144,14 @@ void BufferQueue::dump(String8& result, const char* prefix,
 }
 
 void BufferQueue::freeBufferLocked(int i) {
+    // a FREE buffer without a fence isn't used by the producer or the
+    // consumer anymore, let the allocator reuse it.
+    if (mSlots[i].mGraphicBuffer != 0 &&
+            mSlots[i].mBufferState == BufferSlot::FREE &&
+            mSlots[i].mFence == EGL_NO_SYNC_KHR &&
+            mGraphicBufferAlloc != 0) {
+        mGraphicBufferAlloc->recycleGraphicBuffer(mSlots[i].mGraphicBuffer);
+    }
     mSlots[i].mGraphicBuffer = 0;
     if (mSlots[i].mBufferState == BufferSlot::ACQUIRED) {
         mSlots[i].mNeedsCleanupOnRelease = true;
@@ -1040,14 +1179,17 @@ void BufferQueue::freeAllBuffersLocked() {
 
 status_t BufferQueue::acquireBuffer(BufferItem *buffer) {
     ATRACE_CALL();
-    Mutex::Autolock _l(mMutex);
+    status_t err;
+    if (tryAcquireBuffer(buffer, &err)) {
+        return err;
+    }
+    Lock lock(*this);
+    mLockedOps++;
     // check if queue is empty
     // In asynchronous mode the list is guaranteed to be one buffer
     // deep, while in synchronous mode we use the oldest buffer.
-    if (!mQueue.empty()) {
-        Fifo::iterator front(mQueue.begin());
-        int buf = *front;
-
+    const int buf = mQueue.pop();
+    if (buf != INVALID_BUFFER_SLOT) {
         ATRACE_BUFFER_INDEX(buf);
 
         if (mSlots[buf].mAcquireCalled) {
@@ -1060,11 +1202,12 @@ status_t BufferQueue::acquireBuffer(BufferItem *buffer) {
         buffer->mScalingMode = mSlots[buf].mScalingMode;
         buffer->mFrameNumber = mSlots[buf].mFrameNumber;
         buffer->mTimestamp = mSlots[buf].mTimestamp;
+        buffer->mQueueTime = mSlots[buf].mQueueTime;
         buffer->mBuf = buf;
         mSlots[buf].mAcquireCalled = true;
+        recordAcquire(buf);
 
         mSlots[buf].mBufferState = BufferSlot::ACQUIRED;
-        mQueue.erase(front);
         mDequeueCondition.broadcast();
 
         ATRACE_INT(mConsumerName.string(), mQueue.size());
@@ -1080,7 +1223,12 @@ status_t BufferQueue::releaseBuffer(int buf, EGLDisplay display,
     ATRACE_CALL();
     ATRACE_BUFFER_INDEX(buf);
 
-    Mutex::Autolock _l(mMutex);
+    if (tryReleaseBuffer(buf, display, fence)) {
+        return OK;
+    }
+
+    Lock lock(*this);
+    mLockedOps++;
 
     if (buf == INVALID_BUFFER_SLOT) {
         return -EINVAL;
@@ -1107,7 +1255,7 @@ status_t BufferQueue::releaseBuffer(int buf, EGLDisplay display,
 
 status_t BufferQueue::consumerConnect(const sp<ConsumerListener>& consumerListener) {
     ST_LOGV("consumerConnect");
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mAbandoned) {
         ST_LOGE("consumerConnect: BufferQueue has been abandoned!");
@@ -1121,7 +1269,7 @@ status_t BufferQueue::consumerConnect(const sp<ConsumerListener>& consumerListen
 
 status_t BufferQueue::consumerDisconnect() {
     ST_LOGV("consumerDisconnect");
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mConsumerListener == NULL) {
         ST_LOGE("consumerDisconnect: No consumer is connected!");
@@ -1138,7 +1286,7 @@ status_t BufferQueue::consumerDisconnect() {
 
 status_t BufferQueue::getReleasedBuffers(uint32_t* slotMask) {
     ST_LOGV("getReleasedBuffers");
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
 
     if (mAbandoned) {
         ST_LOGE("getReleasedBuffers: BufferQueue has been abandoned!");
@@ -1166,7 +1314,7 @@ status_t BufferQueue::setDefaultBufferSize(uint32_t w, uint32_t h)
         return BAD_VALUE;
     }
 
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     mDefaultWidth = w;
     mDefaultHeight = h;
     return OK;
@@ -1174,15 +1322,14 @@ status_t BufferQueue::setDefaultBufferSize(uint32_t w, uint32_t h)
 
 status_t BufferQueue::setBufferCountServer(int bufferCount) {
     ATRACE_CALL();
-    Mutex::Autolock lock(mMutex);
+    Lock lock(*this);
     return setBufferCountServerLocked(bufferCount);
 }
 
 void BufferQueue::freeAllBuffersExceptHeadLocked() {
     int head = -1;
-    if (!mQueue.empty()) {
-        Fifo::iterator front(mQueue.begin());
-        head = *front;
+    if (!mQueue.isEmpty()) {
+        head = mQueue.itemAt(0);
     }
     mBufferHasBeenQueued = false;
     for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
@@ -1194,7 +1341,7 @@ void BufferQueue::freeAllBuffersExceptHeadLocked() {
 
 status_t BufferQueue::drainQueueLocked() {
     while (mSynchronousMode && !mQueue.isEmpty()) {
-        mDequeueCondition.wait(mMutex);
+        waitLocked();
         if (mAbandoned) {
             ST_LOGE("drainQueueLocked: BufferQueue has been abandoned!");
             return NO_INIT;
@@ -1219,6 +1366,473 @@ status_t BufferQueue::drainQueueAndFreeBuffersLocked() {
     return err;
 }
 
+// ----------------------------------------------------------------------------
+// Lock-free paths
+//
+// Each side runs at most one lock-free path at a time, so there is a single
+// writer for everything a side owns. A Lock and the lock-free paths exclude
+// each other with a handshake on mLocked and mProducerBusy/mConsumerBusy,
+// and the lock-free paths never wait for mMutex while they run.
+
+BufferQueue::Lock::Lock(const BufferQueue& bq)
+    : mBQ(bq)
+{
+    mBQ.mMutex.lock();
+    mBQ.excludeLockFreePathsLocked();
+}
+
+BufferQueue::Lock::~Lock()
+{
+    android_atomic_release_store(0, &mBQ.mLocked);
+    mBQ.mMutex.unlock();
+}
+
+// the number of times excludeLockFreePathsLocked() yields before it sleeps
+static const int MAX_EXCLUDE_SPINS = 4;
+
+void BufferQueue::excludeLockFreePathsLocked() const {
+    for (int spins = 0 ; ; spins++) {
+        // set again after sleeping, another Lock may have cleared it
+        android_atomic_release_store(1, &mLocked);
+        ANDROID_MEMBAR_FULL();
+        if (!android_atomic_acquire_load(&mProducerBusy) &&
+                !android_atomic_acquire_load(&mConsumerBusy)) {
+            return;
+        }
+        if (spins < MAX_EXCLUDE_SPINS) {
+            // a lock-free path is a handful of loads and stores, it's
+            // usually done by the time we're scheduled again
+            sched_yield();
+            continue;
+        }
+        // the thread running it may not get scheduled while we yield if
+        // it has a lower priority, sleep until it's out. exitLockFreePath()
+        // either sees mExcluders or clears busy before we look again.
+        android_atomic_inc(&mExcluders);
+        ANDROID_MEMBAR_FULL();
+        if (android_atomic_acquire_load(&mProducerBusy) ||
+                android_atomic_acquire_load(&mConsumerBusy)) {
+            mExcludeCondition.wait(mMutex);
+        }
+        android_atomic_dec(&mExcluders);
+    }
+}
+
+void BufferQueue::waitLocked() const {
+    // mWaiters is incremented while the lock-free paths are still
+    // excluded, so the first one that changes anything will see it
+    android_atomic_inc(&mWaiters);
+    android_atomic_release_store(0, &mLocked);
+    mDequeueCondition.wait(mMutex);
+    excludeLockFreePathsLocked();
+    android_atomic_dec(&mWaiters);
+}
+
+bool BufferQueue::enterLockFreePath(volatile int32_t* busy) {
+    if (android_atomic_acquire_cas(0, 1, busy)) {
+        // another thread runs a lock-free path on this side
+        return false;
+    }
+    ANDROID_MEMBAR_FULL();
+    if (android_atomic_acquire_load(&mLocked) || !mLockFree) {
+        exitLockFreePath(busy);
+        return false;
+    }
+    return true;
+}
+
+void BufferQueue::exitLockFreePath(volatile int32_t* busy) {
+    android_atomic_release_store(0, busy);
+    ANDROID_MEMBAR_FULL();
+    if (android_atomic_acquire_load(&mExcluders)) {
+        // the excluder holds mMutex until it waits
+        Mutex::Autolock lock(mMutex);
+        mExcludeCondition.broadcast();
+    }
+}
+
+void BufferQueue::wakeWaiters() {
+    ANDROID_MEMBAR_FULL();
+    if (android_atomic_acquire_load(&mWaiters)) {
+        // broadcasting doesn't need the lock-free paths out
+        Mutex::Autolock lock(mMutex);
+        mDequeueCondition.broadcast();
+    }
+}
+
+bool BufferQueue::tryDequeueBuffer(int *outBuf, uint32_t w, uint32_t h,
+        uint32_t format, uint32_t usage, EGLDisplay* outDpy,
+        EGLSyncKHR* outFence) {
+    if (!enterLockFreePath(&mProducerBusy)) {
+        return false;
+    }
+
+    // changing the number of buffers, waiting for a buffer, (re)allocating
+    // one and the errors are left to the locked path
+    const int minBufferCountNeeded = mSynchronousMode ?
+            mMinSyncBufferSlots : mMinAsyncBufferSlots;
+    const bool numberOfBuffersNeedsToChange = !mClientBufferCount &&
+            ((mServerBufferCount != mBufferCount) ||
+                    (mServerBufferCount < minBufferCountNeeded));
+    if (mAbandoned || numberOfBuffersNeedsToChange) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+
+    // only the producer makes a slot DEQUEUED, so dequeuedCount is exact.
+    // a slot the consumer releases while we look may be missed, then the
+    // locked path will find it.
+    int found = INVALID_BUFFER_SLOT;
+    int dequeuedCount = 0;
+    for (int i = 0; i < mBufferCount; i++) {
+        const int32_t state = android_atomic_acquire_load(&mSlots[i].mBufferState);
+        if (state == BufferSlot::DEQUEUED) {
+            dequeuedCount++;
+        } else if (state == BufferSlot::FREE) {
+            // the oldest of the free buffers, like the locked path
+            if (found < 0 ||
+                    mSlots[i].mFrameNumber < mSlots[found].mFrameNumber) {
+                found = i;
+            }
+        }
+    }
+    if (found == INVALID_BUFFER_SLOT || isQueueFull() ||
+            (!mClientBufferCount && dequeuedCount) ||
+            (mBufferHasBeenQueued && mBufferCount - (dequeuedCount+1) <
+                    mMinUndequeuedBuffers-int(mSynchronousMode))) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+
+    if (format == 0) {
+        format = mDefaultBufferFormat;
+    }
+    usage |= mConsumerUsageBits;
+    if (!w && !h) {
+        w = mDefaultWidth;
+        h = mDefaultHeight;
+    }
+    if (format == 0) {
+        format = mPixelFormat;
+    }
+    const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
+#ifdef QCOM_HARDWARE
+    qBufGeometry currentGeometry;
+    qBufGeometry requiredGeometry;
+    qBufGeometry updatedGeometry;
+    if (buffer != NULL)
+        currentGeometry.set(buffer->width, buffer->height, buffer->format);
+    else
+        currentGeometry.set(0, 0, 0);
+    requiredGeometry.set(w, h, format);
+    updatedGeometry.set(mNextBufferInfo.width, mNextBufferInfo.height,
+                        mNextBufferInfo.format);
+#endif
+    if ((buffer == NULL) ||
+#ifndef QCOM_HARDWARE
+        (uint32_t(buffer->width)  != w) ||
+        (uint32_t(buffer->height) != h) ||
+        (uint32_t(buffer->format) != format) ||
+#else
+         needNewBuffer(currentGeometry, requiredGeometry, updatedGeometry) ||
+#endif
+        ((uint32_t(buffer->usage) & usage) != usage) ||
+        android_atomic_acquire_cas(BufferSlot::FREE, BufferSlot::DEQUEUED,
+                &mSlots[found].mBufferState)) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+
+    // the slot is ours now, including the fence the consumer left in it
+    ATRACE_BUFFER_INDEX(found);
+    *outBuf = found;
+    *outDpy = mSlots[found].mEglDisplay;
+    *outFence = mSlots[found].mFence;
+    mSlots[found].mFence = EGL_NO_SYNC_KHR;
+    recordDequeue(found);
+    mProducerLockFreeOps++;
+    exitLockFreePath(&mProducerBusy);
+    return true;
+}
+
+bool BufferQueue::tryQueueBuffer(int buf, int64_t timestamp, const Rect& crop,
+        int scalingMode, uint32_t transform, QueueBufferOutput* output,
+        sp<ConsumerListener>* outListener) {
+    if (!enterLockFreePath(&mProducerBusy)) {
+        return false;
+    }
+
+    // the locked path reports the errors
+    if (mAbandoned || buf < 0 || buf >= mBufferCount ||
+            android_atomic_acquire_load(&mSlots[buf].mBufferState) !=
+                    BufferSlot::DEQUEUED ||
+            !mSlots[buf].mRequestBufferCalled) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+    switch (scalingMode) {
+        case NATIVE_WINDOW_SCALING_MODE_FREEZE:
+        case NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW:
+        case NATIVE_WINDOW_SCALING_MODE_SCALE_CROP:
+            break;
+        default:
+            exitLockFreePath(&mProducerBusy);
+            return false;
+    }
+
+#ifdef QCOM_HARDWARE
+    qBufGeometry updatedGeometry;
+    updatedGeometry.set(mNextBufferInfo.width,
+                        mNextBufferInfo.height, mNextBufferInfo.format);
+    updateBufferGeometry(mSlots[buf].mGraphicBuffer, updatedGeometry);
+#endif
+
+    const sp<GraphicBuffer>& graphicBuffer(mSlots[buf].mGraphicBuffer);
+    Rect bufferRect(graphicBuffer->getWidth(), graphicBuffer->getHeight());
+    Rect croppedCrop;
+    crop.intersect(bufferRect, &croppedCrop);
+    if (croppedCrop != crop) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+
+    // everything the consumer reads is written before the slot is QUEUED,
+    // and the slot is QUEUED before it's in the FIFO
+    mSlots[buf].mTimestamp = timestamp;
+    mSlots[buf].mCrop = crop;
+    mSlots[buf].mTransform = transform;
+    mSlots[buf].mScalingMode = scalingMode;
+    mFrameCounter++;
+    mSlots[buf].mFrameNumber = mFrameCounter;
+    recordQueue(buf);
+    android_atomic_release_store(BufferSlot::QUEUED, &mSlots[buf].mBufferState);
+
+    if (mSynchronousMode) {
+        mQueue.push(buf);
+        *outListener = mConsumerListener;
+    } else {
+        const int front = mQueue.replace(buf);
+        if (front == INVALID_BUFFER_SLOT) {
+            *outListener = mConsumerListener;
+        } else {
+            // it's out of the FIFO, so the consumer can't acquire it anymore
+            android_atomic_release_store(BufferSlot::FREE,
+                    &mSlots[front].mBufferState);
+        }
+    }
+    mBufferHasBeenQueued = true;
+
+    output->inflate(mDefaultWidth, mDefaultHeight, mTransformHint,
+            mQueue.size());
+
+    ATRACE_INT(mConsumerName.string(), mQueue.size());
+
+    mProducerLockFreeOps++;
+    exitLockFreePath(&mProducerBusy);
+    wakeWaiters();
+    return true;
+}
+
+bool BufferQueue::tryCancelBuffer(int buf) {
+    if (!enterLockFreePath(&mProducerBusy)) {
+        return false;
+    }
+    if (mAbandoned || buf < 0 || buf >= mBufferCount ||
+            android_atomic_acquire_load(&mSlots[buf].mBufferState) !=
+                    BufferSlot::DEQUEUED) {
+        exitLockFreePath(&mProducerBusy);
+        return false;
+    }
+    mSlots[buf].mFrameNumber = 0;
+    android_atomic_release_store(BufferSlot::FREE, &mSlots[buf].mBufferState);
+    mProducerLockFreeOps++;
+    exitLockFreePath(&mProducerBusy);
+    wakeWaiters();
+    return true;
+}
+
+bool BufferQueue::tryAcquireBuffer(BufferItem *buffer, status_t* err) {
+    if (!enterLockFreePath(&mConsumerBusy)) {
+        return false;
+    }
+
+    const int buf = mQueue.pop();
+    if (buf == INVALID_BUFFER_SLOT) {
+        mConsumerLockFreeOps++;
+        exitLockFreePath(&mConsumerBusy);
+        *err = NO_BUFFER_AVAILABLE;
+        return true;
+    }
+
+    ATRACE_BUFFER_INDEX(buf);
+
+    // the slot left the FIFO, it's ours
+    if (mSlots[buf].mAcquireCalled) {
+        buffer->mGraphicBuffer = NULL;
+    } else {
+        buffer->mGraphicBuffer = mSlots[buf].mGraphicBuffer;
+    }
+    buffer->mCrop = mSlots[buf].mCrop;
+    buffer->mTransform = mSlots[buf].mTransform;
+    buffer->mScalingMode = mSlots[buf].mScalingMode;
+    buffer->mFrameNumber = mSlots[buf].mFrameNumber;
+    buffer->mTimestamp = mSlots[buf].mTimestamp;
+    buffer->mQueueTime = mSlots[buf].mQueueTime;
+    buffer->mBuf = buf;
+    mSlots[buf].mAcquireCalled = true;
+    recordAcquire(buf);
+    android_atomic_release_store(BufferSlot::ACQUIRED,
+            &mSlots[buf].mBufferState);
+
+    ATRACE_INT(mConsumerName.string(), mQueue.size());
+
+    mConsumerLockFreeOps++;
+    exitLockFreePath(&mConsumerBusy);
+    wakeWaiters();
+    *err = OK;
+    return true;
+}
+
+bool BufferQueue::tryReleaseBuffer(int buf, EGLDisplay display,
+        EGLSyncKHR fence) {
+    if (!enterLockFreePath(&mConsumerBusy)) {
+        return false;
+    }
+
+    // stale buffers and the errors are left to the locked path
+    if (buf < 0 || buf >= NUM_BUFFER_SLOTS ||
+            android_atomic_acquire_load(&mSlots[buf].mBufferState) !=
+                    BufferSlot::ACQUIRED) {
+        exitLockFreePath(&mConsumerBusy);
+        return false;
+    }
+    mSlots[buf].mEglDisplay = display;
+    mSlots[buf].mFence = fence;
+    android_atomic_release_store(BufferSlot::FREE, &mSlots[buf].mBufferState);
+    mConsumerLockFreeOps++;
+    exitLockFreePath(&mConsumerBusy);
+    wakeWaiters();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Frame pacing
+
+int BufferQueue::adaptiveQueueDepth() const {
+    const int32_t latchPeriod = android_atomic_acquire_load(&mLatchPeriod);
+    if (!latchPeriod) {
+        // the consumer hasn't latched anything yet
+        return NUM_BUFFER_SLOTS;
+    }
+    // the producer renders the next frame while the consumer waits for its
+    // next latch, with one frame queued. when that takes it more than half
+    // a latch period, one more frame absorbs the variations of its pace.
+    const int64_t depth = 1 + (int64_t(mRenderTime) * 2) / latchPeriod;
+    return depth < NUM_BUFFER_SLOTS ? int(depth) : NUM_BUFFER_SLOTS;
+}
+
+bool BufferQueue::isQueueFull() const {
+    return mAdaptiveMode && mSynchronousMode &&
+            int(mQueue.size()) >= adaptiveQueueDepth();
+}
+
+void BufferQueue::recordDequeue(int buf) {
+    mSlots[buf].mDequeueTime = systemTime();
+}
+
+void BufferQueue::recordQueue(int buf) {
+    const nsecs_t now = systemTime();
+    const nsecs_t renderTime = now - mSlots[buf].mDequeueTime;
+    if (renderTime < MAX_PACING_INTERVAL) {
+        mRenderTime = movingAverage(mRenderTime, renderTime);
+    }
+    mSlots[buf].mQueueTime = now;
+}
+
+void BufferQueue::recordAcquire(int buf) {
+    const nsecs_t now = systemTime();
+    const nsecs_t latchPeriod = now - mLastLatchTime;
+    if (latchPeriod < MAX_PACING_INTERVAL) {
+        android_atomic_release_store(movingAverage(mLatchPeriod, latchPeriod),
+                &mLatchPeriod);
+    }
+    mLastLatchTime = now;
+    const nsecs_t latency = now - mSlots[buf].mQueueTime;
+    if (latency < MAX_PACING_INTERVAL) {
+        android_atomic_release_store(movingAverage(mLatchLatency, latency),
+                &mLatchLatency);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+BufferQueue::Fifo::Fifo()
+    : mHead(0), mTail(0), mLatest(INVALID_BUFFER_SLOT)
+{
+}
+
+size_t BufferQueue::Fifo::size() const {
+    // the two sides may change it while we look, it's exact for the one
+    // that calls it and for a Lock holder
+    const uint32_t head = uint32_t(android_atomic_acquire_load(&mHead));
+    const uint32_t tail = uint32_t(android_atomic_acquire_load(&mTail));
+    const int latest = android_atomic_acquire_load(&mLatest);
+    return (tail - head) + (latest != INVALID_BUFFER_SLOT ? 1 : 0);
+}
+
+void BufferQueue::Fifo::push(int buf) {
+    const uint32_t tail = uint32_t(mTail);
+    mRing[tail % NUM_BUFFER_SLOTS] = buf;
+    android_atomic_release_store(int32_t(tail + 1), &mTail);
+}
+
+int BufferQueue::Fifo::replace(int buf) {
+    int32_t latest;
+    do {
+        latest = mLatest;
+    } while (android_atomic_release_cas(latest, buf, &mLatest));
+    return latest;
+}
+
+int BufferQueue::Fifo::pop() {
+    const uint32_t head = uint32_t(mHead);
+    if (head != uint32_t(android_atomic_acquire_load(&mTail))) {
+        const int buf = mRing[head % NUM_BUFFER_SLOTS];
+        android_atomic_release_store(int32_t(head + 1), &mHead);
+        return buf;
+    }
+    int32_t latest;
+    do {
+        latest = mLatest;
+        if (latest == INVALID_BUFFER_SLOT) {
+            break;
+        }
+    } while (android_atomic_acquire_cas(latest, INVALID_BUFFER_SLOT, &mLatest));
+    return latest;
+}
+
+int BufferQueue::Fifo::itemAt(size_t index) const {
+    const uint32_t count = uint32_t(mTail) - uint32_t(mHead);
+    if (index < count) {
+        return mRing[(uint32_t(mHead) + index) % NUM_BUFFER_SLOTS];
+    }
+    return mLatest;
+}
+
+void BufferQueue::Fifo::commitLatest() {
+    if (mLatest != INVALID_BUFFER_SLOT) {
+        push(mLatest);
+        mLatest = INVALID_BUFFER_SLOT;
+    }
+}
+
+void BufferQueue::Fifo::clear() {
+    mHead = mTail;
+    mLatest = INVALID_BUFFER_SLOT;
+}
+
+// ----------------------------------------------------------------------------
+
 BufferQueue::ProxyConsumerListener::ProxyConsumerListener(
         const wp<BufferQueue::ConsumerListener>& consumerListener):
         mConsumerListener(consumerListener) {}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CopyBlt"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <utils/Log.h>
+
+#include <private/gui/CopyBlt.h>
+#include <private/ui/RegionSimd.h>
+
+#if defined(__ARM_HAVE_NEON) && defined(__ARM_NEON__)
+#define COPY_BLT_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define COPY_BLT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+static void copy_rows(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h)
+{
+    do {
+        memcpy(dst, src, size);
+        dst += dbpr;
+        src += sbpr;
+    } while (--h);
+}
+
+static void scalar_copy_rect(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h, size_t)
+{
+    copy_rows(dst, dbpr, src, sbpr, size, h);
+}
+
+static const CopyBlt sScalar = {
+    "scalar",
+    scalar_copy_rect
+};
+
+#if COPY_BLT_NEON || COPY_BLT_SSE2
+
+// rows of fewer than 16 bytes, a pixel at a time. the buffers and their
+// strides are aligned on the size of a pixel.
+template <typename PIXEL>
+static void copy_pixels(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h)
+{
+    const size_t w = size / sizeof(PIXEL);
+    do {
+        PIXEL* d = reinterpret_cast<PIXEL*>(dst);
+        PIXEL const* s = reinterpret_cast<PIXEL const*>(src);
+        for (size_t x=0 ; x<w ; x++) {
+            d[x] = s[x];
+        }
+        dst += dbpr;
+        src += sbpr;
+    } while (--h);
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+#if COPY_BLT_NEON
+
+// rows of 16 to MEMCPY_THRESHOLD bytes, the last 16 bytes of a row are
+// copied even if they overlap the ones before: src and dst never overlap
+static void neon_copy_rows(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h)
+{
+    do {
+        size_t n = 0;
+        while (n + 16 <= size) {
+            vst1q_u8(dst + n, vld1q_u8(src + n));
+            n += 16;
+        }
+        if (n < size) {
+            vst1q_u8(dst + size - 16, vld1q_u8(src + size - 16));
+        }
+        dst += dbpr;
+        src += sbpr;
+    } while (--h);
+}
+
+#define vector_copy_rows neon_copy_rows
+#define VECTOR_NAME "neon"
+
+// ----------------------------------------------------------------------------
+#elif COPY_BLT_SSE2
+
+// rows of 16 to MEMCPY_THRESHOLD bytes, the last 16 bytes of a row are
+// copied even if they overlap the ones before: src and dst never overlap
+static void sse2_copy_rows(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h)
+{
+    do {
+        __m128i const* s = reinterpret_cast<__m128i const*>(src);
+        __m128i* d = reinterpret_cast<__m128i*>(dst);
+        size_t n = 0;
+        while (n + 16 <= size) {
+            _mm_storeu_si128(d++, _mm_loadu_si128(s++));
+            n += 16;
+        }
+        if (n < size) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16),
+                    _mm_loadu_si128(
+                            reinterpret_cast<__m128i const*>(src + size - 16)));
+        }
+        dst += dbpr;
+        src += sbpr;
+    } while (--h);
+}
+
+#define vector_copy_rows sse2_copy_rows
+#define VECTOR_NAME "sse2"
+
+#endif
+// ----------------------------------------------------------------------------
+
+#if COPY_BLT_NEON || COPY_BLT_SSE2
+
+static void vector_copy_rect(uint8_t* dst, size_t dbpr, uint8_t const* src,
+        size_t sbpr, size_t size, size_t h, size_t bpp)
+{
+    if (size >= CopyBlt::MEMCPY_THRESHOLD) {
+        copy_rows(dst, dbpr, src, sbpr, size, h);
+    } else if (size >= 16) {
+        vector_copy_rows(dst, dbpr, src, sbpr, size, h);
+    } else if (bpp == 4) {
+        copy_pixels<uint32_t>(dst, dbpr, src, sbpr, size, h);
+    } else if (bpp == 2) {
+        copy_pixels<uint16_t>(dst, dbpr, src, sbpr, size, h);
+    } else {
+        copy_pixels<uint8_t>(dst, dbpr, src, sbpr, size, h);
+    }
+}
+
+static const CopyBlt sVector = {
+    VECTOR_NAME,
+    vector_copy_rect
+};
+
+#endif
+// ----------------------------------------------------------------------------
+
+static pthread_once_t sOnce = PTHREAD_ONCE_INIT;
+static bool sAvailable = false;
+static const CopyBlt* volatile sImpl = &sScalar;
+
+static void init()
+{
+#if COPY_BLT_NEON || COPY_BLT_SSE2
+    // the region operations already found out what the CPU supports
+    sAvailable = RegionSimd::isAvailable();
+    if (sAvailable) {
+        sImpl = &sVector;
+    }
+#endif
+    ALOGV("using %s copy-back", sImpl->name);
+}
+
+const CopyBlt& CopyBlt::get()
+{
+    pthread_once(&sOnce, init);
+    return *sImpl;
+}
+
+bool CopyBlt::isAvailable()
+{
+    pthread_once(&sOnce, init);
+    return sAvailable;
+}
+
+bool CopyBlt::setEnabled(bool enabled)
+{
+    pthread_once(&sOnce, init);
+#if COPY_BLT_NEON || COPY_BLT_SSE2
+    if (sAvailable) {
+        sImpl = enabled ? &sVector : &sScalar;
+    }
+#endif
+    return sImpl != &sScalar;
+}
+
+// ----------------------------------------------------------------------------
+
+void copyBltRegion(uint8_t* dst, size_t dstStride,
+        uint8_t const* src, size_t srcStride, size_t bpp, const Region& reg)
+{
+    const CopyBlt& blt(CopyBlt::get());
+    const size_t dbpr = dstStride * bpp;
+    const size_t sbpr = srcStride * bpp;
+    Region::const_iterator head(reg.begin());
+    Region::const_iterator tail(reg.end());
+    while (head != tail) {
+        const Rect& r(*head++);
+        ssize_t h = r.height();
+        if (h <= 0 || r.width() <= 0) continue;
+        size_t size = r.width() * bpp;
+        uint8_t const * s = src + (r.left + srcStride * r.top) * bpp;
+        uint8_t       * d = dst + (r.left + dstStride * r.top) * bpp;
+        if (dbpr==sbpr && size==sbpr) {
+            // whole rows, that's a single block
+            size *= h;
+            h = 1;
+        }
+        blt.copyRect(d, dbpr, s, sbpr, size, h, bpp);
+    }
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
@@ -35,6 +35,7 @@ enum {
 #ifdef QCOM_HARDWARE
     SET_GRAPHIC_BUFFER_SIZE,
 #endif
+    RECYCLE_GRAPHIC_BUFFER,
 };
 
 class BpGraphicBufferAlloc : public BpInterface<IGraphicBufferAlloc>
@@ -67,6 +68,14 @@ public:
         return graphicBuffer;
     }
 
+    virtual void recycleGraphicBuffer(const sp<GraphicBuffer>& buffer) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferAlloc::getInterfaceDescriptor());
+        data.write(*buffer);
+        remote()->transact(RECYCLE_GRAPHIC_BUFFER, data, &reply,
+                IBinder::FLAG_ONEWAY);
+    }
+
 #ifdef QCOM_HARDWARE
     virtual void setGraphicBufferSize(int size) {
         Parcel data, reply;
@@ -121,6 +130,14 @@ status_t BnGraphicBufferAlloc::onTransact(
             }
             return NO_ERROR;
         } break;
+        case RECYCLE_GRAPHIC_BUFFER: {
+            CHECK_INTERFACE(IGraphicBufferAlloc, data, reply);
+            sp<GraphicBuffer> buffer = new GraphicBuffer();
+            if (data.read(*buffer) == NO_ERROR) {
+                recycleGraphicBuffer(buffer);
+            }
+            return NO_ERROR;
+        } break;
 #ifdef QCOM_HARDWARE
         case SET_GRAPHIC_BUFFER_SIZE: {
             CHECK_INTERFACE(IGraphicBufferAlloc, data, reply);
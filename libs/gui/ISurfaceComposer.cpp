@@ -33,6 +33,7 @@
 #include <private/gui/LayerState.h>
 
 #include <ui/DisplayInfo.h>
+#include <ui/GraphicBuffer.h>
 
 #include <utils/Log.h>
 
@@ -120,6 +121,67 @@ public:
         return reply.readInt32();
     }
 
+    virtual status_t captureScreenToBuffer(DisplayID dpy,
+            const sp<GraphicBuffer>& buffer, int32_t* fence,
+            uint32_t minLayerZ, uint32_t maxLayerZ)
+    {
+        if (buffer == 0)
+            return BAD_VALUE;
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeInt32(dpy);
+        data.write(*buffer);
+        data.writeInt32(minLayerZ);
+        data.writeInt32(maxLayerZ);
+        remote()->transact(BnSurfaceComposer::CAPTURE_SCREEN_TO_BUFFER,
+                data, &reply);
+        *fence = reply.readInt32();
+        return reply.readInt32();
+    }
+
+    virtual status_t waitForScreenCapture(int32_t fence)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeInt32(fence);
+        remote()->transact(BnSurfaceComposer::WAIT_FOR_SCREEN_CAPTURE,
+                data, &reply);
+        return reply.readInt32();
+    }
+
+    virtual status_t captureScreenAsync(DisplayID dpy, int32_t* token,
+            uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeInt32(dpy);
+        data.writeInt32(reqWidth);
+        data.writeInt32(reqHeight);
+        data.writeInt32(minLayerZ);
+        data.writeInt32(maxLayerZ);
+        remote()->transact(BnSurfaceComposer::CAPTURE_SCREEN_ASYNC,
+                data, &reply);
+        *token = reply.readInt32();
+        return reply.readInt32();
+    }
+
+    virtual status_t collectScreenCapture(int32_t token,
+            sp<IMemoryHeap>* heap,
+            uint32_t* width, uint32_t* height, PixelFormat* format)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceComposer::getInterfaceDescriptor());
+        data.writeInt32(token);
+        remote()->transact(BnSurfaceComposer::COLLECT_SCREEN_CAPTURE,
+                data, &reply);
+        *heap = interface_cast<IMemoryHeap>(reply.readStrongBinder());
+        *width = reply.readInt32();
+        *height = reply.readInt32();
+        *format = reply.readInt32();
+        return reply.readInt32();
+    }
+
 #ifdef ALLWINNER
     virtual int  setDisplayProp(int cmd,int param0,int param1,int param2)
     {
@@ -279,6 +341,52 @@ status_t BnSurfaceComposer::onTransact(
             reply->writeInt32(f);
             reply->writeInt32(res);
         } break;
+        case CAPTURE_SCREEN_TO_BUFFER: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            DisplayID dpy = data.readInt32();
+            sp<GraphicBuffer> buffer = new GraphicBuffer();
+            status_t res = data.read(*buffer);
+            uint32_t minLayerZ = data.readInt32();
+            uint32_t maxLayerZ = data.readInt32();
+            int32_t fence = 0;
+            if (res == NO_ERROR) {
+                res = captureScreenToBuffer(dpy, buffer, &fence,
+                        minLayerZ, maxLayerZ);
+            }
+            reply->writeInt32(fence);
+            reply->writeInt32(res);
+        } break;
+        case CAPTURE_SCREEN_ASYNC: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            DisplayID dpy = data.readInt32();
+            uint32_t reqWidth = data.readInt32();
+            uint32_t reqHeight = data.readInt32();
+            uint32_t minLayerZ = data.readInt32();
+            uint32_t maxLayerZ = data.readInt32();
+            int32_t token = 0;
+            status_t res = captureScreenAsync(dpy, &token,
+                    reqWidth, reqHeight, minLayerZ, maxLayerZ);
+            reply->writeInt32(token);
+            reply->writeInt32(res);
+        } break;
+        case COLLECT_SCREEN_CAPTURE: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            int32_t token = data.readInt32();
+            sp<IMemoryHeap> heap;
+            uint32_t w = 0, h = 0;
+            PixelFormat f = 0;
+            status_t res = collectScreenCapture(token, &heap, &w, &h, &f);
+            reply->writeStrongBinder(heap != 0 ? heap->asBinder() : NULL);
+            reply->writeInt32(w);
+            reply->writeInt32(h);
+            reply->writeInt32(f);
+            reply->writeInt32(res);
+        } break;
+        case WAIT_FOR_SCREEN_CAPTURE: {
+            CHECK_INTERFACE(ISurfaceComposer, data, reply);
+            int32_t fence = data.readInt32();
+            reply->writeInt32(waitForScreenCapture(fence));
+        } break;
         case TURN_ELECTRON_BEAM_OFF: {
             CHECK_INTERFACE(ISurfaceComposer, data, reply);
             int32_t mode = data.readInt32();
@@ -52,6 +52,7 @@ enum {
     SET_PARAMETER,
     GET_PARAMETER,
 #endif
+    QUEUE_AND_DEQUEUE_BUFFER,
 };
 
 
@@ -125,6 +126,30 @@ public:
         return result;
     }
 
+    virtual status_t queueAndDequeueBuffer(int buf,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outBuf, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage) {
+        Parcel data, reply;
+        data.writeInterfaceToken(ISurfaceTexture::getInterfaceDescriptor());
+        data.writeInt32(buf);
+        memcpy(data.writeInplace(sizeof(input)), &input, sizeof(input));
+        data.writeInt32(w);
+        data.writeInt32(h);
+        data.writeInt32(format);
+        data.writeInt32(usage);
+        status_t result = remote()->transact(QUEUE_AND_DEQUEUE_BUFFER,
+                data, &reply);
+        if (result != NO_ERROR) {
+            *outBuf = -1;
+            return result;
+        }
+        memcpy(output, reply.readInplace(sizeof(*output)), sizeof(*output));
+        *outBuf = reply.readInt32();
+        result = reply.readInt32();
+        return result;
+    }
+
     virtual void cancelBuffer(int buf) {
         Parcel data, reply;
         data.writeInterfaceToken(ISurfaceTexture::getInterfaceDescriptor());
@@ -315,6 +340,26 @@ status_t BnSurfaceTexture::onTransact(
             reply->writeInt32(result);
             return NO_ERROR;
         } break;
+        case QUEUE_AND_DEQUEUE_BUFFER: {
+            CHECK_INTERFACE(ISurfaceTexture, data, reply);
+            int buf = data.readInt32();
+            QueueBufferInput const* const input =
+                    reinterpret_cast<QueueBufferInput const *>(
+                            data.readInplace(sizeof(QueueBufferInput)));
+            uint32_t w      = data.readInt32();
+            uint32_t h      = data.readInt32();
+            uint32_t format = data.readInt32();
+            uint32_t usage  = data.readInt32();
+            QueueBufferOutput* const output =
+                    reinterpret_cast<QueueBufferOutput *>(
+                            reply->writeInplace(sizeof(QueueBufferOutput)));
+            int nextBuf;
+            status_t result = queueAndDequeueBuffer(buf, *input, output,
+                    &nextBuf, w, h, format, usage);
+            reply->writeInt32(nextBuf);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        } break;
         case CANCEL_BUFFER: {
             CHECK_INTERFACE(ISurfaceTexture, data, reply);
             int buf = data.readInt32();
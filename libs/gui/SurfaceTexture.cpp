@@ -21,6 +21,8 @@
 #define GL_GLEXT_PROTOTYPES
 #define EGL_EGLEXT_PROTOTYPES
 
+#include <string.h>
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -115,6 +117,8 @@ SurfaceTexture::SurfaceTexture(GLuint tex, bool allowSynchronousMode,
         GLenum texTarget, bool useFenceSync, const sp<BufferQueue> &bufferQueue) :
     mCurrentTransform(0),
     mCurrentTimestamp(0),
+    mCurrentFrameNumber(0),
+    mCurrentQueueTime(0),
     mFilteringEnabled(true),
     mTexName(tex),
 #ifdef USE_FENCE_SYNC
@@ -127,7 +131,9 @@ SurfaceTexture::SurfaceTexture(GLuint tex, bool allowSynchronousMode,
     mEglContext(EGL_NO_CONTEXT),
     mAbandoned(false),
     mCurrentTexture(BufferQueue::INVALID_BUFFER_SLOT),
-    mAttached(true)
+    mAttached(true),
+    mLatchState(LATCH_NONE),
+    mLatchedFiltering(true)
 {
     // Choose a name using the PID and a process-unique ID.
     mName = String8::format("unnamed-%d-%d", getpid(), createProcessUniqueId());
@@ -223,28 +229,22 @@ status_t SurfaceTexture::updateTexImage(BufferRejecter* rejecter) {
     mEglContext = ctx;
 
     BufferQueue::BufferItem item;
-
-    // In asynchronous mode the list is guaranteed to be one buffer
-    // deep, while in synchronous mode we use the oldest buffer.
-    err = mBufferQueue->acquireBuffer(&item);
+    bool rejected = false;
+    bool latched = false;
+
+    if (mLatchState != LATCH_NONE) {
+        // latchTexImage already did the acquiring
+        latched = (mLatchState == LATCH_BUFFER);
+        rejected = (mLatchState == LATCH_REJECTED);
+        item = mLatchedItem;
+        mLatchedItem.mGraphicBuffer.clear();
+        mLatchState = LATCH_NONE;
+    } else {
+        err = acquireBufferLocked(rejecter, dpy, &item, &rejected);
+    }
     if (err == NO_ERROR) {
         int buf = item.mBuf;
-        // This buffer was newly allocated, so we need to clean up on our side
-        if (item.mGraphicBuffer != NULL) {
-            mEGLSlots[buf].mGraphicBuffer = 0;
-            if (mEGLSlots[buf].mEglImage != EGL_NO_IMAGE_KHR) {
-                eglDestroyImageKHR(dpy, mEGLSlots[buf].mEglImage);
-                mEGLSlots[buf].mEglImage = EGL_NO_IMAGE_KHR;
-            }
-            mEGLSlots[buf].mGraphicBuffer = item.mGraphicBuffer;
-        }
-
-        // we call the rejecter here, in case the caller has a reason to
-        // not accept this buffer. this is used by SurfaceFlinger to
-        // reject buffers which have the wrong size
-        if (rejecter && rejecter->reject(mEGLSlots[buf].mGraphicBuffer, item)) {
-            mBufferQueue->releaseBuffer(buf, dpy, mEGLSlots[buf].mFence);
-            mEGLSlots[buf].mFence = EGL_NO_SYNC_KHR;
+        if (rejected) {
             glBindTexture(mTexTarget, mTexName);
             return NO_ERROR;
         }
@@ -330,7 +330,14 @@ status_t SurfaceTexture::updateTexImage(BufferRejecter* rejecter) {
         mCurrentTransform = item.mTransform;
         mCurrentScalingMode = item.mScalingMode;
         mCurrentTimestamp = item.mTimestamp;
-        computeCurrentTransformMatrix();
+        mCurrentFrameNumber = item.mFrameNumber;
+        mCurrentQueueTime = item.mQueueTime;
+        if (latched && mLatchedFiltering == mFilteringEnabled) {
+            memcpy(mCurrentTransformMatrix, mLatchedTransformMatrix,
+                    sizeof(mCurrentTransformMatrix));
+        } else {
+            computeCurrentTransformMatrix();
+        }
     } else  {
         if (err < 0) {
             ALOGE("updateTexImage failed on acquire %d", err);
@@ -343,6 +350,107 @@ status_t SurfaceTexture::updateTexImage(BufferRejecter* rejecter) {
     return err;
 }
 
+status_t SurfaceTexture::acquireBufferLocked(BufferRejecter* rejecter,
+        EGLDisplay dpy, BufferQueue::BufferItem* item, bool* rejected) {
+    // In asynchronous mode the list is guaranteed to be one buffer
+    // deep, while in synchronous mode we use the oldest buffer.
+    status_t err = mBufferQueue->acquireBuffer(item);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    int buf = item->mBuf;
+    // This buffer was newly allocated, so we need to clean up on our side
+    if (item->mGraphicBuffer != NULL) {
+        mEGLSlots[buf].mGraphicBuffer = 0;
+        if (mEGLSlots[buf].mEglImage != EGL_NO_IMAGE_KHR) {
+            eglDestroyImageKHR(dpy, mEGLSlots[buf].mEglImage);
+            mEGLSlots[buf].mEglImage = EGL_NO_IMAGE_KHR;
+        }
+        mEGLSlots[buf].mGraphicBuffer = item->mGraphicBuffer;
+    }
+
+    // we call the rejecter here, in case the caller has a reason to
+    // not accept this buffer. this is used by SurfaceFlinger to
+    // reject buffers which have the wrong size
+    *rejected = false;
+    if (rejecter && rejecter->reject(mEGLSlots[buf].mGraphicBuffer, *item)) {
+        mBufferQueue->releaseBuffer(buf, dpy, mEGLSlots[buf].mFence);
+        mEGLSlots[buf].mFence = EGL_NO_SYNC_KHR;
+        *rejected = true;
+    }
+    return NO_ERROR;
+}
+
+status_t SurfaceTexture::latchTexImage(BufferRejecter* rejecter) {
+    ATRACE_CALL();
+    ST_LOGV("latchTexImage");
+    Mutex::Autolock lock(mMutex);
+
+    if (mAbandoned) {
+        ST_LOGE("latchTexImage: SurfaceTexture is abandoned!");
+        return NO_INIT;
+    }
+
+    if (!mAttached || mEglDisplay == EGL_NO_DISPLAY) {
+        // the first updateTexImage tells us which display to use
+        return INVALID_OPERATION;
+    }
+
+    if (mLatchState != LATCH_NONE) {
+        // updateTexImage hasn't consumed the previous one yet
+        return NO_ERROR;
+    }
+
+    bool rejected = false;
+    status_t err = acquireBufferLocked(rejecter, mEglDisplay, &mLatchedItem,
+            &rejected);
+    if (err != NO_ERROR) {
+        // nothing latched, updateTexImage will try again
+        return err;
+    }
+    if (rejected) {
+        mLatchState = LATCH_REJECTED;
+        return NO_ERROR;
+    }
+
+    // creating an EGLImage only needs the display. if it fails,
+    // updateTexImage tries again and handles the error.
+    int buf = mLatchedItem.mBuf;
+    const sp<GraphicBuffer>& graphicBuffer(mEGLSlots[buf].mGraphicBuffer);
+    if (mEGLSlots[buf].mEglImage == EGL_NO_IMAGE_KHR && graphicBuffer != NULL) {
+        bool gpuSupportedFormat = true;
+#ifdef QCOM_HARDWARE
+        gpuSupportedFormat = qdutils::isGPUSupportedFormat(graphicBuffer->format);
+#endif
+        if (gpuSupportedFormat) {
+            mEGLSlots[buf].mEglImage = createImage(mEglDisplay, graphicBuffer);
+        }
+    }
+
+    if (graphicBuffer != NULL) {
+        computeTransformMatrix(mLatchedTransformMatrix, graphicBuffer,
+                mLatchedItem.mCrop, mLatchedItem.mTransform, mFilteringEnabled);
+        mLatchedFiltering = mFilteringEnabled;
+    } else {
+        // can't happen unless the slot was freed under us, don't let
+        // updateTexImage use a stale matrix
+        mLatchedFiltering = !mFilteringEnabled;
+    }
+    mLatchState = LATCH_BUFFER;
+    return NO_ERROR;
+}
+
+void SurfaceTexture::releaseLatchedBufferLocked() {
+    if (mLatchState == LATCH_BUFFER) {
+        int buf = mLatchedItem.mBuf;
+        mBufferQueue->releaseBuffer(buf, mEglDisplay, mEGLSlots[buf].mFence);
+        mEGLSlots[buf].mFence = EGL_NO_SYNC_KHR;
+    }
+    mLatchedItem.mGraphicBuffer.clear();
+    mLatchState = LATCH_NONE;
+}
+
 status_t SurfaceTexture::detachFromContext() {
     ATRACE_CALL();
     ST_LOGV("detachFromContext");
@@ -381,6 +489,10 @@ status_t SurfaceTexture::detachFromContext() {
         glDeleteTextures(1, &mTexName);
     }
 
+    // a latched buffer would be bound to the next context without going
+    // through the rejecter again, give it back
+    releaseLatchedBufferLocked();
+
     // Because we're giving up the EGLDisplay we need to free all the EGLImages
     // that are associated with it.  They'll be recreated when the
     // SurfaceTexture gets attached to a new OpenGL ES context (and thus gets a
@@ -550,26 +662,32 @@ void SurfaceTexture::setFilteringEnabled(bool enabled) {
 
 void SurfaceTexture::computeCurrentTransformMatrix() {
     ST_LOGV("computeCurrentTransformMatrix");
+    computeTransformMatrix(mCurrentTransformMatrix, mCurrentTextureBuf,
+            mCurrentCrop, mCurrentTransform, mFilteringEnabled);
+}
 
+void SurfaceTexture::computeTransformMatrix(float outTransform[16],
+        const sp<GraphicBuffer>& buf, const Rect& cropRect,
+        uint32_t transform, bool filtering) {
     float xform[16];
     for (int i = 0; i < 16; i++) {
         xform[i] = mtxIdentity[i];
     }
-    if (mCurrentTransform & NATIVE_WINDOW_TRANSFORM_FLIP_H) {
+    if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_H) {
         float result[16];
         mtxMul(result, xform, mtxFlipH);
         for (int i = 0; i < 16; i++) {
             xform[i] = result[i];
         }
     }
-    if (mCurrentTransform & NATIVE_WINDOW_TRANSFORM_FLIP_V) {
+    if (transform & NATIVE_WINDOW_TRANSFORM_FLIP_V) {
         float result[16];
         mtxMul(result, xform, mtxFlipV);
         for (int i = 0; i < 16; i++) {
             xform[i] = result[i];
         }
     }
-    if (mCurrentTransform & NATIVE_WINDOW_TRANSFORM_ROT_90) {
+    if (transform & NATIVE_WINDOW_TRANSFORM_ROT_90) {
         float result[16];
         mtxMul(result, xform, mtxRot90);
         for (int i = 0; i < 16; i++) {
@@ -577,14 +695,12 @@ void SurfaceTexture::computeCurrentTransformMatrix() {
         }
     }
 
-    sp<GraphicBuffer>& buf(mCurrentTextureBuf);
-    Rect cropRect = mCurrentCrop;
     float tx = 0.0f, ty = 0.0f, sx = 1.0f, sy = 1.0f;
     float bufferWidth = buf->getWidth();
     float bufferHeight = buf->getHeight();
     if (!cropRect.isEmpty()) {
         float shrinkAmount = 0.0f;
-        if (mFilteringEnabled) {
+        if (filtering) {
             // In order to prevent bilinear sampling beyond the edge of the
             // crop rectangle we may need to shrink it by 2 texels in each
             // dimension.  Normally this would just need to take 1/2 a texel
@@ -637,7 +753,7 @@ void SurfaceTexture::computeCurrentTransformMatrix() {
     // coordinate of 0, so SurfaceTexture must behave the same way.  We don't
     // want to expose this to applications, however, so we must add an
     // additional vertical flip to the transform after all the other transforms.
-    mtxMul(mCurrentTransformMatrix, mtxFlipV, mtxBeforeFlipV);
+    mtxMul(outTransform, mtxFlipV, mtxBeforeFlipV);
 }
 
 nsecs_t SurfaceTexture::getTimestamp() {
@@ -646,6 +762,18 @@ nsecs_t SurfaceTexture::getTimestamp() {
     return mCurrentTimestamp;
 }
 
+uint64_t SurfaceTexture::getFrameNumber() {
+    ST_LOGV("getFrameNumber");
+    Mutex::Autolock lock(mMutex);
+    return mCurrentFrameNumber;
+}
+
+nsecs_t SurfaceTexture::getQueueTime() {
+    ST_LOGV("getQueueTime");
+    Mutex::Autolock lock(mMutex);
+    return mCurrentQueueTime;
+}
+
 void SurfaceTexture::setFrameAvailableListener(
         const sp<FrameAvailableListener>& listener) {
     ST_LOGV("setFrameAvailableListener");
@@ -746,6 +874,7 @@ void SurfaceTexture::abandon() {
     if (!mAbandoned) {
         mAbandoned = true;
         mCurrentTextureBuf.clear();
+        mLatchState = LATCH_NONE;
 
         // destroy all egl buffers
         for (int i =0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
@@ -780,6 +909,11 @@ status_t SurfaceTexture::setTransformHint(uint32_t hint) {
     return mBufferQueue->setTransformHint(hint);
 }
 
+status_t SurfaceTexture::setAdaptiveMode(bool enabled) {
+    Mutex::Autolock lock(mMutex);
+    return mBufferQueue->setAdaptiveMode(enabled);
+}
+
 // Used for refactoring BufferQueue from SurfaceTexture
 // Should not be in final interface once users of SurfaceTexture are clean up.
 status_t SurfaceTexture::setSynchronousMode(bool enabled) {
@@ -18,9 +18,12 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 //#define LOG_NDEBUG 0
 
+#include <unistd.h>
+
 #include <android/native_window.h>
 
 #include <utils/Log.h>
+#include <utils/SortedVector.h>
 #include <utils/Trace.h>
 
 #ifdef ALLWINNER
@@ -32,12 +35,82 @@
 #include <gui/SurfaceTextureClient.h>
 
 #include <private/gui/ComposerService.h>
+#include <private/gui/CopyBlt.h>
 #ifdef QCOM_HARDWARE
 #include <gralloc_priv.h>
 #endif
 
 namespace android {
 
+// a producer that dequeues within this time after queuing a buffer gets
+// its next buffer along with the queue
+static const nsecs_t MAX_PREFETCH_AGE = ms2ns(1);
+
+// how long a prefetched buffer may stay dequeued on the server after it
+// got too old, at most
+static const nsecs_t PREFETCH_REAP_PERIOD = ms2ns(100);
+
+/*
+ * PrefetchReaper gives back the buffers SurfaceTextureClients prefetched
+ * and didn't use, on a thread shared by all the clients of the process.
+ * A client that prefetches a buffer schedules itself, the reaper looks at
+ * the scheduled clients PREFETCH_REAP_PERIOD later, all at once, so that
+ * it doesn't wake up for every frame of a producer that keeps rendering.
+ */
+class SurfaceTextureClient::PrefetchReaper : public Thread {
+public:
+    static sp<PrefetchReaper> getInstance() {
+        static Mutex sLock;
+        static sp<PrefetchReaper> sInstance;
+        Mutex::Autolock _l(sLock);
+        if (sInstance == 0) {
+            sInstance = new PrefetchReaper();
+            sInstance->run("PrefetchReaper");
+        }
+        return sInstance;
+    }
+
+    void schedule(const wp<SurfaceTextureClient>& client) {
+        Mutex::Autolock _l(mLock);
+        const bool wasIdle = mClients.isEmpty();
+        mClients.add(client);
+        if (wasIdle) {
+            mCondition.signal();
+        }
+    }
+
+private:
+    PrefetchReaper() : Thread(false) {
+    }
+
+    virtual bool threadLoop() {
+        {
+            Mutex::Autolock _l(mLock);
+            while (mClients.isEmpty()) {
+                mCondition.wait(mLock);
+            }
+        }
+        usleep(ns2us(PREFETCH_REAP_PERIOD));
+        SortedVector< wp<SurfaceTextureClient> > clients;
+        {
+            Mutex::Autolock _l(mLock);
+            clients = mClients;
+            mClients.clear();
+        }
+        for (size_t i=0 ; i<clients.size() ; i++) {
+            sp<SurfaceTextureClient> client(clients[i].promote());
+            if (client != 0) {
+                client->expirePrefetchedBuffer();
+            }
+        }
+        return true;
+    }
+
+    Mutex mLock;
+    Condition mCondition;
+    SortedVector< wp<SurfaceTextureClient> > mClients;
+};
+
 SurfaceTextureClient::SurfaceTextureClient(
         const sp<ISurfaceTexture>& surfaceTexture)
 {
@@ -58,6 +131,10 @@ SurfaceTextureClient::SurfaceTextureClient() {
 }
 
 SurfaceTextureClient::~SurfaceTextureClient() {
+    if (mSurfaceTexture != 0) {
+        Mutex::Autolock lock(mMutex);
+        cancelPrefetchedBufferLocked();
+    }
     if (mConnectedToCpu) {
         SurfaceTextureClient::disconnect(NATIVE_WINDOW_API_CPU);
     }
@@ -91,6 +168,9 @@ void SurfaceTextureClient::init() {
     mUserHeight = 0;
     mTransformHint = 0;
     mConsumerRunningBehind = false;
+    mQueueAndDequeue = false;
+    mPrefetchedSlot = -1;
+    mQueueTime = 0;
     mConnectedToCpu = false;
 }
 
@@ -171,13 +251,22 @@ int SurfaceTextureClient::dequeueBuffer(android_native_buffer_t** buffer) {
     int buf = -1;
     int reqW = mReqWidth ? mReqWidth : mUserWidth;
     int reqH = mReqHeight ? mReqHeight : mUserHeight;
-    status_t result = mSurfaceTexture->dequeueBuffer(&buf, reqW, reqH,
-            mReqFormat, mReqUsage);
-    if (result < 0) {
-        ALOGV("dequeueBuffer: ISurfaceTexture::dequeueBuffer(%d, %d, %d, %d)"
-             "failed: %d", mReqWidth, mReqHeight, mReqFormat, mReqUsage,
-             result);
-        return result;
+    status_t result = OK;
+    mQueueAndDequeue = (systemTime(SYSTEM_TIME_MONOTONIC) - mQueueTime <
+            MAX_PREFETCH_AGE);
+    if (mPrefetchedSlot >= 0 && mQueueAndDequeue) {
+        buf = mPrefetchedSlot;
+        mPrefetchedSlot = -1;
+    } else {
+        cancelPrefetchedBufferLocked();
+        result = mSurfaceTexture->dequeueBuffer(&buf, reqW, reqH,
+                mReqFormat, mReqUsage);
+        if (result < 0) {
+            ALOGV("dequeueBuffer: ISurfaceTexture::dequeueBuffer(%d, %d, %d, %d)"
+                 "failed: %d", mReqWidth, mReqHeight, mReqFormat, mReqUsage,
+                 result);
+            return result;
+        }
     }
     sp<GraphicBuffer>& gbuf(mSlots[buf].buffer);
     if (result & ISurfaceTexture::RELEASE_ALL_BUFFERS) {
@@ -191,6 +280,9 @@ int SurfaceTextureClient::dequeueBuffer(android_native_buffer_t** buffer) {
                     result);
             return result;
         }
+        // nothing in a new buffer is up to date
+        mSlots[buf].staleRegion.set(Rect(gbuf->width, gbuf->height));
+        mSlots[buf].dirtyRegion.clear();
     }
     *buffer = gbuf.get();
     return OK;
@@ -251,7 +343,19 @@ int SurfaceTextureClient::queueBuffer(android_native_buffer_t* buffer) {
     ISurfaceTexture::QueueBufferOutput output;
     ISurfaceTexture::QueueBufferInput input(timestamp, crop, mScalingMode,
             mTransform);
-    status_t err = mSurfaceTexture->queueBuffer(i, input, &output);
+    status_t err;
+    if (mQueueAndDequeue && mPrefetchedSlot < 0) {
+        int reqW = mReqWidth ? mReqWidth : mUserWidth;
+        int reqH = mReqHeight ? mReqHeight : mUserHeight;
+        err = mSurfaceTexture->queueAndDequeueBuffer(i, input, &output,
+                &mPrefetchedSlot, reqW, reqH, mReqFormat, mReqUsage);
+    } else {
+        err = mSurfaceTexture->queueBuffer(i, input, &output);
+    }
+    mQueueTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mPrefetchedSlot >= 0) {
+        PrefetchReaper::getInstance()->schedule(this);
+    }
     if (err != OK)  {
         ALOGE("queueBuffer: error queuing buffer to SurfaceTexture, %d", err);
     }
@@ -529,6 +633,8 @@ int SurfaceTextureClient::connect(int api) {
     Mutex::Autolock lock(mMutex);
     ISurfaceTexture::QueueBufferOutput output;
     int err = mSurfaceTexture->connect(api, &output);
+    mQueueAndDequeue = false;
+    mPrefetchedSlot = -1;
     if (err == NO_ERROR) {
         uint32_t numPendingBuffers = 0;
         output.deflate(&mDefaultWidth, &mDefaultHeight, &mTransformHint,
@@ -546,6 +652,8 @@ int SurfaceTextureClient::disconnect(int api) {
     ALOGV("SurfaceTextureClient::disconnect");
     Mutex::Autolock lock(mMutex);
     freeAllBuffers();
+    // disconnecting gives all the buffers back
+    mPrefetchedSlot = -1;
     int err = mSurfaceTexture->disconnect(api);
     if (!err) {
         mReqFormat = 0;
@@ -602,6 +710,9 @@ int SurfaceTextureClient::setUsage(uint32_t reqUsage)
     // and subsequently from driver, the latter ends up overwriting
     // the existing values. We cache certain values in mReqExtUsage
     // to avoid being overwritten.
+    if (mReqUsage != (reqUsage | mReqExtUsage)) {
+        cancelPrefetchedBufferLocked();
+    }
     mReqUsage = reqUsage | mReqExtUsage;
     return OK;
 }
@@ -631,6 +742,9 @@ int SurfaceTextureClient::setBufferCount(int bufferCount)
     ALOGV("SurfaceTextureClient::setBufferCount");
     Mutex::Autolock lock(mMutex);
 
+    // the server refuses to change the buffer count while we own a buffer
+    cancelPrefetchedBufferLocked();
+
     status_t err = mSurfaceTexture->setBufferCount(bufferCount);
     ALOGE_IF(err, "ISurfaceTexture::setBufferCount(%d) returned %s",
             bufferCount, strerror(-err));
@@ -654,6 +768,9 @@ int SurfaceTextureClient::setBuffersDimensions(int w, int h)
         return BAD_VALUE;
 
     Mutex::Autolock lock(mMutex);
+    if (uint32_t(w) != mReqWidth || uint32_t(h) != mReqHeight) {
+        cancelPrefetchedBufferLocked();
+    }
     mReqWidth = w;
     mReqHeight = h;
     return NO_ERROR;
@@ -671,6 +788,9 @@ int SurfaceTextureClient::setBuffersUserDimensions(int w, int h)
         return BAD_VALUE;
 
     Mutex::Autolock lock(mMutex);
+    if (uint32_t(w) != mUserWidth || uint32_t(h) != mUserHeight) {
+        cancelPrefetchedBufferLocked();
+    }
     mUserWidth = w;
     mUserHeight = h;
     return NO_ERROR;
@@ -684,6 +804,9 @@ int SurfaceTextureClient::setBuffersFormat(int format)
         return BAD_VALUE;
 
     Mutex::Autolock lock(mMutex);
+    if (uint32_t(format) != mReqFormat) {
+        cancelPrefetchedBufferLocked();
+    }
     mReqFormat = format;
     return NO_ERROR;
 }
@@ -762,58 +885,70 @@ void SurfaceTextureClient::freeAllBuffers() {
     }
 }
 
+void SurfaceTextureClient::cancelPrefetchedBufferLocked() {
+    if (mPrefetchedSlot >= 0) {
+        mSurfaceTexture->cancelBuffer(mPrefetchedSlot);
+        mPrefetchedSlot = -1;
+    }
+}
+
+void SurfaceTextureClient::expirePrefetchedBuffer() {
+    Mutex::Autolock lock(mMutex);
+    if (mPrefetchedSlot < 0) {
+        return;
+    }
+    if (systemTime(SYSTEM_TIME_MONOTONIC) - mQueueTime < MAX_PREFETCH_AGE) {
+        // prefetched just before the reaper looked, look again later
+        PrefetchReaper::getInstance()->schedule(this);
+        return;
+    }
+    ALOGV("expirePrefetchedBuffer: cancelling slot %d", mPrefetchedSlot);
+    cancelPrefetchedBufferLocked();
+}
+
 // ----------------------------------------------------------------------
 // the lock/unlock APIs must be used from the same thread
 
 static status_t copyBlt(
-        const sp<GraphicBuffer>& dst,
+        const sp<GraphicBuffer>& dst, void* dst_bits,
         const sp<GraphicBuffer>& src,
         const Region& reg)
 {
     // src and dst with, height and format must be identical. no verification
-    // is done here.
+    // is done here. dst is already locked, at dst_bits.
     status_t err;
     uint8_t const * src_bits = NULL;
     err = src->lock(GRALLOC_USAGE_SW_READ_OFTEN, reg.bounds(), (void**)&src_bits);
     ALOGE_IF(err, "error locking src buffer %s", strerror(-err));
 
-    uint8_t* dst_bits = NULL;
-    err = dst->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, reg.bounds(), (void**)&dst_bits);
-    ALOGE_IF(err, "error locking dst buffer %s", strerror(-err));
-
-    Region::const_iterator head(reg.begin());
-    Region::const_iterator tail(reg.end());
-    if (head != tail && src_bits && dst_bits) {
-        const size_t bpp = bytesPerPixel(src->format);
-        const size_t dbpr = dst->stride * bpp;
-        const size_t sbpr = src->stride * bpp;
-
-        while (head != tail) {
-            const Rect& r(*head++);
-            ssize_t h = r.height();
-            if (h <= 0) continue;
-            size_t size = r.width() * bpp;
-            uint8_t const * s = src_bits + (r.left + src->stride * r.top) * bpp;
-            uint8_t       * d = dst_bits + (r.left + dst->stride * r.top) * bpp;
-            if (dbpr==sbpr && size==sbpr) {
-                size *= h;
-                h = 1;
-            }
-            do {
-                memcpy(d, s, size);
-                d += dbpr;
-                s += sbpr;
-            } while (--h > 0);
+    if (src_bits) {
+        const ssize_t bpp = bytesPerPixel(src->format);
+        if (bpp > 0) {
+            copyBltRegion(static_cast<uint8_t*>(dst_bits), dst->stride,
+                    src_bits, src->stride, bpp, reg);
         }
+        src->unlock();
     }
 
-    if (src_bits)
-        src->unlock();
+    return err;
+}
 
-    if (dst_bits)
-        dst->unlock();
+// the smallest rectangle that contains a and b, which aren't empty
+static Rect boundsOf(const Rect& a, const Rect& b)
+{
+    return Rect(a.left < b.left ? a.left : b.left,
+            a.top < b.top ? a.top : b.top,
+            a.right > b.right ? a.right : b.right,
+            a.bottom > b.bottom ? a.bottom : b.bottom);
+}
 
-    return err;
+// whether reg contains rect, when that's cheap to tell: a buffer that is
+// already missing the area being posted, typically the whole buffer or
+// the same small area posted every frame, doesn't need a region operation
+static bool containsRect(const Region& reg, const Rect& rect)
+{
+    Rect r;
+    return reg.isRect() && reg.getBounds().intersect(rect, &r) && r == rect;
 }
 
 // ----------------------------------------------------------------------------
@@ -861,68 +996,51 @@ status_t SurfaceTextureClient::lock(
                     backBuffer->height == frontBuffer->height &&
                     backBuffer->format == frontBuffer->format);
 
-#ifdef QCOM_HARDWARE
-            int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
-#endif
-            if (canCopyBack) {
-                // copy the area that is invalid and not repainted this round
-#ifdef QCOM_HARDWARE
-                Mutex::Autolock lock(mMutex);
-                Region oldDirtyRegion;
-                for(int i = 0 ; i < NUM_BUFFER_SLOTS; i++ ) {
-                     if(i != backBufferSlot && !mSlots[i].dirtyRegion.isEmpty())
-                         oldDirtyRegion.orSelf(mSlots[i].dirtyRegion);
-                }
-                const Region copyback(oldDirtyRegion.subtract(newDirtyRegion));
-#else
-                const Region copyback(mDirtyRegion.subtract(newDirtyRegion));
-#endif
-                if (!copyback.isEmpty())
-                    copyBlt(backBuffer, frontBuffer, copyback);
-            } else {
-                // if we can't copy-back anything, modify the user's dirty
-                // region to make sure they redraw the whole buffer
-                newDirtyRegion.set(bounds);
-#ifndef QCOM_HARDWARE
-                mDirtyRegion.clear();
-#endif
-                Mutex::Autolock lock(mMutex);
-                for (size_t i=0 ; i<NUM_BUFFER_SLOTS ; i++) {
-                    mSlots[i].dirtyRegion.clear();
-                }
-            }
-
-
+            Region copyback;
             { // scope for the lock
                 Mutex::Autolock lock(mMutex);
-#ifdef QCOM_HARDWARE
-                mSlots[backBufferSlot].dirtyRegion = newDirtyRegion;
-#else
                 int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
                 if (backBufferSlot >= 0) {
-                    Region& dirtyRegion(mSlots[backBufferSlot].dirtyRegion);
-                    mDirtyRegion.subtract(dirtyRegion);
-                    dirtyRegion = newDirtyRegion;
+                    BufferSlot& slot(mSlots[backBufferSlot]);
+                    if (canCopyBack) {
+                        // copy the area that changed since this buffer was
+                        // last posted and is not repainted this round. when
+                        // the front buffer itself comes back, that's nothing.
+                        if (!slot.staleRegion.isEmpty()) {
+                            copyback = slot.staleRegion.subtract(
+                                    newDirtyRegion).intersect(bounds);
+                        }
+                    } else {
+                        // if we can't copy-back anything, modify the user's
+                        // dirty region to make sure they redraw the whole
+                        // buffer
+                        newDirtyRegion.set(bounds);
+                    }
+                    slot.dirtyRegion = newDirtyRegion;
                 }
-#endif
             }
 
-#ifndef QCOM_HARDWARE
-           mDirtyRegion.orSelf(newDirtyRegion);
-#endif
-
             if (inOutDirtyBounds) {
                 *inOutDirtyBounds = newDirtyRegion.getBounds();
             }
 
+            // the copy-back and the drawing share a single lock
+            Rect lockBounds(newDirtyRegion.bounds());
+            if (!copyback.isEmpty()) {
+                lockBounds = boundsOf(lockBounds, copyback.bounds());
+            }
             void* vaddr;
             status_t res = backBuffer->lock(
                     GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
-                    newDirtyRegion.bounds(), &vaddr);
+                    lockBounds, &vaddr);
 
             ALOGW_IF(res, "failed locking buffer (handle = %p)",
                     backBuffer->handle);
 
+            if (res == NO_ERROR && !copyback.isEmpty()) {
+                copyBlt(backBuffer, vaddr, frontBuffer, copyback);
+            }
+
             mLockedBuffer = backBuffer;
             outBuffer->width  = backBuffer->width;
             outBuffer->height = backBuffer->height;
@@ -948,6 +1066,24 @@ status_t SurfaceTextureClient::unlockAndPost()
     ALOGE_IF(err, "queueBuffer (handle=%p) failed (%s)",
             mLockedBuffer->handle, strerror(-err));
 
+    if (err == NO_ERROR) {
+        Mutex::Autolock lock(mMutex);
+        int postedSlot(getSlotFromBufferLocked(mLockedBuffer.get()));
+        if (postedSlot >= 0) {
+            // the other buffers are now missing what was drawn in this one
+            const Region& dirtyRegion(mSlots[postedSlot].dirtyRegion);
+            const Rect dirtyBounds(dirtyRegion.getBounds());
+            for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
+                Region& staleRegion(mSlots[i].staleRegion);
+                if (i != postedSlot && mSlots[i].buffer != 0 &&
+                        !containsRect(staleRegion, dirtyBounds)) {
+                    staleRegion.orSelf(dirtyRegion);
+                }
+            }
+            mSlots[postedSlot].staleRegion.clear();
+        }
+    }
+
     mPostedBuffer = mLockedBuffer;
     mLockedBuffer = 0;
     return err;
@@ -7,6 +7,8 @@ LOCAL_MODULE := SurfaceTexture_test
 LOCAL_MODULE_TAGS := tests
 
 LOCAL_SRC_FILES := \
+    BufferQueue_test.cpp \
+    CopyBlt_test.cpp \
     Surface_test.cpp \
     SurfaceTextureClient_test.cpp \
     SurfaceTexture_test.cpp \
@@ -31,6 +33,42 @@ LOCAL_C_INCLUDES := \
 # to integrate with auto-test framework.
 include $(BUILD_NATIVE_TEST)
 
+# Build the benchmarks, they're not part of the unit tests.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := BufferQueue_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    BufferQueue_bench.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libEGL \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := CopyBlt_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    CopyBlt_bench.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
 # Include subdirectory makefiles
 # ============================================================
 
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <gui/BufferQueue.h>
+#include <gui/DummyConsumer.h>
+#include <gui/SurfaceTextureClient.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+/*
+ * Times a ping-pong of frames through a BufferQueue with and without its
+ * lock-free paths, and with and without queueAndDequeueBuffer, then
+ * compares the queue-to-latch latency of a
+ * synchronous BufferQueue with and without the adaptive queue depth. For
+ * the latter a producer thread renders frames that take a given time and
+ * queues them as fast as it can, the consumer latches one every period,
+ * like a compositor.
+ */
+
+// forwards the producer's calls to a BufferQueue and counts them, each is a
+// binder transaction when the producer is in another process. without
+// batching it answers queueAndDequeueBuffer like queueBuffer, so the
+// producer makes the calls it made before that transaction existed.
+class CountingSurfaceTexture : public BnSurfaceTexture {
+public:
+    CountingSurfaceTexture(const sp<BufferQueue>& bq):
+            mBQ(bq),
+            mCalls(0),
+            mBatching(true) {
+    }
+
+    int32_t calls() const {
+        return android_atomic_acquire_load(&mCalls);
+    }
+
+    void setBatchingEnabled(bool enabled) {
+        mBatching = enabled;
+    }
+
+    virtual status_t requestBuffer(int slot, sp<GraphicBuffer>* buf) {
+        android_atomic_inc(&mCalls);
+        return mBQ->requestBuffer(slot, buf);
+    }
+
+    virtual status_t setBufferCount(int bufferCount) {
+        android_atomic_inc(&mCalls);
+        return mBQ->setBufferCount(bufferCount);
+    }
+
+    virtual status_t dequeueBuffer(int *slot, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage) {
+        android_atomic_inc(&mCalls);
+        return mBQ->dequeueBuffer(slot, w, h, format, usage);
+    }
+
+    virtual status_t queueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output) {
+        android_atomic_inc(&mCalls);
+        return mBQ->queueBuffer(slot, input, output);
+    }
+
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage) {
+        android_atomic_inc(&mCalls);
+        if (!mBatching) {
+            *outSlot = BufferQueue::INVALID_BUFFER_SLOT;
+            return mBQ->queueBuffer(slot, input, output);
+        }
+        return mBQ->queueAndDequeueBuffer(slot, input, output, outSlot,
+                w, h, format, usage);
+    }
+
+    virtual void cancelBuffer(int slot) {
+        android_atomic_inc(&mCalls);
+        mBQ->cancelBuffer(slot);
+    }
+
+    virtual int query(int what, int* value) {
+        android_atomic_inc(&mCalls);
+        return mBQ->query(what, value);
+    }
+
+    virtual status_t setSynchronousMode(bool enabled) {
+        android_atomic_inc(&mCalls);
+        return mBQ->setSynchronousMode(enabled);
+    }
+
+    virtual status_t connect(int api, QueueBufferOutput* output) {
+        android_atomic_inc(&mCalls);
+        return mBQ->connect(api, output);
+    }
+
+    virtual status_t disconnect(int api) {
+        android_atomic_inc(&mCalls);
+        return mBQ->disconnect(api);
+    }
+
+#ifdef QCOM_HARDWARE
+    virtual status_t setBuffersSize(int size) {
+        android_atomic_inc(&mCalls);
+        return mBQ->setBuffersSize(size);
+    }
+
+    virtual status_t updateBuffersGeometry(int w, int h, int f) {
+        android_atomic_inc(&mCalls);
+        return mBQ->updateBuffersGeometry(w, h, f);
+    }
+#endif
+
+#ifdef ALLWINNER
+    virtual int setParameter(uint32_t cmd, uint32_t value) {
+        android_atomic_inc(&mCalls);
+        return mBQ->setParameter(cmd, value);
+    }
+
+    virtual uint32_t getParameter(uint32_t cmd) {
+        android_atomic_inc(&mCalls);
+        return mBQ->getParameter(cmd);
+    }
+#endif
+
+private:
+    sp<BufferQueue> mBQ;
+    volatile int32_t mCalls;
+    bool mBatching;
+};
+
+// counts the frames queued and not yet acquired, so the consumer can wait
+// for them
+class FrameListener : public BufferQueue::ConsumerListener {
+public:
+    FrameListener():
+            mPendingFrames(0) {
+    }
+
+    void waitForFrame() {
+        Mutex::Autolock lock(mMutex);
+        while (mPendingFrames == 0) {
+            mCondition.wait(mMutex);
+        }
+        mPendingFrames--;
+    }
+
+    virtual void onFrameAvailable() {
+        Mutex::Autolock lock(mMutex);
+        mPendingFrames++;
+        mCondition.signal();
+    }
+
+    virtual void onBuffersReleased() {
+    }
+
+private:
+    int mPendingFrames;
+    Mutex mMutex;
+    Condition mCondition;
+};
+
+// a producer rendering frames that each take renderTime
+class ProducerThread : public Thread {
+public:
+    ProducerThread(const sp<ANativeWindow>& anw, int frames,
+            nsecs_t renderTime):
+            mANW(anw),
+            mFrames(frames),
+            mRenderTime(renderTime),
+            mErrors(0) {
+    }
+
+    int errors() const {
+        return mErrors;
+    }
+
+private:
+    virtual bool threadLoop() {
+        for (int i = 0; i < mFrames; i++) {
+            ANativeWindowBuffer* buf;
+            if (mANW->dequeueBuffer(mANW.get(), &buf) != NO_ERROR) {
+                mErrors++;
+                break;
+            }
+            if (mRenderTime) {
+                usleep(ns2us(mRenderTime));
+            }
+            if (mANW->queueBuffer(mANW.get(), buf) != NO_ERROR) {
+                mErrors++;
+                break;
+            }
+        }
+        return false;
+    }
+
+    sp<ANativeWindow> mANW;
+    int mFrames;
+    nsecs_t mRenderTime;
+    int mErrors;
+};
+
+// passes frames from a producer thread to this thread, which acquires and
+// releases each of them as soon as it's queued. returns the average time
+// per frame.
+static nsecs_t pingPong(const sp<BufferQueue>& bq,
+        const sp<FrameListener>& listener, const sp<ANativeWindow>& anw,
+        int frames)
+{
+    sp<ProducerThread> producer(new ProducerThread(anw, frames, 0));
+    const nsecs_t start = systemTime();
+    producer->run("BufferQueue_bench::Producer");
+    for (int i = 0; i < frames; i++) {
+        listener->waitForFrame();
+        BufferQueue::BufferItem item;
+        const status_t err = bq->acquireBuffer(&item);
+        if (err != NO_ERROR) {
+            fprintf(stderr, "acquireBuffer failed: %d\n", err);
+            break;
+        }
+        bq->releaseBuffer(item.mBuf, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR);
+    }
+    const nsecs_t elapsed = systemTime() - start;
+    producer->requestExitAndWait();
+    if (producer->errors()) {
+        fprintf(stderr, "the producer failed to queue a frame\n");
+    }
+    return elapsed / frames;
+}
+
+// times a ping-pong of frames with the lock-free paths of the BufferQueue
+// and with every operation under its mutex
+static void benchPingPong(int frames)
+{
+    sp<BufferQueue> bq(new BufferQueue(true));
+    sp<FrameListener> listener(new FrameListener());
+    bq->consumerConnect(listener);
+    sp<SurfaceTextureClient> stc(new SurfaceTextureClient(
+            sp<ISurfaceTexture>(bq)));
+    sp<ANativeWindow> anw(stc);
+    native_window_api_connect(anw.get(), NATIVE_WINDOW_API_CPU);
+    // synchronous mode, every frame is consumed
+    anw->setSwapInterval(anw.get(), 1);
+
+    // warm up, so that the buffers are allocated
+    pingPong(bq, listener, anw, 100);
+
+    const nsecs_t lockFree = pingPong(bq, listener, anw, frames);
+    bq->setLockFreeEnabled(false);
+    const nsecs_t locked = pingPong(bq, listener, anw, frames);
+    printf("ping-pong of %d frames: lock-free %lld ns/frame, "
+            "locked %lld ns/frame\n", frames, lockFree, locked);
+
+    native_window_api_disconnect(anw.get(), NATIVE_WINDOW_API_CPU);
+    bq->consumerDisconnect();
+}
+
+// counts the calls the producer makes and times a ping-pong of frames
+// with queueAndDequeueBuffer and with a dequeue and a queue per frame
+static void benchQueueAndDequeue(int frames)
+{
+    sp<BufferQueue> bq(new BufferQueue(true));
+    sp<FrameListener> listener(new FrameListener());
+    bq->consumerConnect(listener);
+    sp<CountingSurfaceTexture> st(new CountingSurfaceTexture(bq));
+    sp<SurfaceTextureClient> stc(new SurfaceTextureClient(
+            sp<ISurfaceTexture>(st)));
+    sp<ANativeWindow> anw(stc);
+    native_window_api_connect(anw.get(), NATIVE_WINDOW_API_CPU);
+    // synchronous mode, every frame is consumed
+    anw->setSwapInterval(anw.get(), 1);
+
+    // warm up, so that the buffers are allocated
+    pingPong(bq, listener, anw, 100);
+
+    for (int batching = 1; batching >= 0; batching--) {
+        st->setBatchingEnabled(batching);
+        const int32_t calls = st->calls();
+        const nsecs_t start = systemTime();
+        const nsecs_t perFrame = pingPong(bq, listener, anw, frames);
+        const double seconds = (systemTime() - start) / 1e9;
+        const int32_t frameCalls = st->calls() - calls;
+        printf("queue and dequeue %s: %.2f calls/frame, %.0f calls/s, "
+                "%lld ns/frame, %.0f frames/s\n",
+                batching ? "batched" : "separate",
+                double(frameCalls) / frames, frameCalls / seconds,
+                perFrame, frames / seconds);
+    }
+
+    native_window_api_disconnect(anw.get(), NATIVE_WINDOW_API_CPU);
+    bq->consumerDisconnect();
+}
+
+// latches frames from a producer that takes renderTime per frame, one
+// every period at most, keeping the last frame latched until the next one
+// replaces it. returns the average time between the queueBuffer and the
+// acquireBuffer of the frames after the first few, and sets *missed to
+// the number of latches after those that found no frame.
+static nsecs_t latchAtCadence(const sp<BufferQueue>& bq,
+        const sp<ANativeWindow>& anw, nsecs_t period, nsecs_t renderTime,
+        int frames, int* missed)
+{
+    const int warmUp = 10;
+    sp<ProducerThread> producer(new ProducerThread(anw, frames, renderTime));
+    producer->run("BufferQueue_bench::Producer");
+    nsecs_t latency = 0;
+    int current = BufferQueue::INVALID_BUFFER_SLOT;
+    int latched = 0;
+    *missed = 0;
+    nsecs_t next = systemTime();
+    while (latched < frames) {
+        const nsecs_t delay = next - systemTime();
+        if (delay > 0) {
+            usleep(ns2us(delay));
+        }
+        // a period from this latch, even if it's late, like a compositor
+        // that misses a refresh
+        next = systemTime() + period;
+        BufferQueue::BufferItem item;
+        const status_t err = bq->acquireBuffer(&item);
+        if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
+            if (latched > warmUp) {
+                (*missed)++;
+            }
+            continue;
+        }
+        if (err != NO_ERROR) {
+            fprintf(stderr, "acquireBuffer failed: %d\n", err);
+            break;
+        }
+        if (latched >= warmUp) {
+            latency += systemTime() - item.mTimestamp;
+        }
+        latched++;
+        if (current != BufferQueue::INVALID_BUFFER_SLOT) {
+            bq->releaseBuffer(current, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR);
+        }
+        current = item.mBuf;
+    }
+    if (current != BufferQueue::INVALID_BUFFER_SLOT) {
+        bq->releaseBuffer(current, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR);
+    }
+    producer->requestExitAndWait();
+    if (producer->errors()) {
+        fprintf(stderr, "the producer failed to queue a frame\n");
+    }
+    return latched > warmUp ? latency / (latched - warmUp) : 0;
+}
+
+int main(int argc, char** argv)
+{
+    const int frames = argc > 1 ? atoi(argv[1]) : 120;
+    if (frames <= 10) {
+        printf("usage: %s [frames, more than 10]\n", argv[0]);
+        return 0;
+    }
+
+    benchPingPong(10000);
+    benchQueueAndDequeue(10000);
+
+    const nsecs_t period = ms2ns(8);
+    const int buffers = 4;
+
+    sp<BufferQueue> bq(new BufferQueue(true));
+    bq->consumerConnect(new DummyConsumer());
+    bq->setBufferCountServer(buffers);
+    sp<SurfaceTextureClient> stc(new SurfaceTextureClient(
+            sp<ISurfaceTexture>(bq)));
+    sp<ANativeWindow> anw(stc);
+    native_window_api_connect(anw.get(), NATIVE_WINDOW_API_CPU);
+    // synchronous mode, every frame is consumed
+    anw->setSwapInterval(anw.get(), 1);
+
+    printf("latch every %.1f ms, %d buffers: queue-to-latch latency, "
+            "missed latches\n", period / 1e6, buffers);
+    for (int render = 0; render <= 6; render += 2) {
+        int fixedMissed, adaptiveMissed;
+        bq->setAdaptiveMode(false);
+        const nsecs_t fixed = latchAtCadence(bq, anw, period, ms2ns(render),
+                frames, &fixedMissed);
+        bq->setAdaptiveMode(true);
+        const nsecs_t adaptive = latchAtCadence(bq, anw, period,
+                ms2ns(render), frames, &adaptiveMissed);
+        String8 result;
+        bq->dump(result);
+        const char* depth = strstr(result.string(), "queue depth=");
+        printf("render %d ms: fixed %5.1f ms %d missed, adaptive %5.1f ms "
+                "%d missed (%.*s)\n", render, fixed / 1e6, fixedMissed,
+                adaptive / 1e6, adaptiveMissed,
+                depth ? int(strcspn(depth, ",")) : 0, depth ? depth : "");
+    }
+
+    native_window_api_disconnect(anw.get(), NATIVE_WINDOW_API_CPU);
+    bq->consumerDisconnect();
+    return 0;
+}
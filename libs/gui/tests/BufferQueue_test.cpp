@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BufferQueue_test"
+//#define LOG_NDEBUG 0
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <gtest/gtest.h>
+#include <gui/BufferQueue.h>
+#include <gui/SurfaceTextureClient.h>
+#include <utils/Log.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class BufferQueueTest : public ::testing::Test {
+protected:
+
+    // CountingSurfaceTexture forwards the producer's calls to a BufferQueue
+    // and counts them, each is a binder transaction when the producer is in
+    // another process. Without batching it answers queueAndDequeueBuffer
+    // like queueBuffer, so the producer makes the calls it made before that
+    // transaction existed.
+    class CountingSurfaceTexture : public BnSurfaceTexture {
+    public:
+        CountingSurfaceTexture(const sp<BufferQueue>& bq):
+                mBQ(bq),
+                mCalls(0),
+                mBatching(true) {
+        }
+
+        int32_t calls() const {
+            return android_atomic_acquire_load(&mCalls);
+        }
+
+        void setBatchingEnabled(bool enabled) {
+            mBatching = enabled;
+        }
+
+        virtual status_t requestBuffer(int slot, sp<GraphicBuffer>* buf) {
+            android_atomic_inc(&mCalls);
+            return mBQ->requestBuffer(slot, buf);
+        }
+
+        virtual status_t setBufferCount(int bufferCount) {
+            android_atomic_inc(&mCalls);
+            return mBQ->setBufferCount(bufferCount);
+        }
+
+        virtual status_t dequeueBuffer(int *slot, uint32_t w, uint32_t h,
+                uint32_t format, uint32_t usage) {
+            android_atomic_inc(&mCalls);
+            return mBQ->dequeueBuffer(slot, w, h, format, usage);
+        }
+
+        virtual status_t queueBuffer(int slot,
+                const QueueBufferInput& input, QueueBufferOutput* output) {
+            android_atomic_inc(&mCalls);
+            return mBQ->queueBuffer(slot, input, output);
+        }
+
+        virtual status_t queueAndDequeueBuffer(int slot,
+                const QueueBufferInput& input, QueueBufferOutput* output,
+                int* outSlot, uint32_t w, uint32_t h,
+                uint32_t format, uint32_t usage) {
+            android_atomic_inc(&mCalls);
+            if (!mBatching) {
+                *outSlot = BufferQueue::INVALID_BUFFER_SLOT;
+                return mBQ->queueBuffer(slot, input, output);
+            }
+            return mBQ->queueAndDequeueBuffer(slot, input, output, outSlot,
+                    w, h, format, usage);
+        }
+
+        virtual void cancelBuffer(int slot) {
+            android_atomic_inc(&mCalls);
+            mBQ->cancelBuffer(slot);
+        }
+
+        virtual int query(int what, int* value) {
+            android_atomic_inc(&mCalls);
+            return mBQ->query(what, value);
+        }
+
+        virtual status_t setSynchronousMode(bool enabled) {
+            android_atomic_inc(&mCalls);
+            return mBQ->setSynchronousMode(enabled);
+        }
+
+#ifdef QCOM_HARDWARE
+        virtual status_t setBuffersSize(int size) {
+            android_atomic_inc(&mCalls);
+            return mBQ->setBuffersSize(size);
+        }
+
+        virtual status_t updateBuffersGeometry(int w, int h, int f) {
+            android_atomic_inc(&mCalls);
+            return mBQ->updateBuffersGeometry(w, h, f);
+        }
+#endif
+
+        virtual status_t connect(int api, QueueBufferOutput* output) {
+            android_atomic_inc(&mCalls);
+            return mBQ->connect(api, output);
+        }
+
+        virtual status_t disconnect(int api) {
+            android_atomic_inc(&mCalls);
+            return mBQ->disconnect(api);
+        }
+
+#ifdef ALLWINNER
+        virtual int setParameter(uint32_t cmd, uint32_t value) {
+            android_atomic_inc(&mCalls);
+            return mBQ->setParameter(cmd, value);
+        }
+
+        virtual uint32_t getParameter(uint32_t cmd) {
+            android_atomic_inc(&mCalls);
+            return mBQ->getParameter(cmd);
+        }
+#endif
+
+    private:
+        sp<BufferQueue> mBQ;
+        volatile int32_t mCalls;
+        bool mBatching;
+    };
+
+    // FrameListener counts the frames the producer queued and not yet
+    // acquired, so the consumer can wait for them.
+    class FrameListener : public BufferQueue::ConsumerListener {
+    public:
+        FrameListener():
+                mPendingFrames(0) {
+        }
+
+        void waitForFrame() {
+            Mutex::Autolock lock(mMutex);
+            while (mPendingFrames == 0) {
+                mCondition.wait(mMutex);
+            }
+            mPendingFrames--;
+        }
+
+        virtual void onFrameAvailable() {
+            Mutex::Autolock lock(mMutex);
+            mPendingFrames++;
+            mCondition.signal();
+        }
+
+        virtual void onBuffersReleased() {
+        }
+
+    private:
+        int mPendingFrames;
+        Mutex mMutex;
+        Condition mCondition;
+    };
+
+    // ProducerThread queues frames through the ANativeWindow, like an
+    // application rendering as fast as the consumer lets it.
+    class ProducerThread : public Thread {
+    public:
+        ProducerThread(const sp<ANativeWindow>& anw, int frames):
+                mANW(anw),
+                mFrames(frames),
+                mErrors(0) {
+        }
+
+        int errors() const {
+            return mErrors;
+        }
+
+    private:
+        virtual bool threadLoop() {
+            for (int i = 0; i < mFrames; i++) {
+                ANativeWindowBuffer* buf;
+                if (mANW->dequeueBuffer(mANW.get(), &buf) != NO_ERROR ||
+                        mANW->queueBuffer(mANW.get(), buf) != NO_ERROR) {
+                    mErrors++;
+                    break;
+                }
+            }
+            return false;
+        }
+
+        sp<ANativeWindow> mANW;
+        int mFrames;
+        int mErrors;
+    };
+
+    virtual void SetUp() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+
+        mFrameNumber = 0;
+        mBQ = new BufferQueue(true);
+        mListener = new FrameListener();
+        ASSERT_EQ(NO_ERROR, mBQ->consumerConnect(mListener));
+        mST = new CountingSurfaceTexture(mBQ);
+        mSTC = new SurfaceTextureClient(sp<ISurfaceTexture>(mST));
+        mANW = mSTC;
+        ASSERT_EQ(NO_ERROR, native_window_api_connect(mANW.get(),
+                NATIVE_WINDOW_API_CPU));
+        // synchronous mode, every frame is consumed
+        ASSERT_EQ(NO_ERROR, mANW->setSwapInterval(mANW.get(), 1));
+    }
+
+    virtual void TearDown() {
+        native_window_api_disconnect(mANW.get(), NATIVE_WINDOW_API_CPU);
+        mBQ->consumerDisconnect();
+        mANW.clear();
+        mSTC.clear();
+        mST.clear();
+        mListener.clear();
+        mBQ.clear();
+
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    // pingPong passes frames from a producer thread to this thread, which
+    // acquires and releases each of them, and returns the average time per
+    // frame. It fails if a frame is lost, comes out of order or isn't
+    // stamped with the time it was queued.
+    nsecs_t pingPong(int frames) {
+        sp<ProducerThread> producer(new ProducerThread(mANW, frames));
+        const nsecs_t start = systemTime();
+        nsecs_t queueTime = start;
+        producer->run("BufferQueueTest::Producer");
+        for (int i = 0; i < frames; i++) {
+            mListener->waitForFrame();
+            BufferQueue::BufferItem item;
+            EXPECT_EQ(NO_ERROR, mBQ->acquireBuffer(&item));
+            EXPECT_EQ(mFrameNumber + 1, item.mFrameNumber);
+            mFrameNumber = item.mFrameNumber;
+            EXPECT_LE(queueTime, item.mQueueTime);
+            EXPECT_GE(systemTime(), item.mQueueTime);
+            queueTime = item.mQueueTime;
+            EXPECT_EQ(NO_ERROR, mBQ->releaseBuffer(item.mBuf, EGL_NO_DISPLAY,
+                    EGL_NO_SYNC_KHR));
+            if (HasFailure()) {
+                break;
+            }
+        }
+        const nsecs_t elapsed = systemTime() - start;
+        producer->requestExitAndWait();
+        EXPECT_EQ(0, producer->errors());
+        return elapsed / frames;
+    }
+
+    // latchFrame waits for a frame, acquires it and releases it, like a
+    // consumer that's done with each frame as soon as it latches the next.
+    void latchFrame() {
+        mListener->waitForFrame();
+        BufferQueue::BufferItem item;
+        ASSERT_EQ(NO_ERROR, mBQ->acquireBuffer(&item));
+        EXPECT_EQ(NO_ERROR, mBQ->releaseBuffer(item.mBuf, EGL_NO_DISPLAY,
+                EGL_NO_SYNC_KHR));
+    }
+
+    // dumpedValue returns the number that follows name in the dump of
+    // the BufferQueue, or -1 when it isn't there.
+    int dumpedValue(const char* name) {
+        String8 result;
+        mBQ->dump(result);
+        const char* value = strstr(result.string(), name);
+        return value ? atoi(value + strlen(name)) : -1;
+    }
+
+    sp<BufferQueue> mBQ;
+    sp<FrameListener> mListener;
+    sp<CountingSurfaceTexture> mST;
+    sp<SurfaceTextureClient> mSTC;
+    sp<ANativeWindow> mANW;
+
+    // mFrameNumber is the frame number of the last frame acquired
+    uint64_t mFrameNumber;
+};
+
+TEST_F(BufferQueueTest, PingPongDeliversEveryFrameInOrder) {
+    pingPong(1000);
+}
+
+TEST_F(BufferQueueTest, PingPongWithoutLockFreePathsDeliversEveryFrameInOrder) {
+    ASSERT_EQ(NO_ERROR, mBQ->setLockFreeEnabled(false));
+    pingPong(1000);
+}
+
+TEST_F(BufferQueueTest, QueueAndDequeueSavesCallsPerFrame) {
+    const int frames = 1000;
+
+    // warm up, so that the buffers are allocated
+    pingPong(100);
+
+    int32_t calls = mST->calls();
+    pingPong(frames);
+    const int32_t batched = mST->calls() - calls;
+
+    mST->setBatchingEnabled(false);
+    calls = mST->calls();
+    pingPong(frames);
+    const int32_t unbatched = mST->calls() - calls;
+
+    // a dequeue and a queue per frame without batching, but for the first
+    // frame which may still get the buffer dequeued along with the last
+    // batched queue. the producer dequeues right after queuing, so with
+    // batching some of the dequeues come with the queues.
+    EXPECT_LE(2 * frames - 1, unbatched);
+    EXPECT_GT(unbatched, batched);
+}
+
+TEST_F(BufferQueueTest, AdaptiveModeKeepsOneFrameQueued) {
+    const nsecs_t period = ms2ns(16);
+    ASSERT_EQ(NO_ERROR, mBQ->setAdaptiveMode(true));
+    // the producer only holds a buffer while it renders into it
+    mST->setBatchingEnabled(false);
+
+    // a producer that renders in no time, a consumer latching a frame per
+    // period: a single queued frame is enough for the consumer
+    for (int i = 0; i < 4; i++) {
+        ANativeWindowBuffer* buf;
+        ASSERT_EQ(NO_ERROR, mANW->dequeueBuffer(mANW.get(), &buf));
+        ASSERT_EQ(NO_ERROR, mANW->queueBuffer(mANW.get(), buf));
+        usleep(ns2us(period));
+        latchFrame();
+    }
+    EXPECT_EQ(1, dumpedValue("queue depth="));
+    EXPECT_EQ(0, dumpedValue("paced dequeues="));
+
+    // once it queued a frame, the producer's next dequeue waits for the
+    // consumer to latch it
+    sp<ProducerThread> producer(new ProducerThread(mANW, 2));
+    producer->run("BufferQueueTest::Producer");
+    mListener->waitForFrame();
+    for (int i = 0; i < 1000 && dumpedValue("paced dequeues=") < 1; i++) {
+        usleep(1000);
+    }
+    EXPECT_EQ(1, dumpedValue("paced dequeues="));
+
+    BufferQueue::BufferItem item;
+    ASSERT_EQ(NO_ERROR, mBQ->acquireBuffer(&item));
+    EXPECT_EQ(NO_ERROR, mBQ->releaseBuffer(item.mBuf, EGL_NO_DISPLAY,
+            EGL_NO_SYNC_KHR));
+    latchFrame();
+    producer->requestExitAndWait();
+    EXPECT_EQ(0, producer->errors());
+    EXPECT_EQ(1, dumpedValue("paced dequeues="));
+}
+
+} // namespace android
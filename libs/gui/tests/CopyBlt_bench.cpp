@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <private/gui/CopyBlt.h>
+#include <ui/Rect.h>
+#include <ui/Region.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+/*
+ * Times the copy-back SurfaceTextureClient::lock() does from the front
+ * buffer, with the vectorized implementation and with a memcpy() per row,
+ * for the dirty areas a software-rendered UI typically copies back.
+ */
+
+struct Shape {
+    const char* name;
+    int count;          // rectangles, spread over the buffer
+    int w;
+    int h;
+};
+
+static const Shape sShapes[] = {
+    { "full buffer",        1, 0,   0   },
+    { "wide 600x200",       1, 600, 200 },
+    { "list item 720x96",   1, 720, 96  },
+    { "icon 48x48",         1, 48,  48  },
+    { "cursor 2x24",        1, 2,   24  },
+    { "text line 300x20",   1, 300, 20  },
+    { "16 glyphs 12x16",    16, 12, 16  },
+};
+
+static Region shapeRegion(const Shape& shape, int w, int h)
+{
+    Region reg;
+    if (!shape.w) {
+        reg.set(Rect(w, h));
+        return reg;
+    }
+    for (int i = 0; i < shape.count; i++) {
+        const int l = (i * 37 + 5) % (w - shape.w + 1);
+        const int t = (i * 53 + 7) % (h - shape.h + 1);
+        reg.orSelf(Rect(l, t, l + shape.w, t + shape.h));
+    }
+    return reg;
+}
+
+int main(int argc, char** argv)
+{
+    // about this many bytes copied per run
+    const int megabytes = argc > 1 ? atoi(argv[1]) : 32;
+    if (megabytes <= 0) {
+        printf("usage: %s [megabytes per run]\n", argv[0]);
+        return 0;
+    }
+
+    const int w = 720;
+    const int h = 1280;
+    const struct { const char* name; int bpp; } formats[] = {
+        { "RGBA_8888", 4 },
+        { "RGB_565",   2 },
+    };
+
+    printf("copy-back of a %dx%d buffer, %s implementation vs memcpy() "
+            "per row\n", w, h, CopyBlt::get().name);
+    bool failed = false;
+    for (size_t f = 0; f < sizeof(formats)/sizeof(*formats); f++) {
+        const int bpp = formats[f].bpp;
+        const size_t size = w * h * bpp;
+        uint8_t* src = static_cast<uint8_t*>(malloc(size));
+        uint8_t* dst[2];
+        for (size_t i = 0; i < size; i++) {
+            src[i] = uint8_t(i * 7 + 1);
+        }
+
+        for (size_t i = 0; i < sizeof(sShapes)/sizeof(*sShapes); i++) {
+            const Region reg(shapeRegion(sShapes[i], w, h));
+            size_t bytes = 0;
+            Region::const_iterator head(reg.begin());
+            Region::const_iterator tail(reg.end());
+            for ( ; head != tail ; head++) {
+                bytes += head->width() * head->height() * bpp;
+            }
+            const int loops = 1 + (size_t(megabytes) << 20) / bytes;
+
+            for (int v = 0; v < 2; v++) {
+                dst[v] = static_cast<uint8_t*>(malloc(size));
+                memset(dst[v], 0xa5, size);
+            }
+
+            // best of a few runs, alternating the implementations
+            nsecs_t times[2] = { 0, 0 };
+            for (int run = 0; run < 6; run++) {
+                const int v = run & 1;
+                CopyBlt::setEnabled(v == 0);
+                const nsecs_t start = systemTime();
+                for (int l = 0; l < loops; l++) {
+                    copyBltRegion(dst[v], w, src, w, bpp, reg);
+                }
+                const nsecs_t time = (systemTime() - start) / loops;
+                if (!times[v] || time < times[v]) {
+                    times[v] = time;
+                }
+            }
+            const bool match = !memcmp(dst[0], dst[1], size);
+            failed |= !match;
+            printf("%-10s %-18s %8lld ns (%6.0f MB/s)  memcpy %8lld ns "
+                    "(%6.0f MB/s)%s\n", formats[f].name, sShapes[i].name,
+                    times[0], bytes * 1e3 / times[0],
+                    times[1], bytes * 1e3 / times[1],
+                    match ? "" : "  RESULTS DIFFER");
+            free(dst[0]);
+            free(dst[1]);
+        }
+        free(src);
+    }
+    CopyBlt::setEnabled(true);
+    return failed ? 1 : 0;
+}
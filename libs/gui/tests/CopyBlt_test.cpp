@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CopyBlt_test"
+//#define LOG_NDEBUG 0
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <android/native_window.h>
+#include <gtest/gtest.h>
+#include <gui/BufferQueue.h>
+#include <gui/DummyConsumer.h>
+#include <gui/SurfaceTextureClient.h>
+#include <private/gui/CopyBlt.h>
+#include <ui/Region.h>
+#include <utils/Log.h>
+
+namespace android {
+
+// the dirty areas a software-rendered UI typically copies back
+struct Shape {
+    const char* name;
+    int count;          // rectangles, spread over the buffer
+    int w;
+    int h;
+};
+
+static const Shape sShapes[] = {
+    { "full buffer",        1, 0,   0   },
+    { "wide 600x200",       1, 600, 200 },
+    { "list item 720x96",   1, 720, 96  },
+    { "icon 48x48",         1, 48,  48  },
+    { "cursor 2x24",        1, 2,   24  },
+    { "text line 300x20",   1, 300, 20  },
+    { "16 glyphs 12x16",    16, 12, 16  },
+};
+
+static Region shapeRegion(const Shape& shape, int w, int h)
+{
+    Region reg;
+    if (!shape.w) {
+        reg.set(Rect(w, h));
+        return reg;
+    }
+    for (int i = 0; i < shape.count; i++) {
+        const int l = (i * 37 + 5) % (w - shape.w + 1);
+        const int t = (i * 53 + 7) % (h - shape.h + 1);
+        reg.orSelf(Rect(l, t, l + shape.w, t + shape.h));
+    }
+    return reg;
+}
+
+class CopyBltTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mVector = CopyBlt::setEnabled(true);
+    }
+
+    virtual void TearDown() {
+        CopyBlt::setEnabled(true);
+    }
+
+    // copies reg between two buffers of w x h pixels of bpp bytes and
+    // checks that only the pixels in reg changed
+    void checkCopy(int w, int h, int stride, int bpp, const Region& reg) {
+        const size_t size = stride * h * bpp;
+        uint8_t* src = static_cast<uint8_t*>(malloc(size));
+        uint8_t* dst = static_cast<uint8_t*>(malloc(size));
+        uint8_t* ref = static_cast<uint8_t*>(malloc(size));
+        for (size_t i = 0; i < size; i++) {
+            src[i] = uint8_t(i * 7 + 1);
+            dst[i] = ref[i] = uint8_t(i * 13 + 2);
+        }
+        Region::const_iterator head(reg.begin());
+        Region::const_iterator tail(reg.end());
+        for ( ; head != tail ; head++) {
+            for (int y = head->top; y < head->bottom; y++) {
+                const size_t o = (y * stride + head->left) * bpp;
+                memcpy(ref + o, src + o, head->width() * bpp);
+            }
+        }
+
+        copyBltRegion(dst, stride, src, stride, bpp, reg);
+        EXPECT_EQ(0, memcmp(ref, dst, size)) << "bpp=" << bpp <<
+                " bounds=[" << reg.bounds().left << "," << reg.bounds().top <<
+                "," << reg.bounds().right << "," << reg.bounds().bottom << "]";
+
+        free(src);
+        free(dst);
+        free(ref);
+    }
+
+    bool mVector;
+};
+
+TEST_F(CopyBltTest, CopiesOnlyTheRegion) {
+    const int bpps[] = { 4, 2, 3, 1 };
+    for (size_t b = 0; b < sizeof(bpps)/sizeof(*bpps); b++) {
+        // every row width around the vector and memcpy() thresholds
+        for (int w = 1; w <= 160; w++) {
+            checkCopy(200, 8, 208, bpps[b], Region(Rect(3, 2, 3 + w, 7)));
+        }
+        for (size_t i = 0; i < sizeof(sShapes)/sizeof(*sShapes); i++) {
+            checkCopy(720, 300, 736, bpps[b],
+                    shapeRegion(sShapes[i], 720, 300));
+        }
+        // whole rows, copied as a single block
+        checkCopy(64, 32, 64, bpps[b], Region(Rect(0, 4, 64, 20)));
+    }
+}
+
+TEST_F(CopyBltTest, ScalarCopiesOnlyTheRegion) {
+    CopyBlt::setEnabled(false);
+    for (size_t i = 0; i < sizeof(sShapes)/sizeof(*sShapes); i++) {
+        checkCopy(720, 300, 736, 4, shapeRegion(sShapes[i], 720, 300));
+        checkCopy(720, 300, 736, 2, shapeRegion(sShapes[i], 720, 300));
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+class CopyBackTest : public ::testing::Test {
+protected:
+    enum { W = 64, H = 48 };
+
+    virtual void SetUp() {
+        mBQ = new BufferQueue(true);
+        ASSERT_EQ(NO_ERROR, mBQ->consumerConnect(new DummyConsumer()));
+        mSTC = new SurfaceTextureClient(sp<ISurfaceTexture>(mBQ));
+        mANW = mSTC;
+        ASSERT_EQ(NO_ERROR, native_window_api_connect(mANW.get(),
+                NATIVE_WINDOW_API_CPU));
+        ASSERT_EQ(NO_ERROR, mANW->setSwapInterval(mANW.get(), 1));
+        ASSERT_EQ(NO_ERROR, native_window_set_buffers_dimensions(mANW.get(),
+                W, H));
+        memset(mModel, 0, sizeof(mModel));
+    }
+
+    virtual void TearDown() {
+        native_window_api_disconnect(mANW.get(), NATIVE_WINDOW_API_CPU);
+        mBQ->consumerDisconnect();
+        mANW.clear();
+        mSTC.clear();
+        for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+            mBuffers[i].clear();
+        }
+        mBQ.clear();
+    }
+
+    static uint32_t pixel(const uint8_t* p, int bpp) {
+        return bpp == 4 ? *reinterpret_cast<const uint32_t*>(p) :
+                *reinterpret_cast<const uint16_t*>(p);
+    }
+
+    // draws value in dirty, or in the whole buffer if dirty is empty, the
+    // way a UI would: only in the area lock() says must be redrawn
+    void draw(const Rect& dirty, uint16_t value, int bpp) {
+        ANativeWindow_Buffer buffer;
+        ARect bounds = { dirty.left, dirty.top, dirty.right, dirty.bottom };
+        ASSERT_EQ(NO_ERROR, mANW->perform(mANW.get(), NATIVE_WINDOW_LOCK,
+                &buffer, dirty.isEmpty() ? NULL : &bounds));
+        const Rect redraw(dirty.isEmpty() ? Rect(W, H) :
+                Rect(bounds.left, bounds.top, bounds.right, bounds.bottom));
+        uint8_t* bits = static_cast<uint8_t*>(buffer.bits);
+        for (int y = redraw.top; y < redraw.bottom; y++) {
+            for (int x = redraw.left; x < redraw.right; x++) {
+                uint8_t* p = bits + (y * buffer.stride + x) * bpp;
+                if (bpp == 4) {
+                    *reinterpret_cast<uint32_t*>(p) = value;
+                } else {
+                    *reinterpret_cast<uint16_t*>(p) = value;
+                }
+                mModel[y][x] = value;
+            }
+        }
+        ASSERT_EQ(NO_ERROR, mANW->perform(mANW.get(),
+                NATIVE_WINDOW_UNLOCK_AND_POST));
+    }
+
+    // acquires the frame just posted and checks that it shows everything
+    // drawn so far
+    void checkFrame(int bpp) {
+        BufferQueue::BufferItem item;
+        ASSERT_EQ(NO_ERROR, mBQ->acquireBuffer(&item));
+        if (item.mGraphicBuffer != 0) {
+            mBuffers[item.mBuf] = item.mGraphicBuffer;
+        }
+        const sp<GraphicBuffer>& buffer(mBuffers[item.mBuf]);
+        ASSERT_TRUE(buffer != 0);
+        uint8_t* bits;
+        ASSERT_EQ(NO_ERROR, buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN,
+                reinterpret_cast<void**>(&bits)));
+        int errors = 0;
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                if (pixel(bits + (y * buffer->stride + x) * bpp, bpp) !=
+                        mModel[y][x]) {
+                    errors++;
+                }
+            }
+        }
+        buffer->unlock();
+        EXPECT_EQ(0, errors);
+        ASSERT_EQ(NO_ERROR, mBQ->releaseBuffer(item.mBuf, EGL_NO_DISPLAY,
+                EGL_NO_SYNC_KHR));
+    }
+
+    void drawFrames(int format, int bpp) {
+        ASSERT_EQ(NO_ERROR, native_window_set_buffers_format(mANW.get(),
+                format));
+        draw(Rect(), 1, bpp);
+        checkFrame(bpp);
+        for (int i = 2; i < 200 && !HasFailure(); i++) {
+            // mostly small areas, sometimes the same one, sometimes all
+            Rect dirty;
+            switch (i % 7) {
+                case 0:  dirty = Rect(W, H); break;
+                case 1:
+                case 2:  dirty = Rect(10, 10, 12, 30); break;
+                default: {
+                    const int l = (i * 17) % (W - 8);
+                    const int t = (i * 11) % (H - 8);
+                    dirty = Rect(l, t, l + 1 + i % 8, t + 1 + (i / 3) % 8);
+                } break;
+            }
+            draw(dirty, i, bpp);
+            checkFrame(bpp);
+        }
+    }
+
+    sp<BufferQueue> mBQ;
+    sp<SurfaceTextureClient> mSTC;
+    sp<ANativeWindow> mANW;
+    sp<GraphicBuffer> mBuffers[BufferQueue::NUM_BUFFER_SLOTS];
+    uint16_t mModel[H][W];
+};
+
+TEST_F(CopyBackTest, LockCopiesBackWhatOtherBuffersShowRGBA8888) {
+    drawFrames(HAL_PIXEL_FORMAT_RGBA_8888, 4);
+}
+
+TEST_F(CopyBackTest, LockCopiesBackWhatOtherBuffersShowRGB565) {
+    drawFrames(HAL_PIXEL_FORMAT_RGB_565, 2);
+}
+
+TEST_F(CopyBackTest, LockCopiesBackWhatOtherBuffersShowWithScalarCopy) {
+    CopyBlt::setEnabled(false);
+    drawFrames(HAL_PIXEL_FORMAT_RGBA_8888, 4);
+    CopyBlt::setEnabled(true);
+}
+
+} // namespace android
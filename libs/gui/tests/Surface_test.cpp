@@ -20,6 +20,7 @@
 #include <gui/ISurfaceComposer.h>
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
+#include <ui/GraphicBuffer.h>
 #include <utils/String8.h>
 
 #include <private/gui/ComposerService.h>
@@ -121,6 +122,97 @@ TEST_F(SurfaceTest, ScreenshotsOfProtectedBuffersSucceed) {
     ASSERT_TRUE(heap != NULL);
 }
 
+TEST_F(SurfaceTest, ScreenshotToBufferMatchesScreenshotToHeap) {
+    sp<ISurfaceComposer> sf(ComposerService::getComposerService());
+
+    sp<IMemoryHeap> heap;
+    uint32_t w=0, h=0;
+    PixelFormat fmt=0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreen(0, &heap, &w, &h, &fmt, 64, 64, 0,
+            0x7fffffff));
+    ASSERT_TRUE(heap != NULL);
+    ASSERT_EQ(PIXEL_FORMAT_RGBA_8888, fmt);
+
+    sp<GraphicBuffer> buffer(new GraphicBuffer(w, h, PIXEL_FORMAT_RGBA_8888,
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_SW_READ_OFTEN));
+    ASSERT_EQ(NO_ERROR, buffer->initCheck());
+    int32_t fence = 0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreenToBuffer(0, buffer, &fence, 0,
+            0x7fffffff));
+    ASSERT_EQ(NO_ERROR, sf->waitForScreenCapture(fence));
+    EXPECT_EQ(BAD_VALUE, sf->waitForScreenCapture(fence));
+
+    uint8_t* img;
+    ASSERT_EQ(NO_ERROR, buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN,
+            (void**)(&img)));
+    const uint8_t* ref = static_cast<const uint8_t*>(heap->getBase());
+    for (uint32_t y = 0; y < h; y++) {
+        EXPECT_EQ(0, memcmp(ref + y*w*4, img + y*buffer->getStride()*4, w*4))
+                << "row " << y << " differs";
+    }
+    buffer->unlock();
+}
+
+TEST_F(SurfaceTest, AsyncScreenshotMatchesScreenshot) {
+    sp<ISurfaceComposer> sf(ComposerService::getComposerService());
+
+    sp<IMemoryHeap> heap;
+    uint32_t w=0, h=0;
+    PixelFormat fmt=0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreen(0, &heap, &w, &h, &fmt, 64, 64, 0,
+            0x7fffffff));
+    ASSERT_TRUE(heap != NULL);
+
+    int32_t token = 0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreenAsync(0, &token, 64, 64, 0,
+            0x7fffffff));
+
+    sp<IMemoryHeap> asyncHeap;
+    uint32_t aw=0, ah=0;
+    PixelFormat afmt=0;
+    ASSERT_EQ(NO_ERROR, sf->collectScreenCapture(token, &asyncHeap,
+            &aw, &ah, &afmt));
+    ASSERT_TRUE(asyncHeap != NULL);
+    ASSERT_EQ(w, aw);
+    ASSERT_EQ(h, ah);
+    ASSERT_EQ(fmt, afmt);
+    EXPECT_EQ(0, memcmp(heap->getBase(), asyncHeap->getBase(), w*h*4));
+}
+
+TEST_F(SurfaceTest, AsyncScreenshotTokensExpire) {
+    sp<ISurfaceComposer> sf(ComposerService::getComposerService());
+
+    int32_t first = 0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreenAsync(0, &first, 64, 64, 0,
+            0x7fffffff));
+    int32_t last = first;
+    for (int i = 0; i < ISurfaceComposer::eNumCaptureBuffers; i++) {
+        ASSERT_EQ(NO_ERROR, sf->captureScreenAsync(0, &last, 64, 64, 0,
+                0x7fffffff));
+    }
+
+    sp<IMemoryHeap> heap;
+    uint32_t w=0, h=0;
+    PixelFormat fmt=0;
+    EXPECT_EQ(BAD_VALUE, sf->collectScreenCapture(first, &heap, &w, &h, &fmt));
+    EXPECT_EQ(NO_ERROR, sf->collectScreenCapture(last, &heap, &w, &h, &fmt));
+}
+
+TEST_F(SurfaceTest, AsyncScreenshotCanOnlyBeCollectedOnce) {
+    sp<ISurfaceComposer> sf(ComposerService::getComposerService());
+
+    int32_t token = 0;
+    ASSERT_EQ(NO_ERROR, sf->captureScreenAsync(0, &token, 64, 64, 0,
+            0x7fffffff));
+    EXPECT_GT(token, 0);
+
+    sp<IMemoryHeap> heap;
+    uint32_t w=0, h=0;
+    PixelFormat fmt=0;
+    EXPECT_EQ(NO_ERROR, sf->collectScreenCapture(token, &heap, &w, &h, &fmt));
+    EXPECT_EQ(BAD_VALUE, sf->collectScreenCapture(token, &heap, &w, &h, &fmt));
+}
+
 TEST_F(SurfaceTest, ConcreteTypeIsSurface) {
     sp<ANativeWindow> anw(mSurface);
     int result = -123;
@@ -23,13 +23,20 @@ LOCAL_SRC_FILES:= \
 	GraphicBufferMapper.cpp \
 	PixelFormat.cpp \
 	Rect.cpp \
-	Region.cpp
+	Region.cpp \
+	RegionSimd.cpp
 
 LOCAL_SHARED_LIBRARIES := \
 	libcutils \
 	libutils \
 	libhardware
 
+ifeq ($(TARGET_ARCH),arm)
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+	LOCAL_CFLAGS += -D__ARM_HAVE_NEON
+endif
+endif
+
 ifeq ($(TARGET_BOARD_PLATFORM),exDroid)
 	LOCAL_CFLAGS += -DALLWINNER
 
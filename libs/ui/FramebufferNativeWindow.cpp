@@ -71,8 +71,24 @@ private:
  * 
  */
 
+struct FramebufferNativeWindow::DamageState {
+    DamageState() : hasFrameDamage(false), backBufferDequeued(false) {
+        for (int i = 0; i < MAX_NUM_FRAME_BUFFERS; i++) {
+            bufferDamageValid[i] = false;
+        }
+    }
+
+    // damage accumulated by each buffer since it was last posted
+    Region bufferDamage[MAX_NUM_FRAME_BUFFERS];
+    bool bufferDamageValid[MAX_NUM_FRAME_BUFFERS];
+    Region frameDamage;
+    bool hasFrameDamage;
+    bool backBufferDequeued;
+};
+
 FramebufferNativeWindow::FramebufferNativeWindow() 
-    : BASE(), fbDev(0), grDev(0), mUpdateOnDemand(false)
+    : BASE(), fbDev(0), grDev(0), mUpdateOnDemand(false),
+      mDamage(new DamageState())
 {
     hw_module_t const* module;
 
@@ -177,6 +193,8 @@ FramebufferNativeWindow::~FramebufferNativeWindow()
     if (fbDev) {
         framebuffer_close(fbDev);
     }
+
+    delete mDamage;
 }
 
 status_t FramebufferNativeWindow::setUpdateRectangle(const Rect& r) 
@@ -195,6 +213,27 @@ status_t FramebufferNativeWindow::compositionComplete()
     return INVALID_OPERATION;
 }
 
+void FramebufferNativeWindow::setFrameDamage(const Region& damage)
+{
+    Mutex::Autolock _l(mutex);
+    mDamage->frameDamage = damage;
+    mDamage->hasFrameDamage = true;
+}
+
+bool FramebufferNativeWindow::getBackBufferDamage(Region* outDamage) const
+{
+    Mutex::Autolock _l(mutex);
+    // the buffers are dequeued in order, so if the EGL hasn't dequeued
+    // the back buffer yet, we know which one it'll be.
+    const int index = mDamage->backBufferDequeued ?
+            mCurrentBufferIndex : mBufferHead;
+    if (!mDamage->bufferDamageValid[index]) {
+        return false;
+    }
+    *outDamage = mDamage->bufferDamage[index];
+    return true;
+}
+
 int FramebufferNativeWindow::setSwapInterval(
         ANativeWindow* window, int interval) 
 {
@@ -238,6 +277,7 @@ int FramebufferNativeWindow::dequeueBuffer(ANativeWindow* window,
     // get this buffer
     self->mNumFreeBuffers--;
     self->mCurrentBufferIndex = index;
+    self->mDamage->backBufferDequeued = true;
 
     *buffer = self->buffers[index].get();
 
@@ -279,6 +319,23 @@ int FramebufferNativeWindow::queueBuffer(ANativeWindow* window,
     self->mNumFreeBuffers++;
     self->mCondition.broadcast();
 
+    // the other buffers are now missing this frame's damage. if we don't
+    // know what it was, none of the buffers can be trusted anymore.
+    DamageState* damage = self->mDamage;
+    for (int i = 0; i < self->mNumBuffers; i++) {
+        if (i == index) {
+            damage->bufferDamage[i].clear();
+            damage->bufferDamageValid[i] = damage->hasFrameDamage;
+        } else if (damage->hasFrameDamage && damage->bufferDamageValid[i]) {
+            damage->bufferDamage[i].orSelf(damage->frameDamage);
+        } else {
+            damage->bufferDamageValid[i] = false;
+        }
+    }
+    damage->frameDamage.clear();
+    damage->hasFrameDamage = false;
+    damage->backBufferDequeued = false;
+
 #ifdef SAMSUNG_HDMI_SUPPORT
 #if defined(SAMSUNG_EXYNOS4210) || defined(SAMSUNG_EXYNOS4x12) || defined(SAMSUNG_S5P)
     if (self->mHdmiClient != NULL)
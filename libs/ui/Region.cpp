@@ -17,15 +17,22 @@
 #define LOG_TAG "Region"
 
 #include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/atomic.h>
 
 #include <utils/Log.h>
+#include <utils/SharedBuffer.h>
 #include <utils/String8.h>
 
 #include <ui/Rect.h>
 #include <ui/Region.h>
 #include <ui/Point.h>
 
+#include <private/ui/RegionDebug.h>
 #include <private/ui/RegionHelper.h>
+#include <private/ui/RegionSimd.h>
 
 // ----------------------------------------------------------------------------
 #define VALIDATE_REGIONS        (false)
@@ -48,6 +55,100 @@ enum {
 
 // ----------------------------------------------------------------------------
 
+static volatile int32_t sHeapAllocations = 0;
+static bool sReuseStorage = true;
+
+uint32_t RegionDebug::getHeapAllocationCount()
+{
+    return uint32_t(android_atomic_acquire_load(&sHeapAllocations));
+}
+
+void RegionDebug::setStorageReuseEnabled(bool enabled)
+{
+    sReuseStorage = enabled;
+}
+
+// returns a writable pointer to the rectangles, counting the allocation
+// if the storage was shared or had to grow.
+static Rect* editStorage(Vector<Rect>& storage, Rect const* previous)
+{
+    Rect* const rects = storage.editArray();
+    if (rects != previous) {
+        android_atomic_inc(&sHeapAllocations);
+    }
+    return rects;
+}
+
+/*
+ * A growable array of rectangles that starts out on the stack, so that the
+ * lists a region operation builds only need the heap when they get long.
+ */
+template <size_t N>
+class RectBuffer
+{
+public:
+    RectBuffer()
+        : mRects(sReuseStorage ? mLocal : 0), mCount(0),
+          mCapacity(sReuseStorage ? N : 0) {
+    }
+    ~RectBuffer() {
+        if (mRects != mLocal) {
+            free(mRects);
+        }
+    }
+
+    inline size_t size() const { return mCount; }
+    inline Rect* editArray() { return mRects; }
+    inline const Rect& operator[](size_t index) const { return mRects[index]; }
+    inline const Rect& top() const { return mRects[mCount - 1]; }
+    inline void clear() { mCount = 0; }
+
+    inline void add(const Rect& rect) {
+        if (mCount == mCapacity) {
+            grow(mCount + 1);
+        }
+        mRects[mCount++] = rect;
+    }
+
+    inline void appendArray(Rect const* rects, size_t count) {
+        if (mCount + count > mCapacity) {
+            grow(mCount + count);
+        }
+        memcpy(mRects + mCount, rects, count*sizeof(Rect));
+        mCount += count;
+    }
+
+private:
+    RectBuffer(const RectBuffer&);
+    RectBuffer& operator = (const RectBuffer&);
+
+    void grow(size_t size) {
+        size_t capacity = mCapacity ? mCapacity*2 : 4;
+        if (capacity < size) {
+            capacity = size;
+        }
+        Rect* rects = static_cast<Rect*>(malloc(capacity * sizeof(Rect)));
+        LOG_ALWAYS_FATAL_IF(!rects, "can't allocate %u rectangles",
+                uint32_t(capacity));
+        if (mCount) {
+            memcpy(rects, mRects, mCount*sizeof(Rect));
+        }
+        if (mRects != mLocal) {
+            free(mRects);
+        }
+        mRects = rects;
+        mCapacity = capacity;
+        android_atomic_inc(&sHeapAllocations);
+    }
+
+    Rect    mLocal[N];
+    Rect*   mRects;
+    size_t  mCount;
+    size_t  mCapacity;
+};
+
+// ----------------------------------------------------------------------------
+
 Region::Region()
     : mBounds(0,0)
 {
@@ -82,33 +183,71 @@ Region& Region::operator = (const Region& rhs)
     validate(*this, "this->operator=");
     validate(rhs, "rhs.operator=");
 #endif
-    mBounds = rhs.mBounds;
-    mStorage = rhs.mStorage;
+    if (this != &rhs) {
+        mBounds = rhs.mBounds;
+        mStorage = rhs.mStorage;
+    }
     return *this;
 }
 
 Region& Region::makeBoundsSelf()
 {
-    mStorage.clear();
+    releaseStorage();
     return *this;
 }
 
 void Region::clear()
 {
     mBounds.clear();
-    mStorage.clear();
+    releaseStorage();
 }
 
 void Region::set(const Rect& r)
 {
     mBounds = r;
-    mStorage.clear();
+    releaseStorage();
 }
 
 void Region::set(uint32_t w, uint32_t h)
 {
     mBounds = Rect(int(w), int(h));
-    mStorage.clear();
+    releaseStorage();
+}
+
+void Region::setRects(const Rect& bounds, Rect const* rects, size_t count)
+{
+    mBounds = bounds;
+    if (count <= 1) {
+        // the region is its bounds
+        releaseStorage();
+    } else {
+        // reuse the current storage if we can
+        Rect const* const previous = mStorage.array();
+        const size_t size = mStorage.size();
+        if (size < count) {
+            mStorage.insertAt(size, count - size);
+        } else if (size > count) {
+            mStorage.removeItemsAt(count, size - count);
+        }
+        memcpy(editStorage(mStorage, previous), rects, count*sizeof(Rect));
+    }
+}
+
+void Region::releaseStorage()
+{
+    if (mStorage.isEmpty()) {
+        return;
+    }
+    if (sReuseStorage &&
+            SharedBuffer::sharedBuffer(mStorage.array())->onlyOwner()) {
+        // keep a small buffer, most regions that stop being a rectangle
+        // have only a few rectangles the next time and fit in it.
+        // it's shrunk in place, isRect() only looks at the size.
+        mStorage.clear();
+    } else {
+        // clearing a shared buffer would allocate a new one
+        mStorage = Vector<Rect>();
+    }
 }
 
 // ----------------------------------------------------------------------------
@@ -136,8 +275,8 @@ Region& Region::subtractSelf(const Rect& r) {
     return operationSelf(r, op_nand);
 }
 Region& Region::operationSelf(const Rect& r, int op) {
-    Region lhs(*this);
-    boolean_operation(op, *this, lhs, r);
+    // the result is only written back once the operation is complete
+    boolean_operation(op, *this, *this, r);
     return *this;
 }
 
@@ -156,8 +295,7 @@ Region& Region::subtractSelf(const Region& rhs) {
     return operationSelf(rhs, op_nand);
 }
 Region& Region::operationSelf(const Region& rhs, int op) {
-    Region lhs(*this);
-    boolean_operation(op, *this, lhs, rhs);
+    boolean_operation(op, *this, *this, rhs);
     return *this;
 }
 
@@ -206,6 +344,19 @@ const Region Region::operation(const Region& rhs, int op) const {
     return result;
 }
 
+Region& Region::setMerge(const Region& lhs, const Region& rhs) {
+    boolean_operation(op_or, *this, lhs, rhs);
+    return *this;
+}
+Region& Region::setIntersect(const Region& lhs, const Region& rhs) {
+    boolean_operation(op_and, *this, lhs, rhs);
+    return *this;
+}
+Region& Region::setSubtract(const Region& lhs, const Region& rhs) {
+    boolean_operation(op_nand, *this, lhs, rhs);
+    return *this;
+}
+
 const Region Region::translate(int x, int y) const {
     Region result;
     translate(result, *this, x, y);
@@ -227,8 +378,7 @@ Region& Region::subtractSelf(const Region& rhs, int dx, int dy) {
     return operationSelf(rhs, dx, dy, op_nand);
 }
 Region& Region::operationSelf(const Region& rhs, int dx, int dy, int op) {
-    Region lhs(*this);
-    boolean_operation(op, *this, lhs, rhs, dx, dy);
+    boolean_operation(op, *this, *this, rhs, dx, dy);
     return *this;
 }
 
@@ -255,22 +405,24 @@ const Region Region::operation(const Region& rhs, int dx, int dy, int op) const
 // ----------------------------------------------------------------------------
 
 // This is our region rasterizer, which merges rects and spans together
-// to obtain an optimal region.
+// to obtain an optimal region. It works in scratch storage and only
+// writes the result to the destination region when it's destroyed, so
+// the destination may also be one of the operands.
 class Region::rasterizer : public region_operator<Rect>::region_rasterizer 
 {
-    Rect& bounds;
-    Vector<Rect>& storage;
+    Region& dst;
+    Rect bounds;
+    RectBuffer<32> storage;
     Rect* head;
     Rect* tail;
-    Vector<Rect> span;
+    RectBuffer<8> span;
     Rect* cur;
 public:
     rasterizer(Region& reg) 
-        : bounds(reg.mBounds), storage(reg.mStorage), head(), tail(), cur() {
+        : dst(reg), head(), tail(), cur() {
         bounds.top = bounds.bottom = 0;
         bounds.left   = INT_MAX;
         bounds.right  = INT_MIN;
-        storage.clear();
     }
 
     ~rasterizer() {
@@ -278,15 +430,13 @@ public:
             flushSpan();
         }
         if (storage.size()) {
-            bounds.top = storage.itemAt(0).top;
+            bounds.top = storage[0].top;
             bounds.bottom = storage.top().bottom;
-            if (storage.size() == 1) {
-                storage.clear();
-            }
         } else {
             bounds.left  = 0;
             bounds.right = 0;
         }
+        dst.setRects(bounds, storage.editArray(), storage.size());
     }
     
     virtual void operator()(const Rect& rect) {
@@ -314,27 +464,15 @@ private:
             Rect const* p = span.editArray();
             Rect const* q = head;
             if (p->top == q->bottom) {
-                merge = true;
-                while (q != tail) {
-                    if ((p->left != q->left) || (p->right != q->right)) {
-                        merge = false;
-                        break;
-                    }
-                    p++, q++;
-                }
+                merge = region_bands_match(p, q, span.size());
             }
         }
         if (merge) {
-            const int bottom = span[0].bottom;
-            Rect* r = head;
-            while (r != tail) {
-                r->bottom = bottom;
-                r++;
-            }
+            region_set_bottom(head, span.size(), span[0].bottom);
         } else {
-            bounds.left = min(span.itemAt(0).left, bounds.left);
+            bounds.left = min(span[0].left, bounds.left);
             bounds.right = max(span.top().right, bounds.right);
-            storage.appendVector(span);
+            storage.appendArray(span.editArray(), span.size());
             tail = storage.editArray() + storage.size();
             head = tail - span.size();
         }
@@ -540,12 +678,9 @@ void Region::translate(Region& reg, int dx, int dy)
         validate(reg, "translate (before)");
 #endif
         reg.mBounds.translate(dx, dy);
-        size_t count = reg.mStorage.size();
-        Rect* rects = reg.mStorage.editArray();
-        while (count) {
-            rects->translate(dx, dy);
-            rects++;
-            count--;
+        if (!reg.mStorage.isEmpty()) {
+            Rect* const rects = editStorage(reg.mStorage, reg.mStorage.array());
+            region_translate(rects, reg.mStorage.size(), dx, dy);
         }
 #if VALIDATE_REGIONS
         validate(reg, "translate (after)");
@@ -566,7 +701,8 @@ ssize_t Region::write(void* buffer, size_t size) const
 #if VALIDATE_REGIONS
     validate(*this, "write(buffer)");
 #endif
-    const size_t count = mStorage.size();
+    size_t count = 0;
+    Rect const* const rects = isRect() ? 0 : getArray(&count);
     const size_t sizeNeeded = sizeof(int32_t) + (1+count)*sizeof(Rect);
     if (buffer != NULL) {
         if (sizeNeeded > size) return NO_MEMORY;
@@ -574,7 +710,7 @@ ssize_t Region::write(void* buffer, size_t size) const
         *p = count;
         memcpy(p+1, &mBounds, sizeof(Rect));
         if (count) {
-            memcpy(p+5, mStorage.array(), count*sizeof(Rect));
+            memcpy(p+5, rects, count*sizeof(Rect));
         }
     }
     return ssize_t(sizeNeeded);
@@ -584,12 +720,9 @@ ssize_t Region::read(const void* buffer)
 {
     int32_t const* const p = static_cast<int32_t const*>(buffer); 
     const size_t count = *p;
-    memcpy(&mBounds, p+1, sizeof(Rect));
-    mStorage.clear();
-    if (count) {
-        mStorage.insertAt(0, count);
-        memcpy(mStorage.editArray(), p+5, count*sizeof(Rect));
-    }
+    Rect bounds;
+    memcpy(&bounds, p+1, sizeof(Rect));
+    setRects(bounds, reinterpret_cast<Rect const*>(p+5), count);
 #if VALIDATE_REGIONS
     validate(*this, "read(buffer)");
 #endif
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RegionSimd"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+
+#include <private/ui/RegionSimd.h>
+
+#if defined(__ARM_HAVE_NEON) && defined(__ARM_NEON__)
+#define REGION_SIMD_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define REGION_SIMD_SSE2 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#endif
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// index of the first rectangle from n on whose top isn't the given one
+static inline size_t band_end(Rect const* rects, size_t n, size_t count,
+        int32_t top)
+{
+    while (n < count && rects[n].top == top) {
+        n++;
+    }
+    return n;
+}
+
+static size_t scalar_band_length(Rect const* rects, size_t count)
+{
+    return band_end(rects, 1, count, rects->top);
+}
+
+static bool scalar_bands_match(Rect const* lhs, Rect const* rhs, size_t count)
+{
+    while (count) {
+        if ((lhs->left != rhs->left) || (lhs->right != rhs->right)) {
+            return false;
+        }
+        lhs++, rhs++, count--;
+    }
+    return true;
+}
+
+static void scalar_set_bottom(Rect* rects, size_t count, int32_t bottom)
+{
+    while (count) {
+        rects->bottom = bottom;
+        rects++, count--;
+    }
+}
+
+static void scalar_translate(Rect* rects, size_t count, int32_t dx, int32_t dy)
+{
+    while (count) {
+        rects->left   += dx;
+        rects->top    += dy;
+        rects->right  += dx;
+        rects->bottom += dy;
+        rects++, count--;
+    }
+}
+
+static const RegionSimd sScalar = {
+    "scalar",
+    scalar_band_length,
+    scalar_bands_match,
+    scalar_set_bottom,
+    scalar_translate
+};
+
+// ----------------------------------------------------------------------------
+#if REGION_SIMD_NEON
+
+/*
+ * vld4q/vst4q de-interleave 4 rectangles so that each register holds one
+ * of the fields (left, top, right, bottom) of all 4 of them.
+ */
+
+static inline bool all_set(uint32x4_t v)
+{
+    uint32x2_t m = vand_u32(vget_low_u32(v), vget_high_u32(v));
+    m = vpmin_u32(m, m);
+    return vget_lane_u32(m, 0) == 0xFFFFFFFF;
+}
+
+static size_t neon_band_length(Rect const* rects, size_t count)
+{
+    const int32_t* p = &rects->left;
+    const int32x4_t top = vdupq_n_s32(rects->top);
+    size_t n = 0;
+    while (n + 4 <= count) {
+        int32x4x4_t r = vld4q_s32(p + n*4);
+        if (!all_set(vceqq_s32(r.val[1], top)))
+            break;
+        n += 4;
+    }
+    // the band ends within the next 4 rectangles
+    return band_end(rects, n, count, rects->top);
+}
+
+static bool neon_bands_match(Rect const* lhs, Rect const* rhs, size_t count)
+{
+    const int32_t* a = &lhs->left;
+    const int32_t* b = &rhs->left;
+    size_t n = 0;
+    while (n + 4 <= count) {
+        int32x4x4_t ra = vld4q_s32(a + n*4);
+        int32x4x4_t rb = vld4q_s32(b + n*4);
+        uint32x4_t eq = vandq_u32(
+                vceqq_s32(ra.val[0], rb.val[0]),
+                vceqq_s32(ra.val[2], rb.val[2]));
+        if (!all_set(eq))
+            return false;
+        n += 4;
+    }
+    return scalar_bands_match(lhs + n, rhs + n, count - n);
+}
+
+static void neon_set_bottom(Rect* rects, size_t count, int32_t bottom)
+{
+    int32_t* p = &rects->left;
+    const int32x4_t b = vdupq_n_s32(bottom);
+    size_t n = 0;
+    while (n + 4 <= count) {
+        int32x4x4_t r = vld4q_s32(p + n*4);
+        r.val[3] = b;
+        vst4q_s32(p + n*4, r);
+        n += 4;
+    }
+    scalar_set_bottom(rects + n, count - n, bottom);
+}
+
+static void neon_translate(Rect* rects, size_t count, int32_t dx, int32_t dy)
+{
+    // a rectangle is exactly one q register: (dx, dy, dx, dy)
+    int32_t* p = &rects->left;
+    const int32x2_t d = vset_lane_s32(dy, vdup_n_s32(dx), 1);
+    const int32x4_t offset = vcombine_s32(d, d);
+    size_t n = 0;
+    while (n + 2 <= count) {
+        int32x4_t r0 = vld1q_s32(p + n*4);
+        int32x4_t r1 = vld1q_s32(p + n*4 + 4);
+        vst1q_s32(p + n*4,     vaddq_s32(r0, offset));
+        vst1q_s32(p + n*4 + 4, vaddq_s32(r1, offset));
+        n += 2;
+    }
+    scalar_translate(rects + n, count - n, dx, dy);
+}
+
+static const RegionSimd sVector = {
+    "neon",
+    neon_band_length,
+    neon_bands_match,
+    neon_set_bottom,
+    neon_translate
+};
+
+static bool cpuHasVector()
+{
+    // the kernel lists "neon" in the Features line of /proc/cpuinfo
+    char buffer[4096];
+    int fd = open("/proc/cpuinfo", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (size <= 0) {
+        return false;
+    }
+    buffer[size] = 0;
+    const char* features = strstr(buffer, "Features");
+    if (!features) {
+        return false;
+    }
+    const char* eol = strchr(features, '\n');
+    const char* neon = strstr(features, " neon");
+    return neon && (!eol || neon < eol);
+}
+
+// ----------------------------------------------------------------------------
+#elif REGION_SIMD_SSE2
+
+/*
+ * A rectangle is exactly one xmm register. The helpers below gather one of
+ * the fields of 4 rectangles into a single register.
+ */
+
+static inline __m128i load(Rect const* r)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(r));
+}
+
+static inline __m128i tops(Rect const* r)
+{
+    // (l0, l1, t0, t1) and (l2, l3, t2, t3)
+    __m128i a = _mm_unpacklo_epi32(load(r),     load(r + 1));
+    __m128i b = _mm_unpacklo_epi32(load(r + 2), load(r + 3));
+    return _mm_unpackhi_epi64(a, b);
+}
+
+static size_t sse2_band_length(Rect const* rects, size_t count)
+{
+    const __m128i top = _mm_set1_epi32(rects->top);
+    size_t n = 0;
+    while (n + 4 <= count) {
+        __m128i eq = _mm_cmpeq_epi32(tops(rects + n), top);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask != 0xF) {
+            // index of the first rectangle with a different top
+            return n + __builtin_ctz(~mask);
+        }
+        n += 4;
+    }
+    return band_end(rects, n, count, rects->top);
+}
+
+static bool sse2_bands_match(Rect const* lhs, Rect const* rhs, size_t count)
+{
+    // only compare the left and right lanes
+    const __m128i mask = _mm_set_epi32(0, -1, 0, -1);
+    size_t n = 0;
+    while (n + 4 <= count) {
+        __m128i d =        _mm_xor_si128(load(lhs + n),     load(rhs + n));
+        d = _mm_or_si128(d, _mm_xor_si128(load(lhs + n + 1), load(rhs + n + 1)));
+        d = _mm_or_si128(d, _mm_xor_si128(load(lhs + n + 2), load(rhs + n + 2)));
+        d = _mm_or_si128(d, _mm_xor_si128(load(lhs + n + 3), load(rhs + n + 3)));
+        d = _mm_and_si128(d, mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(d, _mm_setzero_si128())) != 0xFFFF)
+            return false;
+        n += 4;
+    }
+    return scalar_bands_match(lhs + n, rhs + n, count - n);
+}
+
+static void sse2_set_bottom(Rect* rects, size_t count, int32_t bottom)
+{
+    const __m128i keep = _mm_set_epi32(0, -1, -1, -1);
+    const __m128i b = _mm_set_epi32(bottom, 0, 0, 0);
+    __m128i* p = reinterpret_cast<__m128i*>(rects);
+    for (size_t n=0 ; n<count ; n++) {
+        __m128i r = _mm_loadu_si128(p + n);
+        _mm_storeu_si128(p + n, _mm_or_si128(_mm_and_si128(r, keep), b));
+    }
+}
+
+static void sse2_translate(Rect* rects, size_t count, int32_t dx, int32_t dy)
+{
+    const __m128i offset = _mm_set_epi32(dy, dx, dy, dx);
+    __m128i* p = reinterpret_cast<__m128i*>(rects);
+    for (size_t n=0 ; n<count ; n++) {
+        _mm_storeu_si128(p + n, _mm_add_epi32(_mm_loadu_si128(p + n), offset));
+    }
+}
+
+static const RegionSimd sVector = {
+    "sse2",
+    sse2_band_length,
+    sse2_bands_match,
+    sse2_set_bottom,
+    sse2_translate
+};
+
+static bool cpuHasVector()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (edx & bit_SSE2) != 0;
+}
+
+#endif
+// ----------------------------------------------------------------------------
+
+static pthread_once_t sOnce = PTHREAD_ONCE_INIT;
+static bool sAvailable = false;
+static const RegionSimd* volatile sImpl = &sScalar;
+
+static void init()
+{
+#if REGION_SIMD_NEON || REGION_SIMD_SSE2
+    sAvailable = cpuHasVector();
+    if (sAvailable) {
+        sImpl = &sVector;
+    }
+#endif
+    ALOGV("using %s region operations", sImpl->name);
+}
+
+const RegionSimd& RegionSimd::get()
+{
+    pthread_once(&sOnce, init);
+    return *sImpl;
+}
+
+bool RegionSimd::isAvailable()
+{
+    pthread_once(&sOnce, init);
+    return sAvailable;
+}
+
+bool RegionSimd::setEnabled(bool enabled)
+{
+    pthread_once(&sOnce, init);
+#if REGION_SIMD_NEON || REGION_SIMD_SSE2
+    if (sAvailable) {
+        sImpl = enabled ? &sVector : &sScalar;
+    }
+#endif
+    return sImpl != &sScalar;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
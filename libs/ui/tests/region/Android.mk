@@ -14,3 +14,19 @@ LOCAL_MODULE:= test-region
 LOCAL_MODULE_TAGS := tests
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	region_bench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils \
+	libui
+
+LOCAL_MODULE:= test-region-bench
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
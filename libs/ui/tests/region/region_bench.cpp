@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <private/ui/RegionDebug.h>
+#include <private/ui/RegionSimd.h>
+
+using namespace android;
+
+/*
+ * Times the region operations SurfaceFlinger performs each frame, with the
+ * vectorized helpers enabled and then disabled, and checks that both give
+ * the same results. Then counts the heap allocations those operations make
+ * with and without the reuse of Region's storage.
+ *
+ * The stacks below mimic what's typically on screen: a scrolling wallpaper,
+ * an application window, a launcher-like grid of icons, a soft keyboard
+ * whose transparent region is the gaps between its keys, a dialog sliding
+ * in, and the status and navigation bars.
+ */
+
+static const int W = 720;
+static const int H = 1280;
+
+struct Layer {
+    Rect bounds;
+    Region transparent;     // relative to bounds
+    bool opaque;
+    int dx, dy;             // motion per frame
+    Region oldVisible;
+    Region oldCovered;
+};
+
+// a grid of cols x rows cells of the given size, separated by gaps
+static Region grid(int cols, int rows, int w, int h, int gap)
+{
+    Region r;
+    for (int y=0 ; y<rows ; y++) {
+        for (int x=0 ; x<cols ; x++) {
+            const int l = gap + x * (w + gap);
+            const int t = gap + y * (h + gap);
+            r.orSelf(Rect(l, t, l + w, t + h));
+        }
+    }
+    return r;
+}
+
+static void addLayer(Vector<Layer>& stack, const Rect& bounds, bool opaque,
+        const Region& transparent = Region(), int dx = 0, int dy = 0)
+{
+    Layer l;
+    l.bounds = bounds;
+    l.opaque = opaque;
+    l.transparent = transparent;
+    l.dx = dx;
+    l.dy = dy;
+    stack.add(l);
+}
+
+// bottom to top
+static void makeStack(Vector<Layer>& stack, int keyColumns)
+{
+    stack.clear();
+    addLayer(stack, Rect(0, 0, W*2, H), true, Region(), -4, 0);
+    addLayer(stack, Rect(0, 50, W, 1184), true);
+    addLayer(stack, Rect(0, 100, W, 900), false,
+            Region(Rect(W, 800)).subtract(grid(4, 5, 144, 144, 20)));
+    const int keyWidth = W / keyColumns - 6;
+    const Region keys(grid(keyColumns, 4, keyWidth, 100, 6));
+    addLayer(stack, Rect(0, 700, W, 1184), false,
+            Region(Rect(W, 484)).subtract(keys), 0, -2);
+    addLayer(stack, Rect(60, 300, 660, 800), true, Region(), 0, 3);
+    addLayer(stack, Rect(0, 0, W, 50), true);
+    addLayer(stack, Rect(0, 1184, W, H), true);
+}
+
+static uint32_t hash(uint32_t h, const Region& r)
+{
+    size_t count;
+    Rect const* rects = r.getArray(&count);
+    const int32_t* p = &rects->left;
+    for (size_t i=0 ; i<count*4 ; i++) {
+        h = h * 31 + uint32_t(p[i]);
+    }
+    return h;
+}
+
+// what SurfaceFlinger::computeVisibleRegions() does, top to bottom
+static uint32_t composeFrame(Vector<Layer>& stack, int frame,
+        size_t* rectCount)
+{
+    const Region screen(Rect(W, H));
+    Region aboveOpaque;
+    Region aboveCovered;
+    Region dirty;
+    Region dirtyRegion;
+    Region newExposed;
+    Region oldExposed;
+    uint32_t h = 0;
+    for (ssize_t i=stack.size()-1 ; i>=0 ; i--) {
+        Layer& layer(stack.editItemAt(i));
+        Rect bounds(layer.bounds);
+        bounds.offsetBy(layer.dx * (frame % 64), layer.dy * (frame % 64));
+
+        Region visible;
+        Region opaque;
+        Region covered;
+        visible.set(bounds);
+        visible.andSelf(screen);
+        if (!layer.opaque) {
+            visible.subtractSelf(layer.transparent, bounds.left, bounds.top);
+        } else {
+            opaque = visible;
+        }
+        covered.setIntersect(aboveCovered, visible);
+        aboveCovered.orSelf(visible);
+        visible.subtractSelf(aboveOpaque);
+
+        newExposed.setSubtract(visible, covered);
+        oldExposed.setSubtract(layer.oldVisible, layer.oldCovered);
+        newExposed.subtractSelf(oldExposed);
+        dirty.setIntersect(visible, layer.oldCovered);
+        dirty.orSelf(newExposed);
+        dirty.subtractSelf(aboveOpaque);
+        dirtyRegion.orSelf(dirty);
+        aboveOpaque.orSelf(opaque);
+        layer.oldVisible = visible;
+        layer.oldCovered = covered;
+
+        h = hash(h, visible);
+        size_t n;
+        visible.getArray(&n);
+        *rectCount += n;
+    }
+    return hash(h, dirtyRegion);
+}
+
+static nsecs_t run(bool simd, int frames, int keyColumns,
+        uint32_t* checksum, size_t* rectCount, uint32_t* allocations = NULL)
+{
+    RegionSimd::setEnabled(simd);
+    Vector<Layer> stack;
+    makeStack(stack, keyColumns);
+    *checksum = 0;
+    *rectCount = 0;
+    // the first frame sets up the layers' regions, don't count it
+    composeFrame(stack, 0, rectCount);
+    *rectCount = 0;
+    const uint32_t allocationsBefore = RegionDebug::getHeapAllocationCount();
+    const nsecs_t start = systemTime();
+    for (int i=1 ; i<=frames ; i++) {
+        *checksum ^= composeFrame(stack, i, rectCount) + i;
+    }
+    const nsecs_t duration = systemTime() - start;
+    if (allocations) {
+        *allocations = RegionDebug::getHeapAllocationCount() - allocationsBefore;
+    }
+    return duration;
+}
+
+int main(int argc, char** argv)
+{
+    const int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    if (frames <= 0) {
+        printf("usage: %s [frames]\n", argv[0]);
+        return 0;
+    }
+
+    printf("region operations: %s (vectorized implementation %savailable)\n",
+            RegionSimd::get().name,
+            RegionSimd::isAvailable() ? "" : "not ");
+
+    // narrow keys make for wide bands, which is where vectors pay off
+    static const int keyColumns[] = { 10, 20, 40 };
+    bool failed = false;
+    for (size_t i=0 ; i<sizeof(keyColumns)/sizeof(*keyColumns) ; i++) {
+        uint32_t scalarSum, simdSum;
+        size_t scalarRects, simdRects;
+        // warm up the caches and the allocator
+        run(false, frames / 10 + 1, keyColumns[i], &scalarSum, &scalarRects);
+        const nsecs_t scalar = run(false, frames, keyColumns[i],
+                &scalarSum, &scalarRects);
+        const nsecs_t simd = run(true, frames, keyColumns[i],
+                &simdSum, &simdRects);
+        const bool match = (scalarSum == simdSum && scalarRects == simdRects);
+        failed |= !match;
+        printf("%2d keys per row: %6u visible rects/frame, "
+                "scalar %7.2f us/frame, vector %7.2f us/frame (%.2fx)%s\n",
+                keyColumns[i], uint32_t(scalarRects / frames),
+                scalar / 1e3 / frames, simd / 1e3 / frames,
+                simd ? double(scalar) / simd : 0.0,
+                match ? "" : "  RESULTS DIFFER");
+    }
+    RegionSimd::setEnabled(true);
+
+    // with a simple keyboard, and a very busy one
+    for (size_t i=0 ; i<2 ; i++) {
+        const int columns = i ? 40 : 10;
+        uint32_t reuseSum, heapSum;
+        size_t reuseRects, heapRects;
+        uint32_t reuseAllocations, heapAllocations;
+        RegionDebug::setStorageReuseEnabled(false);
+        const nsecs_t heap = run(true, frames, columns,
+                &heapSum, &heapRects, &heapAllocations);
+        RegionDebug::setStorageReuseEnabled(true);
+        const nsecs_t reuse = run(true, frames, columns,
+                &reuseSum, &reuseRects, &reuseAllocations);
+        const bool match = (reuseSum == heapSum);
+        failed |= !match;
+        printf("%2d keys per row: heap allocations/frame %.1f -> %.1f "
+                "(%.1f saved), %.2f -> %.2f us/frame%s\n",
+                columns,
+                double(heapAllocations) / frames,
+                double(reuseAllocations) / frames,
+                double(heapAllocations - reuseAllocations) / frames,
+                heap / 1e3 / frames, reuse / 1e3 / frames,
+                match ? "" : "  RESULTS DIFFER");
+    }
+    return failed ? 1 : 0;
+}
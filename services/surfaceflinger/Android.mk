@@ -2,20 +2,28 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
+    CompositionCache.cpp                    \
     EventThread.cpp                         \
+    FrameTimeline.cpp                       \
     Layer.cpp                               \
     LayerBase.cpp                           \
     LayerDim.cpp                            \
     LayerScreenshot.cpp                     \
     DisplayHardware/DisplayHardware.cpp     \
     DisplayHardware/DisplayHardwareBase.cpp \
+    DisplayHardware/HWCWorkList.cpp         \
     DisplayHardware/HWComposer.cpp          \
     DisplayHardware/PowerHAL.cpp            \
     GLExtensions.cpp                        \
+    GraphicBufferPool.cpp                   \
     MessageQueue.cpp                        \
+    ScreenCaptureBuffer.cpp                 \
     SurfaceFlinger.cpp                      \
     SurfaceTextureLayer.cpp                 \
+    TransactionQueue.cpp                    \
     Transform.cpp                           \
+    VSyncModel.cpp                          \
+    WorkerPool.cpp                          \
 
 ifeq ($(TARGET_BOARD_PLATFORM),exDroid)
 	LOCAL_CFLAGS += -DALLWINNER
@@ -39,6 +47,20 @@ ifeq ($(TARGET_DISABLE_TRIPLE_BUFFERING), true)
 	LOCAL_CFLAGS += -DTARGET_DISABLE_TRIPLE_BUFFERING
 endif
 
+# how long after the vsync edge applications and SurfaceFlinger itself are
+# woken up, in nanoseconds. waking SurfaceFlinger up after applications
+# lets it compose the frames they render within the same refresh.
+ifneq ($(VSYNC_EVENT_PHASE_OFFSET_NS),)
+	LOCAL_CFLAGS += -DVSYNC_EVENT_PHASE_OFFSET_NS=$(VSYNC_EVENT_PHASE_OFFSET_NS)
+else
+	LOCAL_CFLAGS += -DVSYNC_EVENT_PHASE_OFFSET_NS=0
+endif
+ifneq ($(SF_VSYNC_EVENT_PHASE_OFFSET_NS),)
+	LOCAL_CFLAGS += -DSF_VSYNC_EVENT_PHASE_OFFSET_NS=$(SF_VSYNC_EVENT_PHASE_OFFSET_NS)
+else
+	LOCAL_CFLAGS += -DSF_VSYNC_EVENT_PHASE_OFFSET_NS=0
+endif
+
 LOCAL_SHARED_LIBRARIES := \
 	libcutils \
 	libhardware \
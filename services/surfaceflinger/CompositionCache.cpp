@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Log.h>
+#include <utils/Trace.h>
+
+#include "clz.h"
+#include "CompositionCache.h"
+#include "GLExtensions.h"
+#include "Layer.h"
+#include "LayerBase.h"
+
+#include "DisplayHardware/DisplayHardware.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+CompositionCache::CompositionCache()
+    : mThreshold(0), mCachedCount(0),
+      mTexture(0), mFramebuffer(0), mWidth(0), mHeight(0), mU(1), mV(1),
+      mFrames(0), mHits(0), mBuilds(0), mInvalidations(0)
+{
+}
+
+CompositionCache::~CompositionCache()
+{
+    release();
+}
+
+void CompositionCache::setThreshold(uint32_t frames)
+{
+    mThreshold = frames;
+    invalidate();
+    if (!mThreshold) {
+        release();
+    }
+}
+
+size_t CompositionCache::update(const Vector< sp<LayerBase> >& layers,
+        const hwc_layer_t* cur, const DisplayHardware& hw)
+{
+    if (!mThreshold) {
+        return 0;
+    }
+
+    // track for how many frames each position in the stack has been
+    // holding the same, unchanged layer.
+    const size_t count = layers.size();
+    Vector<Entry> entries;
+    entries.setCapacity(count);
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<LayerBase>& layer(layers[i]);
+        Entry entry;
+        entry.sequence = layer->sequence;
+        entry.generation = layer->contentGeneration;
+        entry.unchangedFrames = 0;
+        if (i < mEntries.size()) {
+            const Entry& previous(mEntries[i]);
+            if (previous.sequence == entry.sequence &&
+                    previous.generation == entry.generation) {
+                entry.unchangedFrames = previous.unchangedFrames;
+                if (entry.unchangedFrames < mThreshold) {
+                    entry.unchangedFrames++;
+                }
+            }
+        }
+        entries.add(entry);
+    }
+    mEntries = entries;
+
+    // find the static layers composited with GLES at the bottom of the stack
+    size_t n = 0;
+    while (n < count && mEntries[n].unchangedFrames >= mThreshold &&
+            (!cur || cur[n].compositionType == HWC_FRAMEBUFFER)) {
+        n++;
+    }
+    if (n < 2) {
+        // flattening a single layer doesn't save anything
+        n = 0;
+    }
+
+    mFrames++;
+    if (n != mCachedCount) {
+        if (n < mCachedCount) {
+            mInvalidations++;
+        }
+        mCachedCount = 0;
+        if (n && build(layers, n, hw)) {
+            mCachedCount = n;
+            mBuilds++;
+        }
+    } else if (n) {
+        mHits++;
+    }
+
+    // the layers above may have moved, which changes what is visible
+    // of the flattened ones.
+    mCachedRegion.clear();
+    for (size_t i=0 ; i<mCachedCount ; i++) {
+        mCachedRegion.orSelf(layers[i]->visibleRegionScreen);
+    }
+    return mCachedCount;
+}
+
+bool CompositionCache::build(const Vector< sp<LayerBase> >& layers,
+        size_t count, const DisplayHardware& hw)
+{
+    ATRACE_CALL();
+
+    if (!GLExtensions::getInstance().haveFramebufferObject())
+        return false;
+
+    const uint32_t hw_w = hw.getWidth();
+    const uint32_t hw_h = hw.getHeight();
+    if (!mTexture || mWidth != hw_w || mHeight != hw_h) {
+        release();
+        if (!allocate(hw_w, hw_h)) {
+            release();
+            return false;
+        }
+    }
+
+    // render the layers exactly like composeSurfaces() would over a
+    // cleared framebuffer. the layers must be drawn in full, even the
+    // parts that are hidden now, they may be uncovered later.
+    GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, mFramebuffer);
+    glDisable(GL_TEXTURE_EXTERNAL_OES);
+    glDisable(GL_TEXTURE_2D);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    const Region bounds(hw.bounds());
+    for (size_t i=0 ; i<count ; i++) {
+        layers[i]->draw(bounds);
+    }
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+    if (scissor) {
+        glEnable(GL_SCISSOR_TEST);
+    }
+    return true;
+}
+
+bool CompositionCache::allocate(uint32_t w, uint32_t h)
+{
+    // make sure to clear all GL error flags
+    while ( glGetError() != GL_NO_ERROR ) ;
+
+    mU = 1;
+    mV = 1;
+    glGenTextures(1, &mTexture);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+            w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    if (glGetError() != GL_NO_ERROR) {
+        while ( glGetError() != GL_NO_ERROR ) ;
+        GLint tw = (2 << (31 - clz(w)));
+        GLint th = (2 << (31 - clz(h)));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                tw, th, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        mU = GLfloat(w) / tw;
+        mV = GLfloat(h) / th;
+    }
+
+    glGenFramebuffersOES(1, &mFramebuffer);
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, mFramebuffer);
+    glFramebufferTexture2DOES(GL_FRAMEBUFFER_OES,
+            GL_COLOR_ATTACHMENT0_OES, GL_TEXTURE_2D, mTexture, 0);
+    GLenum status = glCheckFramebufferStatusOES(GL_FRAMEBUFFER_OES);
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_OES || glGetError() != GL_NO_ERROR) {
+        ALOGE("CompositionCache: couldn't create a %ux%u framebuffer (%#x)",
+                w, h, status);
+        return false;
+    }
+    mWidth = w;
+    mHeight = h;
+    return true;
+}
+
+void CompositionCache::release()
+{
+    if (mFramebuffer) {
+        glDeleteFramebuffersOES(1, &mFramebuffer);
+        mFramebuffer = 0;
+    }
+    if (mTexture) {
+        glDeleteTextures(1, &mTexture);
+        mTexture = 0;
+    }
+    mWidth = 0;
+    mHeight = 0;
+    mCachedCount = 0;
+    mCachedRegion.clear();
+}
+
+void CompositionCache::draw(const Region& dirty, const DisplayHardware& hw) const
+{
+    const Region region(dirty.intersect(mCachedRegion));
+    if (!mCachedCount || region.isEmpty())
+        return;
+
+    const GLfloat w = hw.getWidth();
+    const GLfloat h = hw.getHeight();
+    const GLfloat u = mU / w;
+    const GLfloat v = mV / h;
+
+    glDisable(GL_TEXTURE_EXTERNAL_OES);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glTexEnvx(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glDisable(GL_BLEND);
+    glDisable(GL_DITHER);
+
+    // the texture was rendered with the screen's projection, so its
+    // rows are upside-down w.r.t. the screen coordinates.
+    GLfloat vertices[4][2];
+    GLfloat texCoords[4][2];
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, vertices);
+    glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
+    Region::const_iterator it = region.begin();
+    Region::const_iterator const end = region.end();
+    while (it != end) {
+        const Rect& r = *it++;
+        vertices[0][0] = r.left;
+        vertices[0][1] = h - r.top;
+        vertices[1][0] = r.left;
+        vertices[1][1] = h - r.bottom;
+        vertices[2][0] = r.right;
+        vertices[2][1] = h - r.bottom;
+        vertices[3][0] = r.right;
+        vertices[3][1] = h - r.top;
+        for (size_t i=0 ; i<4 ; i++) {
+            texCoords[i][0] = vertices[i][0] * u;
+            texCoords[i][1] = vertices[i][1] * v;
+        }
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+}
+
+void CompositionCache::invalidate()
+{
+    if (mCachedCount) {
+        mInvalidations++;
+    }
+    mEntries.clear();
+    mCachedCount = 0;
+    mCachedRegion.clear();
+}
+
+void CompositionCache::dump(String8& result, const char* prefix) const
+{
+    if (!mThreshold) {
+        result.appendFormat("%sdisabled\n", prefix);
+        return;
+    }
+    result.appendFormat(
+            "%sthreshold=%u frames, cached layers=%u, "
+            "hits=%u/%u (%.1f%%), builds=%u, invalidations=%u\n",
+            prefix, mThreshold, uint32_t(mCachedCount),
+            mHits, mFrames, mFrames ? (100.0 * mHits) / mFrames : 0.0,
+            mBuilds, mInvalidations);
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_COMPOSITION_CACHE_H
+#define ANDROID_SF_COMPOSITION_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <ui/Region.h>
+
+#include <hardware/hwcomposer.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+class DisplayHardware;
+class LayerBase;
+
+/*
+ * Flattens the bottom-most layers that haven't changed for a while into a
+ * single screen-sized texture, so that GLES composition can draw them with
+ * one textured quad per dirty rectangle instead of redrawing each of them.
+ *
+ * Only a contiguous run of layers starting at the bottom of the stack can
+ * be flattened, and only if all of them are composited with GLES. A layer
+ * is considered unchanged as long as it stays at the same position in the
+ * stack and its contentGeneration doesn't move.
+ *
+ * All methods must be called on the main thread, with the GL context current.
+ */
+class CompositionCache
+{
+public:
+    CompositionCache();
+    ~CompositionCache();
+
+    // number of frames a layer must stay unchanged before it's flattened,
+    // 0 disables the cache.
+    void setThreshold(uint32_t frames);
+    uint32_t getThreshold() const { return mThreshold; }
+
+    // called once per composition, after the h/w composer has been
+    // prepared; (re)builds the texture if needed and returns the number
+    // of layers it holds.
+    size_t update(const Vector< sp<LayerBase> >& layers,
+            const hwc_layer_t* cur, const DisplayHardware& hw);
+
+    // number of layers at the bottom of the stack the texture replaces,
+    // as of the last update().
+    size_t getCachedCount() const { return mCachedCount; }
+
+    // draw the flattened layers over the given dirty region
+    void draw(const Region& dirty, const DisplayHardware& hw) const;
+
+    // drop the flattened layers and forget their history
+    void invalidate();
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    struct Entry {
+        int32_t sequence;
+        uint32_t generation;
+        uint32_t unchangedFrames;
+    };
+
+    bool build(const Vector< sp<LayerBase> >& layers, size_t count,
+            const DisplayHardware& hw);
+    bool allocate(uint32_t w, uint32_t h);
+    void release();
+
+    uint32_t mThreshold;
+    Vector<Entry> mEntries;
+
+    size_t mCachedCount;
+    Region mCachedRegion;   // union of the flattened layers' visible regions
+
+    GLuint mTexture;
+    GLuint mFramebuffer;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    GLfloat mU;
+    GLfloat mV;
+
+    // statistics
+    uint32_t mFrames;
+    uint32_t mHits;
+    uint32_t mBuilds;
+    uint32_t mInvalidations;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_COMPOSITION_CACHE_H
@@ -271,6 +271,12 @@ void DisplayHardware::init(uint32_t dpy)
 
     if (mNativeWindow->isUpdateOnDemand()) {
         mFlags |= PARTIAL_UPDATES;
+    } else if (property_get("debug.sf.damage_tracking", property, "0") > 0 &&
+            atoi(property)) {
+        // only safe if the GL driver doesn't discard the content of the
+        // framebuffer outside of what is drawn each frame.
+        ALOGI("Framebuffer damage tracking enabled");
+        mFlags |= DAMAGE_TRACKING;
     }
     
     if (eglGetConfigAttrib(display, config, EGL_CONFIG_CAVEAT, &dummy) == EGL_TRUE) {
@@ -485,6 +491,16 @@ void DisplayHardware::flip(const Region& dirty) const
     //glClear(GL_COLOR_BUFFER_BIT);
 }
 
+void DisplayHardware::setFrameDamage(const Region& damage) const
+{
+    mNativeWindow->setFrameDamage(damage);
+}
+
+bool DisplayHardware::getBackBufferDamage(Region* outDamage) const
+{
+    return mNativeWindow->getBackBufferDamage(outDamage);
+}
+
 uint32_t DisplayHardware::getFlags() const
 {
     return mFlags;
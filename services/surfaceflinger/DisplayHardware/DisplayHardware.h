@@ -59,6 +59,7 @@ public:
         PARTIAL_UPDATES             = 0x00020000,   // video driver feature
         SLOW_CONFIG                 = 0x00040000,   // software
         SWAP_RECTANGLE              = 0x00080000,
+        DAMAGE_TRACKING             = 0x00100000,   // back buffers keep content
     };
 
     DisplayHardware(
@@ -74,6 +75,10 @@ public:
     // be instantaneous, might involve copying the frame buffer around.
     void flip(const Region& dirty) const;
 
+    // with DAMAGE_TRACKING, see FramebufferNativeWindow
+    void setFrameDamage(const Region& damage) const;
+    bool getBackBufferDamage(Region* outDamage) const;
+
     float       getDpiX() const;
     float       getDpiY() const;
     float       getRefreshRate() const;
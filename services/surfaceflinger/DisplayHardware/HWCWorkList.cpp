@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "HWCWorkList.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+HWCWorkList::HWCWorkList()
+    : mList(0), mVisible(0), mCapacity(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+HWCWorkList::~HWCWorkList()
+{
+    release();
+}
+
+status_t HWCWorkList::create(size_t numLayers)
+{
+    if (!mList || mCapacity < numLayers) {
+        // grow by whole slabs, and keep what's already there so that
+        // unchanged layers don't need to be rewritten
+        const size_t capacity = (numLayers + LAYER_SLAB - 1) & ~(LAYER_SLAB - 1);
+        size_t size = sizeof(hwc_layer_list) + capacity*sizeof(hwc_layer_t);
+        hwc_layer_list_t* list = (hwc_layer_list_t*)realloc(mList, size);
+        if (!list) {
+            return NO_MEMORY;
+        }
+        if (!mList) {
+            list->flags = HWC_GEOMETRY_CHANGED;
+            list->numHwLayers = 0;
+        }
+        mList = list;
+        VisibleRegion* visible = (VisibleRegion*)realloc(mVisible,
+                capacity*sizeof(VisibleRegion));
+        if (!visible) {
+            return NO_MEMORY;
+        }
+        memset(&visible[mCapacity], 0,
+                (capacity - mCapacity)*sizeof(VisibleRegion));
+        mVisible = visible;
+        memset(&list->hwLayers[list->numHwLayers], 0,
+                (capacity - list->numHwLayers)*sizeof(hwc_layer_t));
+        mCapacity = capacity;
+    } else if (numLayers > mList->numHwLayers) {
+        memset(&mList->hwLayers[mList->numHwLayers], 0,
+                (numLayers - mList->numHwLayers)*sizeof(hwc_layer_t));
+    }
+    if (mList->numHwLayers != numLayers) {
+        mList->flags |= HWC_GEOMETRY_CHANGED;
+        mList->numHwLayers = numLayers;
+    }
+    mStats.passes++;
+    if (mList->flags & HWC_GEOMETRY_CHANGED) {
+        mStats.changes++;
+    }
+    return NO_ERROR;
+}
+
+static inline bool operator != (const hwc_rect_t& lhs, const hwc_rect_t& rhs) {
+    return lhs.left != rhs.left || lhs.top != rhs.top ||
+            lhs.right != rhs.right || lhs.bottom != rhs.bottom;
+}
+
+static bool isSameGeometry(const hwc_layer_t& lhs, const hwc_layer_t& rhs,
+        const hwc_rect_t* visible, size_t numVisible) {
+    // compositionType and hints belong to the HAL
+    if (lhs.flags != rhs.flags ||
+            lhs.transform != rhs.transform ||
+            lhs.blending != rhs.blending ||
+            lhs.sourceCrop != rhs.sourceCrop ||
+            lhs.displayFrame != rhs.displayFrame) {
+        return false;
+    }
+#ifdef QCOM_HARDWARE
+    if (lhs.sourceTransform != rhs.sourceTransform) {
+        return false;
+    }
+#endif
+    // lhs.visibleRegionScreen.rects can't be used here, it points to the
+    // storage of a region that has since been reassigned.
+    const hwc_region_t& r(rhs.visibleRegionScreen);
+    return numVisible == r.numRects &&
+            !memcmp(visible, r.rects, r.numRects*sizeof(hwc_rect_t));
+}
+
+bool HWCWorkList::saveVisibleRegion(size_t index, const hwc_region_t& region)
+{
+    VisibleRegion& v(mVisible[index]);
+    if (v.capacity < region.numRects) {
+        hwc_rect_t* rects = (hwc_rect_t*)realloc(v.rects,
+                region.numRects*sizeof(hwc_rect_t));
+        if (!rects) {
+            return false;
+        }
+        v.rects = rects;
+        v.capacity = region.numRects;
+    }
+    if (region.numRects) {
+        memcpy(v.rects, region.rects, region.numRects*sizeof(hwc_rect_t));
+    }
+    v.numRects = region.numRects;
+    v.saved = true;
+    return true;
+}
+
+bool HWCWorkList::setLayerGeometry(size_t index, const hwc_layer_t& layer)
+{
+    if (!mList || index >= mList->numHwLayers) {
+        return false;
+    }
+    mStats.layersChecked++;
+    hwc_layer_t& l(mList->hwLayers[index]);
+    const VisibleRegion& v(mVisible[index]);
+    if (!(mList->flags & HWC_GEOMETRY_CHANGED) && v.saved &&
+            isSameGeometry(l, layer, v.rects, v.numRects)) {
+        // the region's storage may have moved
+        l.visibleRegionScreen.rects = layer.visibleRegionScreen.rects;
+        return false;
+    }
+    if (!(mList->flags & HWC_GEOMETRY_CHANGED)) {
+        mStats.changes++;
+    }
+    l = layer;
+    if (!saveVisibleRegion(index, layer.visibleRegionScreen)) {
+        // can't tell next time, it'll be rewritten then
+        mVisible[index].saved = false;
+    }
+    mList->flags |= HWC_GEOMETRY_CHANGED;
+    mStats.layersRewritten++;
+    return true;
+}
+
+void HWCWorkList::clearGeometryChanged()
+{
+    if (mList) {
+        mList->flags &= ~HWC_GEOMETRY_CHANGED;
+    }
+}
+
+void HWCWorkList::release()
+{
+    for (size_t i=0 ; i<mCapacity ; i++) {
+        free(mVisible[i].rects);
+    }
+    free(mVisible);
+    free(mList);
+    mVisible = 0;
+    mList = 0;
+    mCapacity = 0;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
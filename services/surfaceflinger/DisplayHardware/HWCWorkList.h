@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_HWC_WORK_LIST_H
+#define ANDROID_SF_HWC_WORK_LIST_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/hwcomposer.h>
+
+#include <utils/Errors.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * The hwc_layer_list_t handed to the h/w composer HAL, and the tracking of
+ * its geometry changes.
+ *
+ * This only depends on the HAL's header, so that the composition tests can
+ * build it on the host along with a simulated HAL.
+ */
+class HWCWorkList
+{
+public:
+    struct Stats {
+        uint32_t passes;            // calls to create()
+        uint32_t changes;           // passes that set HWC_GEOMETRY_CHANGED
+        uint32_t layersChecked;     // calls to setLayerGeometry()
+        uint32_t layersRewritten;   // ... that changed the entry
+    };
+
+    HWCWorkList();
+    ~HWCWorkList();
+
+    // make room for numLayers layers. the list only grows, the layers
+    // already in it are kept. sets HWC_GEOMETRY_CHANGED if the number of
+    // layers changed.
+    status_t create(size_t numLayers);
+
+    // update the geometry of a layer. the entry is only rewritten, and
+    // HWC_GEOMETRY_CHANGED set, if it actually changed. returns whether
+    // it did.
+    bool setLayerGeometry(size_t index, const hwc_layer_t& layer);
+
+    // the HAL has seen the geometry
+    void clearGeometryChanged();
+
+    // free the list, the next create() starts over
+    void release();
+
+    hwc_layer_list_t* getList() const { return mList; }
+    size_t getNumLayers() const { return mList ? mList->numHwLayers : 0; }
+    hwc_layer_t* getLayers() const { return mList ? mList->hwLayers : 0; }
+    size_t getCapacity() const { return mCapacity; }
+    const Stats& getStats() const { return mStats; }
+
+private:
+    enum {
+        LAYER_SLAB = 16     // the list grows by this many layers
+    };
+
+    // a copy of the visible region of each entry as the HAL last saw it;
+    // the entry itself only points to SurfaceFlinger's region.
+    struct VisibleRegion {
+        hwc_rect_t* rects;
+        size_t numRects;
+        size_t capacity;
+        bool saved;
+    };
+
+    bool saveVisibleRegion(size_t index, const hwc_region_t& region);
+
+    HWCWorkList(const HWCWorkList&);
+    HWCWorkList& operator = (const HWCWorkList&);
+
+    hwc_layer_list_t*   mList;
+    VisibleRegion*      mVisible;
+    size_t              mCapacity;
+    Stats               mStats;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_HWC_WORK_LIST_H
@@ -51,7 +51,7 @@ HWComposer::HWComposer(
         EventHandler& handler,
         nsecs_t refreshPeriod)
     : mFlinger(flinger),
-      mModule(0), mHwc(0), mList(0), mCapacity(0),
+      mModule(0), mHwc(0),
       mNumOVLayers(0), mNumFBLayers(0),
       mDpy(EGL_NO_DISPLAY), mSur(EGL_NO_SURFACE),
       mEventHandler(handler),
@@ -98,7 +98,6 @@ HWComposer::HWComposer(
 
 HWComposer::~HWComposer() {
     eventControl(EVENT_VSYNC, 0);
-    free(mList);
     if (mVSyncThread != NULL) {
         mVSyncThread->requestExitAndWait();
     }
@@ -152,26 +151,24 @@ void HWComposer::setFrameBuffer(EGLDisplay dpy, EGLSurface sur) {
 
 status_t HWComposer::createWorkList(size_t numLayers) {
     if (mHwc) {
-        if (!mList || mCapacity < numLayers) {
-            free(mList);
-            size_t size = sizeof(hwc_layer_list) + numLayers*sizeof(hwc_layer_t);
-            mList = (hwc_layer_list_t*)malloc(size);
-            mCapacity = numLayers;
-        }
-        mList->flags = HWC_GEOMETRY_CHANGED;
-        mList->numHwLayers = numLayers;
+        return mWorkList.create(numLayers);
     }
     return NO_ERROR;
 }
 
+bool HWComposer::setLayerGeometry(size_t index, const hwc_layer_t& layer) {
+    return mWorkList.setLayerGeometry(index, layer);
+}
+
 status_t HWComposer::prepare() const {
-    int err = mHwc->prepare(mHwc, mList);
+    hwc_layer_list_t* const list(mWorkList.getList());
+    int err = mHwc->prepare(mHwc, list);
     if (err == NO_ERROR) {
         size_t numOVLayers = 0;
         size_t numFBLayers = 0;
-        size_t count = mList->numHwLayers;
+        size_t count = list->numHwLayers;
         for (size_t i=0 ; i<count ; i++) {
-            hwc_layer& l(mList->hwLayers[i]);
+            hwc_layer& l(list->hwLayers[i]);
             if (l.flags & HWC_SKIP_LAYER) {
                 l.compositionType = HWC_FRAMEBUFFER;
             }
@@ -205,11 +202,9 @@ size_t HWComposer::getLayerCount(int type) const {
     return 0;
 }
 
-status_t HWComposer::commit() const {
-    int err = mHwc->set(mHwc, mDpy, mSur, mList);
-    if (mList) {
-        mList->flags &= ~HWC_GEOMETRY_CHANGED;
-    }
+status_t HWComposer::commit() {
+    int err = mHwc->set(mHwc, mDpy, mSur, mWorkList.getList());
+    mWorkList.clearGeometryChanged();
     return (status_t)err;
 }
 
@@ -226,8 +221,7 @@ status_t HWComposer::release() const {
 
 status_t HWComposer::disable() {
     if (mHwc) {
-        free(mList);
-        mList = NULL;
+        mWorkList.release();
         int err = mHwc->prepare(mHwc, NULL);
         return (status_t)err;
     }
@@ -235,11 +229,11 @@ status_t HWComposer::disable() {
 }
 
 size_t HWComposer::getNumLayers() const {
-    return mList ? mList->numHwLayers : 0;
+    return mWorkList.getNumLayers();
 }
 
 hwc_layer_t* HWComposer::getLayers() const {
-    return mList ? mList->hwLayers : 0;
+    return mWorkList.getLayers();
 }
 
 #ifdef ALLWINNER
@@ -267,18 +261,24 @@ uint32_t HWComposer::getParameter(uint32_t cmd)
 
 void HWComposer::dump(String8& result, char* buffer, size_t SIZE,
         const Vector< sp<LayerBase> >& visibleLayersSortedByZ) const {
-    if (mHwc && mList) {
+    const hwc_layer_list_t* const list(mWorkList.getList());
+    if (mHwc && list) {
+        const HWCWorkList::Stats& stats(mWorkList.getStats());
         result.append("Hardware Composer state:\n");
         result.appendFormat("  mDebugForceFakeVSync=%d\n",
                 mDebugForceFakeVSync);
-        result.appendFormat("  numHwLayers=%u, flags=%08x\n",
-                mList->numHwLayers, mList->flags);
+        result.appendFormat("  numHwLayers=%u, capacity=%u, flags=%08x\n",
+                list->numHwLayers, mWorkList.getCapacity(), list->flags);
+        result.appendFormat("  geometry passes=%u, changed=%u, "
+                "layers rewritten=%u/%u\n",
+                stats.passes, stats.changes,
+                stats.layersRewritten, stats.layersChecked);
         result.append(
                 "   type   |  handle  |   hints  |   flags  | tr | blend |  format  |       source crop         |           frame           name \n"
                 "----------+----------+----------+----------+----+-------+----------+---------------------------+--------------------------------\n");
         //      " ________ | ________ | ________ | ________ | __ | _____ | ________ | [_____,_____,_____,_____] | [_____,_____,_____,_____]
-        for (size_t i=0 ; i<mList->numHwLayers ; i++) {
-            const hwc_layer_t& l(mList->hwLayers[i]);
+        for (size_t i=0 ; i<list->numHwLayers ; i++) {
+            const hwc_layer_t& l(list->hwLayers[i]);
             const sp<LayerBase> layer(visibleLayersSortedByZ[i]);
             int32_t format = -1;
             if (layer->getLayer() != NULL) {
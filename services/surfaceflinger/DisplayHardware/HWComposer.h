@@ -27,6 +27,8 @@
 #include <utils/StrongPointer.h>
 #include <utils/Vector.h>
 
+#include "HWCWorkList.h"
+
 extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
                            const struct timespec *request,
                            struct timespec *remain);
@@ -57,9 +59,16 @@ public:
     // tells the HAL what the framebuffer is
     void setFrameBuffer(EGLDisplay dpy, EGLSurface sur);
 
-    // create a work list for numLayers layer. sets HWC_GEOMETRY_CHANGED.
+    // create a work list for numLayers layer. the list only grows, the
+    // layers already in it are kept. sets HWC_GEOMETRY_CHANGED if the
+    // number of layers changed.
     status_t createWorkList(size_t numLayers);
 
+    // update the geometry of a layer of the work list. the entry is only
+    // rewritten, and HWC_GEOMETRY_CHANGED set, if it actually changed.
+    // returns whether it did.
+    bool setLayerGeometry(size_t index, const hwc_layer_t& layer);
+
     // Asks the HAL what it can do
     status_t prepare() const;
 
@@ -67,7 +76,7 @@ public:
     status_t disable();
 
     // commits the list
-    status_t commit() const;
+    status_t commit();
 
     // release hardware resources
     status_t release() const;
@@ -139,8 +148,7 @@ private:
     sp<SurfaceFlinger>      mFlinger;
     hw_module_t const*      mModule;
     hwc_composer_device_t*  mHwc;
-    hwc_layer_list_t*       mList;
-    size_t                  mCapacity;
+    HWCWorkList             mWorkList;
     mutable size_t          mNumOVLayers;
     mutable size_t          mNumFBLayers;
     hwc_display_t           mDpy;
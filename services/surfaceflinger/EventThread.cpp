@@ -16,13 +16,18 @@
 
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <gui/BitTube.h>
 #include <gui/IDisplayEventConnection.h>
 #include <gui/DisplayEventReceiver.h>
 
+#include <cutils/properties.h>
+
 #include <utils/Errors.h>
 #include <utils/Trace.h>
 
@@ -39,12 +44,53 @@ namespace android {
 EventThread::EventThread(const sp<SurfaceFlinger>& flinger)
     : mFlinger(flinger),
       mHw(flinger->graphicPlane(0).editDisplayHardware()),
+      mVSyncModelMode(VSYNC_MODEL_REPORT),
+      mAppPhase(VSYNC_EVENT_PHASE_OFFSET_NS),
+      mCompositorPhase(SF_VSYNC_EVENT_PHASE_OFFSET_NS),
       mLastVSyncTimestamp(0),
       mVSyncTimestamp(0),
       mUseSoftwareVSync(false),
+      mVSyncModel(mHw.getRefreshPeriod()),
+      mPredictedSinceResync(0),
+      mResyncSamples(0),
+      mPredictedVSyncs(0),
+      mLateHwVSyncs(0),
+      mResyncs(0),
       mDeliveredEvents(0),
       mDebugVsyncEnabled(false)
 {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.vsync_model", value, "0");
+    mVSyncModelMode = atoi(value);
+    ALOGI_IF(mVSyncModelMode == VSYNC_MODEL_FILL,
+            "vsync model fills in for late h/w vsync");
+    ALOGI_IF(mVSyncModelMode == VSYNC_MODEL_POWER,
+            "vsync model replaces h/w vsync once locked");
+
+    // the build sets the default phase offsets, these are for tuning
+    if (property_get("debug.sf.vsync_app_phase_ns", value, NULL) > 0) {
+        mAppPhase = atoll(value);
+    }
+    if (property_get("debug.sf.vsync_sf_phase_ns", value, NULL) > 0) {
+        mCompositorPhase = atoll(value);
+    }
+    mAppPhase = clampPhase(mAppPhase, "app");
+    mCompositorPhase = clampPhase(mCompositorPhase, "SurfaceFlinger");
+    ALOGI_IF(mAppPhase || mCompositorPhase,
+            "vsync phase offsets: app=%lld us, SurfaceFlinger=%lld us",
+            ns2us(mAppPhase), ns2us(mCompositorPhase));
+}
+
+nsecs_t EventThread::clampPhase(nsecs_t phase, const char* what) const {
+    // events are only ever delayed, and by less than a refresh so that
+    // they don't run into the next vsync
+    const nsecs_t period = mHw.getRefreshPeriod();
+    if (phase < 0 || phase >= period) {
+        ALOGW("%s vsync phase offset %lld us out of [0, %lld us), ignored",
+                what, ns2us(phase), ns2us(period));
+        return 0;
+    }
+    return phase;
 }
 
 void EventThread::onFirstRef() {
@@ -53,7 +99,11 @@ void EventThread::onFirstRef() {
 }
 
 sp<EventThread::Connection> EventThread::createEventConnection() const {
-    return new Connection(const_cast<EventThread*>(this));
+    return new Connection(const_cast<EventThread*>(this), mAppPhase);
+}
+
+sp<EventThread::Connection> EventThread::createCompositorEventConnection() const {
+    return new Connection(const_cast<EventThread*>(this), mCompositorPhase);
 }
 
 status_t EventThread::registerDisplayEventConnection(
@@ -111,8 +161,12 @@ void EventThread::onScreenReleased() {
 void EventThread::onScreenAcquired() {
     Mutex::Autolock _l(mLock);
     if (mUseSoftwareVSync) {
-        // resume use of h/w vsync
+        // resume use of h/w vsync. the display may not come back with
+        // the same phase, start the model over.
         mUseSoftwareVSync = false;
+        mVSyncModel.reset();
+        mPredictedSinceResync = 0;
+        mResyncSamples = 0;
         mCondition.broadcast();
     }
 }
@@ -120,10 +174,25 @@ void EventThread::onScreenAcquired() {
 
 void EventThread::onVSyncReceived(int, nsecs_t timestamp) {
     Mutex::Autolock _l(mLock);
+    mVSyncModel.addSample(timestamp);
+    if (mResyncSamples && --mResyncSamples == 0) {
+        mPredictedSinceResync = 0;
+    }
+    if (mVSyncModelMode != VSYNC_MODEL_REPORT && mLastVSyncTimestamp &&
+            timestamp - mLastVSyncTimestamp < mVSyncModel.getPeriod() / 2) {
+        // the model already served this one
+        mLateHwVSyncs++;
+        return;
+    }
     mVSyncTimestamp = timestamp;
     mCondition.broadcast();
 }
 
+bool EventThread::isHwVSyncNeededLocked() const {
+    return mVSyncModelMode != VSYNC_MODEL_POWER ||
+            !mVSyncModel.isLocked() || mResyncSamples;
+}
+
 bool EventThread::threadLoop() {
 
     nsecs_t timestamp;
@@ -171,7 +240,36 @@ bool EventThread::threadLoop() {
             }
 
             // wait for something to happen
-            if (mUseSoftwareVSync && waitForNextVsync) {
+            const bool predict = waitForNextVsync &&
+                    mVSyncModelMode != VSYNC_MODEL_REPORT &&
+                    mVSyncModel.isLocked();
+            if (predict) {
+                // serve the vsync the model predicts, unless h/w delivers
+                // it first
+                const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+                const nsecs_t period = mVSyncModel.getPeriod();
+                nsecs_t after = mLastVSyncTimestamp + period / 2;
+                if (after < now) {
+                    after = now;
+                }
+                const nsecs_t next = mVSyncModel.getNextVSync(after);
+                const bool hwVSync = !mUseSoftwareVSync && isHwVSyncNeededLocked();
+                // when h/w vsync is on, only fill in for it when it's late
+                const nsecs_t deadline = hwVSync ? next + period / 4 : next;
+                if (mCondition.waitRelative(mLock,
+                        deadline > now ? deadline - now : 0) == TIMED_OUT &&
+                        !mVSyncTimestamp) {
+                    mVSyncTimestamp = next;
+                    mPredictedVSyncs++;
+                    if (mVSyncModelMode == VSYNC_MODEL_POWER && !hwVSync &&
+                            !mUseSoftwareVSync &&
+                            ++mPredictedSinceResync >= RESYNC_INTERVAL) {
+                        // turn h/w vsync back on for a few events
+                        mResyncSamples = RESYNC_SAMPLES;
+                        mResyncs++;
+                    }
+                }
+            } else if (mUseSoftwareVSync && waitForNextVsync) {
                 // h/w vsync cannot be used (screen is off), so we use
                 // a  timeout instead. it doesn't matter how imprecise this
                 // is, we just need to make sure to serve the clients
@@ -215,14 +313,52 @@ bool EventThread::threadLoop() {
         }
     } while (!displayEventConnections.size());
 
-    // dispatch vsync events to listeners...
+    // dispatch vsync events to listeners, in order of their phase offset.
+    // the events still carry the time of the vsync edge itself.
     vsync.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
     vsync.header.timestamp = timestamp;
     vsync.vsync.count = mDeliveredEvents;
 
-    const size_t count = displayEventConnections.size();
-    for (size_t i=0 ; i<count ; i++) {
+    while (displayEventConnections.size()) {
+        nsecs_t phase = -1;
+        const size_t count = displayEventConnections.size();
+        for (size_t i=0 ; i<count ; i++) {
+            sp<Connection> conn(displayEventConnections[i].promote());
+            if (conn != NULL && (phase < 0 || conn->phase < phase)) {
+                phase = conn->phase;
+            }
+        }
+        if (phase > 0) {
+            waitUntil(timestamp + phase);
+        }
+        dispatchEvent(displayEventConnections, phase, vsync);
+    }
+
+    return true;
+}
+
+void EventThread::waitUntil(nsecs_t when) {
+    struct timespec spec;
+    spec.tv_sec  = when / 1000000000;
+    spec.tv_nsec = when % 1000000000;
+    int err;
+    do {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+    } while (err == EINTR);
+}
+
+void EventThread::dispatchEvent(
+        Vector< wp<EventThread::Connection> >& displayEventConnections,
+        nsecs_t phase, const DisplayEventReceiver::Event& vsync) {
+    // posts the event to the connections with the given phase offset and
+    // removes them from the list, along with the dead ones
+    size_t i = 0;
+    while (i < displayEventConnections.size()) {
         sp<Connection> conn(displayEventConnections[i].promote());
+        if (conn != NULL && conn->phase != phase) {
+            i++;
+            continue;
+        }
         // make sure the connection didn't die
         if (conn != NULL) {
             status_t err = conn->postEvent(vsync);
@@ -243,18 +379,15 @@ bool EventThread::threadLoop() {
             // just clean the list.
             removeDisplayEventConnection(displayEventConnections[i]);
         }
+        displayEventConnections.removeAt(i);
     }
-
-    // clear all our references without holding mLock
-    displayEventConnections.clear();
-
-    return true;
 }
 
 void EventThread::enableVSyncLocked() {
     if (!mUseSoftwareVSync) {
-        // never enable h/w VSYNC when screen is off
-        mHw.eventControl(DisplayHardware::EVENT_VSYNC, true);
+        // never enable h/w VSYNC when screen is off, nor while the model
+        // stands in for it
+        mHw.eventControl(DisplayHardware::EVENT_VSYNC, isHwVSyncNeededLocked());
     }
     mDebugVsyncEnabled = true;
 }
@@ -280,16 +413,24 @@ void EventThread::dump(String8& result, char* buffer, size_t SIZE) const {
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
                 mDisplayEventConnections.itemAt(i).promote();
-        result.appendFormat("    %p: count=%d\n",
-                connection.get(), connection!=NULL ? connection->count : 0);
+        result.appendFormat("    %p: count=%d, phase=%lld us\n",
+                connection.get(), connection!=NULL ? connection->count : 0,
+                connection!=NULL ? ns2us(connection->phase) : 0);
     }
+    result.appendFormat("  phase offsets: app=%lld us, SurfaceFlinger=%lld us\n",
+            ns2us(mAppPhase), ns2us(mCompositorPhase));
+    result.appendFormat("  vsync model (mode %d):\n", mVSyncModelMode);
+    mVSyncModel.dump(result, "    ");
+    result.appendFormat("    predicted vsyncs served: %u, "
+            "late h/w vsyncs dropped: %u, resyncs: %u\n",
+            mPredictedVSyncs, mLateHwVSyncs, mResyncs);
 }
 
 // ---------------------------------------------------------------------------
 
 EventThread::Connection::Connection(
-        const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(new BitTube())
+        const sp<EventThread>& eventThread, nsecs_t phase)
+    : count(-1), phase(phase), mEventThread(eventThread), mChannel(new BitTube())
 {
 }
 
@@ -28,6 +28,7 @@
 #include <utils/SortedVector.h>
 
 #include "DisplayHardware/DisplayHardware.h"
+#include "VSyncModel.h"
 
 // ---------------------------------------------------------------------------
 
@@ -42,9 +43,12 @@ class SurfaceFlinger;
 class EventThread : public Thread, public DisplayHardware::VSyncHandler {
     class Connection : public BnDisplayEventConnection {
     public:
-        Connection(const sp<EventThread>& eventThread);
+        Connection(const sp<EventThread>& eventThread, nsecs_t phase);
         status_t postEvent(const DisplayEventReceiver::Event& event);
 
+        // how long after the vsync edge events are posted
+        const nsecs_t phase;
+
         // count >= 1 : continuous event. count is the vsync rate
         // count == 0 : one-shot event that has not fired
         // count ==-1 : one-shot event that fired this round / disabled
@@ -65,7 +69,10 @@ public:
 
     EventThread(const sp<SurfaceFlinger>& flinger);
 
+    // for applications
     sp<Connection> createEventConnection() const;
+    // for SurfaceFlinger's own message queue
+    sp<Connection> createCompositorEventConnection() const;
     status_t registerDisplayEventConnection(const sp<Connection>& connection);
     status_t unregisterDisplayEventConnection(const wp<Connection>& connection);
 
@@ -87,12 +94,34 @@ private:
     virtual void        onVSyncReceived(int, nsecs_t timestamp);
 
     void removeDisplayEventConnection(const wp<Connection>& connection);
+    void dispatchEvent(Vector< wp<Connection> >& displayEventConnections,
+            nsecs_t phase, const DisplayEventReceiver::Event& vsync);
+    static void waitUntil(nsecs_t when);
+    nsecs_t clampPhase(nsecs_t phase, const char* what) const;
     void enableVSyncLocked();
     void disableVSyncLocked();
+    bool isHwVSyncNeededLocked() const;
+
+    // how the vsync model is used (debug.sf.vsync_model)
+    enum {
+        VSYNC_MODEL_REPORT  = 0,    // only fitted and reported in dumpsys
+        VSYNC_MODEL_FILL    = 1,    // stands in for late or missing h/w vsync
+        VSYNC_MODEL_POWER   = 2     // also turns h/w vsync off once locked
+    };
+
+    // h/w vsync is turned back on for RESYNC_SAMPLES events every
+    // RESYNC_INTERVAL predicted ones, to keep the model honest.
+    enum {
+        RESYNC_INTERVAL = 240,
+        RESYNC_SAMPLES  = 8
+    };
 
     // constants
     sp<SurfaceFlinger> mFlinger;
     DisplayHardware& mHw;
+    int mVSyncModelMode;
+    nsecs_t mAppPhase;
+    nsecs_t mCompositorPhase;
 
     mutable Mutex mLock;
     mutable Condition mCondition;
@@ -102,6 +131,12 @@ private:
     nsecs_t mLastVSyncTimestamp;
     nsecs_t mVSyncTimestamp;
     bool mUseSoftwareVSync;
+    VSyncModel mVSyncModel;
+    uint32_t mPredictedSinceResync;
+    uint32_t mResyncSamples;
+    uint32_t mPredictedVSyncs;
+    uint32_t mLateHwVSyncs;
+    uint32_t mResyncs;
 
     // main thread only
     size_t mDeliveredEvents;
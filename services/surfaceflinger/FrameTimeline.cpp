@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <cutils/atomic.h>
+
+#include "FrameTimeline.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram()
+{
+    clear();
+}
+
+void LatencyHistogram::add(nsecs_t latency)
+{
+    if (latency < 0)
+        latency = 0;
+    size_t index = size_t(latency / BUCKET_WIDTH);
+    if (index > NUM_BUCKETS)
+        index = NUM_BUCKETS;
+    mBuckets[index]++;
+    mCount++;
+    if (latency > mMax)
+        mMax = latency;
+}
+
+void LatencyHistogram::clear()
+{
+    memset(mBuckets, 0, sizeof(mBuckets));
+    mCount = 0;
+    mMax = 0;
+}
+
+nsecs_t LatencyHistogram::getPercentile(uint32_t percent) const
+{
+    const uint32_t count = mCount;
+    if (!count)
+        return 0;
+    // rank of the sample we're looking for, rounded up
+    const uint64_t rank = (uint64_t(count) * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i=0 ; i<NUM_BUCKETS ; i++) {
+        seen += mBuckets[i];
+        if (seen >= rank) {
+            return nsecs_t(i + 1) * BUCKET_WIDTH;
+        }
+    }
+    return mMax;
+}
+
+void LatencyHistogram::dump(String8& result,
+        const char* prefix, const char* what) const
+{
+    result.appendFormat(
+            "%s%s: p50=%.1fms, p95=%.1fms, p99=%.1fms, max=%.1fms\n",
+            prefix, what,
+            getPercentile(50) / 1e6,
+            getPercentile(95) / 1e6,
+            getPercentile(99) / 1e6,
+            getMax() / 1e6);
+}
+
+// ---------------------------------------------------------------------------
+
+FrameTimeline::FrameTimeline()
+    : mClearRequested(0), mLastFrameNumber(0), mPendingQueueTime(0),
+      mPending(false), mLastDisplayTime(0), mFrames(0), mJankyFrames(0),
+      mSkippedFrames(0)
+{
+}
+
+void FrameTimeline::onFrameLatched(nsecs_t when,
+        uint64_t frameNumber, nsecs_t queueTime)
+{
+    if (android_atomic_acquire_load(&mClearRequested)) {
+        applyClear();
+    }
+
+    if (frameNumber == mLastFrameNumber) {
+        // no new frame, the one queued was rejected
+        mPending = false;
+        return;
+    }
+    if (mLastFrameNumber && frameNumber > mLastFrameNumber + 1) {
+        // frames replaced or rejected before we could latch them
+        mSkippedFrames += uint32_t(frameNumber - mLastFrameNumber - 1);
+    }
+    mLastFrameNumber = frameNumber;
+    mPendingQueueTime = queueTime;
+    mPending = true;
+
+    mQueueToLatch.add(when - queueTime);
+}
+
+void FrameTimeline::onFrameDropped()
+{
+    mPending = false;
+}
+
+void FrameTimeline::onFrameDisplayed(nsecs_t when, nsecs_t period)
+{
+    if (!mPending)
+        return;
+    mPending = false;
+
+    mFrames++;
+    mQueueToDisplay.add(when - mPendingQueueTime);
+
+    if (mLastDisplayTime) {
+        const bool late = (when - mLastDisplayTime) > (period * 3) / 2;
+        const bool ready = mPendingQueueTime < (mLastDisplayTime + period);
+        if (late && ready) {
+            mJankyFrames++;
+        }
+    }
+    mLastDisplayTime = when;
+}
+
+void FrameTimeline::clear() const
+{
+    android_atomic_release_store(1, &mClearRequested);
+}
+
+void FrameTimeline::applyClear()
+{
+    android_atomic_release_store(0, &mClearRequested);
+    mLastDisplayTime = 0;
+    mFrames = 0;
+    mJankyFrames = 0;
+    mSkippedFrames = 0;
+    mQueueToLatch.clear();
+    mQueueToDisplay.clear();
+}
+
+void FrameTimeline::dump(String8& result, const char* prefix) const
+{
+    result.appendFormat("%sframes=%u, janky=%u, skipped=%u\n",
+            prefix, mFrames, mJankyFrames, mSkippedFrames);
+    mQueueToLatch.dump(result, prefix, "queue-to-latch");
+    mQueueToDisplay.dump(result, prefix, "queue-to-display");
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_FRAME_TIMELINE_H
+#define ANDROID_SF_FRAME_TIMELINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * Fixed-size latency histogram, 0.5ms buckets up to 200ms.
+ */
+class LatencyHistogram
+{
+public:
+    enum {
+        BUCKET_WIDTH = 500000,  // ns
+        NUM_BUCKETS  = 400
+    };
+
+    LatencyHistogram();
+
+    void add(nsecs_t latency);
+    void clear();
+
+    uint32_t getCount() const { return mCount; }
+    nsecs_t getMax() const { return mMax; }
+
+    // upper bound of the bucket holding the given percentile
+    nsecs_t getPercentile(uint32_t percent) const;
+
+    void dump(String8& result, const char* prefix, const char* what) const;
+
+private:
+    uint32_t mBuckets[NUM_BUCKETS + 1]; // the last one is the overflow
+    uint32_t mCount;
+    nsecs_t mMax;
+};
+
+/*
+ * Timeline of the frames going through a single layer (or through the
+ * compositor itself): queued -> latched -> displayed.
+ *
+ * A latched frame is identified by the frame number and the queue time the
+ * BufferQueue gave it, so the timeline stays right when the producer
+ * replaces frames before they're latched (asynchronous mode) or when a frame
+ * is rejected. Everything happens on the main thread; dump() only reads
+ * counters and may race with it, which is fine for statistics.
+ *
+ * A displayed frame is counted as janky when it comes more than 1.5 refresh
+ * periods after the previous one even though it was queued in time to make
+ * the next refresh.
+ */
+class FrameTimeline
+{
+public:
+    FrameTimeline();
+
+    // main thread
+    void onFrameLatched(nsecs_t when, uint64_t frameNumber, nsecs_t queueTime);
+    void onFrameDropped();
+    void onFrameDisplayed(nsecs_t when, nsecs_t period);
+
+    // any thread, takes effect at the next latch
+    void clear() const;
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    void applyClear();
+
+    mutable volatile int32_t mClearRequested;
+
+    // main thread
+    uint64_t mLastFrameNumber;
+    nsecs_t mPendingQueueTime;
+    bool mPending;
+    nsecs_t mLastDisplayTime;
+    uint32_t mFrames;
+    uint32_t mJankyFrames;
+    uint32_t mSkippedFrames;    // queued, but never latched
+    LatencyHistogram mQueueToLatch;
+    LatencyHistogram mQueueToDisplay;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_FRAME_TIMELINE_H
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <hardware/gralloc.h>
+
+#include <utils/Log.h>
+
+#include "GraphicBufferPool.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// a buffer that hasn't been taken back after this long probably won't be
+static const nsecs_t MAX_AGE = s2ns(30);
+
+static size_t bufferSize(const sp<GraphicBuffer>& buffer)
+{
+    // only used to account for the memory held, YUV formats don't have
+    // a bytesPerPixel() but don't take more than 2 bytes per pixel
+    ssize_t bpp = bytesPerPixel(buffer->format);
+    if (bpp <= 0) {
+        bpp = 2;
+    }
+    return size_t(buffer->stride) * buffer->height * bpp;
+}
+
+GraphicBufferPool::GraphicBufferPool(size_t capacity)
+    : mCapacity(capacity), mSize(0),
+      mRequests(0), mHits(0), mRecycled(0), mEvicted(0)
+{
+}
+
+GraphicBufferPool::~GraphicBufferPool()
+{
+}
+
+sp<GraphicBuffer> GraphicBufferPool::take(const void* owner,
+        uint32_t w, uint32_t h, PixelFormat format, uint32_t usage)
+{
+    sp<GraphicBuffer> buffer;
+    Mutex::Autolock _l(mLock);
+    mRequests++;
+    trimLocked(mCapacity, systemTime());
+    // the most recently recycled first, it's the most likely to be in
+    // the caches still
+    for (size_t i=mEntries.size() ; i>0 ; i--) {
+        const Entry& entry(mEntries[i-1]);
+        const sp<GraphicBuffer>& b(entry.buffer);
+        if (entry.owner == owner &&
+                uint32_t(b->width) == w && uint32_t(b->height) == h &&
+                b->format == format && (uint32_t(b->usage) & usage) == usage) {
+            buffer = b;
+            mSize -= entry.size;
+            mEntries.removeAt(i-1);
+            mHits++;
+            break;
+        }
+    }
+    return buffer;
+}
+
+void GraphicBufferPool::recycle(const void* owner,
+        const sp<GraphicBuffer>& buffer)
+{
+    if (buffer == 0 || buffer->handle == 0 ||
+            (buffer->usage & GRALLOC_USAGE_PROTECTED)) {
+        return;
+    }
+    const size_t size = bufferSize(buffer);
+    if (size > mCapacity) {
+        return;
+    }
+    Mutex::Autolock _l(mLock);
+    const nsecs_t now = systemTime();
+    trimLocked(mCapacity - size, now);
+    Entry entry;
+    entry.owner = owner;
+    entry.buffer = buffer;
+    entry.size = size;
+    entry.time = now;
+    mEntries.add(entry);
+    mSize += size;
+    mRecycled++;
+}
+
+void GraphicBufferPool::releaseOwner(const void* owner)
+{
+    Mutex::Autolock _l(mLock);
+    for (size_t i=mEntries.size() ; i>0 ; i--) {
+        if (mEntries[i-1].owner == owner) {
+            mSize -= mEntries[i-1].size;
+            mEntries.removeAt(i-1);
+        }
+    }
+}
+
+void GraphicBufferPool::trimLocked(size_t capacity, nsecs_t now)
+{
+    size_t count = 0;
+    size_t size = mSize;
+    while (count < mEntries.size() && (size > capacity ||
+            now - mEntries[count].time > MAX_AGE)) {
+        size -= mEntries[count].size;
+        count++;
+    }
+    if (count) {
+        mEntries.removeItemsAt(0, count);
+        mSize = size;
+        mEvicted += count;
+    }
+}
+
+void GraphicBufferPool::dump(String8& result, const char* prefix) const
+{
+    char buffer[256];
+    Mutex::Autolock _l(mLock);
+    snprintf(buffer, sizeof(buffer),
+            "%s%u buffers, %u KB of %u KB, requests=%u, hits=%u (%.1f%%), "
+            "recycled=%u, evicted=%u\n",
+            prefix, uint32_t(mEntries.size()), uint32_t(mSize / 1024),
+            uint32_t(mCapacity / 1024), mRequests, mHits,
+            mRequests ? (100.0 * mHits) / mRequests : 0.0,
+            mRecycled, mEvicted);
+    result.append(buffer);
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_GRAPHIC_BUFFER_POOL_H
+#define ANDROID_SF_GRAPHIC_BUFFER_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * Gralloc buffers that BufferQueues don't need anymore, kept so that
+ * the next allocation of the same size and format doesn't go to gralloc.
+ *
+ * A buffer is only handed back to the owner that recycled it, which is
+ * the IGraphicBufferAlloc of a single BufferQueue: its content must not
+ * leak to another client. The pool is shared by all the owners and is
+ * capped in bytes, the least recently recycled buffers go first, and so
+ * do the buffers that have been sitting in the pool for too long. Both
+ * are only evicted when a buffer is taken or recycled: a pool nobody uses
+ * keeps what it holds.
+ */
+class GraphicBufferPool : public LightRefBase<GraphicBufferPool>
+{
+public:
+    GraphicBufferPool(size_t capacity);
+    ~GraphicBufferPool();
+
+    // a buffer owner recycled that has this size and format and at least
+    // these usage bits, or 0
+    sp<GraphicBuffer> take(const void* owner, uint32_t w, uint32_t h,
+            PixelFormat format, uint32_t usage);
+
+    // keeps a buffer owner doesn't use anymore
+    void recycle(const void* owner, const sp<GraphicBuffer>& buffer);
+
+    // drops the buffers owner recycled
+    void releaseOwner(const void* owner);
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    struct Entry {
+        const void* owner;
+        sp<GraphicBuffer> buffer;
+        size_t size;
+        nsecs_t time;       // when it was recycled
+    };
+
+    // evicts until the pool holds at most capacity bytes, and the buffers
+    // that are too old
+    void trimLocked(size_t capacity, nsecs_t now);
+
+    const size_t mCapacity;
+
+    mutable Mutex mLock;
+    Vector<Entry> mEntries;     // least recently recycled first
+    size_t mSize;
+
+    // statistics
+    uint32_t mRequests;
+    uint32_t mHits;
+    uint32_t mRecycled;
+    uint32_t mEvicted;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_GRAPHIC_BUFFER_POOL_H
@@ -54,14 +54,15 @@ namespace android {
 // ---------------------------------------------------------------------------
 
 Layer::Layer(SurfaceFlinger* flinger,
-        DisplayID display, const sp<Client>& client)
+        DisplayID display, const sp<Client>& client, GLuint textureName)
     :   LayerBaseClient(flinger, display, client),
-        mTextureName(-1U),
+        mTextureName(textureName),
         mQueuedFrames(0),
         mCurrentTransform(0),
         mCurrentScalingMode(NATIVE_WINDOW_SCALING_MODE_FREEZE),
         mCurrentOpacity(true),
         mRefreshPending(false),
+        mLatchRecomputeVisibleRegions(false),
         mFrameLatencyNeeded(false),
         mFrameLatencyOffset(0),
         mFormat(PIXEL_FORMAT_NONE),
@@ -72,17 +73,18 @@ Layer::Layer(SurfaceFlinger* flinger,
         mProtectedByApp(false)
 {
     mCurrentCrop.makeInvalid();
-    glGenTextures(1, &mTextureName);
 }
 
 void Layer::onLayerDisplayed() {
     if (mFrameLatencyNeeded) {
         const DisplayHardware& hw(graphicPlane(0).displayHardware());
+        const nsecs_t now = systemTime();
         mFrameStats[mFrameLatencyOffset].timestamp = mSurfaceTexture->getTimestamp();
-        mFrameStats[mFrameLatencyOffset].set = systemTime();
+        mFrameStats[mFrameLatencyOffset].set = now;
         mFrameStats[mFrameLatencyOffset].vsync = hw.getRefreshTimestamp();
         mFrameLatencyOffset = (mFrameLatencyOffset + 1) % 128;
         mFrameLatencyNeeded = false;
+        mTimeline.onFrameDisplayed(now, hw.getRefreshPeriod());
     }
 }
 
@@ -550,10 +552,114 @@ bool Layer::onPreComposition() {
     return mQueuedFrames > 0;
 }
 
+struct Layer::Reject : public SurfaceTexture::BufferRejecter {
+    Layer::State& front;
+    Layer::State& current;
+    bool& recomputeVisibleRegions;
+    Reject(Layer::State& front, Layer::State& current,
+            bool& recomputeVisibleRegions)
+        : front(front), current(current),
+          recomputeVisibleRegions(recomputeVisibleRegions) {
+    }
+
+    virtual bool reject(const sp<GraphicBuffer>& buf,
+            const BufferQueue::BufferItem& item) {
+        if (buf == NULL) {
+            return false;
+        }
+
+        uint32_t bufWidth  = buf->getWidth();
+        uint32_t bufHeight = buf->getHeight();
+
+        // check that we received a buffer of the right size
+        // (Take the buffer's orientation into account)
+        if (item.mTransform & Transform::ROT_90) {
+            swap(bufWidth, bufHeight);
+        }
+
+
+        bool isFixedSize = item.mScalingMode != NATIVE_WINDOW_SCALING_MODE_FREEZE;
+        if (front.active != front.requested) {
+
+            if (isFixedSize ||
+                    (bufWidth == front.requested.w &&
+                     bufHeight == front.requested.h))
+            {
+                // Here we pretend the transaction happened by updating the
+                // current and drawing states. Drawing state is only accessed
+                // in this thread, no need to have it locked
+                front.active = front.requested;
+
+                // We also need to update the current state so that
+                // we don't end-up overwriting the drawing state with
+                // this stale current state during the next transaction
+                //
+                // NOTE: We don't need to hold the transaction lock here
+                // because State::active is only accessed from this thread.
+                current.active = front.active;
+
+                // recompute visible region
+                recomputeVisibleRegions = true;
+            }
+
+            ALOGD_IF(DEBUG_RESIZE,
+                    "lockPageFlip: (layer=%p), buffer (%ux%u, tr=%02x), scalingMode=%d\n"
+                    "  drawing={ active   ={ wh={%4u,%4u} crop={%4d,%4d,%4d,%4d} (%4d,%4d) }\n"
+                    "            requested={ wh={%4u,%4u} crop={%4d,%4d,%4d,%4d} (%4d,%4d) }}\n",
+                    this, bufWidth, bufHeight, item.mTransform, item.mScalingMode,
+                    front.active.w, front.active.h,
+                    front.active.crop.left,
+                    front.active.crop.top,
+                    front.active.crop.right,
+                    front.active.crop.bottom,
+                    front.active.crop.getWidth(),
+                    front.active.crop.getHeight(),
+                    front.requested.w, front.requested.h,
+                    front.requested.crop.left,
+                    front.requested.crop.top,
+                    front.requested.crop.right,
+                    front.requested.crop.bottom,
+                    front.requested.crop.getWidth(),
+                    front.requested.crop.getHeight());
+        }
+
+        if (!isFixedSize) {
+            if (front.active.w != bufWidth ||
+                front.active.h != bufHeight) {
+                // reject this buffer
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+bool Layer::hasBufferToLatch() const {
+    return mQueuedFrames > 0 && !mRefreshPending;
+}
+
+void Layer::latchBuffer()
+{
+    ATRACE_CALL();
+
+    // lockPageFlip() runs next, on the main thread, and makes the same
+    // checks; it binds the buffer latched here. the rejecter only touches
+    // this layer's state.
+    if (hasBufferToLatch()) {
+        Reject r(mDrawingState, currentState(), mLatchRecomputeVisibleRegions);
+        mSurfaceTexture->latchTexImage(&r);
+    }
+}
+
 void Layer::lockPageFlip(bool& recomputeVisibleRegions)
 {
     ATRACE_CALL();
 
+    if (mLatchRecomputeVisibleRegions) {
+        mLatchRecomputeVisibleRegions = false;
+        recomputeVisibleRegions = true;
+    }
+
     if (mQueuedFrames > 0) {
 
         // if we've already called updateTexImage() without going through
@@ -574,88 +680,8 @@ void Layer::lockPageFlip(bool& recomputeVisibleRegions)
         if (android_atomic_dec(&mQueuedFrames) > 1) {
             mFlinger->signalLayerUpdate();
         }
-
-        struct Reject : public SurfaceTexture::BufferRejecter {
-            Layer::State& front;
-            Layer::State& current;
-            bool& recomputeVisibleRegions;
-            Reject(Layer::State& front, Layer::State& current,
-                    bool& recomputeVisibleRegions)
-                : front(front), current(current),
-                  recomputeVisibleRegions(recomputeVisibleRegions) {
-            }
-
-            virtual bool reject(const sp<GraphicBuffer>& buf,
-                    const BufferQueue::BufferItem& item) {
-                if (buf == NULL) {
-                    return false;
-                }
-
-                uint32_t bufWidth  = buf->getWidth();
-                uint32_t bufHeight = buf->getHeight();
-
-                // check that we received a buffer of the right size
-                // (Take the buffer's orientation into account)
-                if (item.mTransform & Transform::ROT_90) {
-                    swap(bufWidth, bufHeight);
-                }
-
-
-                bool isFixedSize = item.mScalingMode != NATIVE_WINDOW_SCALING_MODE_FREEZE;
-                if (front.active != front.requested) {
-
-                    if (isFixedSize ||
-                            (bufWidth == front.requested.w &&
-                             bufHeight == front.requested.h))
-                    {
-                        // Here we pretend the transaction happened by updating the
-                        // current and drawing states. Drawing state is only accessed
-                        // in this thread, no need to have it locked
-                        front.active = front.requested;
-
-                        // We also need to update the current state so that
-                        // we don't end-up overwriting the drawing state with
-                        // this stale current state during the next transaction
-                        //
-                        // NOTE: We don't need to hold the transaction lock here
-                        // because State::active is only accessed from this thread.
-                        current.active = front.active;
-
-                        // recompute visible region
-                        recomputeVisibleRegions = true;
-                    }
-
-                    ALOGD_IF(DEBUG_RESIZE,
-                            "lockPageFlip: (layer=%p), buffer (%ux%u, tr=%02x), scalingMode=%d\n"
-                            "  drawing={ active   ={ wh={%4u,%4u} crop={%4d,%4d,%4d,%4d} (%4d,%4d) }\n"
-                            "            requested={ wh={%4u,%4u} crop={%4d,%4d,%4d,%4d} (%4d,%4d) }}\n",
-                            this, bufWidth, bufHeight, item.mTransform, item.mScalingMode,
-                            front.active.w, front.active.h,
-                            front.active.crop.left,
-                            front.active.crop.top,
-                            front.active.crop.right,
-                            front.active.crop.bottom,
-                            front.active.crop.getWidth(),
-                            front.active.crop.getHeight(),
-                            front.requested.w, front.requested.h,
-                            front.requested.crop.left,
-                            front.requested.crop.top,
-                            front.requested.crop.right,
-                            front.requested.crop.bottom,
-                            front.requested.crop.getWidth(),
-                            front.requested.crop.getHeight());
-                }
-
-                if (!isFixedSize) {
-                    if (front.active.w != bufWidth ||
-                        front.active.h != bufHeight) {
-                        // reject this buffer
-                        return true;
-                    }
-                }
-                return false;
-            }
-        };
+        const nsecs_t latchTime = systemTime();
+        contentGeneration++;
 
 
         Reject r(mDrawingState, currentState(), recomputeVisibleRegions);
@@ -663,6 +689,7 @@ void Layer::lockPageFlip(bool& recomputeVisibleRegions)
         if (mSurfaceTexture->updateTexImage(&r) < NO_ERROR) {
             // something happened!
             recomputeVisibleRegions = true;
+            mTimeline.onFrameDropped();
             return;
         }
 
@@ -670,8 +697,12 @@ void Layer::lockPageFlip(bool& recomputeVisibleRegions)
         mActiveBuffer = mSurfaceTexture->getCurrentBuffer();
         if (mActiveBuffer == NULL) {
             // this can only happen if the very first buffer was rejected.
+            mTimeline.onFrameDropped();
             return;
         }
+        mTimeline.onFrameLatched(latchTime,
+                mSurfaceTexture->getFrameNumber(),
+                mSurfaceTexture->getQueueTime());
 
         mRefreshPending = true;
         mFrameLatencyNeeded = true;
@@ -788,10 +819,17 @@ void Layer::dumpStats(String8& result, char* buffer, size_t SIZE) const
     result.append("\n");
 }
 
+void Layer::dumpLatencyHistogram(String8& result, char* buffer, size_t SIZE) const
+{
+    LayerBaseClient::dumpLatencyHistogram(result, buffer, SIZE);
+    mTimeline.dump(result, "  ");
+}
+
 void Layer::clearStats()
 {
     LayerBaseClient::clearStats();
     memset(mFrameStats, 0, sizeof(mFrameStats));
+    mTimeline.clear();
 }
 
 uint32_t Layer::getEffectiveUsage(uint32_t usage) const
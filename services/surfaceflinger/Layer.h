@@ -34,6 +34,7 @@
 #include <GLES/gl.h>
 #include <GLES/glext.h>
 
+#include "FrameTimeline.h"
 #include "LayerBase.h"
 #include "SurfaceTextureLayer.h"
 #include "Transform.h"
@@ -51,7 +52,7 @@ class Layer : public LayerBaseClient
 {
 public:
             Layer(SurfaceFlinger* flinger, DisplayID display,
-                    const sp<Client>& client);
+                    const sp<Client>& client, GLuint textureName);
 
     virtual ~Layer();
 
@@ -80,6 +81,8 @@ public:
     virtual void onDraw(const Region& clip) const;
     virtual uint32_t doTransaction(uint32_t transactionFlags);
     virtual void lockPageFlip(bool& recomputeVisibleRegions);
+    virtual void latchBuffer();
+    virtual bool hasBufferToLatch() const;
     virtual void unlockPageFlip(const Transform& planeTransform, Region& outDirtyRegion);
     virtual bool isOpaque() const;
     virtual bool needsDithering() const     { return mNeedsDithering; }
@@ -103,10 +106,12 @@ protected:
     virtual void onFirstRef();
     virtual void dump(String8& result, char* scratch, size_t size) const;
     virtual void dumpStats(String8& result, char* buffer, size_t SIZE) const;
+    virtual void dumpLatencyHistogram(String8& result, char* buffer, size_t SIZE) const;
     virtual void clearStats();
 
 private:
     friend class SurfaceTextureLayer;
+    struct Reject;
     void onFrameQueued();
     virtual sp<ISurface> createSurface();
     uint32_t getEffectiveUsage(uint32_t usage) const;
@@ -131,6 +136,7 @@ private:
     uint32_t mCurrentScalingMode;
     bool mCurrentOpacity;
     bool mRefreshPending;
+    bool mLatchRecomputeVisibleRegions; // set by latchBuffer()
     bool mFrameLatencyNeeded;
     int mFrameLatencyOffset;
 
@@ -144,6 +150,9 @@ private:
     // protected by mLock
     Statistics mFrameStats[128];
 
+    // queue/latch/display timeline, see FrameTimeline.h for thread-safety
+    FrameTimeline mTimeline;
+
     // constants
     PixelFormat mFormat;
     const GLExtensions& mGLExtensions;
@@ -48,6 +48,8 @@ int32_t LayerBase::sSequence = 1;
 LayerBase::LayerBase(SurfaceFlinger* flinger, DisplayID display)
     : dpy(display), contentDirty(false),
       sequence(uint32_t(android_atomic_inc(&sSequence))),
+      visibilityDirty(true),
+      contentGeneration(0),
       mFlinger(flinger), mFiltering(false),
       mNeedsFiltering(false),
       mOrientation(0),
@@ -489,6 +491,9 @@ void LayerBase::shortDump(String8& result, char* scratch, size_t size) const {
 void LayerBase::dumpStats(String8& result, char* scratch, size_t SIZE) const {
 }
 
+void LayerBase::dumpLatencyHistogram(String8& result, char* scratch, size_t SIZE) const {
+}
+
 void LayerBase::clearStats() {
 }
 
@@ -64,6 +64,17 @@ public:
             Region      transparentRegionScreen;
             Region      coveredRegionScreen;
             int32_t     sequence;
+
+            // set when this layer's visible region must be recomputed, the
+            // regions below are the state of the traversal right above this
+            // layer, cached by computeVisibleRegions() for incremental updates
+            bool        visibilityDirty;
+            Region      aboveOpaqueLayersScreen;
+            Region      aboveCoveredLayersScreen;
+
+            // bumped each time what this layer draws may have changed,
+            // see CompositionCache
+            uint32_t    contentGeneration;
             
             struct Geometry {
                 uint32_t w;
@@ -170,6 +181,15 @@ public:
      * to figure out if the content or size of a surface has changed.
      */
     virtual void lockPageFlip(bool& recomputeVisibleRegions);
+
+    /**
+     * latchBuffer - called right before lockPageFlip, possibly on another
+     * thread and concurrently with other layers, to do the part of latching
+     * a new buffer that doesn't need the GL context.
+     * hasBufferToLatch tells whether there is any such work.
+     */
+    virtual void latchBuffer() { }
+    virtual bool hasBufferToLatch() const { return false; }
     
     /**
      * unlockPageFlip - called each time the screen is redrawn. updates the
@@ -223,6 +243,7 @@ public:
     virtual void dump(String8& result, char* scratch, size_t size) const;
     virtual void shortDump(String8& result, char* scratch, size_t size) const;
     virtual void dumpStats(String8& result, char* buffer, size_t SIZE) const;
+    virtual void dumpLatencyHistogram(String8& result, char* buffer, size_t SIZE) const;
     virtual void clearStats();
 
 
@@ -93,7 +93,7 @@ void MessageQueue::init(const sp<SurfaceFlinger>& flinger)
 void MessageQueue::setEventThread(const sp<EventThread>& eventThread)
 {
     mEventThread = eventThread;
-    mEvents = eventThread->createEventConnection();
+    mEvents = eventThread->createCompositorEventConnection();
     mEventTube = mEvents->getDataChannel();
     mLooper->addFd(mEventTube->getFd(), 0, ALOOPER_EVENT_INPUT,
             MessageQueue::cb_eventReceiver, this);
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_REORDERABLE_VECTOR_H
+#define ANDROID_SF_REORDERABLE_VECTOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Errors.h>
+#include <utils/SortedVector.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * A SortedVector whose items can change their sort key in place.
+ *
+ * After an item's key changed, reorder() moves it to its new place.
+ * Removing and adding it back shifts everything above both places,
+ * reorder() only shifts the items between the old and the new place,
+ * and finds the new place with a binary search on that side only.
+ * The items are moved with do_move_forward/backward(), so an sp<> or
+ * wp<> is moved without touching its reference counts.
+ *
+ * syncFrom() is for keeping a snapshot of such a vector. Assigning the
+ * vector shares its storage, and the next change to either one copies
+ * all of it, which for an sp<> means a reference count update per item.
+ * syncFrom() keeps the snapshot's own storage and only assigns the items
+ * that differ.
+ */
+template <class TYPE>
+class ReorderableVector : public SortedVector<TYPE>
+{
+public:
+    ReorderableVector() { }
+    ReorderableVector(const ReorderableVector<TYPE>& rhs)
+        : SortedVector<TYPE>(rhs) { }
+
+    // the item at index had its key changed, moves it where it belongs
+    // and returns its new index
+    ssize_t reorder(size_t index);
+
+    // makes this vector hold the same items as rhs, without sharing its
+    // storage
+    void syncFrom(const ReorderableVector<TYPE>& rhs);
+};
+
+template <class TYPE>
+ssize_t ReorderableVector<TYPE>::reorder(size_t index)
+{
+    const size_t count = this->size();
+    if (index >= count) {
+        return BAD_INDEX;
+    }
+
+    // don't make a copy of a shared array just to find out the item
+    // stays where it is
+    const TYPE* items = this->array();
+    size_t to = index;
+    if (index > 0 && this->do_compare(&items[index], &items[index-1]) < 0) {
+        // it moves down, before the first item of [0, index) above it
+        size_t l = 0;
+        size_t h = index;
+        while (l < h) {
+            const size_t m = (l + h) / 2;
+            if (this->do_compare(&items[m], &items[index]) > 0) {
+                h = m;
+            } else {
+                l = m + 1;
+            }
+        }
+        to = l;
+    } else if (index+1 < count &&
+            this->do_compare(&items[index], &items[index+1]) > 0) {
+        // it moves up, after the last item of (index, count) below it
+        size_t l = index + 1;
+        size_t h = count;
+        while (l < h) {
+            const size_t m = (l + h) / 2;
+            if (this->do_compare(&items[m], &items[index]) < 0) {
+                l = m + 1;
+            } else {
+                h = m;
+            }
+        }
+        to = l - 1;
+    }
+    if (to == index) {
+        return index;
+    }
+
+    // park the item in raw storage, shift the ones in between and put
+    // it back in its new slot. nothing is constructed or destroyed.
+    union {
+        char data[sizeof(TYPE)];
+        void* align;
+        int64_t align64;
+    } parked;
+    TYPE* const item = reinterpret_cast<TYPE*>(parked.data);
+    TYPE* const array = this->editArray();
+    this->do_move_forward(item, &array[index], 1);
+    if (to < index) {
+        this->do_move_forward(&array[to+1], &array[to], index - to);
+    } else {
+        this->do_move_backward(&array[index], &array[index+1], to - index);
+    }
+    this->do_move_forward(&array[to], item, 1);
+    return to;
+}
+
+template <class TYPE>
+void ReorderableVector<TYPE>::syncFrom(const ReorderableVector<TYPE>& rhs)
+{
+    const size_t count = rhs.size();
+    if (this->size() > count) {
+        this->removeItemsAt(count, this->size() - count);
+    }
+    const size_t common = this->size();
+    const TYPE* const items = rhs.array();
+    TYPE* array = 0;
+    for (size_t i=0 ; i<common ; i++) {
+        if (this->array()[i] != items[i]) {
+            if (!array) {
+                array = this->editArray();
+            }
+            array[i] = items[i];
+        }
+    }
+    // the first items are now those of rhs, in the same order, so the
+    // others are added at the end
+    for (size_t i=common ; i<count ; i++) {
+        this->add(items[i]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_REORDERABLE_VECTOR_H
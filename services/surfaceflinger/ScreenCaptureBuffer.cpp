@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <utils/Errors.h>
+#include <utils/Log.h>
+#include <utils/Trace.h>
+
+#include <binder/MemoryHeapBase.h>
+
+#include <hardware/gralloc.h>
+
+#include "ScreenCaptureBuffer.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+ScreenCaptureBuffer::ScreenCaptureBuffer(EGLDisplay dpy, uint32_t w, uint32_t h)
+    : mDisplay(dpy), mWidth(w), mHeight(h), mOwnsBuffer(true),
+      mImage(EGL_NO_IMAGE_KHR), mRenderbuffer(0), mFramebuffer(0),
+      mTexture(0), mStatus(NO_INIT)
+{
+    mGraphicBuffer = new GraphicBuffer(w, h, PIXEL_FORMAT_RGBA_8888,
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE |
+            GRALLOC_USAGE_SW_READ_OFTEN);
+    status_t err = mGraphicBuffer->initCheck();
+    if (err != NO_ERROR) {
+        ALOGE("ScreenCaptureBuffer: couldn't allocate %ux%u buffer (%s)",
+                w, h, strerror(-err));
+        mStatus = err;
+        return;
+    }
+    mStatus = init();
+}
+
+ScreenCaptureBuffer::ScreenCaptureBuffer(EGLDisplay dpy,
+        const sp<GraphicBuffer>& buffer)
+    : mDisplay(dpy), mWidth(buffer->getWidth()), mHeight(buffer->getHeight()),
+      mOwnsBuffer(false), mGraphicBuffer(buffer),
+      mImage(EGL_NO_IMAGE_KHR), mRenderbuffer(0), mFramebuffer(0),
+      mTexture(0), mStatus(NO_INIT)
+{
+    mStatus = init();
+}
+
+status_t ScreenCaptureBuffer::init()
+{
+    EGLint attrs[] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
+    mImage = eglCreateImageKHR(mDisplay, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID,
+            EGLClientBuffer(mGraphicBuffer->getNativeBuffer()), attrs);
+    if (mImage == EGL_NO_IMAGE_KHR) {
+        ALOGE("ScreenCaptureBuffer: eglCreateImageKHR failed (%#x)",
+                eglGetError());
+        return INVALID_OPERATION;
+    }
+
+    // make sure to clear all GL error flags
+    while ( glGetError() != GL_NO_ERROR ) ;
+
+    glGenRenderbuffersOES(1, &mRenderbuffer);
+    glBindRenderbufferOES(GL_RENDERBUFFER_OES, mRenderbuffer);
+    glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER_OES,
+            GLeglImageOES(mImage));
+
+    glGenFramebuffersOES(1, &mFramebuffer);
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, mFramebuffer);
+    glFramebufferRenderbufferOES(GL_FRAMEBUFFER_OES,
+            GL_COLOR_ATTACHMENT0_OES, GL_RENDERBUFFER_OES, mRenderbuffer);
+
+    GLenum status = glCheckFramebufferStatusOES(GL_FRAMEBUFFER_OES);
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE_OES || glGetError() != GL_NO_ERROR) {
+        ALOGE("ScreenCaptureBuffer: incomplete framebuffer (%#x)", status);
+        return INVALID_OPERATION;
+    }
+
+    return NO_ERROR;
+}
+
+ScreenCaptureBuffer::~ScreenCaptureBuffer()
+{
+    if (mTexture) {
+        glDeleteTextures(1, &mTexture);
+    }
+    if (mFramebuffer) {
+        glDeleteFramebuffersOES(1, &mFramebuffer);
+    }
+    if (mRenderbuffer) {
+        glDeleteRenderbuffersOES(1, &mRenderbuffer);
+    }
+    if (mImage != EGL_NO_IMAGE_KHR) {
+        eglDestroyImageKHR(mDisplay, mImage);
+    }
+}
+
+status_t ScreenCaptureBuffer::initCheck() const
+{
+    return mStatus;
+}
+
+void ScreenCaptureBuffer::bind() const
+{
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, mFramebuffer);
+}
+
+GLuint ScreenCaptureBuffer::getTextureName()
+{
+    if (mTexture || mStatus != NO_ERROR) {
+        return mTexture;
+    }
+
+    // make sure to clear all GL error flags
+    while ( glGetError() != GL_NO_ERROR ) ;
+
+    GLuint tname;
+    glGenTextures(1, &tname);
+    glBindTexture(GL_TEXTURE_2D, tname);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, GLeglImageOES(mImage));
+    if (glGetError() != GL_NO_ERROR) {
+        ALOGE("ScreenCaptureBuffer: couldn't bind the image to a texture");
+        glDeleteTextures(1, &tname);
+        return 0;
+    }
+    mTexture = tname;
+    return mTexture;
+}
+
+// ---------------------------------------------------------------------------
+
+ScreenCaptureQueue::ScreenCaptureQueue(size_t count)
+    : mDisplay(EGL_NO_DISPLAY), mCount(count), mNext(0),
+      mRandomFd(open("/dev/urandom", O_RDONLY)),
+      mSlots(new Slot[count])
+{
+    if (mRandomFd < 0) {
+        ALOGE("ScreenCaptureQueue: couldn't open /dev/urandom (%s)",
+                strerror(errno));
+    }
+}
+
+ScreenCaptureQueue::~ScreenCaptureQueue()
+{
+    for (size_t i=0 ; i<mCount ; i++) {
+        if (mSlots[i].fence != EGL_NO_SYNC_KHR) {
+            eglDestroySyncKHR(mDisplay, mSlots[i].fence);
+        }
+    }
+    delete [] mSlots;
+    if (mRandomFd >= 0) {
+        close(mRandomFd);
+    }
+}
+
+int32_t ScreenCaptureQueue::newTokenLocked()
+{
+    // tokens must not be guessable, or any client allowed to collect
+    // could read captures it didn't request
+    int32_t token;
+    do {
+        if (mRandomFd < 0 ||
+                read(mRandomFd, &token, sizeof(token)) != sizeof(token)) {
+            return 0;
+        }
+        token &= 0x7fffffff;
+    } while (token == 0 || findSlotLocked(token) != NULL);
+    return token;
+}
+
+ScreenCaptureQueue::Slot* ScreenCaptureQueue::findSlotLocked(
+        int32_t token) const
+{
+    for (size_t i=0 ; i<mCount ; i++) {
+        if (mSlots[i].token == token) {
+            return &mSlots[i];
+        }
+    }
+    return NULL;
+}
+
+ScreenCaptureQueue::Slot* ScreenCaptureQueue::dequeueSlotLocked(
+        EGLDisplay dpy, pid_t pid, uid_t uid)
+{
+    mDisplay = dpy;
+
+    const int32_t t = newTokenLocked();
+    if (t == 0) {
+        ALOGE("ScreenCaptureQueue: couldn't generate a token");
+        return NULL;
+    }
+    Slot& slot(mSlots[mNext]);
+    mNext = (mNext + 1) % mCount;
+
+    // this slot's previous capture is now stale
+    if (slot.fence != EGL_NO_SYNC_KHR) {
+        eglDestroySyncKHR(dpy, slot.fence);
+        slot.fence = EGL_NO_SYNC_KHR;
+    }
+    slot.token = t;
+    slot.pid = pid;
+    slot.uid = uid;
+    slot.queued = false;
+    slot.collected = false;
+    return &slot;
+}
+
+sp<ScreenCaptureBuffer> ScreenCaptureQueue::dequeue(EGLDisplay dpy,
+        uint32_t w, uint32_t h, pid_t pid, uid_t uid, int32_t* token)
+{
+    Mutex::Autolock _l(mLock);
+    Slot* slot = dequeueSlotLocked(dpy, pid, uid);
+    if (slot == NULL)
+        return 0;
+
+    sp<ScreenCaptureBuffer>& capture(slot->capture);
+    if (capture == 0 || !capture->ownsBuffer() ||
+            capture->getWidth() != w || capture->getHeight() != h ||
+            capture->initCheck() != NO_ERROR) {
+        capture = new ScreenCaptureBuffer(dpy, w, h);
+        if (capture->initCheck() != NO_ERROR) {
+            capture.clear();
+            slot->token = 0;
+            return 0;
+        }
+    }
+    *token = slot->token;
+    return capture;
+}
+
+sp<ScreenCaptureBuffer> ScreenCaptureQueue::dequeue(EGLDisplay dpy,
+        const sp<GraphicBuffer>& buffer, pid_t pid, uid_t uid,
+        int32_t* token)
+{
+    Mutex::Autolock _l(mLock);
+    Slot* slot = dequeueSlotLocked(dpy, pid, uid);
+    if (slot == NULL)
+        return 0;
+
+    // the client's buffer comes through a new handle every time, so the
+    // EGLImage can't be reused. the slot keeps it until the GPU is done.
+    sp<ScreenCaptureBuffer>& capture(slot->capture);
+    capture = new ScreenCaptureBuffer(dpy, buffer);
+    if (capture->initCheck() != NO_ERROR) {
+        capture.clear();
+        slot->token = 0;
+        return 0;
+    }
+    *token = slot->token;
+    return capture;
+}
+
+void ScreenCaptureQueue::queue(int32_t token, EGLSyncKHR fence)
+{
+    Mutex::Autolock _l(mLock);
+    Slot* slot = findSlotLocked(token);
+    if (slot == NULL) {
+        // can't happen, dequeue() and queue() are both on the main thread
+        if (fence != EGL_NO_SYNC_KHR) {
+            eglDestroySyncKHR(mDisplay, fence);
+        }
+        return;
+    }
+    slot->fence = fence;
+    slot->queued = true;
+}
+
+status_t ScreenCaptureQueue::acquireAndWait(int32_t token,
+        pid_t pid, uid_t uid, sp<GraphicBuffer>* buffer)
+{
+    if (token <= 0)
+        return BAD_VALUE;
+
+    EGLSyncKHR fence;
+    EGLDisplay dpy;
+    { // scope for the lock
+        Mutex::Autolock _l(mLock);
+        Slot* slot = findSlotLocked(token);
+        // someone else's token looks just like a stale one
+        if (slot == NULL || slot->pid != pid || slot->uid != uid ||
+                !slot->queued || slot->collected || slot->capture == 0)
+            return BAD_VALUE;
+        // a capture is collected once, so whoever collects it always waits
+        // for its fence. we only hold the GraphicBuffer, the GL objects
+        // must never be released from this thread. the fence is ours now.
+        slot->collected = true;
+        *buffer = slot->capture->getGraphicBuffer();
+        fence = slot->fence;
+        slot->fence = EGL_NO_SYNC_KHR;
+        dpy = mDisplay;
+    }
+
+    if (fence != EGL_NO_SYNC_KHR) {
+        ScopedTrace _t(ATRACE_TAG, "waitForCapture");
+        EGLint result = eglClientWaitSyncKHR(dpy, fence, 0, 1000000000);
+        eglDestroySyncKHR(dpy, fence);
+        if (result == EGL_FALSE) {
+            ALOGE("ScreenCaptureQueue: error waiting for fence: %#x",
+                    eglGetError());
+            return UNKNOWN_ERROR;
+        } else if (result == EGL_TIMEOUT_EXPIRED_KHR) {
+            ALOGE("ScreenCaptureQueue: timeout waiting for fence");
+            return TIMED_OUT;
+        }
+    }
+    return NO_ERROR;
+}
+
+status_t ScreenCaptureQueue::wait(int32_t token, pid_t pid, uid_t uid)
+{
+    ATRACE_CALL();
+
+    sp<GraphicBuffer> buffer;
+    return acquireAndWait(token, pid, uid, &buffer);
+}
+
+status_t ScreenCaptureQueue::collect(int32_t token, pid_t pid, uid_t uid,
+        sp<IMemoryHeap>* heap, uint32_t* w, uint32_t* h, PixelFormat* f)
+{
+    ATRACE_CALL();
+
+    sp<GraphicBuffer> buffer;
+    status_t err = acquireAndWait(token, pid, uid, &buffer);
+    if (err != NO_ERROR)
+        return err;
+
+    const uint32_t bw = buffer->getWidth();
+    const uint32_t bh = buffer->getHeight();
+    const size_t bpr = bw * 4;
+    sp<MemoryHeapBase> base(new MemoryHeapBase(bpr * bh, 0, "screen-capture"));
+    uint8_t* dst = static_cast<uint8_t*>(base->getBase());
+    if (dst == 0 || dst == MAP_FAILED)
+        return NO_MEMORY;
+
+    uint8_t* src;
+    err = buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN, (void**)&src);
+    if (err != NO_ERROR)
+        return err;
+    const size_t stride = buffer->getStride() * 4;
+    if (stride == bpr) {
+        memcpy(dst, src, bpr * bh);
+    } else {
+        for (uint32_t y=0 ; y<bh ; y++) {
+            memcpy(dst, src, bpr);
+            dst += bpr;
+            src += stride;
+        }
+    }
+    buffer->unlock();
+
+    { // the slot may have been recycled while we were copying
+        Mutex::Autolock _l(mLock);
+        if (findSlotLocked(token) == NULL)
+            return BAD_VALUE;
+    }
+
+    *heap = base;
+    *w = bw;
+    *h = bh;
+    *f = PIXEL_FORMAT_RGBA_8888;
+    return NO_ERROR;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
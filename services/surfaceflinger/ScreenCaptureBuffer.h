@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_SCREEN_CAPTURE_BUFFER_H
+#define ANDROID_SF_SCREEN_CAPTURE_BUFFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES/gl.h>
+#include <GLES/glext.h>
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+
+#include <binder/IMemory.h>
+
+#include <ui/GraphicBuffer.h>
+#include <ui/PixelFormat.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * A gralloc buffer bound to an FBO through an EGLImage, so that the screen
+ * can be rendered straight into memory that is shared with the client.
+ * All methods must be called on the main thread, with the GL context current.
+ */
+class ScreenCaptureBuffer : public LightRefBase<ScreenCaptureBuffer>
+{
+public:
+    // allocates a w x h RGBA_8888 buffer
+    ScreenCaptureBuffer(EGLDisplay dpy, uint32_t w, uint32_t h);
+    // renders into a buffer allocated by someone else
+    ScreenCaptureBuffer(EGLDisplay dpy, const sp<GraphicBuffer>& buffer);
+    ~ScreenCaptureBuffer();
+
+    status_t initCheck() const;
+
+    // bind this buffer's FBO as the current framebuffer
+    void bind() const;
+
+    // a GL_TEXTURE_2D texture sampling this buffer, created on first use.
+    // 0 if it couldn't be created.
+    GLuint getTextureName();
+
+    uint32_t getWidth() const { return mWidth; }
+    uint32_t getHeight() const { return mHeight; }
+    // false if the buffer was allocated by someone else
+    bool ownsBuffer() const { return mOwnsBuffer; }
+    const sp<GraphicBuffer>& getGraphicBuffer() const { return mGraphicBuffer; }
+
+private:
+    ScreenCaptureBuffer(const ScreenCaptureBuffer&);
+    ScreenCaptureBuffer& operator = (const ScreenCaptureBuffer&);
+
+    status_t init();
+
+    EGLDisplay mDisplay;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    bool mOwnsBuffer;
+    sp<GraphicBuffer> mGraphicBuffer;
+    EGLImageKHR mImage;
+    GLuint mRenderbuffer;
+    GLuint mFramebuffer;
+    GLuint mTexture;
+    status_t mStatus;
+};
+
+/*
+ * A ring of ScreenCaptureBuffers for the captures the GPU renders while
+ * the caller goes on.
+ *
+ * The main thread dequeue()s a buffer, renders into it, and queue()s it
+ * along with a fence; it never waits for the GPU. collect() is called from
+ * a binder thread: it waits for the fence and copies the pixels out of the
+ * gralloc buffer, so the readback never blocks composition. Captures into
+ * a client's own buffer only need wait(), there is nothing to copy.
+ *
+ * Tokens identify a capture. They're random, belong to the pid and uid
+ * that requested the capture, and can be collected only once; once the
+ * ring wraps around, the slot is reused and older tokens become stale.
+ */
+class ScreenCaptureQueue
+{
+public:
+    ScreenCaptureQueue(size_t count);
+    ~ScreenCaptureQueue();
+
+    // main thread only, with the GL context current
+    sp<ScreenCaptureBuffer> dequeue(EGLDisplay dpy,
+            uint32_t w, uint32_t h, pid_t pid, uid_t uid, int32_t* token);
+    sp<ScreenCaptureBuffer> dequeue(EGLDisplay dpy,
+            const sp<GraphicBuffer>& buffer, pid_t pid, uid_t uid,
+            int32_t* token);
+    void queue(int32_t token, EGLSyncKHR fence);
+
+    // any thread
+    status_t collect(int32_t token, pid_t pid, uid_t uid,
+            sp<IMemoryHeap>* heap, uint32_t* w, uint32_t* h, PixelFormat* f);
+    status_t wait(int32_t token, pid_t pid, uid_t uid);
+
+private:
+    struct Slot {
+        Slot() : fence(EGL_NO_SYNC_KHR), token(0), pid(0), uid(0),
+                queued(false), collected(false) { }
+        sp<ScreenCaptureBuffer> capture;
+        EGLSyncKHR fence;
+        int32_t token;
+        pid_t pid;
+        uid_t uid;
+        bool queued;
+        bool collected;
+    };
+
+    // a new token that no slot uses, 0 on error. called with mLock held.
+    int32_t newTokenLocked();
+    // the next slot, holding a new token. called with mLock held.
+    Slot* dequeueSlotLocked(EGLDisplay dpy, pid_t pid, uid_t uid);
+    // takes the capture for token and waits until it's rendered
+    status_t acquireAndWait(int32_t token, pid_t pid, uid_t uid,
+            sp<GraphicBuffer>* buffer);
+    // the slot holding token, or NULL. called with mLock held.
+    Slot* findSlotLocked(int32_t token) const;
+
+    EGLDisplay mDisplay;
+    const size_t mCount;
+    size_t mNext;
+    int mRandomFd;
+
+    // protects mSlots tokens and fences, the ScreenCaptureBuffers themselves
+    // are only created and destroyed on the main thread.
+    mutable Mutex mLock;
+    Slot* mSlots;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_SCREEN_CAPTURE_BUFFER_H
@@ -89,22 +89,50 @@ SurfaceFlinger::SurfaceFlinger()
     :   BnSurfaceComposer(), Thread(false),
         mTransactionFlags(0),
         mTransationPending(false),
+        mMergedLayerStates(0),
         mLayersRemoved(false),
         mBootTime(systemTime()),
         mVisibleRegionsDirty(false),
+        mFullVisibleRegionsDirty(true),
         mHwWorkListDirty(false),
         mElectronBeamAnimationMode(0),
+        mScreenCaptureQueue(ISurfaceComposer::eNumCaptureBuffers),
+        mScreenSnapshotDirty(true),
+        mScreenSnapshotRenders(0),
+        mScreenSnapshotReuses(0),
         mDebugRegion(0),
         mDebugDDMS(0),
         mDebugDisableHWC(0),
         mDebugDisableTransformHint(0),
+        mDebugCheckVisibleRegions(0),
         mDebugInSwapBuffers(0),
         mLastSwapBufferTime(0),
         mDebugInTransaction(0),
         mLastTransactionTime(0),
+        mRepaintVsyncTime(0),
+        mMissedRefreshCount(0),
         mBootFinished(false),
         mSecureFrameBuffer(0),
-        mUseDithering(0)
+        mUseDithering(0),
+        mIncrementalVisibleRegions(true),
+        mFullVisibleRegionsCount(0),
+        mIncrementalVisibleRegionsCount(0),
+        mVisibleRegionsLayersSkipped(0),
+        mOccludedLayersSkipped(0),
+        mPartialRepaintCount(0),
+        mFullRepaintCount(0),
+        mPipelinedTransactions(false),
+        mDeferredTransactionFrames(0),
+        mDeferredTransactionCount(0),
+        mLatchWorkers(0),
+        mAsyncSurfaceCreation(true),
+        mTextureNamesRefillPending(false),
+        mAsyncSurfacesCreated(0),
+        mSyncSurfacesCreated(0),
+        mSkipIdleFrames(true),
+        mBuffersLatched(false),
+        mFramesComposed(0),
+        mIdleFramesSkipped(0)
 {
     init();
 #ifdef BOARD_USES_SAMSUNG_HDMI
@@ -148,9 +176,52 @@ void SurfaceFlinger::init()
     property_get("persist.sys.use_dithering", value, "1");
     mUseDithering = atoi(value);
 
+    property_get("debug.sf.incremental_vr", value, "1");
+    mIncrementalVisibleRegions = atoi(value) ? true : false;
+
+    property_get("debug.sf.check_vr", value, "0");
+    mDebugCheckVisibleRegions = atoi(value);
+
+    property_get("debug.sf.pipelined_transactions", value, "0");
+    mPipelinedTransactions = atoi(value) ? true : false;
+
+    property_get("debug.sf.layer_cache_frames", value, "0");
+    mCompositionCache.setThreshold(atoi(value) > 0 ? atoi(value) : 0);
+
+    property_get("debug.sf.latch_threads", value, "0");
+    if (atoi(value) > 0) {
+        mLatchWorkers = new WorkerPool(atoi(value), "SFLatch");
+    }
+
+    property_get("debug.sf.async_create", value, "1");
+    mAsyncSurfaceCreation = atoi(value) ? true : false;
+
+    property_get("debug.sf.skip_idle_frames", value, "1");
+    mSkipIdleFrames = atoi(value) ? true : false;
+
+    // the pool only ages its buffers out when one is taken or recycled, so
+    // it holds on to up to that much memory while nothing allocates
+    property_get("debug.sf.buffer_pool_kb", value, "0");
+    if (atoi(value) > 0) {
+        mGraphicBufferPool = new GraphicBufferPool(size_t(atoi(value)) * 1024);
+    }
+
     ALOGI_IF(mDebugRegion,       "showupdates enabled");
     ALOGI_IF(mDebugDDMS,         "DDMS debugging enabled");
     ALOGI_IF(mUseDithering,      "use dithering");
+    ALOGI_IF(!mIncrementalVisibleRegions,
+            "incremental visible regions disabled");
+    ALOGI_IF(mDebugCheckVisibleRegions,
+            "visible regions cross-check enabled");
+    ALOGI_IF(mPipelinedTransactions, "pipelined transactions enabled");
+    ALOGI_IF(mCompositionCache.getThreshold(),
+            "composition cache enabled (%u frames)",
+            mCompositionCache.getThreshold());
+    ALOGI_IF(mLatchWorkers, "parallel buffer latching enabled (%u threads)",
+            mLatchWorkers ? uint32_t(mLatchWorkers->getThreadCount()) : 0);
+    ALOGI_IF(!mAsyncSurfaceCreation, "asynchronous surface creation disabled");
+    ALOGI_IF(!mSkipIdleFrames, "idle frame skipping disabled");
+    ALOGI_IF(mGraphicBufferPool != 0, "graphic buffer recycling enabled");
 }
 
 void SurfaceFlinger::onFirstRef()
@@ -167,6 +238,10 @@ void SurfaceFlinger::onFirstRef()
 SurfaceFlinger::~SurfaceFlinger()
 {
     glDeleteTextures(1, &mWormholeTexName);
+    if (!mTextureNames.isEmpty()) {
+        glDeleteTextures(mTextureNames.size(), mTextureNames.array());
+    }
+    delete mLatchWorkers;
 }
 
 void SurfaceFlinger::binderDied(const wp<IBinder>& who)
@@ -199,7 +274,7 @@ sp<ISurfaceComposerClient> SurfaceFlinger::createConnection()
 
 sp<IGraphicBufferAlloc> SurfaceFlinger::createGraphicBufferAlloc()
 {
-    sp<GraphicBufferAlloc> gba(new GraphicBufferAlloc());
+    sp<GraphicBufferAlloc> gba(new GraphicBufferAlloc(mGraphicBufferPool));
     return gba;
 }
 
@@ -330,6 +405,8 @@ status_t SurfaceFlinger::readyToRun()
     // put the origin in the left-bottom corner
     glOrthof(0, w, 0, h, 0, 1); // l=0, r=w ; b=0, t=h
 
+    // texture names for the first layers
+    refillTextureNames();
 
     // start the EventThread
     mEventThread = new EventThread(this);
@@ -448,7 +525,8 @@ void SurfaceFlinger::onMessageReceived(int32_t what)
         case MessageQueue::REFRESH: {
 //        case MessageQueue::INVALIDATE: {
             // if we're in a global transaction, don't do anything.
-            const uint32_t mask = eTransactionNeeded | eTraversalNeeded;
+            const uint32_t mask = eTransactionNeeded | eTraversalNeeded |
+                    eTransactionQueued;
             uint32_t transactionFlags = peekTransactionFlags(mask);
             if (CC_UNLIKELY(transactionFlags)) {
                 handleTransaction(transactionFlags);
@@ -467,22 +545,47 @@ void SurfaceFlinger::onMessageReceived(int32_t what)
 
             const DisplayHardware& hw(graphicPlane(0).displayHardware());
 
+            if (!mDirtyRegion.isEmpty()) {
+                mScreenSnapshotDirty = true;
+            }
+
 //            if (mDirtyRegion.isEmpty()) {
 //                return;
 //            }
 
-            if (CC_UNLIKELY(mHwWorkListDirty)) {
+            // handleWorkList() clears mHwWorkListDirty
+            const bool workListRebuilt = mHwWorkListDirty;
+            if (CC_UNLIKELY(workListRebuilt)) {
                 // build the h/w work list
                 handleWorkList();
             }
 
             if (CC_LIKELY(hw.canDraw())) {
+                if (mSkipIdleFrames && mDirtyRegion.isEmpty() &&
+                        !mBuffersLatched && !workListRebuilt) {
+                    // nothing on screen changed and no layer has a new
+                    // buffer the h/w composer could be holding on to,
+                    // the frame would be identical to the last one.
+                    mIdleFramesSkipped++;
+                    break;
+                }
+                mFramesComposed++;
                 // repaint the framebuffer (if needed)
                 handleRepaint();
                 // inform the h/w that we're done compositing
                 hw.compositionComplete();
                 postFramebuffer();
             } else {
+                if (mScreenSnapshot != 0 && mScreenSnapshotDirty) {
+                    // the screen is off, and what it'll show when it's
+                    // turned back on changed: update the snapshot now
+                    // rather than when the power key is pressed.
+                    GLuint tname;
+                    getScreenSnapshotLocked(&tname);
+                    // the screen is repainted entirely when it's turned
+                    // back on, only what changes from now on matters.
+                    mDirtyRegion.clear();
+                }
                 // pretend we did the post
                 hw.compositionComplete();
             }
@@ -509,8 +612,19 @@ void SurfaceFlinger::postFramebuffer()
         mVisibleLayersSortedByZ[i]->onLayerDisplayed();
     }
 
+    const nsecs_t posted = systemTime();
+    if (mRepaintVsyncTime) {
+        // only repaints started for a refresh are timed, not the
+        // electron-beam animation or screenshot posts
+        const nsecs_t latency = posted - mRepaintVsyncTime;
+        mCompositionLatency.add(latency);
+        if (latency > (hw.getRefreshPeriod() * 3) / 2) {
+            mMissedRefreshCount++;
+        }
+        mRepaintVsyncTime = 0;
+    }
 
-    mLastSwapBufferTime = systemTime() - now;
+    mLastSwapBufferTime = posted - now;
     mDebugInSwapBuffers = 0;
     mSwapRegion.clear();
 }
@@ -519,24 +633,52 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
 {
     ATRACE_CALL();
 
-    Mutex::Autolock _l(mStateLock);
+    if (!mPipelinedTransactions) {
+        mStateLock.lock();
+    } else if (mStateLock.tryLock() < 0) {
+        // a client is staging a transaction (or someone else holds the
+        // state lock), don't make this frame wait for it: compose with
+        // the state we already have and pick the transaction up at the
+        // next refresh, unless we've already deferred it too many times.
+        if (mDeferredTransactionFrames < MAX_DEFERRED_TRANSACTION_FRAMES) {
+            mDeferredTransactionFrames++;
+            mDeferredTransactionCount++;
+            signalTransaction();
+            return;
+        }
+        ScopedTrace _t(ATRACE_TAG, "waitForTransaction");
+        mStateLock.lock();
+    }
+    mDeferredTransactionFrames = 0;
+
     const nsecs_t now = systemTime();
     mDebugInTransaction = now;
 
-    // Here we're guaranteed that some transaction flags are set
-    // so we can call handleTransactionLocked() unconditionally.
     // We call getTransactionFlags(), which will also clear the flags,
     // with mStateLock held to guarantee that mCurrentState won't change
     // until the transaction is committed.
 
-    const uint32_t mask = eTransactionNeeded | eTraversalNeeded;
+    const uint32_t mask = eTransactionNeeded | eTraversalNeeded |
+            eTransactionQueued;
     transactionFlags = getTransactionFlags(mask);
-    handleTransactionLocked(transactionFlags);
+    if (transactionFlags & eTransactionQueued) {
+        // apply what clients have queued since the last frame. the flag is
+        // cleared first, so anything queued from now on will signal again.
+        transactionFlags &= ~eTransactionQueued;
+        transactionFlags |= drainTransactionQueueLocked();
+    }
+
+    // the queued transactions may all have been no-ops
+    if (transactionFlags) {
+        handleTransactionLocked(transactionFlags);
+        invalidateHwcGeometry();
+        // here the transaction has been committed
+    }
 
     mLastTransactionTime = systemTime() - now;
     mDebugInTransaction = 0;
-    invalidateHwcGeometry();
-    // here the transaction has been committed
+
+    mStateLock.unlock();
 }
 
 void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
@@ -556,9 +698,18 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
             uint32_t trFlags = layer->getTransactionFlags(eTransactionNeeded);
             if (!trFlags) continue;
 
+            const uint32_t z = layer->drawingState().z;
             const uint32_t flags = layer->doTransaction(0);
-            if (flags & Layer::eVisibleRegion)
+            layer->contentGeneration++;
+            if (flags & Layer::eVisibleRegion) {
                 mVisibleRegionsDirty = true;
+                layer->visibilityDirty = true;
+            }
+            if (layer->drawingState().z != z) {
+                // the layer moved in the Z order, all the layers it used
+                // to be above of are affected.
+                mFullVisibleRegionsDirty = true;
+            }
         }
     }
 
@@ -587,7 +738,9 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
             dcblk->h = plane.getHeight();
 
             mVisibleRegionsDirty = true;
+            mFullVisibleRegionsDirty = true;
             mDirtyRegion.set(hw.bounds());
+            mCompositionCache.invalidate();
 
 #if defined(BOARD_USES_SAMSUNG_HDMI) && defined(SAMSUNG_EXYNOS5250)
             HWComposer& hwc(graphicPlane(0).displayHardware().getHwComposer());
@@ -613,6 +766,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
         if (currentLayers.size() > mDrawingState.layersSortedByZ.size()) {
             // layers have been added
             mVisibleRegionsDirty = true;
+            mFullVisibleRegionsDirty = true;
         }
 
         // some layers might have been removed, so
@@ -620,6 +774,7 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
         if (mLayersRemoved) {
             mLayersRemoved = false;
             mVisibleRegionsDirty = true;
+            mFullVisibleRegionsDirty = true;
             const LayerVector& previousLayers(mDrawingState.layersSortedByZ);
             const size_t count = previousLayers.size();
             for (size_t i=0 ; i<count ; i++) {
@@ -635,6 +790,52 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
     commitTransaction();
 }
 
+/*
+ * computeLayerFootprint - computes the on-screen footprint of a layer, without
+ * taking the layers above it into account, as well as its opaque region.
+ */
+static void computeLayerFootprint(const sp<LayerBase>& layer,
+        const Region& screenRegion, Region& visibleRegion, Region& opaqueRegion)
+{
+    // start with the whole surface at its current location
+    const Layer::State& s(layer->drawingState());
+
+    // handle hidden surfaces by setting the visible region to empty
+    if (CC_LIKELY(!(s.flags & ISurfaceComposer::eLayerHidden) && s.alpha)) {
+        const bool translucent = !layer->isOpaque();
+        const Rect bounds(layer->visibleBounds());
+        visibleRegion.set(bounds);
+        visibleRegion.andSelf(screenRegion);
+        if (!visibleRegion.isEmpty()) {
+            // Remove the transparent area from the visible region
+            if (translucent) {
+                visibleRegion.subtractSelf(layer->transparentRegionScreen);
+            }
+
+            // compute the opaque region
+            const int32_t layerOrientation = layer->getOrientation();
+            if (s.alpha==255 && !translucent &&
+                    ((layerOrientation & Transform::ROT_INVALID) == false)) {
+                // the opaque region is the layer's footprint
+                opaqueRegion = visibleRegion;
+            }
+        }
+    }
+}
+
+static bool coversScreen(const Region& opaqueRegion, const Region& screenRegion)
+{
+    // the bounds test is cheap and rules out most cases, only subtract
+    // the regions once the opaque layers span the whole screen
+    const Rect b(opaqueRegion.getBounds());
+    const Rect s(screenRegion.getBounds());
+    if (b.left > s.left || b.top > s.top ||
+            b.right < s.right || b.bottom < s.bottom) {
+        return false;
+    }
+    return screenRegion.subtract(opaqueRegion).isEmpty();
+}
+
 void SurfaceFlinger::computeVisibleRegions(
     const LayerVector& currentLayers, Region& dirtyRegion, Region& opaqueRegion)
 {
@@ -648,16 +849,69 @@ void SurfaceFlinger::computeVisibleRegions(
     Region aboveOpaqueLayers;
     Region aboveCoveredLayers;
     Region dirty;
+    Region newExposed;
+    Region oldExposed;
 
     bool secureFrameBuffer = false;
 
     size_t i = currentLayers.size();
+
+    if (mIncrementalVisibleRegions && !mFullVisibleRegionsDirty) {
+        /*
+         * The regions of a layer only depend on the layers above it, so
+         * the layers above the top-most layer that changed keep what we
+         * computed last time. Restart the traversal from that layer, with
+         * the state we cached when we last went through it.
+         */
+        ssize_t top = ssize_t(i) - 1;
+        while (top >= 0 && !currentLayers[top]->visibilityDirty) {
+            top--;
+        }
+        if (top >= 0) {
+            for (size_t j=top+1 ; j<i ; j++) {
+                const sp<LayerBase>& layer = currentLayers[j];
+                if (layer->isSecure() && !layer->visibleRegionScreen.isEmpty()) {
+                    secureFrameBuffer = true;
+                }
+            }
+            const sp<LayerBase>& layer = currentLayers[top];
+            aboveOpaqueLayers = layer->aboveOpaqueLayersScreen;
+            aboveCoveredLayers = layer->aboveCoveredLayersScreen;
+            mVisibleRegionsLayersSkipped += i - (top+1);
+            mIncrementalVisibleRegionsCount++;
+            i = top + 1;
+        }
+    }
+    if (i == currentLayers.size()) {
+        mFullVisibleRegionsCount++;
+    }
+
+    bool occluded = coversScreen(aboveOpaqueLayers, screenRegion);
+
     while (i--) {
         const sp<LayerBase>& layer = currentLayers[i];
         layer->validateVisibility(planeTransform);
 
-        // start with the whole surface at its current location
-        const Layer::State& s(layer->drawingState());
+        // remember where we are for the next incremental update
+        layer->aboveOpaqueLayersScreen = aboveOpaqueLayers;
+        layer->aboveCoveredLayersScreen = aboveCoveredLayers;
+        layer->visibilityDirty = false;
+
+        if (occluded) {
+            /*
+             * The opaque layers above cover the whole screen, so this
+             * layer is neither visible nor can it add anything to the
+             * dirty region. Skip the region math. The covered region is
+             * set to the whole screen rather than to the layer's footprint,
+             * which is conservative: whatever gets exposed later is
+             * redrawn entirely.
+             */
+            layer->contentDirty = false;
+            layer->setVisibleRegion(Region());
+            layer->setCoveredRegion(screenRegion);
+            mOccludedLayersSkipped++;
+            continue;
+        }
 
         /*
          * opaqueRegion: area of a surface that is fully opaque.
@@ -678,31 +932,10 @@ void SurfaceFlinger::computeVisibleRegions(
          */
         Region coveredRegion;
 
-
-        // handle hidden surfaces by setting the visible region to empty
-        if (CC_LIKELY(!(s.flags & ISurfaceComposer::eLayerHidden) && s.alpha)) {
-            const bool translucent = !layer->isOpaque();
-            const Rect bounds(layer->visibleBounds());
-            visibleRegion.set(bounds);
-            visibleRegion.andSelf(screenRegion);
-            if (!visibleRegion.isEmpty()) {
-                // Remove the transparent area from the visible region
-                if (translucent) {
-                    visibleRegion.subtractSelf(layer->transparentRegionScreen);
-                }
-
-                // compute the opaque region
-                const int32_t layerOrientation = layer->getOrientation();
-                if (s.alpha==255 && !translucent &&
-                        ((layerOrientation & Transform::ROT_INVALID) == false)) {
-                    // the opaque region is the layer's footprint
-                    opaqueRegion = visibleRegion;
-                }
-            }
-        }
+        computeLayerFootprint(layer, screenRegion, visibleRegion, opaqueRegion);
 
         // Clip the covered region to the visible region
-        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+        coveredRegion.setIntersect(aboveCoveredLayers, visibleRegion);
 
         // Update aboveCoveredLayers for next (lower) layer
         aboveCoveredLayers.orSelf(visibleRegion);
@@ -713,9 +946,8 @@ void SurfaceFlinger::computeVisibleRegions(
         // compute this layer's dirty region
         if (layer->contentDirty) {
             // we need to invalidate the whole region
-            dirty = visibleRegion;
             // as well, as the old visible region
-            dirty.orSelf(layer->visibleRegionScreen);
+            dirty.setMerge(visibleRegion, layer->visibleRegionScreen);
             layer->contentDirty = false;
         } else {
             /* compute the exposed region:
@@ -730,11 +962,12 @@ void SurfaceFlinger::computeVisibleRegions(
              * (2) handles areas that were not covered by anything but got
              * exposed because of a resize.
              */
-            const Region newExposed = visibleRegion - coveredRegion;
-            const Region oldVisibleRegion = layer->visibleRegionScreen;
-            const Region oldCoveredRegion = layer->coveredRegionScreen;
-            const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
-            dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
+            newExposed.setSubtract(visibleRegion, coveredRegion);
+            oldExposed.setSubtract(layer->visibleRegionScreen,
+                    layer->coveredRegionScreen);
+            newExposed.subtractSelf(oldExposed);
+            dirty.setIntersect(visibleRegion, layer->coveredRegionScreen);
+            dirty.orSelf(newExposed);
         }
         dirty.subtractSelf(aboveOpaqueLayers);
 
@@ -742,7 +975,10 @@ void SurfaceFlinger::computeVisibleRegions(
         dirtyRegion.orSelf(dirty);
 
         // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
+        if (!opaqueRegion.isEmpty()) {
+            aboveOpaqueLayers.orSelf(opaqueRegion);
+            occluded = coversScreen(aboveOpaqueLayers, screenRegion);
+        }
 
         // Store the visible region is screen space
         layer->setVisibleRegion(visibleRegion);
@@ -760,6 +996,53 @@ void SurfaceFlinger::computeVisibleRegions(
 
     mSecureFrameBuffer = secureFrameBuffer;
     opaqueRegion = aboveOpaqueLayers;
+    mFullVisibleRegionsDirty = false;
+
+    if (CC_UNLIKELY(mDebugCheckVisibleRegions)) {
+        checkVisibleRegions(currentLayers);
+    }
+}
+
+void SurfaceFlinger::checkVisibleRegions(const LayerVector& currentLayers) const
+{
+    // recompute all the regions from scratch and compare them with
+    // what computeVisibleRegions() came up with.
+    const DisplayHardware& hw(graphicPlane(0).displayHardware());
+    const Region screenRegion(hw.bounds());
+
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+    size_t i = currentLayers.size();
+    while (i--) {
+        const sp<LayerBase>& layer = currentLayers[i];
+        Region opaqueRegion;
+        Region visibleRegion;
+        computeLayerFootprint(layer, screenRegion, visibleRegion, opaqueRegion);
+        // layers under an opaque layer covering the whole screen are
+        // skipped, they get the whole screen as their covered region
+        const Region coveredRegion(
+                coversScreen(aboveOpaqueLayers, screenRegion) ?
+                screenRegion : aboveCoveredLayers.intersect(visibleRegion));
+        aboveCoveredLayers.orSelf(visibleRegion);
+        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        aboveOpaqueLayers.orSelf(opaqueRegion);
+
+        const bool visibleOk = visibleRegion.subtract(
+                layer->visibleRegionScreen).isEmpty() &&
+                layer->visibleRegionScreen.subtract(visibleRegion).isEmpty();
+        const bool coveredOk = coveredRegion.subtract(
+                layer->coveredRegionScreen).isEmpty() &&
+                layer->coveredRegionScreen.subtract(coveredRegion).isEmpty();
+        if (CC_UNLIKELY(!visibleOk || !coveredOk)) {
+            ALOGE("visible regions mismatch for layer %p (%s): "
+                    "visible %s, covered %s",
+                    layer.get(), layer->getName().string(),
+                    visibleOk ? "ok" : "wrong",
+                    coveredOk ? "ok" : "wrong");
+            visibleRegion.dump("expected visibleRegion");
+            layer->visibleRegionScreen.dump("actual visibleRegion");
+        }
+    }
 }
 
 
@@ -773,7 +1056,11 @@ void SurfaceFlinger::commitTransaction()
         mLayersPendingRemoval.clear();
     }
 
-    mDrawingState = mCurrentState;
+    // the drawing state keeps its own layer list, so that the next change
+    // to the current state's doesn't copy it, see syncFrom()
+    mDrawingState.layersSortedByZ.syncFrom(mCurrentState.layersSortedByZ);
+    mDrawingState.orientation = mCurrentState.orientation;
+    mDrawingState.orientationFlags = mCurrentState.orientationFlags;
     mTransationPending = false;
     mTransactionCV.broadcast();
 }
@@ -847,13 +1134,55 @@ bool SurfaceFlinger::lockPageFlip(const LayerVector& currentLayers)
     bool recomputeVisibleRegions = false;
     size_t count = currentLayers.size();
     sp<LayerBase> const* layers = currentLayers.array();
+    if (mLatchWorkers) {
+        latchBuffers(layers, count);
+    }
+    mBuffersLatched = false;
     for (size_t i=0 ; i<count ; i++) {
         const sp<LayerBase>& layer(layers[i]);
-        layer->lockPageFlip(recomputeVisibleRegions);
+        const uint32_t generation = layer->contentGeneration;
+        bool layerVisibleRegions = false;
+        layer->lockPageFlip(layerVisibleRegions);
+        if (layer->contentGeneration != generation) {
+            mBuffersLatched = true;
+        }
+        if (layerVisibleRegions) {
+            layer->visibilityDirty = true;
+            recomputeVisibleRegions = true;
+        }
     }
     return recomputeVisibleRegions;
 }
 
+void SurfaceFlinger::latchBuffers(sp<LayerBase> const* layers, size_t count)
+{
+    ATRACE_CALL();
+
+    // acquiring the new buffers and creating their EGLImages doesn't need
+    // the GL context, so it's done for all the layers at once on the
+    // workers. lockPageFlip() then binds the latched buffers on this thread.
+    mLayersToLatch.clear();
+    for (size_t i=0 ; i<count ; i++) {
+        if (layers[i]->hasBufferToLatch()) {
+            mLayersToLatch.add(layers[i]);
+        }
+    }
+
+    // not worth waking up the workers for a single layer
+    if (mLayersToLatch.size() > 1) {
+        struct Latch : public WorkerPool::Job {
+            const Vector< sp<LayerBase> >& layers;
+            Latch(const Vector< sp<LayerBase> >& layers) : layers(layers) { }
+            virtual void run(size_t index) {
+                layers[index]->latchBuffer();
+            }
+        };
+        Latch latch(mLayersToLatch);
+        mLatchWorkers->run(latch, mLayersToLatch.size());
+    }
+    mLayersToLatch.clear();
+}
+
 void SurfaceFlinger::unlockPageFlip(const LayerVector& currentLayers)
 {
     const GraphicPlane& plane(graphicPlane(0));
@@ -893,11 +1222,16 @@ void SurfaceFlinger::handleWorkList()
         hwc.createWorkList(count);
         hwc_layer_t* const cur(hwc.getLayers());
         for (size_t i=0 ; cur && i<count ; i++) {
-            currentLayers[i]->setGeometry(&cur[i]);
+            // only the layers whose geometry actually changed are
+            // rewritten, so that e.g. alpha animations, which recompute
+            // the visible regions, don't make the HAL start over.
+            hwc_layer_t l(cur[i]);
+            currentLayers[i]->setGeometry(&l);
             if (mDebugDisableHWC || mDebugRegion) {
-                cur[i].compositionType = HWC_FRAMEBUFFER;
-                cur[i].flags |= HWC_SKIP_LAYER;
+                l.compositionType = HWC_FRAMEBUFFER;
+                l.flags |= HWC_SKIP_LAYER;
             }
+            hwc.setLayerGeometry(i, l);
         }
     }
 }
@@ -906,10 +1240,15 @@ void SurfaceFlinger::handleRepaint()
 {
     ATRACE_CALL();
 
+    // the refresh this frame was started for, see postFramebuffer()
+    mRepaintVsyncTime = graphicPlane(0).displayHardware().getRefreshTimestamp();
+
     // compute the invalid region
     mSwapRegion.orSelf(mDirtyRegion);
 
     if (CC_UNLIKELY(mDebugRegion)) {
+        // showupdates must see every layer being redrawn
+        mCompositionCache.invalidate();
         debugFlashRegions();
     }
 
@@ -931,6 +1270,23 @@ void SurfaceFlinger::handleRepaint()
             // This is needed because PARTIAL_UPDATES only takes one
             // rectangle instead of a region (see DisplayHardware::flip())
             mDirtyRegion.set(mSwapRegion.bounds());
+        } else if (flags & DisplayHardware::DAMAGE_TRACKING) {
+            // the back buffer still holds the frame it showed last time,
+            // we need to redraw what changed since then, plus this frame's
+            // damage. layers draw their whole quad regardless of the clip,
+            // so redraw the bounding rectangle and scissor to it.
+            Region damage;
+            if (hw.getBackBufferDamage(&damage)) {
+                Rect dirty;
+                mSwapRegion.merge(damage).bounds().intersect(hw.bounds(),
+                        &dirty);
+                mDirtyRegion.set(dirty);
+                mPartialRepaintCount++;
+            } else {
+                mDirtyRegion.set(hw.bounds());
+                mFullRepaintCount++;
+            }
+            hw.setFrameDamage(mSwapRegion);
         } else {
             // we need to redraw everything (the whole screen)
             mDirtyRegion.set(hw.bounds());
@@ -939,8 +1295,31 @@ void SurfaceFlinger::handleRepaint()
     }
 
     setupHardwareComposer();
+
+    // flatten the layers that haven't changed in a while, this must
+    // happen after the h/w composer has picked its layers.
+    if (CC_LIKELY(!mDebugRegion)) {
+        HWComposer& hwc(hw.getHwComposer());
+        if (!hwc.getLayers() || hwc.getLayerCount(HWC_FRAMEBUFFER)) {
+            mCompositionCache.update(mVisibleLayersSortedByZ,
+                    hwc.getLayers(), hw);
+        }
+    }
+
+    const bool scissor = (flags & DisplayHardware::DAMAGE_TRACKING) &&
+            mDirtyRegion.bounds() != hw.bounds();
+    if (scissor) {
+        const Rect r(mDirtyRegion.bounds());
+        glScissor(r.left, hw.getHeight() - r.bottom, r.width(), r.height());
+        glEnable(GL_SCISSOR_TEST);
+    }
+
     composeSurfaces(mDirtyRegion);
 
+    if (scissor) {
+        glDisable(GL_SCISSOR_TEST);
+    }
+
     // update the swap region and clear the dirty region
     mSwapRegion.orSelf(mDirtyRegion);
     mDirtyRegion.clear();
@@ -1023,6 +1402,10 @@ void SurfaceFlinger::composeSurfaces(const Region& dirty)
         const Vector< sp<LayerBase> >& layers(mVisibleLayersSortedByZ);
         const size_t count = layers.size();
 
+        // the bottom-most layers may have been flattened into a texture
+        const size_t cachedCount = mCompositionCache.getCachedCount();
+        mCompositionCache.draw(dirty, hw);
+
         for (size_t i=0 ; i<count ; i++) {
 #ifdef HWC_LAYER_DIRTY_INFO
             cur[i].flags &= (~0x80000000);
@@ -1051,6 +1434,9 @@ void SurfaceFlinger::composeSurfaces(const Region& dirty)
                     continue;
 #endif
 
+                if (i < cachedCount)
+                    continue;
+
                 // render the layer
                 layer->draw(clip);
             }
@@ -1254,9 +1640,45 @@ uint32_t SurfaceFlinger::setTransactionFlags(uint32_t flags)
 
 void SurfaceFlinger::setTransactionState(const Vector<ComposerState>& state,
         int orientation, uint32_t flags) {
+    // look up the layers before taking mStateLock, so that a large
+    // transaction holds it (and the composition waiting on it) for as
+    // little time as possible.
+    const size_t count = state.size();
+    Vector< sp<LayerBaseClient> > layers;
+    layers.setCapacity(count);
+    for (size_t i=0 ; i<count ; i++) {
+        const ComposerState& s(state[i]);
+        sp<Client> client( static_cast<Client *>(s.client.get()) );
+        layers.add(client->getLayerUser(s.state.surface));
+    }
+
+    if (!count && orientation == eOrientationUnchanged) {
+        // nothing to do
+        return;
+    }
+
+    // asynchronous transactions that don't rotate the screen are queued
+    // without taking mStateLock and applied at the next frame.
+    if (!(flags & eSynchronous) && orientation == eOrientationUnchanged) {
+        TransactionQueue::Transaction* transaction =
+                new TransactionQueue::Transaction;
+        transaction->layers = layers;
+        transaction->states.setCapacity(count);
+        for (size_t i=0 ; i<count ; i++) {
+            transaction->states.add(state[i].state);
+        }
+        if (mTransactionQueue.enqueue(transaction)) {
+            setTransactionFlags(eTransactionQueued);
+            return;
+        }
+        // the queue is full, apply it now
+        delete transaction;
+    }
+
     Mutex::Autolock _l(mStateLock);
 
-    uint32_t transactionFlags = 0;
+    // what has been queued before must be applied first
+    uint32_t transactionFlags = drainTransactionQueueLocked();
     if (mCurrentState.orientation != orientation) {
         if (uint32_t(orientation)<=eOrientation270 || orientation==42) {
             mCurrentState.orientation = orientation;
@@ -1267,11 +1689,11 @@ void SurfaceFlinger::setTransactionState(const Vector<ComposerState>& state,
         }
     }
 
-    const size_t count = state.size();
     for (size_t i=0 ; i<count ; i++) {
-        const ComposerState& s(state[i]);
-        sp<Client> client( static_cast<Client *>(s.client.get()) );
-        transactionFlags |= setClientStateLocked(client, s.state);
+        const sp<LayerBaseClient>& layer(layers[i]);
+        if (layer != 0) {
+            transactionFlags |= setClientStateLocked(layer, state[i].state);
+        }
     }
 
     if (transactionFlags) {
@@ -1316,7 +1738,7 @@ sp<ISurface> SurfaceFlinger::createSurface(
         const String8& name,
         const sp<Client>& client,
         DisplayID d, uint32_t w, uint32_t h, PixelFormat format,
-        uint32_t flags)
+        uint32_t flags, GLuint textureName)
 {
     sp<LayerBaseClient> layer;
     sp<ISurface> surfaceHandle;
@@ -1324,6 +1746,9 @@ sp<ISurface> SurfaceFlinger::createSurface(
     if (int32_t(w|h) < 0) {
         ALOGE("createSurface() failed, w or h is negative (w=%d, h=%d)",
                 int(w), int(h));
+        if (textureName != -1U) {
+            returnTextureName(textureName);
+        }
         return surfaceHandle;
     }
 
@@ -1331,7 +1756,8 @@ sp<ISurface> SurfaceFlinger::createSurface(
     sp<Layer> normalLayer;
     switch (flags & eFXSurfaceMask) {
         case eFXSurfaceNormal:
-            normalLayer = createNormalSurface(client, d, w, h, flags, format);
+            normalLayer = createNormalSurface(client, d, w, h, flags, format,
+                    textureName);
             layer = normalLayer;
             break;
         case eFXSurfaceBlur:
@@ -1369,7 +1795,7 @@ sp<ISurface> SurfaceFlinger::createSurface(
 sp<Layer> SurfaceFlinger::createNormalSurface(
         const sp<Client>& client, DisplayID display,
         uint32_t w, uint32_t h, uint32_t flags,
-        PixelFormat& format)
+        PixelFormat& format, GLuint textureName)
 {
     // initialize the surfaces
     switch (format) { // TODO: take h/w into account
@@ -1391,7 +1817,11 @@ sp<Layer> SurfaceFlinger::createNormalSurface(
         format = PIXEL_FORMAT_RGBA_8888;
 #endif
 
-    sp<Layer> layer = new Layer(this, display, client);
+    if (textureName == -1U) {
+        glGenTextures(1, &textureName);
+    }
+
+    sp<Layer> layer = new Layer(this, display, client, textureName);
     status_t err = layer->setBuffers(w, h, format, flags);
     if (CC_LIKELY(err != NO_ERROR)) {
         ALOGE("createNormalSurfaceLocked() failed (%s)", strerror(-err));
@@ -1400,6 +1830,67 @@ sp<Layer> SurfaceFlinger::createNormalSurface(
     return layer;
 }
 
+bool SurfaceFlinger::takeTextureName(GLuint* name)
+{
+    class MessageRefillTextureNames : public MessageBase {
+        SurfaceFlinger* flinger;
+    public:
+        MessageRefillTextureNames(SurfaceFlinger* flinger) : flinger(flinger) { }
+        virtual bool handler() {
+            flinger->refillTextureNames();
+            return true;
+        }
+    };
+
+    bool refill = false;
+    bool taken = false;
+    { // scope for the lock
+        Mutex::Autolock _l(mTextureNamesLock);
+        if (!mTextureNames.isEmpty()) {
+            *name = mTextureNames.top();
+            mTextureNames.pop();
+            taken = true;
+        }
+        if (mTextureNames.size() < TEXTURE_NAMES_COUNT/2 &&
+                !mTextureNamesRefillPending) {
+            mTextureNamesRefillPending = true;
+            refill = true;
+        }
+    }
+    if (refill) {
+        postMessageAsync(new MessageRefillTextureNames(this));
+    }
+    return taken;
+}
+
+void SurfaceFlinger::returnTextureName(GLuint name)
+{
+    Mutex::Autolock _l(mTextureNamesLock);
+    mTextureNames.push(name);
+}
+
+void SurfaceFlinger::refillTextureNames()
+{
+    // main thread only, we need the GL context
+    size_t needed = 0;
+    { // scope for the lock
+        Mutex::Autolock _l(mTextureNamesLock);
+        mTextureNamesRefillPending = false;
+        if (mTextureNames.size() < TEXTURE_NAMES_COUNT) {
+            needed = TEXTURE_NAMES_COUNT - mTextureNames.size();
+        }
+    }
+    if (!needed) {
+        return;
+    }
+    GLuint names[TEXTURE_NAMES_COUNT];
+    glGenTextures(needed, names);
+    Mutex::Autolock _l(mTextureNamesLock);
+    for (size_t i=0 ; i<needed ; i++) {
+        mTextureNames.push(names[i]);
+    }
+}
+
 sp<LayerDim> SurfaceFlinger::createDimSurface(
         const sp<Client>& client, DisplayID display,
         uint32_t w, uint32_t h, uint32_t flags)
@@ -1462,54 +1953,88 @@ status_t SurfaceFlinger::destroySurface(const wp<LayerBaseClient>& layer)
     return err;
 }
 
+uint32_t SurfaceFlinger::drainTransactionQueueLocked()
+{
+    // merge the states queued for the same layer, so that each layer is
+    // only updated once, however many transactions touched it.
+    KeyedVector<LayerBaseClient*, size_t> indices;
+    Vector< sp<LayerBaseClient> > layers;
+    Vector<layer_state_t> states;
+    TransactionQueue::Transaction* transaction;
+    while ((transaction = mTransactionQueue.dequeue()) != 0) {
+        const size_t count = transaction->layers.size();
+        for (size_t i=0 ; i<count ; i++) {
+            const sp<LayerBaseClient>& layer(transaction->layers[i]);
+            if (layer == 0)
+                continue;
+            const ssize_t idx = indices.indexOfKey(layer.get());
+            if (idx < 0) {
+                indices.add(layer.get(), layers.size());
+                layers.add(layer);
+                states.add(transaction->states[i]);
+            } else {
+                TransactionQueue::merge(
+                        states.editItemAt(indices.valueAt(idx)),
+                        transaction->states[i]);
+                mMergedLayerStates++;
+            }
+        }
+        delete transaction;
+    }
+
+    uint32_t flags = 0;
+    const size_t count = layers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        flags |= setClientStateLocked(layers[i], states[i]);
+    }
+    return flags;
+}
+
 uint32_t SurfaceFlinger::setClientStateLocked(
-        const sp<Client>& client,
+        const sp<LayerBaseClient>& layer,
         const layer_state_t& s)
 {
     uint32_t flags = 0;
-    sp<LayerBaseClient> layer(client->getLayerUser(s.surface));
-    if (layer != 0) {
-        const uint32_t what = s.what;
-        if (what & ePositionChanged) {
-            if (layer->setPosition(s.x, s.y))
-                flags |= eTraversalNeeded;
-        }
-        if (what & eLayerChanged) {
-            ssize_t idx = mCurrentState.layersSortedByZ.indexOf(layer);
-            if (layer->setLayer(s.z)) {
-                mCurrentState.layersSortedByZ.removeAt(idx);
-                mCurrentState.layersSortedByZ.add(layer);
-                // we need traversal (state changed)
-                // AND transaction (list changed)
-                flags |= eTransactionNeeded|eTraversalNeeded;
-            }
-        }
-        if (what & eSizeChanged) {
-            if (layer->setSize(s.w, s.h)) {
-                flags |= eTraversalNeeded;
-            }
-        }
-        if (what & eAlphaChanged) {
-            if (layer->setAlpha(uint8_t(255.0f*s.alpha+0.5f)))
-                flags |= eTraversalNeeded;
-        }
-        if (what & eMatrixChanged) {
-            if (layer->setMatrix(s.matrix))
-                flags |= eTraversalNeeded;
-        }
-        if (what & eTransparentRegionChanged) {
-            if (layer->setTransparentRegionHint(s.transparentRegion))
-                flags |= eTraversalNeeded;
-        }
-        if (what & eVisibilityChanged) {
-            if (layer->setFlags(s.flags, s.mask))
-                flags |= eTraversalNeeded;
+    const uint32_t what = s.what;
+    if (what & ePositionChanged) {
+        if (layer->setPosition(s.x, s.y))
+            flags |= eTraversalNeeded;
+    }
+    if (what & eLayerChanged) {
+        // the layer may have been removed since it was looked up
+        ssize_t idx = mCurrentState.layersSortedByZ.indexOf(layer);
+        if (idx >= 0 && layer->setLayer(s.z)) {
+            mCurrentState.layersSortedByZ.reorder(idx);
+            // we need traversal (state changed)
+            // AND transaction (list changed)
+            flags |= eTransactionNeeded|eTraversalNeeded;
         }
-        if (what & eCropChanged) {
-            if (layer->setCrop(s.crop))
-                flags |= eTraversalNeeded;
+    }
+    if (what & eSizeChanged) {
+        if (layer->setSize(s.w, s.h)) {
+            flags |= eTraversalNeeded;
         }
     }
+    if (what & eAlphaChanged) {
+        if (layer->setAlpha(uint8_t(255.0f*s.alpha+0.5f)))
+            flags |= eTraversalNeeded;
+    }
+    if (what & eMatrixChanged) {
+        if (layer->setMatrix(s.matrix))
+            flags |= eTraversalNeeded;
+    }
+    if (what & eTransparentRegionChanged) {
+        if (layer->setTransparentRegionHint(s.transparentRegion))
+            flags |= eTraversalNeeded;
+    }
+    if (what & eVisibilityChanged) {
+        if (layer->setFlags(s.flags, s.mask))
+            flags |= eTraversalNeeded;
+    }
+    if (what & eCropChanged) {
+        if (layer->setCrop(s.crop))
+            flags |= eTraversalNeeded;
+    }
     return flags;
 }
 
@@ -1617,6 +2142,13 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                 dumpAll = false;
             }
 
+            if ((index < numArgs) &&
+                    (args[index] == String16("--latency-histogram"))) {
+                index++;
+                dumpLatencyHistogramLocked(args, index, result, buffer, SIZE);
+                dumpAll = false;
+            }
+
             if ((index < numArgs) &&
                     (args[index] == String16("--latency-clear"))) {
                 index++;
@@ -1672,6 +2204,39 @@ void SurfaceFlinger::dumpStatsLocked(const Vector<String16>& args, size_t& index
     }
 }
 
+void SurfaceFlinger::dumpLatencyHistogramLocked(const Vector<String16>& args,
+        size_t& index, String8& result, char* buffer, size_t SIZE) const
+{
+    String8 name;
+    if (index < args.size()) {
+        name = String8(args[index]);
+        index++;
+    }
+
+    const DisplayHardware& hw(graphicPlane(0).displayHardware());
+    snprintf(buffer, SIZE, "refresh-period=%.2fms\n",
+            hw.getRefreshPeriod() / 1e6);
+    result.append(buffer);
+
+    if (name.isEmpty()) {
+        snprintf(buffer, SIZE, "composition: frames=%u, missed=%u\n",
+                mCompositionLatency.getCount(), mMissedRefreshCount);
+        result.append(buffer);
+        mCompositionLatency.dump(result, "  ", "vsync-to-post");
+    }
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    const size_t count = currentLayers.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const sp<LayerBase>& layer(currentLayers[i]);
+        if (name.isEmpty() || (name == layer->getName())) {
+            snprintf(buffer, SIZE, "%s\n", layer->getName().string());
+            result.append(buffer);
+            layer->dumpLatencyHistogram(result, buffer, SIZE);
+        }
+    }
+}
+
 void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& index,
         String8& result, char* buffer, size_t SIZE) const
 {
@@ -1681,6 +2246,11 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
         index++;
     }
 
+    if (name.isEmpty()) {
+        mCompositionLatency.clear();
+        mMissedRefreshCount = 0;
+    }
+
     const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
     const size_t count = currentLayers.size();
     for (size_t i=0 ; i<count ; i++) {
@@ -1748,11 +2318,56 @@ void SurfaceFlinger::dumpAllLocked(
     result.append(buffer);
 
     mWormholeRegion.dump(result, "WormholeRegion");
+    snprintf(buffer, SIZE,
+            "  visible regions: incremental=%d, full=%u, partial=%u, "
+            "layers-skipped=%u, layers-occluded=%u\n",
+            mIncrementalVisibleRegions,
+            mFullVisibleRegionsCount,
+            mIncrementalVisibleRegionsCount,
+            mVisibleRegionsLayersSkipped,
+            mOccludedLayersSkipped);
+    result.append(buffer);
+    snprintf(buffer, SIZE,
+            "  idle frames: skip=%d, composed=%u, skipped=%u (%.1f%%)\n",
+            mSkipIdleFrames, mFramesComposed, mIdleFramesSkipped,
+            (mFramesComposed + mIdleFramesSkipped) ?
+                    (100.0 * mIdleFramesSkipped) /
+                    (mFramesComposed + mIdleFramesSkipped) : 0.0);
+    result.append(buffer);
     const DisplayHardware& hw(graphicPlane(0).displayHardware());
     snprintf(buffer, SIZE,
             "  orientation=%d, canDraw=%d\n",
             mCurrentState.orientation, hw.canDraw());
     result.append(buffer);
+    if (hw.getFlags() & DisplayHardware::DAMAGE_TRACKING) {
+        snprintf(buffer, SIZE,
+                "  damage tracking: partial=%u, full=%u\n",
+                mPartialRepaintCount, mFullRepaintCount);
+        result.append(buffer);
+    }
+    mCompositionCache.dump(result, "  composition cache: ");
+    snprintf(buffer, SIZE,
+            "  electron beam snapshot: %s, renders=%u, reuses=%u\n",
+            mScreenSnapshot != 0 ? "allocated" : "none",
+            mScreenSnapshotRenders, mScreenSnapshotReuses);
+    result.append(buffer);
+    if (mLatchWorkers) {
+        mLatchWorkers->dump(result, "  latch workers: ");
+    }
+    if (mGraphicBufferPool != 0) {
+        mGraphicBufferPool->dump(result, "  buffer pool: ");
+    }
+    size_t textureNames;
+    { // scope for the lock
+        Mutex::Autolock _l(mTextureNamesLock);
+        textureNames = mTextureNames.size();
+    }
+    snprintf(buffer, SIZE,
+            "  surface creation: async=%d, binder threads=%d, "
+            "main thread=%d, spare texture names=%u\n",
+            mAsyncSurfaceCreation, mAsyncSurfacesCreated,
+            mSyncSurfacesCreated, uint32_t(textureNames));
+    result.append(buffer);
     snprintf(buffer, SIZE,
             "  last eglSwapBuffers() time: %f us\n"
             "  last transaction time     : %f us\n"
@@ -1778,6 +2393,19 @@ void SurfaceFlinger::dumpAllLocked(
             inTransactionDuration/1000.0);
     result.append(buffer);
 
+    if (mPipelinedTransactions) {
+        snprintf(buffer, SIZE, "  deferred transactions: %u\n",
+                mDeferredTransactionCount);
+        result.append(buffer);
+    }
+
+    snprintf(buffer, SIZE,
+            "  queued transactions: %u, merged layer states: %u, "
+            "queue full: %u\n",
+            mTransactionQueue.getEnqueueCount(), mMergedLayerStates,
+            mTransactionQueue.getOverflowCount());
+    result.append(buffer);
+
     /*
      * VSYNC state
      */
@@ -1827,6 +2455,10 @@ status_t SurfaceFlinger::onTransact(
             break;
         }
         case CAPTURE_SCREEN:
+        case CAPTURE_SCREEN_TO_BUFFER:
+        case CAPTURE_SCREEN_ASYNC:
+        case COLLECT_SCREEN_CAPTURE:
+        case WAIT_FOR_SCREEN_CAPTURE:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -1974,6 +2606,22 @@ status_t SurfaceFlinger::renderScreenToTextureLocked(DisplayID dpy,
     glFramebufferTexture2DOES(GL_FRAMEBUFFER_OES,
             GL_COLOR_ATTACHMENT0_OES, GL_TEXTURE_2D, tname, 0);
 
+    drawScreenForTextureLocked();
+
+    hw.compositionComplete();
+
+    // back to main framebuffer
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+    glDeleteFramebuffersOES(1, &name);
+
+    *textureName = tname;
+    *uOut = u;
+    *vOut = v;
+    return NO_ERROR;
+}
+
+void SurfaceFlinger::drawScreenForTextureLocked()
+{
     // redraw the screen entirely...
     glDisable(GL_TEXTURE_EXTERNAL_OES);
     glDisable(GL_TEXTURE_2D);
@@ -1987,16 +2635,53 @@ status_t SurfaceFlinger::renderScreenToTextureLocked(DisplayID dpy,
         const sp<LayerBase>& layer(layers[i]);
         layer->drawForSreenShot();
     }
+}
 
-    hw.compositionComplete();
+status_t SurfaceFlinger::getScreenSnapshotLocked(GLuint* textureName)
+{
+    ATRACE_CALL();
 
-    // back to main framebuffer
-    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
-    glDeleteFramebuffersOES(1, &name);
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    if (!extensions.haveFramebufferObject() || !extensions.haveDirectTexture())
+        return INVALID_OPERATION;
+
+    // the snapshot's buffer is kept around, it's only rendered again if
+    // something was composed since. it doesn't need the padding to a
+    // power of two that renderScreenToTextureLocked() may use.
+    const DisplayHardware& hw(graphicPlane(0).displayHardware());
+    if (mScreenSnapshot == 0) {
+        sp<ScreenCaptureBuffer> snapshot(new ScreenCaptureBuffer(
+                hw.getEGLDisplay(), hw.getWidth(), hw.getHeight()));
+        status_t err = snapshot->initCheck();
+        if (err != NO_ERROR) {
+            return err;
+        }
+        mScreenSnapshot = snapshot;
+        mScreenSnapshotDirty = true;
+    }
+
+    if (mScreenSnapshotDirty) {
+        // make sure to clear all GL error flags
+        while ( glGetError() != GL_NO_ERROR ) ;
+
+        mScreenSnapshot->bind();
+        drawScreenForTextureLocked();
+        hw.compositionComplete();
+        glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+        if (glGetError() != GL_NO_ERROR) {
+            return INVALID_OPERATION;
+        }
+        mScreenSnapshotDirty = false;
+        mScreenSnapshotRenders++;
+    } else {
+        mScreenSnapshotReuses++;
+    }
 
+    const GLuint tname = mScreenSnapshot->getTextureName();
+    if (!tname) {
+        return INVALID_OPERATION;
+    }
     *textureName = tname;
-    *uOut = u;
-    *vOut = v;
     return NO_ERROR;
 }
 
@@ -2039,21 +2724,30 @@ status_t SurfaceFlinger::electronBeamOffAnimationImplLocked()
     const uint32_t hw_h = hw.getHeight();
     const Region screenBounds(hw.getBounds());
 
-    GLfloat u, v;
+    // the snapshot's texture is already set up, a texture we render
+    // ourselves needs its parameters and is deleted at the end.
+    GLfloat u = 1, v = 1;
     GLuint tname;
-    status_t result = renderScreenToTextureLocked(0, &tname, &u, &v);
+    bool ownTexture = false;
+    status_t result = getScreenSnapshotLocked(&tname);
     if (result != NO_ERROR) {
-        return result;
+        result = renderScreenToTextureLocked(0, &tname, &u, &v);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        ownTexture = true;
     }
 
     GLfloat vtx[8];
     const GLfloat texCoords[4][2] = { {0,0}, {0,v}, {u,v}, {u,0} };
     glBindTexture(GL_TEXTURE_2D, tname);
     glTexEnvx(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (ownTexture) {
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
     glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
     glVertexPointer(2, GL_FLOAT, 0, vtx);
@@ -2201,7 +2895,9 @@ status_t SurfaceFlinger::electronBeamOffAnimationImplLocked()
 
     glColorMask(1,1,1,1);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDeleteTextures(1, &tname);
+    if (ownTexture) {
+        glDeleteTextures(1, &tname);
+    }
     glDisable(GL_TEXTURE_2D);
     glDisable(GL_BLEND);
     return NO_ERROR;
@@ -2221,21 +2917,30 @@ status_t SurfaceFlinger::electronBeamOnAnimationImplLocked()
     const uint32_t hw_h = hw.getHeight();
     const Region screenBounds(hw.bounds());
 
-    GLfloat u, v;
+    // usually the snapshot is still the one taken when the screen was
+    // turned off, or was updated while it was off
+    GLfloat u = 1, v = 1;
     GLuint tname;
-    result = renderScreenToTextureLocked(0, &tname, &u, &v);
+    bool ownTexture = false;
+    result = getScreenSnapshotLocked(&tname);
     if (result != NO_ERROR) {
-        return result;
+        result = renderScreenToTextureLocked(0, &tname, &u, &v);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        ownTexture = true;
     }
 
     GLfloat vtx[8];
     const GLfloat texCoords[4][2] = { {0,v}, {0,0}, {u,0}, {u,v} };
     glBindTexture(GL_TEXTURE_2D, tname);
     glTexEnvx(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (ownTexture) {
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameterx(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
     glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
     glVertexPointer(2, GL_FLOAT, 0, vtx);
@@ -2352,7 +3057,9 @@ status_t SurfaceFlinger::electronBeamOnAnimationImplLocked()
 
     glColorMask(1,1,1,1);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDeleteTextures(1, &tname);
+    if (ownTexture) {
+        glDeleteTextures(1, &tname);
+    }
     glDisable(GL_TEXTURE_2D);
     glDisable(GL_BLEND);
 
@@ -2467,6 +3174,45 @@ status_t SurfaceFlinger::turnElectronBeamOn(int32_t mode)
 
 // ---------------------------------------------------------------------------
 
+void SurfaceFlinger::drawScreenForCaptureLocked(const DisplayHardware& hw,
+        uint32_t sw, uint32_t sh,
+        uint32_t minLayerZ, uint32_t maxLayerZ)
+{
+    const uint32_t hw_w = hw.getWidth();
+    const uint32_t hw_h = hw.getHeight();
+
+    // invert everything, b/c glReadPixel() will invert the FB and
+    // a gralloc buffer is addressed bottom-up by GL as well
+    glViewport(0, 0, sw, sh);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrthof(0, hw_w, hw_h, 0, 0, 1);
+    glMatrixMode(GL_MODELVIEW);
+
+    // redraw the screen entirely...
+    glClearColor(0,0,0,1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    const LayerVector& layers(mDrawingState.layersSortedByZ);
+    const size_t count = layers.size();
+    for (size_t i=0 ; i<count ; ++i) {
+        const sp<LayerBase>& layer(layers[i]);
+        const uint32_t flags = layer->drawingState().flags;
+        if (!(flags & ISurfaceComposer::eLayerHidden)) {
+            const uint32_t z = layer->drawingState().z;
+            if (z >= minLayerZ && z <= maxLayerZ) {
+                layer->drawForSreenShot();
+            }
+        }
+    }
+
+    glViewport(0, 0, hw_w, hw_h);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
 status_t SurfaceFlinger::captureScreenImplLocked(DisplayID dpy,
         sp<IMemoryHeap>* heap,
         uint32_t* w, uint32_t* h, PixelFormat* f,
@@ -2517,30 +3263,7 @@ status_t SurfaceFlinger::captureScreenImplLocked(DisplayID dpy,
 
     if (status == GL_FRAMEBUFFER_COMPLETE_OES) {
 
-        // invert everything, b/c glReadPixel() below will invert the FB
-        glViewport(0, 0, sw, sh);
-        glMatrixMode(GL_PROJECTION);
-        glPushMatrix();
-        glLoadIdentity();
-        glOrthof(0, hw_w, hw_h, 0, 0, 1);
-        glMatrixMode(GL_MODELVIEW);
-
-        // redraw the screen entirely...
-        glClearColor(0,0,0,1);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        const LayerVector& layers(mDrawingState.layersSortedByZ);
-        const size_t count = layers.size();
-        for (size_t i=0 ; i<count ; ++i) {
-            const sp<LayerBase>& layer(layers[i]);
-            const uint32_t flags = layer->drawingState().flags;
-            if (!(flags & ISurfaceComposer::eLayerHidden)) {
-                const uint32_t z = layer->drawingState().z;
-                if (z >= minLayerZ && z <= maxLayerZ) {
-                    layer->drawForSreenShot();
-                }
-            }
-        }
+        drawScreenForCaptureLocked(hw, sw, sh, minLayerZ, maxLayerZ);
 
         // check for errors and return screen capture
         if (glGetError() != GL_NO_ERROR) {
@@ -2567,10 +3290,6 @@ status_t SurfaceFlinger::captureScreenImplLocked(DisplayID dpy,
                 result = NO_MEMORY;
             }
         }
-        glViewport(0, 0, hw_w, hw_h);
-        glMatrixMode(GL_PROJECTION);
-        glPopMatrix();
-        glMatrixMode(GL_MODELVIEW);
     } else {
         result = BAD_VALUE;
     }
@@ -2650,6 +3369,272 @@ status_t SurfaceFlinger::captureScreen(DisplayID dpy,
     return res;
 }
 
+status_t SurfaceFlinger::captureScreenToBufferImplLocked(DisplayID dpy,
+        const sp<GraphicBuffer>& buffer, int32_t* fence,
+        pid_t pid, uid_t uid,
+        uint32_t minLayerZ, uint32_t maxLayerZ)
+{
+    ATRACE_CALL();
+
+    // only one display supported for now
+    if (CC_UNLIKELY(uint32_t(dpy) >= DISPLAY_COUNT))
+        return BAD_VALUE;
+
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    if (!extensions.haveFramebufferObject() || !extensions.haveDirectTexture())
+        return INVALID_OPERATION;
+
+    // get screen geometry
+    const DisplayHardware& hw(graphicPlane(dpy).displayHardware());
+    const uint32_t hw_w = hw.getWidth();
+    const uint32_t hw_h = hw.getHeight();
+
+    // the screen is scaled to the caller's buffer
+    const uint32_t sw = buffer->getWidth();
+    const uint32_t sh = buffer->getHeight();
+    if (!sw || !sh || (sw > hw_w) || (sh > hw_h))
+        return BAD_VALUE;
+    if (buffer->getPixelFormat() != PIXEL_FORMAT_RGBA_8888 ||
+            !(buffer->getUsage() & GRALLOC_USAGE_HW_RENDER))
+        return BAD_VALUE;
+
+    int32_t t;
+    sp<ScreenCaptureBuffer> capture(mScreenCaptureQueue.dequeue(
+            hw.getEGLDisplay(), buffer, pid, uid, &t));
+    if (capture == 0)
+        return NO_MEMORY;
+
+    // make sure to clear all GL error flags
+    while ( glGetError() != GL_NO_ERROR ) ;
+
+    capture->bind();
+    drawScreenForCaptureLocked(hw, sw, sh, minLayerZ, maxLayerZ);
+
+    status_t result = INVALID_OPERATION;
+    if (glGetError() == GL_NO_ERROR) {
+        // don't wait for the GPU here, the caller waits on the fence with
+        // waitForScreenCapture() before it reads the buffer. without
+        // fences, we have no choice.
+        EGLSyncKHR sync = eglCreateSyncKHR(hw.getEGLDisplay(),
+                EGL_SYNC_FENCE_KHR, NULL);
+        if (sync != EGL_NO_SYNC_KHR) {
+            glFlush();
+        } else {
+            glFinish();
+        }
+        mScreenCaptureQueue.queue(t, sync);
+        *fence = t;
+        result = NO_ERROR;
+    }
+
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+
+    hw.compositionComplete();
+
+    return result;
+}
+
+status_t SurfaceFlinger::captureScreenToBuffer(DisplayID dpy,
+        const sp<GraphicBuffer>& buffer, int32_t* fence,
+        uint32_t minLayerZ, uint32_t maxLayerZ)
+{
+    // only one display supported for now
+    if (CC_UNLIKELY(uint32_t(dpy) >= DISPLAY_COUNT))
+        return BAD_VALUE;
+
+    if (!GLExtensions::getInstance().haveFramebufferObject())
+        return INVALID_OPERATION;
+
+    class MessageCaptureScreenToBuffer : public MessageBase {
+        SurfaceFlinger* flinger;
+        DisplayID dpy;
+        sp<GraphicBuffer> buffer;
+        int32_t* fence;
+        pid_t pid;
+        uid_t uid;
+        uint32_t minLayerZ;
+        uint32_t maxLayerZ;
+        status_t result;
+    public:
+        MessageCaptureScreenToBuffer(SurfaceFlinger* flinger, DisplayID dpy,
+                const sp<GraphicBuffer>& buffer, int32_t* fence,
+                pid_t pid, uid_t uid, uint32_t minLayerZ, uint32_t maxLayerZ)
+            : flinger(flinger), dpy(dpy), buffer(buffer), fence(fence),
+              pid(pid), uid(uid), minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              result(PERMISSION_DENIED)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+
+            // if we have secure windows, never allow the screen capture
+            if (flinger->mSecureFrameBuffer)
+                return true;
+
+            result = flinger->captureScreenToBufferImplLocked(dpy,
+                    buffer, fence, pid, uid, minLayerZ, maxLayerZ);
+
+            return true;
+        }
+    };
+
+    // the fence will only be good for the caller
+    IPCThreadState* ipc = IPCThreadState::self();
+    sp<MessageBase> msg = new MessageCaptureScreenToBuffer(this,
+            dpy, buffer, fence, ipc->getCallingPid(), ipc->getCallingUid(),
+            minLayerZ, maxLayerZ);
+    status_t res = postMessageSync(msg);
+    if (res == NO_ERROR) {
+        res = static_cast<MessageCaptureScreenToBuffer*>( msg.get() )->getResult();
+    }
+    return res;
+}
+
+status_t SurfaceFlinger::waitForScreenCapture(int32_t fence)
+{
+    // like collectScreenCapture(), this only blocks the calling binder
+    // thread.
+    IPCThreadState* ipc = IPCThreadState::self();
+    return mScreenCaptureQueue.wait(fence,
+            ipc->getCallingPid(), ipc->getCallingUid());
+}
+
+status_t SurfaceFlinger::captureScreenAsyncImplLocked(DisplayID dpy,
+        int32_t* token, pid_t pid, uid_t uid,
+        uint32_t sw, uint32_t sh,
+        uint32_t minLayerZ, uint32_t maxLayerZ)
+{
+    ATRACE_CALL();
+
+    // only one display supported for now
+    if (CC_UNLIKELY(uint32_t(dpy) >= DISPLAY_COUNT))
+        return BAD_VALUE;
+
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    if (!extensions.haveFramebufferObject() || !extensions.haveDirectTexture())
+        return INVALID_OPERATION;
+
+    // get screen geometry
+    const DisplayHardware& hw(graphicPlane(dpy).displayHardware());
+    const uint32_t hw_w = hw.getWidth();
+    const uint32_t hw_h = hw.getHeight();
+
+    if ((sw > hw_w) || (sh > hw_h))
+        return BAD_VALUE;
+
+    sw = (!sw) ? hw_w : sw;
+    sh = (!sh) ? hw_h : sh;
+
+    int32_t t;
+    sp<ScreenCaptureBuffer> capture(mScreenCaptureQueue.dequeue(
+            hw.getEGLDisplay(), sw, sh, pid, uid, &t));
+    if (capture == 0)
+        return NO_MEMORY;
+
+    // make sure to clear all GL error flags
+    while ( glGetError() != GL_NO_ERROR ) ;
+
+    capture->bind();
+    drawScreenForCaptureLocked(hw, sw, sh, minLayerZ, maxLayerZ);
+
+    status_t result = INVALID_OPERATION;
+    if (glGetError() == GL_NO_ERROR) {
+        // don't wait for the GPU here, collectScreenCapture() waits on
+        // the fence from a binder thread. without fences, we have no choice.
+        EGLSyncKHR fence = eglCreateSyncKHR(hw.getEGLDisplay(),
+                EGL_SYNC_FENCE_KHR, NULL);
+        if (fence != EGL_NO_SYNC_KHR) {
+            glFlush();
+        } else {
+            glFinish();
+        }
+        mScreenCaptureQueue.queue(t, fence);
+        *token = t;
+        result = NO_ERROR;
+    }
+
+    glBindFramebufferOES(GL_FRAMEBUFFER_OES, 0);
+
+    hw.compositionComplete();
+
+    return result;
+}
+
+status_t SurfaceFlinger::captureScreenAsync(DisplayID dpy, int32_t* token,
+        uint32_t sw, uint32_t sh,
+        uint32_t minLayerZ, uint32_t maxLayerZ)
+{
+    // only one display supported for now
+    if (CC_UNLIKELY(uint32_t(dpy) >= DISPLAY_COUNT))
+        return BAD_VALUE;
+
+    if (!GLExtensions::getInstance().haveFramebufferObject())
+        return INVALID_OPERATION;
+
+    class MessageCaptureScreenAsync : public MessageBase {
+        SurfaceFlinger* flinger;
+        DisplayID dpy;
+        int32_t* token;
+        pid_t pid;
+        uid_t uid;
+        uint32_t sw;
+        uint32_t sh;
+        uint32_t minLayerZ;
+        uint32_t maxLayerZ;
+        status_t result;
+    public:
+        MessageCaptureScreenAsync(SurfaceFlinger* flinger, DisplayID dpy,
+                int32_t* token, pid_t pid, uid_t uid, uint32_t sw, uint32_t sh,
+                uint32_t minLayerZ, uint32_t maxLayerZ)
+            : flinger(flinger), dpy(dpy), token(token), pid(pid), uid(uid),
+              sw(sw), sh(sh), minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              result(PERMISSION_DENIED)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+
+            // if we have secure windows, never allow the screen capture
+            if (flinger->mSecureFrameBuffer)
+                return true;
+
+            result = flinger->captureScreenAsyncImplLocked(dpy,
+                    token, pid, uid, sw, sh, minLayerZ, maxLayerZ);
+
+            return true;
+        }
+    };
+
+    // the token will only be good for the caller
+    IPCThreadState* ipc = IPCThreadState::self();
+    sp<MessageBase> msg = new MessageCaptureScreenAsync(this,
+            dpy, token, ipc->getCallingPid(), ipc->getCallingUid(),
+            sw, sh, minLayerZ, maxLayerZ);
+    status_t res = postMessageSync(msg);
+    if (res == NO_ERROR) {
+        res = static_cast<MessageCaptureScreenAsync*>( msg.get() )->getResult();
+    }
+    return res;
+}
+
+status_t SurfaceFlinger::collectScreenCapture(int32_t token,
+        sp<IMemoryHeap>* heap,
+        uint32_t* width, uint32_t* height, PixelFormat* format)
+{
+    // this runs on the binder thread, it doesn't need the main thread
+    // or the state lock.
+    IPCThreadState* ipc = IPCThreadState::self();
+    return mScreenCaptureQueue.collect(token,
+            ipc->getCallingPid(), ipc->getCallingUid(),
+            heap, width, height, format);
+}
+
 // ---------------------------------------------------------------------------
 
 sp<Layer> SurfaceFlinger::getLayer(const sp<ISurface>& sur) const
@@ -2743,8 +3728,27 @@ sp<ISurface> Client::createSurface(
         uint32_t flags)
 {
     /*
-     * createSurface must be called from the GL thread so that it can
-     * have access to the GL context.
+     * Normal and dim layers only need the GL context for their texture
+     * name. With one from the pool they're created right here, on the
+     * binder thread, so that they don't wait for a composition to finish.
+     * Only adding them to the current state is serialized, under
+     * mStateLock.
+     */
+    const uint32_t type = flags & ISurfaceComposer::eFXSurfaceMask;
+    if (mFlinger->mAsyncSurfaceCreation &&
+            type != ISurfaceComposer::eFXSurfaceScreenshot) {
+        GLuint textureName = -1U;
+        if (type != ISurfaceComposer::eFXSurfaceNormal ||
+                mFlinger->takeTextureName(&textureName)) {
+            android_atomic_inc(&mFlinger->mAsyncSurfacesCreated);
+            return mFlinger->createSurface(params, name, this,
+                    display, w, h, format, flags, textureName);
+        }
+    }
+
+    /*
+     * otherwise createSurface must be called from the GL thread so that
+     * it can have access to the GL context.
      */
 
     class MessageCreateSurface : public MessageBase {
@@ -2770,11 +3774,12 @@ sp<ISurface> Client::createSurface(
         sp<ISurface> getResult() const { return result; }
         virtual bool handler() {
             result = flinger->createSurface(params, name, client,
-                    display, w, h, format, flags);
+                    display, w, h, format, flags, -1U);
             return true;
         }
     };
 
+    android_atomic_inc(&mFlinger->mSyncSurfacesCreated);
     sp<MessageBase> msg = new MessageCreateSurface(mFlinger.get(),
             params, name, this, display, w, h, format, flags);
     mFlinger->postMessageSync(msg);
@@ -2786,16 +3791,33 @@ status_t Client::destroySurface(SurfaceID sid) {
 
 // ---------------------------------------------------------------------------
 
-GraphicBufferAlloc::GraphicBufferAlloc() {
+GraphicBufferAlloc::GraphicBufferAlloc(const sp<GraphicBufferPool>& pool)
+    : mPool(pool) {
 #ifdef QCOM_HARDWARE
     mBufferSize = 0;
 #endif
 }
 
-GraphicBufferAlloc::~GraphicBufferAlloc() {}
+GraphicBufferAlloc::~GraphicBufferAlloc() {
+    if (mPool != 0) {
+        mPool->releaseOwner(this);
+    }
+}
 
 sp<GraphicBuffer> GraphicBufferAlloc::createGraphicBuffer(uint32_t w, uint32_t h,
         PixelFormat format, uint32_t usage, status_t* error) {
+    bool recycle = mPool != 0;
+#ifdef QCOM_HARDWARE
+    // the pool doesn't know what size the buffers were allocated with
+    recycle = recycle && !mBufferSize;
+#endif
+    if (recycle) {
+        sp<GraphicBuffer> graphicBuffer(mPool->take(this, w, h, format, usage));
+        if (graphicBuffer != 0) {
+            *error = NO_ERROR;
+            return graphicBuffer;
+        }
+    }
     sp<GraphicBuffer> graphicBuffer(new GraphicBuffer(w, h, format,
                                                       usage
 #ifdef QCOM_HARDWARE
@@ -2816,6 +3838,12 @@ sp<GraphicBuffer> GraphicBufferAlloc::createGraphicBuffer(uint32_t w, uint32_t h
     return graphicBuffer;
 }
 
+void GraphicBufferAlloc::recycleGraphicBuffer(const sp<GraphicBuffer>& buffer) {
+    if (mPool != 0) {
+        mPool->recycle(this, buffer);
+    }
+}
+
 #ifdef QCOM_HARDWARE
 void GraphicBufferAlloc::setGraphicBufferSize(int size) {
     mBufferSize = size;
@@ -38,9 +38,15 @@
 #include <gui/ISurfaceComposerClient.h>
 
 #include "Barrier.h"
+#include "CompositionCache.h"
+#include "GraphicBufferPool.h"
 #include "Layer.h"
 
 #include "MessageQueue.h"
+#include "ReorderableVector.h"
+#include "ScreenCaptureBuffer.h"
+#include "TransactionQueue.h"
+#include "WorkerPool.h"
 
 #ifdef BOARD_USES_SAMSUNG_HDMI
 #include "SecHdmiClient.h"
@@ -98,13 +104,18 @@ private:
 class GraphicBufferAlloc : public BnGraphicBufferAlloc
 {
 public:
-    GraphicBufferAlloc();
+    // pool can be 0, buffers are then always allocated
+    GraphicBufferAlloc(const sp<GraphicBufferPool>& pool);
     virtual ~GraphicBufferAlloc();
     virtual sp<GraphicBuffer> createGraphicBuffer(uint32_t w, uint32_t h,
         PixelFormat format, uint32_t usage, status_t* error);
+    virtual void recycleGraphicBuffer(const sp<GraphicBuffer>& buffer);
 #ifdef QCOM_HARDWARE
     virtual void setGraphicBufferSize(int size);
+#endif
 private:
+    const sp<GraphicBufferPool> mPool;
+#ifdef QCOM_HARDWARE
     int mBufferSize;
 #endif
 };
@@ -151,7 +162,8 @@ private:
 
 enum {
     eTransactionNeeded      = 0x01,
-    eTraversalNeeded        = 0x02
+    eTraversalNeeded        = 0x02,
+    eTransactionQueued      = 0x04
 };
 
 class SurfaceFlinger :
@@ -193,6 +205,18 @@ public:
             PixelFormat* format, uint32_t reqWidth, uint32_t reqHeight,
             uint32_t minLayerZ, uint32_t maxLayerZ);
 
+    virtual status_t captureScreenToBuffer(DisplayID dpy,
+            const sp<GraphicBuffer>& buffer, int32_t* fence,
+            uint32_t minLayerZ, uint32_t maxLayerZ);
+    virtual status_t waitForScreenCapture(int32_t fence);
+
+    virtual status_t captureScreenAsync(DisplayID dpy, int32_t* token,
+            uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ);
+    virtual status_t collectScreenCapture(int32_t token,
+            sp<IMemoryHeap>* heap,
+            uint32_t* width, uint32_t* height, PixelFormat* format);
+
     virtual status_t                    turnElectronBeamOff(int32_t mode);
     virtual status_t                    turnElectronBeamOn(int32_t mode);
 
@@ -230,6 +254,11 @@ public:
 
     GLuint getProtectedTexName() const { return mProtectedTexName; }
 
+    // texture names for new layers, generated ahead of time on the main
+    // thread so that layers can be created without the GL context.
+    // returns false when there are none left.
+    bool takeTextureName(GLuint* name);
+
 #ifdef ALLWINNER
     int         setDisplayParameter(uint32_t cmd,uint32_t  value);
     uint32_t    getDisplayParameter(uint32_t cmd);
@@ -261,17 +290,23 @@ private:
     friend class LayerBaseClient;
     friend class Layer;
 
+    // textureName is used by normal surfaces. It comes from
+    // takeTextureName(), or is -1U to have one generated, which can only
+    // be done on the main thread.
     sp<ISurface> createSurface(
             ISurfaceComposerClient::surface_data_t* params,
             const String8& name,
             const sp<Client>& client,
             DisplayID display, uint32_t w, uint32_t h, PixelFormat format,
-            uint32_t flags);
+            uint32_t flags, GLuint textureName);
 
     sp<Layer> createNormalSurface(
             const sp<Client>& client, DisplayID display,
             uint32_t w, uint32_t h, uint32_t flags,
-            PixelFormat& format);
+            PixelFormat& format, GLuint textureName);
+
+    void returnTextureName(GLuint name);
+    void refillTextureNames();
 
     sp<LayerDim> createDimSurface(
             const sp<Client>& client, DisplayID display,
@@ -283,12 +318,14 @@ private:
 
     status_t removeSurface(const sp<Client>& client, SurfaceID sid);
     status_t destroySurface(const wp<LayerBaseClient>& layer);
-    uint32_t setClientStateLocked(const sp<Client>& client, const layer_state_t& s);
+    uint32_t setClientStateLocked(const sp<LayerBaseClient>& layer,
+            const layer_state_t& s);
+    uint32_t drainTransactionQueueLocked();
 
-    class LayerVector : public SortedVector< sp<LayerBase> > {
+    class LayerVector : public ReorderableVector< sp<LayerBase> > {
     public:
         LayerVector() { }
-        LayerVector(const LayerVector& rhs) : SortedVector< sp<LayerBase> >(rhs) { }
+        LayerVector(const LayerVector& rhs) : ReorderableVector< sp<LayerBase> >(rhs) { }
         virtual int do_compare(const void* lhs, const void* rhs) const {
             const sp<LayerBase>& l(*reinterpret_cast<const sp<LayerBase>*>(lhs));
             const sp<LayerBase>& r(*reinterpret_cast<const sp<LayerBase>*>(rhs));
@@ -332,9 +369,12 @@ private:
                             const LayerVector& currentLayers,
                             Region& dirtyRegion,
                             Region& wormholeRegion);
+            void        checkVisibleRegions(
+                            const LayerVector& currentLayers) const;
 
             void        handlePageFlip();
             bool        lockPageFlip(const LayerVector& currentLayers);
+            void        latchBuffers(sp<LayerBase> const* layers, size_t count);
             void        unlockPageFlip(const LayerVector& currentLayers);
             void        handleRefresh();
             void        handleWorkList();
@@ -364,6 +404,19 @@ private:
                     uint32_t* width, uint32_t* height, PixelFormat* format,
                     uint32_t reqWidth, uint32_t reqHeight,
                     uint32_t minLayerZ, uint32_t maxLayerZ);
+            status_t captureScreenToBufferImplLocked(DisplayID dpy,
+                    const sp<GraphicBuffer>& buffer, int32_t* fence,
+                    pid_t pid, uid_t uid,
+                    uint32_t minLayerZ, uint32_t maxLayerZ);
+            status_t captureScreenAsyncImplLocked(DisplayID dpy,
+                    int32_t* token, pid_t pid, uid_t uid,
+                    uint32_t reqWidth, uint32_t reqHeight,
+                    uint32_t minLayerZ, uint32_t maxLayerZ);
+            void drawScreenForTextureLocked();
+            status_t getScreenSnapshotLocked(GLuint* textureName);
+            void drawScreenForCaptureLocked(const DisplayHardware& hw,
+                    uint32_t sw, uint32_t sh,
+                    uint32_t minLayerZ, uint32_t maxLayerZ);
 
             status_t turnElectronBeamOffImplLocked(int32_t mode);
             status_t turnElectronBeamOnImplLocked(int32_t mode);
@@ -379,6 +432,9 @@ private:
                     String8& result, char* buffer, size_t SIZE) const;
             void dumpStatsLocked(const Vector<String16>& args, size_t& index,
                     String8& result, char* buffer, size_t SIZE) const;
+            void dumpLatencyHistogramLocked(const Vector<String16>& args,
+                    size_t& index, String8& result, char* buffer,
+                    size_t SIZE) const;
             void clearStatsLocked(const Vector<String16>& args, size_t& index,
                     String8& result, char* buffer, size_t SIZE) const;
             void dumpAllLocked(String8& result, char* buffer, size_t SIZE) const;
@@ -394,6 +450,11 @@ private:
                 bool                    mTransationPending;
                 Vector< sp<LayerBase> > mLayersPendingRemoval;
 
+                // filled by binder threads without any lock, drained into
+                // mCurrentState with mStateLock held
+                TransactionQueue        mTransactionQueue;
+                uint32_t                mMergedLayerStates;
+
                 // protected by mStateLock (but we could use another lock)
                 GraphicPlane                mGraphicPlanes[1];
                 bool                        mLayersRemoved;
@@ -419,9 +480,22 @@ private:
                 Region                      mSwapRegion;
                 Region                      mWormholeRegion;
                 bool                        mVisibleRegionsDirty;
+                bool                        mFullVisibleRegionsDirty;
                 bool                        mHwWorkListDirty;
                 int32_t                     mElectronBeamAnimationMode;
                 Vector< sp<LayerBase> >     mVisibleLayersSortedByZ;
+                CompositionCache            mCompositionCache;
+
+                // thread safe, rendered into on the main thread,
+                // read back from binder threads
+                ScreenCaptureQueue          mScreenCaptureQueue;
+
+                // the screen as last rendered for the electron beam
+                // animations, main thread only
+                sp<ScreenCaptureBuffer>     mScreenSnapshot;
+                bool                        mScreenSnapshotDirty;
+                uint32_t                    mScreenSnapshotRenders;
+                uint32_t                    mScreenSnapshotReuses;
 
 
                 // don't use a lock for these, we don't care
@@ -429,10 +503,14 @@ private:
                 int                         mDebugDDMS;
                 int                         mDebugDisableHWC;
                 int                         mDebugDisableTransformHint;
+                int                         mDebugCheckVisibleRegions;
                 volatile nsecs_t            mDebugInSwapBuffers;
                 nsecs_t                     mLastSwapBufferTime;
                 volatile nsecs_t            mDebugInTransaction;
                 nsecs_t                     mLastTransactionTime;
+                nsecs_t                     mRepaintVsyncTime;
+    mutable     LatencyHistogram            mCompositionLatency;
+    mutable     uint32_t                    mMissedRefreshCount;
                 bool                        mBootFinished;
 
                 // these are thread safe
@@ -446,6 +524,45 @@ private:
    // only written in the main thread, only read in other threads
    volatile     int32_t                     mSecureFrameBuffer;
                 int                         mUseDithering;
+                bool                        mIncrementalVisibleRegions;
+
+                // visible region statistics, main thread only
+                uint32_t                    mFullVisibleRegionsCount;
+                uint32_t                    mIncrementalVisibleRegionsCount;
+                uint32_t                    mVisibleRegionsLayersSkipped;
+                uint32_t                    mOccludedLayersSkipped;
+
+                // damage tracking statistics, main thread only
+                uint32_t                    mPartialRepaintCount;
+                uint32_t                    mFullRepaintCount;
+
+                // pipelined transactions, main thread only
+                enum { MAX_DEFERRED_TRANSACTION_FRAMES = 2 };
+                bool                        mPipelinedTransactions;
+                uint32_t                    mDeferredTransactionFrames;
+                uint32_t                    mDeferredTransactionCount;
+
+                // parallel buffer latching, main thread only
+                WorkerPool*                 mLatchWorkers;
+                Vector< sp<LayerBase> >     mLayersToLatch;
+
+                // surface creation on the binder threads
+                enum { TEXTURE_NAMES_COUNT = 8 };
+                bool                        mAsyncSurfaceCreation;
+    mutable     Mutex                       mTextureNamesLock;
+                Vector<GLuint>              mTextureNames;
+                bool                        mTextureNamesRefillPending;
+    volatile    int32_t                     mAsyncSurfacesCreated;
+    volatile    int32_t                     mSyncSurfacesCreated;
+
+                // recycled gralloc buffers, 0 if disabled
+                sp<GraphicBufferPool>       mGraphicBufferPool;
+
+                // idle frame skipping, main thread only
+                bool                        mSkipIdleFrames;
+                bool                        mBuffersLatched;
+                uint32_t                    mFramesComposed;
+                uint32_t                    mIdleFramesSkipped;
 #if defined(BOARD_USES_SAMSUNG_HDMI) && defined(SAMSUNG_EXYNOS5250)
     SecHdmiClient *                         mHdmiClient;
 #endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <cutils/atomic.h>
+
+#include <gui/ISurfaceComposer.h>
+
+#include "Layer.h"
+#include "LayerBase.h"
+#include "TransactionQueue.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+TransactionQueue::TransactionQueue()
+    : mTail(0), mHead(0), mEnqueued(0), mOverflows(0)
+{
+    for (int32_t i=0 ; i<SIZE ; i++) {
+        // slot i is free for the producer that claims position i
+        mSlots[i].sequence = i;
+        mSlots[i].transaction = 0;
+    }
+}
+
+TransactionQueue::~TransactionQueue()
+{
+    Transaction* transaction;
+    while ((transaction = dequeue()) != 0) {
+        delete transaction;
+    }
+}
+
+bool TransactionQueue::enqueue(Transaction* transaction)
+{
+    int32_t pos = android_atomic_acquire_load(&mTail);
+    Slot* slot;
+    for (;;) {
+        slot = &mSlots[pos & (SIZE - 1)];
+        const int32_t seq = android_atomic_acquire_load(&slot->sequence);
+        const int32_t dif = seq - pos;
+        if (dif == 0) {
+            // the slot is free, try to claim it
+            if (android_atomic_cmpxchg(pos, pos + 1, &mTail) == 0)
+                break;
+            pos = android_atomic_acquire_load(&mTail);
+        } else if (dif < 0) {
+            // the consumer hasn't read this slot yet, we're full
+            android_atomic_inc(&mOverflows);
+            return false;
+        } else {
+            // another producer got it first
+            pos = android_atomic_acquire_load(&mTail);
+        }
+    }
+    slot->transaction = transaction;
+    android_atomic_release_store(pos + 1, &slot->sequence);
+    android_atomic_inc(&mEnqueued);
+    return true;
+}
+
+TransactionQueue::Transaction* TransactionQueue::dequeue()
+{
+    const int32_t pos = mHead;
+    Slot& slot(mSlots[pos & (SIZE - 1)]);
+    const int32_t seq = android_atomic_acquire_load(&slot.sequence);
+    if (seq - (pos + 1) < 0) {
+        // not published yet
+        return 0;
+    }
+    Transaction* transaction = slot.transaction;
+    slot.transaction = 0;
+    // hand the slot back to the producers, one lap later
+    android_atomic_release_store(pos + SIZE, &slot.sequence);
+    mHead = pos + 1;
+    return transaction;
+}
+
+void TransactionQueue::merge(layer_state_t& dst, const layer_state_t& src)
+{
+    const uint32_t what = src.what;
+    if (what & ISurfaceComposer::ePositionChanged) {
+        dst.x = src.x;
+        dst.y = src.y;
+    }
+    if (what & ISurfaceComposer::eLayerChanged) {
+        dst.z = src.z;
+    }
+    if (what & ISurfaceComposer::eSizeChanged) {
+        dst.w = src.w;
+        dst.h = src.h;
+    }
+    if (what & ISurfaceComposer::eAlphaChanged) {
+        dst.alpha = src.alpha;
+    }
+    if (what & ISurfaceComposer::eMatrixChanged) {
+        dst.matrix = src.matrix;
+    }
+    if (what & ISurfaceComposer::eTransparentRegionChanged) {
+        dst.transparentRegion = src.transparentRegion;
+    }
+    if (what & ISurfaceComposer::eVisibilityChanged) {
+        // only the bits in the mask are being changed
+        dst.flags = (dst.flags & ~src.mask) | (src.flags & src.mask);
+        dst.mask |= src.mask;
+    }
+    if (what & ISurfaceComposer::eFreezeTintChanged) {
+        dst.tint = src.tint;
+    }
+    if (what & ISurfaceComposer::eCropChanged) {
+        dst.crop = src.crop;
+    }
+    dst.what |= what;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
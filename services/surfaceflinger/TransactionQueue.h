@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_TRANSACTION_QUEUE_H
+#define ANDROID_SF_TRANSACTION_QUEUE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/RefBase.h>
+#include <utils/Vector.h>
+
+#include <private/gui/LayerState.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+class LayerBaseClient;
+
+/*
+ * Bounded multi-producer/single-consumer queue of client transactions.
+ *
+ * Binder threads append to it without taking any lock: a producer claims a
+ * slot by advancing the tail with a compare-and-swap, fills it, then
+ * publishes it by storing the slot's sequence number. The consumer reads
+ * slots in order until it finds one that isn't published yet.
+ *
+ * There must be only one consumer at a time, SurfaceFlinger only dequeues
+ * with mStateLock held.
+ */
+class TransactionQueue
+{
+public:
+    struct Transaction {
+        Vector< sp<LayerBaseClient> > layers;
+        Vector<layer_state_t> states;
+    };
+
+    TransactionQueue();
+    ~TransactionQueue();
+
+    // any thread. takes ownership of the transaction, unless the queue is
+    // full in which case false is returned.
+    bool enqueue(Transaction* transaction);
+
+    // consumer only. returns NULL when there is nothing left to read, the
+    // caller owns the returned transaction.
+    Transaction* dequeue();
+
+    // fold the changes in src into dst, as if dst had been applied first
+    static void merge(layer_state_t& dst, const layer_state_t& src);
+
+    uint32_t getEnqueueCount() const { return mEnqueued; }
+    uint32_t getOverflowCount() const { return mOverflows; }
+
+private:
+    enum { SIZE = 64 };     // must be a power of two
+
+    struct Slot {
+        volatile int32_t sequence;
+        Transaction* transaction;
+    };
+
+    Slot mSlots[SIZE];
+    volatile int32_t mTail;     // next slot to be claimed by a producer
+    int32_t mHead;              // next slot to be read, consumer only
+    volatile int32_t mEnqueued;
+    volatile int32_t mOverflows;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_TRANSACTION_QUEUE_H
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Log.h>
+
+#include "VSyncModel.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// the model locks when the samples are within this distance of the line
+static const nsecs_t LOCK_RESIDUAL = us2ns(500);
+
+// a sample further than this from the prediction means we lost track
+static const nsecs_t MAX_ERROR = ms2ns(2);
+
+VSyncModel::VSyncModel(nsecs_t refreshPeriod)
+    : mNominalPeriod(refreshPeriod),
+      mFirst(0), mCount(0),
+      mReference(0), mPeriod(refreshPeriod), mResidual(0), mLocked(false),
+      mPredictions(0), mErrorSum(0), mErrorMax(0), mUnlocks(0)
+{
+}
+
+void VSyncModel::reset()
+{
+    mFirst = 0;
+    mCount = 0;
+    mLocked = false;
+    mResidual = 0;
+}
+
+void VSyncModel::addSample(nsecs_t timestamp)
+{
+    if (mLocked) {
+        const nsecs_t expected = getNextVSync(timestamp - mPeriod / 2);
+        nsecs_t error = timestamp - expected;
+        if (error < 0) {
+            error = -error;
+        }
+        mPredictions++;
+        mErrorSum += error;
+        if (error > mErrorMax) {
+            mErrorMax = error;
+        }
+        if (error > MAX_ERROR) {
+            ALOGD("vsync model lost track (off by %lld us)", ns2us(error));
+            mUnlocks++;
+            reset();
+        }
+    }
+
+    if (mCount && timestamp <= mSamples[(mFirst + mCount - 1) % MAX_SAMPLES]) {
+        // not monotonic, ignore it
+        return;
+    }
+    if (mCount == MAX_SAMPLES) {
+        mFirst = (mFirst + 1) % MAX_SAMPLES;
+        mCount--;
+    }
+    mSamples[(mFirst + mCount) % MAX_SAMPLES] = timestamp;
+    mCount++;
+    fit();
+}
+
+void VSyncModel::fit()
+{
+    const nsecs_t origin = mSamples[mFirst];
+    if (mCount < 2) {
+        mReference = origin;
+        mPeriod = mNominalPeriod;
+        mLocked = false;
+        return;
+    }
+
+    // index of each sample's refresh, using the current estimate of the
+    // period. it's good enough as long as the error it accumulates over
+    // the whole window stays under half a period.
+    const double estimate = double(mPeriod);
+    double index[MAX_SAMPLES];
+    double time[MAX_SAMPLES];
+    double meanIndex = 0;
+    double meanTime = 0;
+    for (size_t i=0 ; i<mCount ; i++) {
+        time[i] = double(mSamples[(mFirst + i) % MAX_SAMPLES] - origin);
+        index[i] = floor(time[i] / estimate + 0.5);
+        meanIndex += index[i];
+        meanTime += time[i];
+    }
+    meanIndex /= mCount;
+    meanTime /= mCount;
+
+    double sxy = 0;
+    double sxx = 0;
+    for (size_t i=0 ; i<mCount ; i++) {
+        sxy += (index[i] - meanIndex) * (time[i] - meanTime);
+        sxx += (index[i] - meanIndex) * (index[i] - meanIndex);
+    }
+    if (sxx == 0) {
+        // all samples in the same refresh, can't tell anything
+        return;
+    }
+    const double period = sxy / sxx;
+    const double intercept = meanTime - period * meanIndex;
+
+    double sse = 0;
+    for (size_t i=0 ; i<mCount ; i++) {
+        const double d = time[i] - (intercept + period * index[i]);
+        sse += d * d;
+    }
+
+    mPeriod = nsecs_t(period + 0.5);
+    mReference = origin + nsecs_t(intercept + 0.5);
+    mResidual = nsecs_t(sqrt(sse / mCount) + 0.5);
+
+    // don't trust a period that's way off the nominal one
+    const bool plausible =
+            mPeriod > mNominalPeriod / 2 && mPeriod < mNominalPeriod * 2;
+    mLocked = plausible && mCount >= MIN_SAMPLES && mResidual < LOCK_RESIDUAL;
+}
+
+nsecs_t VSyncModel::getNextVSync(nsecs_t after) const
+{
+    const nsecs_t period = mPeriod > 0 ? mPeriod : mNominalPeriod;
+    nsecs_t n = (after - mReference) / period;
+    nsecs_t next = mReference + n * period;
+    // the division truncates towards zero
+    while (next <= after) {
+        next += period;
+    }
+    while (next - period > after) {
+        next -= period;
+    }
+    return next;
+}
+
+void VSyncModel::dump(String8& result, const char* prefix) const
+{
+    result.appendFormat(
+            "%s%s, period=%.3f ms (nominal %.3f ms), "
+            "residual=%lld us, samples=%u\n",
+            prefix, mLocked ? "locked" : "unlocked",
+            mPeriod / 1e6, mNominalPeriod / 1e6,
+            ns2us(mResidual), uint32_t(mCount));
+    result.appendFormat(
+            "%sprediction error: mean=%lld us, max=%lld us "
+            "over %u vsyncs, lost track %u times\n",
+            prefix, mPredictions ? ns2us(mErrorSum / mPredictions) : 0,
+            ns2us(mErrorMax), mPredictions, mUnlocks);
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
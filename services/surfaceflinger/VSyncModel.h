@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_VSYNC_MODEL_H
+#define ANDROID_SF_VSYNC_MODEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * Software model of the display's vsync, fitted on the most recent
+ * hardware vsync timestamps.
+ *
+ * Each timestamp is assigned the index of the refresh it belongs to
+ * (missed events just leave gaps), and a least-squares fit of
+ * timestamp = reference + index * period gives the actual period, which
+ * drifts from the nominal one, and the phase. The model is locked when it
+ * has enough samples and they're all close to the fitted line; a sample
+ * far from where the model expected it means we lost track (e.g. the
+ * display was reconfigured), the history is then dropped.
+ *
+ * Not thread-safe, EventThread only uses it with its lock held.
+ */
+class VSyncModel
+{
+public:
+    VSyncModel(nsecs_t refreshPeriod);
+
+    // feed a hardware vsync timestamp
+    void addSample(nsecs_t timestamp);
+
+    // forget all samples, e.g. after the display was turned off
+    void reset();
+
+    bool isLocked() const { return mLocked; }
+    nsecs_t getPeriod() const { return mPeriod; }
+
+    // the first vsync the model predicts strictly after the given time.
+    // only meaningful when the model is locked.
+    nsecs_t getNextVSync(nsecs_t after) const;
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    enum {
+        MAX_SAMPLES = 32,
+        MIN_SAMPLES = 8         // to lock
+    };
+
+    void fit();
+
+    const nsecs_t mNominalPeriod;
+
+    // ring of the last hardware timestamps
+    nsecs_t mSamples[MAX_SAMPLES];
+    size_t mFirst;
+    size_t mCount;
+
+    // the fitted line
+    nsecs_t mReference;     // a vsync on the line
+    nsecs_t mPeriod;
+    nsecs_t mResidual;      // rms distance of the samples to the line
+    bool mLocked;
+
+    // prediction error: distance of the hardware timestamps to where the
+    // locked model expected them.
+    uint32_t mPredictions;
+    nsecs_t mErrorSum;
+    nsecs_t mErrorMax;
+    uint32_t mUnlocks;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_VSYNC_MODEL_H
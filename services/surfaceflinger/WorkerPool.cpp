@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <cutils/atomic.h>
+
+#include <utils/Log.h>
+
+#include "WorkerPool.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+WorkerPool::WorkerPool(size_t numThreads, const char* name)
+    : mJob(0), mCount(0), mGeneration(0), mBusy(0), mExiting(false),
+      mNext(0), mJobs(0), mItems(0), mItemsOffloaded(0)
+{
+    for (size_t i=0 ; i<numThreads ; i++) {
+        char threadName[32];
+        snprintf(threadName, sizeof(threadName), "%s:%u", name, uint32_t(i));
+        sp<Worker> worker(new Worker(*this));
+        status_t err = worker->run(threadName, PRIORITY_URGENT_DISPLAY);
+        if (err != NO_ERROR) {
+            ALOGE("couldn't start worker %s (%s)", threadName, strerror(-err));
+            break;
+        }
+        mWorkers.add(worker);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    { // scope for the lock
+        Mutex::Autolock _l(mLock);
+        mExiting = true;
+        mJobCondition.broadcast();
+    }
+    for (size_t i=0 ; i<mWorkers.size() ; i++) {
+        mWorkers[i]->requestExitAndWait();
+    }
+}
+
+void WorkerPool::run(Job& job, size_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    { // scope for the lock
+        Mutex::Autolock _l(mLock);
+        mJob = &job;
+        mCount = count;
+        mNext = 0;
+        mGeneration++;
+        mJobCondition.broadcast();
+    }
+
+    runItems();
+
+    // all the items have been handed out, wait for the workers that are
+    // still running one. a worker that wakes up after the job is over
+    // doesn't join it, so we never wait for a thread to be scheduled.
+    Mutex::Autolock _l(mLock);
+    while (mBusy) {
+        mDoneCondition.wait(mLock);
+    }
+    mJob = 0;
+    mJobs++;
+    mItems += count;
+}
+
+size_t WorkerPool::runItems()
+{
+    Job* const job = mJob;
+    const int32_t count = int32_t(mCount);
+    size_t done = 0;
+    int32_t index;
+    while ((index = android_atomic_inc(&mNext)) < count) {
+        job->run(size_t(index));
+        done++;
+    }
+    return done;
+}
+
+bool WorkerPool::Worker::threadLoop()
+{
+    WorkerPool& pool(mPool);
+    { // scope for the lock
+        Mutex::Autolock _l(pool.mLock);
+        while (!pool.mExiting && (!pool.mJob || pool.mGeneration == mGeneration)) {
+            pool.mJobCondition.wait(pool.mLock);
+        }
+        if (pool.mExiting) {
+            return false;
+        }
+        mGeneration = pool.mGeneration;
+        pool.mBusy++;
+    }
+
+    const size_t done = pool.runItems();
+
+    Mutex::Autolock _l(pool.mLock);
+    pool.mItemsOffloaded += done;
+    if (--pool.mBusy == 0) {
+        pool.mDoneCondition.signal();
+    }
+    return true;
+}
+
+void WorkerPool::dump(String8& result, const char* prefix) const
+{
+    Mutex::Autolock _l(mLock);
+    result.appendFormat("%s%u threads, %u jobs, %u items (%u on workers)\n",
+            prefix, uint32_t(mWorkers.size()), mJobs, mItems, mItemsOffloaded);
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
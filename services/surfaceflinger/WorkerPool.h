@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_WORKER_POOL_H
+#define ANDROID_SF_WORKER_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * A small pool of threads that SurfaceFlinger's main thread hands
+ * independent per-layer work to.
+ *
+ * run() splits the items of a job between the workers and the calling
+ * thread, which takes its share too, and returns once they're all done.
+ * Items are handed out one at a time, so a slow one doesn't hold up the
+ * others. Only one job runs at a time, run() must always be called from
+ * the same thread.
+ */
+class WorkerPool
+{
+public:
+    class Job {
+    public:
+        // called once for each index, from any of the threads
+        virtual void run(size_t index) = 0;
+    protected:
+        virtual ~Job() { }
+    };
+
+    WorkerPool(size_t numThreads, const char* name);
+    ~WorkerPool();
+
+    size_t getThreadCount() const { return mWorkers.size(); }
+
+    void run(Job& job, size_t count);
+
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    class Worker : public Thread {
+    public:
+        Worker(WorkerPool& pool)
+            : Thread(false), mPool(pool), mGeneration(0) { }
+    private:
+        virtual bool threadLoop();
+        WorkerPool& mPool;
+        uint32_t mGeneration;   // of the last job this worker joined
+    };
+    friend class Worker;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator = (const WorkerPool&);
+
+    // takes and runs items of the current job until there are none left,
+    // returns how many it ran
+    size_t runItems();
+
+    Vector< sp<Worker> > mWorkers;
+
+    mutable Mutex mLock;
+    Condition mJobCondition;    // a job was posted, or the pool is exiting
+    Condition mDoneCondition;   // a worker is done with the current job
+    Job* mJob;
+    size_t mCount;
+    uint32_t mGeneration;       // of the current job
+    size_t mBusy;               // workers not done with the current job
+    bool mExiting;
+
+    // the next item to hand out
+    volatile int32_t mNext;
+
+    // statistics
+    uint32_t mJobs;
+    uint32_t mItems;
+    uint32_t mItemsOffloaded;   // items that didn't run on the caller
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_WORKER_POOL_H
@@ -197,6 +197,29 @@ TEST_F(LayerUpdateTest, LayerMoveWorks) {
     }
 }
 
+TEST_F(LayerUpdateTest, QueuedLayerMovesAreAppliedInOrder) {
+    // a burst of asynchronous transactions moving the same layer, the last
+    // one must win.
+    for (int i = 0; i <= 64; i++) {
+        SurfaceComposerClient::openGlobalTransaction();
+        ASSERT_EQ(NO_ERROR, mFGSurfaceControl->setPosition(64 + i, 64 + i));
+        SurfaceComposerClient::closeGlobalTransaction();
+    }
+
+    // a synchronous transaction is applied after everything queued before
+    SurfaceComposerClient::openGlobalTransaction();
+    ASSERT_EQ(NO_ERROR, mSyncSurfaceControl->setLayer(INT_MAX));
+    SurfaceComposerClient::closeGlobalTransaction(true);
+    {
+        SCOPED_TRACE("after moves");
+        sp<ScreenCapture> sc;
+        ScreenCapture::captureScreen(&sc);
+        sc->checkPixel( 24,  24,  63,  63, 195);
+        sc->checkPixel( 75,  75,  63,  63, 195);
+        sc->checkPixel(145, 145, 195,  63,  63);
+    }
+}
+
 TEST_F(LayerUpdateTest, LayerResizeWorks) {
     sp<ScreenCapture> sc;
     {
@@ -0,0 +1,21 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	hwc_sim.cpp \
+	SimulatedHwc.cpp \
+	../../DisplayHardware/HWCWorkList.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../../DisplayHardware
+
+LOCAL_STATIC_LIBRARIES := \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_MODULE:= hwc-sim
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
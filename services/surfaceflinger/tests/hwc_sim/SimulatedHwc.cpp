@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <system/graphics.h>
+
+#include "SimulatedHwc.h"
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+// the ints of a simulated buffer's native_handle
+enum {
+    BUFFER_MAGIC = 0x73696d62,  // 'simb'
+    BUFFER_INTS = 4
+};
+
+SimulatedHwc::Config::Config()
+    : maxOverlays(2), numFormats(0),
+      blending(false), transforms(false), scaling(true),
+      minOverlayArea(64*64),
+      glesOpaqueCost(1.0), glesBlendedCost(2.0), overlayCost(20000.0)
+{
+    // opaque RGB and video, like most overlay engines of the time
+    formats[numFormats++] = HAL_PIXEL_FORMAT_RGBX_8888;
+    formats[numFormats++] = HAL_PIXEL_FORMAT_RGB_565;
+    formats[numFormats++] = HAL_PIXEL_FORMAT_YV12;
+}
+
+SimulatedHwc::SimulatedHwc(const Config& config)
+    : mConfig(config), mGeometryChanged(false)
+{
+    memset(&mDevice, 0, sizeof(mDevice));
+    mDevice.common.tag = HARDWARE_DEVICE_TAG;
+    mDevice.common.version = HWC_DEVICE_API_VERSION_0_1;
+    mDevice.prepare = hook_prepare;
+    mDevice.set = hook_set;
+    mDevice.dump = hook_dump;
+    mDevice.self = this;
+    memset(&mLastFrame, 0, sizeof(mLastFrame));
+}
+
+int SimulatedHwc::hook_prepare(hwc_composer_device_t* dev,
+        hwc_layer_list_t* list) {
+    return static_cast<Device*>(dev)->self->prepare(list);
+}
+
+int SimulatedHwc::hook_set(hwc_composer_device_t* dev,
+        hwc_display_t dpy, hwc_surface_t sur, hwc_layer_list_t* list) {
+    return static_cast<Device*>(dev)->self->set(list);
+}
+
+void SimulatedHwc::hook_dump(hwc_composer_device_t* dev, char* buff, int len) {
+    static_cast<Device*>(dev)->self->dump(buff, len);
+}
+
+static uint64_t area(const hwc_region_t& region) {
+    uint64_t a = 0;
+    for (size_t i=0 ; i<region.numRects ; i++) {
+        const hwc_rect_t& r(region.rects[i]);
+        a += uint64_t(r.right - r.left) * uint64_t(r.bottom - r.top);
+    }
+    return a;
+}
+
+bool SimulatedHwc::canUseOverlay(const hwc_layer_t& l) const {
+    int format, width, height;
+    if ((l.flags & HWC_SKIP_LAYER) ||
+            !getBufferInfo(l.handle, &format, &width, &height)) {
+        return false;
+    }
+    bool supported = false;
+    for (size_t i=0 ; i<mConfig.numFormats ; i++) {
+        supported |= (mConfig.formats[i] == uint32_t(format));
+    }
+    if (!supported) {
+        return false;
+    }
+    if (l.blending != HWC_BLENDING_NONE && !mConfig.blending) {
+        return false;
+    }
+    if (l.transform && !mConfig.transforms) {
+        return false;
+    }
+    const int cropW = l.sourceCrop.right - l.sourceCrop.left;
+    const int cropH = l.sourceCrop.bottom - l.sourceCrop.top;
+    const int frameW = l.displayFrame.right - l.displayFrame.left;
+    const int frameH = l.displayFrame.bottom - l.displayFrame.top;
+    const bool rotated = (l.transform & HWC_TRANSFORM_ROT_90) != 0;
+    const bool scaled = rotated ?
+            (cropW != frameH || cropH != frameW) :
+            (cropW != frameW || cropH != frameH);
+    if (scaled && !mConfig.scaling) {
+        return false;
+    }
+    return area(l.visibleRegionScreen) >= mConfig.minOverlayArea;
+}
+
+int SimulatedHwc::prepare(hwc_layer_list_t* list) {
+    if (!list) {
+        return 0;
+    }
+    const size_t count = list->numHwLayers;
+    if (list->flags & HWC_GEOMETRY_CHANGED) {
+        mGeometryChanged = true;
+        for (size_t i=0 ; i<count ; i++) {
+            list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
+            list->hwLayers[i].hints = 0;
+        }
+        // the overlays go to the eligible layers that save the most GLES
+        // work. a handful of layers, so a selection is fine.
+        for (size_t n=0 ; n<mConfig.maxOverlays ; n++) {
+            ssize_t best = -1;
+            uint64_t bestArea = 0;
+            for (size_t i=0 ; i<count ; i++) {
+                const hwc_layer_t& l(list->hwLayers[i]);
+                if (l.compositionType == HWC_OVERLAY || !canUseOverlay(l)) {
+                    continue;
+                }
+                const uint64_t a = area(l.visibleRegionScreen);
+                if (best < 0 || a > bestArea) {
+                    best = i;
+                    bestArea = a;
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            list->hwLayers[best].compositionType = HWC_OVERLAY;
+            list->hwLayers[best].hints = HWC_HINT_CLEAR_FB;
+        }
+    } else {
+        // no geometry change, the decisions stand unless the layer's
+        // new buffer can't be scanned out
+        for (size_t i=0 ; i<count ; i++) {
+            hwc_layer_t& l(list->hwLayers[i]);
+            if (l.compositionType == HWC_OVERLAY && !canUseOverlay(l)) {
+                l.compositionType = HWC_FRAMEBUFFER;
+                l.hints = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+int SimulatedHwc::set(hwc_layer_list_t* list) {
+    FrameStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.geometryChanged = mGeometryChanged;
+    mGeometryChanged = false;
+    if (list) {
+        for (size_t i=0 ; i<list->numHwLayers ; i++) {
+            const hwc_layer_t& l(list->hwLayers[i]);
+            const uint64_t a = area(l.visibleRegionScreen);
+            if (l.compositionType == HWC_OVERLAY) {
+                stats.overlays++;
+                stats.clearedPixels += a;
+                stats.cost += mConfig.overlayCost;
+            } else {
+                stats.framebuffer++;
+                stats.glesPixels += a;
+                stats.cost += a * (l.blending == HWC_BLENDING_NONE ?
+                        mConfig.glesOpaqueCost : mConfig.glesBlendedCost);
+            }
+        }
+        if (!stats.framebuffer) {
+            // SurfaceFlinger doesn't touch the framebuffer at all
+            stats.clearedPixels = 0;
+        } else {
+            stats.cost += stats.clearedPixels * mConfig.glesOpaqueCost;
+        }
+    }
+    mLastFrame = stats;
+    return 0;
+}
+
+void SimulatedHwc::dump(char* buff, int len) const {
+    int n = snprintf(buff, len,
+            "simulated hwc: %u overlays, blending=%d, transforms=%d, "
+            "scaling=%d, min area=%u, formats:",
+            uint32_t(mConfig.maxOverlays), mConfig.blending,
+            mConfig.transforms, mConfig.scaling, mConfig.minOverlayArea);
+    for (size_t i=0 ; i<mConfig.numFormats && n>0 && n<len ; i++) {
+        n += snprintf(buff + n, len - n, " %x", mConfig.formats[i]);
+    }
+    if (n > 0 && n < len) {
+        snprintf(buff + n, len - n, "\n");
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+buffer_handle_t SimulatedHwc::createBuffer(int format, int width, int height) {
+    native_handle_t* h = (native_handle_t*)malloc(
+            sizeof(native_handle_t) + BUFFER_INTS*sizeof(int));
+    h->version = sizeof(native_handle_t);
+    h->numFds = 0;
+    h->numInts = BUFFER_INTS;
+    h->data[0] = BUFFER_MAGIC;
+    h->data[1] = format;
+    h->data[2] = width;
+    h->data[3] = height;
+    return h;
+}
+
+void SimulatedHwc::destroyBuffer(buffer_handle_t handle) {
+    free(const_cast<native_handle_t*>(handle));
+}
+
+bool SimulatedHwc::getBufferInfo(buffer_handle_t handle,
+        int* format, int* width, int* height) {
+    if (!handle || handle->numFds != 0 || handle->numInts != BUFFER_INTS ||
+            handle->data[0] != BUFFER_MAGIC) {
+        return false;
+    }
+    *format = handle->data[1];
+    *width  = handle->data[2];
+    *height = handle->data[3];
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+}; // namespace android
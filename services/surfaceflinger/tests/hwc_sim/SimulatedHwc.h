@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SF_SIMULATED_HWC_H
+#define ANDROID_SF_SIMULATED_HWC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/hwcomposer.h>
+
+namespace android {
+// ---------------------------------------------------------------------------
+
+/*
+ * A software stand-in for an hwc_composer_device_t.
+ *
+ * It makes the decisions a typical overlay-based HAL makes: when the
+ * geometry changes, the largest layers that the overlay engine can take
+ * (format, blending, transform and scaling permitting) go to overlays, the
+ * others are left to GLES. Without a geometry change it keeps its previous
+ * decisions. set() doesn't show anything, it accounts for what the frame
+ * costs with a simple per-pixel and per-overlay model.
+ */
+class SimulatedHwc
+{
+public:
+    enum {
+        MAX_FORMATS = 8
+    };
+
+    struct Config {
+        size_t maxOverlays;
+        uint32_t formats[MAX_FORMATS];  // formats the overlays can scan out
+        size_t numFormats;
+        bool blending;                  // overlays can blend
+        bool transforms;                // overlays can rotate and flip
+        bool scaling;                   // overlays can scale
+        uint32_t minOverlayArea;        // smaller layers aren't worth it
+        double glesOpaqueCost;          // ns per pixel composed with GLES
+        double glesBlendedCost;         // ns per pixel blended with GLES
+        double overlayCost;             // ns per overlay and frame
+
+        Config();
+    };
+
+    struct FrameStats {
+        uint32_t overlays;
+        uint32_t framebuffer;           // layers composed with GLES
+        uint64_t glesPixels;            // pixels composed with GLES
+        uint64_t clearedPixels;         // holes punched for the overlays
+        double cost;                    // ns, according to the model
+        bool geometryChanged;
+    };
+
+    SimulatedHwc(const Config& config);
+
+    hwc_composer_device_t* getDevice() { return &mDevice; }
+    const Config& getConfig() const { return mConfig; }
+
+    // what the last set() composed
+    const FrameStats& getLastFrame() const { return mLastFrame; }
+
+    // simulated gralloc buffers, they only carry their format and size
+    static buffer_handle_t createBuffer(int format, int width, int height);
+    static void destroyBuffer(buffer_handle_t handle);
+    static bool getBufferInfo(buffer_handle_t handle,
+            int* format, int* width, int* height);
+
+private:
+    struct Device : public hwc_composer_device_t {
+        SimulatedHwc* self;
+    };
+
+    static int hook_prepare(hwc_composer_device_t* dev,
+            hwc_layer_list_t* list);
+    static int hook_set(hwc_composer_device_t* dev,
+            hwc_display_t dpy, hwc_surface_t sur, hwc_layer_list_t* list);
+    static void hook_dump(hwc_composer_device_t* dev, char* buff, int len);
+
+    int prepare(hwc_layer_list_t* list);
+    int set(hwc_layer_list_t* list);
+    void dump(char* buff, int len) const;
+
+    bool canUseOverlay(const hwc_layer_t& layer) const;
+
+    Device mDevice;
+    const Config mConfig;
+    FrameStats mLastFrame;
+    bool mGeometryChanged;
+};
+
+// ---------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_SF_SIMULATED_HWC_H
@@ -0,0 +1,656 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <system/graphics.h>
+
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "HWCWorkList.h"
+#include "SimulatedHwc.h"
+
+using namespace android;
+
+/*
+ * Replays layer stacks through the h/w composer work list the way
+ * SurfaceFlinger's handleWorkList() and setupHardwareComposer() do, on top
+ * of a simulated HAL, and reports what the composition strategy costs:
+ * overlay use, the pixels left to GLES, the modelled composition cost and
+ * the CPU time spent on the work list.
+ *
+ * The stacks come from built-in scenarios, or from a recording: the
+ * "Hardware Composer state" tables of successive dumps, e.g.
+ *
+ *   while true; do adb shell dumpsys SurfaceFlinger; done > recording.txt
+ *
+ * The per-frame decisions can be saved as a baseline (-w) and checked
+ * against it later (-c), which fails when the strategy changes.
+ *
+ * It builds for the host, no device needed.
+ */
+
+struct LayerState {
+    char name[64];
+    int format;                 // -1 when the layer has no buffer
+    int width, height;          // of the buffer
+    uint32_t buffer;            // identifies the buffer, 0 for none
+    uint32_t flags;
+    uint32_t transform;
+    int32_t blending;
+    int alpha;
+    hwc_rect_t crop;
+    hwc_rect_t frame;
+    int recordedType;           // -1 unless replaying a recording
+};
+
+typedef Vector<LayerState> Frame;
+
+static hwc_rect_t rect(int l, int t, int r, int b) {
+    hwc_rect_t rc = { l, t, r, b };
+    return rc;
+}
+
+static bool operator == (const hwc_rect_t& lhs, const hwc_rect_t& rhs) {
+    return lhs.left == rhs.left && lhs.top == rhs.top &&
+            lhs.right == rhs.right && lhs.bottom == rhs.bottom;
+}
+
+// ---------------------------------------------------------------------------
+// built-in scenarios
+
+static const int W = 720;
+static const int H = 1280;
+
+static LayerState layer(const char* name, int format, int w, int h,
+        uint32_t buffer, const hwc_rect_t& frame, int32_t blending) {
+    LayerState l;
+    memset(&l, 0, sizeof(l));
+    strncpy(l.name, name, sizeof(l.name) - 1);
+    l.format = format;
+    l.width = w;
+    l.height = h;
+    l.buffer = buffer;
+    l.blending = blending;
+    l.alpha = 255;
+    l.crop = rect(0, 0, w, h);
+    l.frame = frame;
+    l.recordedType = -1;
+    return l;
+}
+
+static void addBars(Frame& out) {
+    out.add(layer("StatusBar", HAL_PIXEL_FORMAT_RGBA_8888, W, 50,
+            10, rect(0, 0, W, 50), HWC_BLENDING_PREMULT));
+    out.add(layer("NavigationBar", HAL_PIXEL_FORMAT_RGBA_8888, W, 96,
+            11, rect(0, H-96, W, H), HWC_BLENDING_PREMULT));
+}
+
+// a scrolling wallpaper under a launcher that redraws every frame
+static void launcher(int f, Frame& out) {
+    LayerState wallpaper(layer("ImageWallpaper", HAL_PIXEL_FORMAT_RGBX_8888,
+            W*2, H, 1, rect(0, 0, W, H), HWC_BLENDING_NONE));
+    const int x = (f * 8) % W;
+    wallpaper.crop = rect(x, 0, x + W, H);
+    out.add(wallpaper);
+    out.add(layer("Launcher", HAL_PIXEL_FORMAT_RGBA_8888, W, H-146,
+            2 + f % 3, rect(0, 50, W, H-96), HWC_BLENDING_PREMULT));
+    addBars(out);
+}
+
+// a scaled video, with playback controls fading out half-way through
+static void video(int f, Frame& out) {
+    out.add(layer("SurfaceView", HAL_PIXEL_FORMAT_YV12, 1280, 720,
+            100 + f % 3, rect(0, 437, W, 842), HWC_BLENDING_NONE));
+    if (f < 90) {
+        LayerState controls(layer("MediaControls", HAL_PIXEL_FORMAT_RGBA_8888,
+                W, 200, 20, rect(0, H-296, W, H-96), HWC_BLENDING_PREMULT));
+        controls.alpha = f < 60 ? 255 : 255 - (f - 60) * 8;
+        out.add(controls);
+    }
+    addBars(out);
+}
+
+// a dialog fading in over a dimmed, animating application
+static void dialog(int f, Frame& out) {
+    out.add(layer("Application", HAL_PIXEL_FORMAT_RGBX_8888, W, H-50,
+            1 + f % 2, rect(0, 50, W, H), HWC_BLENDING_NONE));
+    LayerState dim(layer("DimLayer", -1, 0, 0, 0,
+            rect(0, 0, W, H), HWC_BLENDING_PREMULT));
+    dim.alpha = 128;
+    dim.flags = HWC_SKIP_LAYER;
+    out.add(dim);
+    LayerState d(layer("Dialog", HAL_PIXEL_FORMAT_RGBA_8888, 600, 400,
+            30, rect(60, 440, 660, 840), HWC_BLENDING_PREMULT));
+    d.alpha = f < 30 ? f * 8 : 255;
+    out.add(d);
+    addBars(out);
+}
+
+// an application rotating to landscape
+static void rotation(int f, Frame& out) {
+    if (f < 30) {
+        out.add(layer("Application", HAL_PIXEL_FORMAT_RGBX_8888, W, H,
+                1 + f % 2, rect(0, 0, W, H), HWC_BLENDING_NONE));
+    } else {
+        LayerState app(layer("Application", HAL_PIXEL_FORMAT_RGBX_8888, H, W,
+                3 + f % 2, rect(0, 0, W, H), HWC_BLENDING_NONE));
+        app.transform = HWC_TRANSFORM_ROT_90;
+        out.add(app);
+    }
+    addBars(out);
+}
+
+struct Scenario {
+    const char* name;
+    void (*generate)(int frame, Frame& out);
+};
+
+static const Scenario sScenarios[] = {
+    { "launcher",   launcher },
+    { "video",      video },
+    { "dialog",     dialog },
+    { "rotation",   rotation },
+};
+
+static const size_t NUM_SCENARIOS = sizeof(sScenarios) / sizeof(*sScenarios);
+
+// ---------------------------------------------------------------------------
+// recordings
+
+static bool loadRecording(const char* path, Vector<Frame>& frames) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char line[1024];
+    bool inTable = false;
+    bool inRows = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "Hardware Composer state:")) {
+            frames.add(Frame());
+            inTable = true;
+            inRows = false;
+            continue;
+        }
+        if (!inTable) {
+            continue;
+        }
+        char type[16];
+        unsigned int handle, hints, flags, tr, blend, format;
+        int cl, ct, cr, cb, fl, ft, fr, fb;
+        int end = 0;
+        int n = sscanf(line,
+                " %15s | %x | %x | %x | %x | %x | %x | "
+                "[%d,%d,%d,%d] | [%d,%d,%d,%d] %n",
+                type, &handle, &hints, &flags, &tr, &blend, &format,
+                &cl, &ct, &cr, &cb, &fl, &ft, &fr, &fb, &end);
+        if (n != 15) {
+            // the table ends with the first line after the rows that
+            // isn't one
+            inTable = !inRows;
+            continue;
+        }
+        inRows = true;
+        char* name = line + end;
+        name[strcspn(name, "\r\n")] = 0;
+        LayerState l(layer(name, format == 0xffffffff ? -1 : int(format),
+                cr, cb, handle, rect(fl, ft, fr, fb), blend));
+        l.crop = rect(cl, ct, cr, cb);
+        l.flags = flags;
+        l.transform = tr;
+        l.recordedType = strcmp(type, "OVERLAY") ? HWC_FRAMEBUFFER : HWC_OVERLAY;
+        frames.editTop().add(l);
+    }
+    fclose(f);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// replay
+
+typedef Vector<hwc_rect_t> RectList;
+
+// the parts of the rectangles in list that aren't in r
+static void subtract(RectList& list, const hwc_rect_t& r) {
+    RectList result;
+    for (size_t i=0 ; i<list.size() ; i++) {
+        const hwc_rect_t& a(list[i]);
+        if (a.right <= r.left || a.left >= r.right ||
+                a.bottom <= r.top || a.top >= r.bottom) {
+            result.add(a);
+            continue;
+        }
+        const int top = a.top > r.top ? a.top : r.top;
+        const int bottom = a.bottom < r.bottom ? a.bottom : r.bottom;
+        if (a.top < r.top)
+            result.add(rect(a.left, a.top, a.right, r.top));
+        if (a.left < r.left)
+            result.add(rect(a.left, top, r.left, bottom));
+        if (a.right > r.right)
+            result.add(rect(r.right, top, a.right, bottom));
+        if (a.bottom > r.bottom)
+            result.add(rect(a.left, r.bottom, a.right, a.bottom));
+    }
+    list = result;
+}
+
+struct Totals {
+    uint32_t frames;
+    uint32_t overlays;
+    uint32_t glesFrames;
+    uint64_t glesPixels;
+    uint64_t maxGlesPixels;
+    double cost;
+    double maxCost;
+    nsecs_t cpu;
+    nsecs_t maxCpu;
+    uint32_t recorded;
+    uint32_t recordedMatches;
+};
+
+class Replay {
+public:
+    Replay(SimulatedHwc& hwc, int width, int height)
+        : mHwc(hwc), mWidth(width), mHeight(height) {
+        memset(&mTotals, 0, sizeof(mTotals));
+    }
+
+    ~Replay() {
+        for (size_t i=0 ; i<mBuffers.size() ; i++) {
+            SimulatedHwc::destroyBuffer(mBuffers.valueAt(i));
+        }
+    }
+
+    // composes a frame, and describes the decisions: one letter per
+    // layer, bottom to top, 'O' for overlays and 'F' for GLES, then the
+    // number of pixels composed with GLES
+    void compose(const Frame& frame, char* decisions, size_t size);
+
+    const Totals& getTotals() const { return mTotals; }
+    const HWCWorkList::Stats& getListStats() const { return mList.getStats(); }
+
+private:
+    bool needsGeometryPass(const Frame& frame) const;
+    void computeVisibleRegions(const Frame& frame);
+    buffer_handle_t getBuffer(const LayerState& s);
+
+    SimulatedHwc& mHwc;
+    const int mWidth;
+    const int mHeight;
+    HWCWorkList mList;
+    Frame mPrevious;
+    Vector<RectList> mVisible;
+    KeyedVector<uint32_t, buffer_handle_t> mBuffers;
+    Totals mTotals;
+};
+
+bool Replay::needsGeometryPass(const Frame& frame) const {
+    // SurfaceFlinger rebuilds the work list when the visible regions
+    // change, i.e. on any change but a new buffer of the same size
+    if (frame.size() != mPrevious.size() || !mList.getList()) {
+        return true;
+    }
+    for (size_t i=0 ; i<frame.size() ; i++) {
+        const LayerState& a(frame[i]);
+        const LayerState& b(mPrevious[i]);
+        if (strcmp(a.name, b.name) || a.format != b.format ||
+                a.width != b.width || a.height != b.height ||
+                a.flags != b.flags || a.transform != b.transform ||
+                a.blending != b.blending || a.alpha != b.alpha ||
+                !(a.crop == b.crop) || !(a.frame == b.frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Replay::computeVisibleRegions(const Frame& frame) {
+    const size_t count = frame.size();
+    mVisible.clear();
+    mVisible.insertAt(RectList(), 0, count);
+    RectList aboveOpaque;
+    for (ssize_t i=count-1 ; i>=0 ; i--) {
+        const LayerState& s(frame[i]);
+        hwc_rect_t r(s.frame);
+        if (r.left < 0) r.left = 0;
+        if (r.top < 0) r.top = 0;
+        if (r.right > mWidth) r.right = mWidth;
+        if (r.bottom > mHeight) r.bottom = mHeight;
+        if (r.left >= r.right || r.top >= r.bottom) {
+            continue;
+        }
+        RectList& visible(mVisible.editItemAt(i));
+        visible.add(r);
+        for (size_t j=0 ; j<aboveOpaque.size() ; j++) {
+            subtract(visible, aboveOpaque[j]);
+        }
+        if (s.buffer && s.blending == HWC_BLENDING_NONE && s.alpha == 255) {
+            aboveOpaque.add(r);
+        }
+    }
+}
+
+buffer_handle_t Replay::getBuffer(const LayerState& s) {
+    if (!s.buffer || s.format < 0) {
+        return NULL;
+    }
+    ssize_t index = mBuffers.indexOfKey(s.buffer);
+    if (index >= 0) {
+        return mBuffers.valueAt(index);
+    }
+    buffer_handle_t handle = SimulatedHwc::createBuffer(
+            s.format, s.width, s.height);
+    mBuffers.add(s.buffer, handle);
+    return handle;
+}
+
+void Replay::compose(const Frame& frame, char* decisions, size_t size) {
+    hwc_composer_device_t* hwc = mHwc.getDevice();
+    const size_t count = frame.size();
+    const nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+
+    // handleWorkList()
+    if (needsGeometryPass(frame)) {
+        computeVisibleRegions(frame);
+        mList.create(count);
+        hwc_layer_t* const cur(mList.getLayers());
+        for (size_t i=0 ; cur && i<count ; i++) {
+            const LayerState& s(frame[i]);
+            hwc_layer_t l(cur[i]);
+            l.compositionType = HWC_FRAMEBUFFER;
+            l.hints = 0;
+            l.flags = s.flags;
+            if (s.alpha < 255) {
+                // we can't do alpha-fade with the hwc HAL
+                l.flags |= HWC_SKIP_LAYER;
+            }
+            l.transform = s.transform;
+            l.blending = s.blending;
+            l.sourceCrop = s.crop;
+            l.displayFrame = s.frame;
+            l.visibleRegionScreen.numRects = mVisible[i].size();
+            l.visibleRegionScreen.rects = mVisible[i].array();
+            mList.setLayerGeometry(i, l);
+        }
+    }
+    mPrevious = frame;
+
+    // setupHardwareComposer()
+    hwc_layer_list_t* const list(mList.getList());
+    for (size_t i=0 ; i<count ; i++) {
+        hwc_layer_t& l(list->hwLayers[i]);
+        l.handle = getBuffer(frame[i]);
+        if (!l.handle) {
+            l.flags |= HWC_SKIP_LAYER;
+        }
+    }
+    hwc->prepare(hwc, list);
+    size_t length = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        hwc_layer_t& l(list->hwLayers[i]);
+        if (l.flags & HWC_SKIP_LAYER) {
+            l.compositionType = HWC_FRAMEBUFFER;
+        }
+        if (length + 1 < size) {
+            decisions[length++] = l.compositionType == HWC_OVERLAY ? 'O' : 'F';
+        }
+        if (frame[i].recordedType >= 0) {
+            mTotals.recorded++;
+            if (frame[i].recordedType == l.compositionType) {
+                mTotals.recordedMatches++;
+            }
+        }
+    }
+
+    // postFramebuffer()
+    hwc->set(hwc, NULL, NULL, list);
+    mList.clearGeometryChanged();
+
+    const nsecs_t cpu = systemTime(SYSTEM_TIME_THREAD) - start;
+    const SimulatedHwc::FrameStats& stats(mHwc.getLastFrame());
+    mTotals.frames++;
+    mTotals.overlays += stats.overlays;
+    if (stats.framebuffer) {
+        mTotals.glesFrames++;
+    }
+    mTotals.glesPixels += stats.glesPixels;
+    if (stats.glesPixels > mTotals.maxGlesPixels) {
+        mTotals.maxGlesPixels = stats.glesPixels;
+    }
+    mTotals.cost += stats.cost;
+    if (stats.cost > mTotals.maxCost) {
+        mTotals.maxCost = stats.cost;
+    }
+    mTotals.cpu += cpu;
+    if (cpu > mTotals.maxCpu) {
+        mTotals.maxCpu = cpu;
+    }
+    snprintf(decisions + length, size - length, " %llu",
+            (unsigned long long)stats.glesPixels);
+}
+
+// ---------------------------------------------------------------------------
+
+static void report(const char* name, const Replay& replay,
+        int width, int height) {
+    const Totals& t(replay.getTotals());
+    const HWCWorkList::Stats& list(replay.getListStats());
+    const double frames = t.frames ? t.frames : 1;
+    printf("%s: %u frames, %dx%d\n", name, t.frames, width, height);
+    printf("  geometry: %u passes, %u flagged to the HAL, "
+            "%u/%u layers rewritten\n",
+            list.passes, list.changes,
+            list.layersRewritten, list.layersChecked);
+    printf("  overlays: %.2f/frame, frames using GLES: %u (%.1f%%)\n",
+            t.overlays / frames, t.glesFrames, 100.0 * t.glesFrames / frames);
+    printf("  GLES pixels: %.0f/frame (%.1f%% of the screen), max %llu\n",
+            t.glesPixels / frames,
+            100.0 * t.glesPixels / frames / (double(width) * height),
+            (unsigned long long)t.maxGlesPixels);
+    printf("  composition cost (model): %.1f us/frame, max %.1f us\n",
+            t.cost / frames / 1000, t.maxCost / 1000);
+    printf("  CPU time (work list, prepare, set): %.2f us/frame, "
+            "max %.2f us\n", t.cpu / frames / 1000, t.maxCpu / 1000.0);
+    if (t.recorded) {
+        printf("  recorded decisions matched: %u/%u layers\n",
+                t.recordedMatches, t.recorded);
+    }
+}
+
+static void usage(const char* cmd) {
+    fprintf(stderr,
+        "usage: %s [options] [scenario|recording]...\n"
+        "  -o n       number of overlays (2)\n"
+        "  -f list    overlay formats, comma separated (2,4,0x32315659)\n"
+        "  -b         overlays can blend\n"
+        "  -t         overlays can rotate and flip\n"
+        "  -x         overlays can't scale\n"
+        "  -m pixels  smallest layer worth an overlay (4096)\n"
+        "  -n frames  frames per built-in scenario (120)\n"
+        "  -s WxH     screen size of recordings (bounds of their layers)\n"
+        "  -w file    write the decisions of each frame to file\n"
+        "  -c file    check the decisions against file, fail if they differ\n"
+        "  -l         list the built-in scenarios\n"
+        "runs all the built-in scenarios by default\n", cmd);
+}
+
+int main(int argc, char** argv)
+{
+    SimulatedHwc::Config config;
+    int frames = 120;
+    int screenW = 0, screenH = 0;
+    const char* writePath = NULL;
+    const char* checkPath = NULL;
+    int c;
+    while ((c = getopt(argc, argv, "o:f:btxm:n:s:w:c:lh")) != -1) {
+        switch (c) {
+            case 'o':
+                config.maxOverlays = atoi(optarg);
+                break;
+            case 'f': {
+                config.numFormats = 0;
+                char* p = optarg;
+                while (*p && config.numFormats < SimulatedHwc::MAX_FORMATS) {
+                    config.formats[config.numFormats++] = strtoul(p, &p, 0);
+                    if (*p == ',') p++;
+                }
+                break;
+            }
+            case 'b':
+                config.blending = true;
+                break;
+            case 't':
+                config.transforms = true;
+                break;
+            case 'x':
+                config.scaling = false;
+                break;
+            case 'm':
+                config.minOverlayArea = atoi(optarg);
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 's':
+                sscanf(optarg, "%dx%d", &screenW, &screenH);
+                break;
+            case 'w':
+                writePath = optarg;
+                break;
+            case 'c':
+                checkPath = optarg;
+                break;
+            case 'l':
+                for (size_t i=0 ; i<NUM_SCENARIOS ; i++) {
+                    printf("%s\n", sScenarios[i].name);
+                }
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    Vector<const char*> inputs;
+    for (int i=optind ; i<argc ; i++) {
+        inputs.add(argv[i]);
+    }
+    if (inputs.isEmpty()) {
+        for (size_t i=0 ; i<NUM_SCENARIOS ; i++) {
+            inputs.add(sScenarios[i].name);
+        }
+    }
+
+    FILE* out = NULL;
+    if (writePath && !(out = fopen(writePath, "w"))) {
+        fprintf(stderr, "can't write %s\n", writePath);
+        return 1;
+    }
+    FILE* check = NULL;
+    if (checkPath && !(check = fopen(checkPath, "r"))) {
+        fprintf(stderr, "can't read %s\n", checkPath);
+        return 1;
+    }
+
+    {
+        SimulatedHwc hwc(config);
+        char buffer[512];
+        hwc.getDevice()->dump(hwc.getDevice(), buffer, sizeof(buffer));
+        printf("%s", buffer);
+    }
+
+    uint32_t mismatches = 0;
+    for (size_t n=0 ; n<inputs.size() ; n++) {
+        const char* input = inputs[n];
+        Vector<Frame> stacks;
+        const Scenario* scenario = NULL;
+        for (size_t i=0 ; i<NUM_SCENARIOS ; i++) {
+            if (!strcmp(input, sScenarios[i].name)) {
+                scenario = &sScenarios[i];
+            }
+        }
+        int width = W, height = H;
+        if (scenario) {
+            for (int f=0 ; f<frames ; f++) {
+                stacks.add(Frame());
+                scenario->generate(f, stacks.editTop());
+            }
+        } else {
+            if (!loadRecording(input, stacks) || stacks.isEmpty()) {
+                fprintf(stderr, "%s: not a scenario nor a recording\n", input);
+                return 1;
+            }
+            width = screenW;
+            height = screenH;
+            if (!width || !height) {
+                for (size_t f=0 ; f<stacks.size() ; f++) {
+                    for (size_t i=0 ; i<stacks[f].size() ; i++) {
+                        const hwc_rect_t& r(stacks[f][i].frame);
+                        if (r.right > width) width = r.right;
+                        if (r.bottom > height) height = r.bottom;
+                    }
+                }
+            }
+        }
+
+        SimulatedHwc hwc(config);
+        Replay replay(hwc, width, height);
+        for (size_t f=0 ; f<stacks.size() ; f++) {
+            char decisions[256];
+            replay.compose(stacks[f], decisions, sizeof(decisions));
+            char line[512];
+            snprintf(line, sizeof(line), "%s %u %s\n", input, uint32_t(f),
+                    decisions);
+            if (out) {
+                fputs(line, out);
+            }
+            if (check) {
+                char expected[1024];
+                if (!fgets(expected, sizeof(expected), check)) {
+                    expected[0] = 0;
+                }
+                if (strcmp(expected, line)) {
+                    if (mismatches < 10) {
+                        printf("MISMATCH expected: %s", expected[0] ?
+                                expected : "(nothing)\n");
+                        printf("              got: %s", line);
+                    }
+                    mismatches++;
+                }
+            }
+        }
+        report(input, replay, width, height);
+    }
+
+    if (out) {
+        fclose(out);
+    }
+    if (check) {
+        fclose(check);
+        if (mismatches) {
+            printf("%u frames differ from %s\n", mismatches, checkPath);
+            return 1;
+        }
+        printf("all frames match %s\n", checkPath);
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	layer_vector_bench.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../..
+
+LOCAL_STATIC_LIBRARIES := \
+	libutils \
+	libcutils \
+	liblog
+
+LOCAL_MODULE:= layer-vector-bench
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
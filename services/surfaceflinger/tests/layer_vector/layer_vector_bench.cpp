@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+
+#include "ReorderableVector.h"
+
+using namespace android;
+
+/*
+ * Compares the ways of keeping SurfaceFlinger's layer list in Z order
+ * when a layer's Z changes, and of taking the drawing state's snapshot of
+ * it at the end of each transaction:
+ *
+ *  - removing the layer and adding it back, and assigning the list to the
+ *    snapshot, which is what SurfaceFlinger used to do,
+ *  - ReorderableVector::reorder(), still assigning the list,
+ *  - reorder() and ReorderableVector::syncFrom() for the snapshot.
+ *
+ * The layers only carry what LayerVector sorts on.
+ */
+
+struct FakeLayer : public RefBase {
+    uint32_t z;
+    uint32_t sequence;  // unique, like LayerBase::sequence
+};
+
+class FakeLayerVector : public ReorderableVector< sp<FakeLayer> > {
+public:
+    virtual int do_compare(const void* lhs, const void* rhs) const {
+        const sp<FakeLayer>& l(*reinterpret_cast<const sp<FakeLayer>*>(lhs));
+        const sp<FakeLayer>& r(*reinterpret_cast<const sp<FakeLayer>*>(rhs));
+        return (l->z != r->z) ? (l->z - r->z) : (l->sequence - r->sequence);
+    }
+};
+
+// the same pseudo-random sequence of Z changes for both runs
+struct Change {
+    uint32_t layer;
+    uint32_t z;
+};
+
+enum Mode {
+    REMOVE_ADD,
+    REORDER,
+    REORDER_SYNC
+};
+
+static nsecs_t run(const Vector< sp<FakeLayer> >& layers,
+        const Change* changes, size_t numChanges, size_t snapshotEvery,
+        Mode mode, FakeLayerVector* result)
+{
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        layers[i]->z = 1000 + i;
+    }
+    FakeLayerVector current;
+    for (size_t i=0 ; i<layers.size() ; i++) {
+        current.add(layers[i]);
+    }
+    FakeLayerVector drawing(current);
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_THREAD);
+    for (size_t i=0 ; i<numChanges ; i++) {
+        const sp<FakeLayer>& layer(layers[changes[i].layer]);
+        ssize_t idx = current.indexOf(layer);
+        layer->z = changes[i].z;
+        if (mode == REMOVE_ADD) {
+            current.removeAt(idx);
+            current.add(layer);
+        } else {
+            current.reorder(idx);
+        }
+        if ((i + 1) % snapshotEvery == 0) {
+            if (mode == REORDER_SYNC) {
+                drawing.syncFrom(current);
+            } else {
+                drawing = current;
+            }
+        }
+    }
+    const nsecs_t time = systemTime(SYSTEM_TIME_THREAD) - start;
+    *result = drawing;
+    return time;
+}
+
+int main(int argc, char** argv)
+{
+    int numLayers = 200;
+    int numChanges = 1000000;
+    int snapshotEvery = 10;     // Z changes per transaction
+    if (argc > 1) numLayers = atoi(argv[1]);
+    if (argc > 2) numChanges = atoi(argv[2]);
+    if (argc > 3) snapshotEvery = atoi(argv[3]);
+    if (numLayers <= 0 || numChanges <= 0 || snapshotEvery <= 0) {
+        printf("usage: %s [layers] [z-changes] [z-changes-per-transaction]\n",
+                argv[0]);
+        exit(0);
+    }
+
+    Vector< sp<FakeLayer> > layers;
+    for (int i=0 ; i<numLayers ; i++) {
+        sp<FakeLayer> layer = new FakeLayer();
+        layer->sequence = i;
+        layers.add(layer);
+    }
+
+    // most Z changes move a layer by a few slots (a window brought forward
+    // over its neighbours), some move it anywhere
+    Change* changes = new Change[numChanges];
+    srand(1);
+    uint32_t* z = new uint32_t[numLayers];
+    for (int i=0 ; i<numLayers ; i++) {
+        z[i] = 1000 + i;
+    }
+    for (int i=0 ; i<numChanges ; i++) {
+        const uint32_t l = rand() % numLayers;
+        if (rand() % 4) {
+            z[l] = z[l] + (rand() % 9) - 4;
+        } else {
+            z[l] = 1000 + rand() % numLayers;
+        }
+        changes[i].layer = l;
+        changes[i].z = z[l];
+    }
+    delete [] z;
+
+    static const char* const names[] = {
+        "remove+add, assign", "reorder, assign", "reorder, syncFrom"
+    };
+    printf("%d layers, %d Z changes, snapshot every %d changes\n",
+            numLayers, numChanges, snapshotEvery);
+    FakeLayerVector expected;
+    bool same = true;
+    for (int mode=REMOVE_ADD ; mode<=REORDER_SYNC ; mode++) {
+        FakeLayerVector drawing;
+        const nsecs_t t = run(layers, changes, numChanges, snapshotEvery,
+                Mode(mode), &drawing);
+        printf("%-20s: %8.1f ns per change\n", names[mode],
+                double(t) / numChanges);
+        if (mode == REMOVE_ADD) {
+            expected = drawing;
+            continue;
+        }
+        bool ok = expected.size() == drawing.size();
+        for (size_t i=0 ; ok && i<drawing.size() ; i++) {
+            ok = expected[i] == drawing[i];
+        }
+        if (!ok) {
+            printf("%s: the snapshot is in a different order!\n",
+                    names[mode]);
+            same = false;
+        }
+    }
+    delete [] changes;
+    return same ? 0 : 1;
+}
@@ -24,3 +24,21 @@ LOCAL_C_INCLUDES += \
 	external/skia/include/utils
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	screencap_bench.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils \
+	libbinder \
+	libui \
+	libgui
+
+LOCAL_MODULE:= test-screencap-bench
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/Timers.h>
+
+#include <binder/IMemory.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+
+#include <ui/GraphicBuffer.h>
+
+#include <gui/ISurfaceComposer.h>
+
+using namespace android;
+
+/*
+ * Measures how many screen captures per second can be taken with the
+ * ashmem + glReadPixels path (captureScreen), with the gralloc buffer
+ * path (captureScreenToBuffer) and with pipelined asynchronous captures
+ * (captureScreenAsync), at a few fractions of the screen size.
+ */
+
+static double benchHeap(const sp<ISurfaceComposer>& composer,
+        uint32_t w, uint32_t h, int count)
+{
+    nsecs_t start = systemTime();
+    for (int i=0 ; i<count ; i++) {
+        sp<IMemoryHeap> heap;
+        uint32_t cw, ch;
+        PixelFormat f;
+        status_t err = composer->captureScreen(0, &heap, &cw, &ch, &f,
+                w, h, 0, 0x7fffffff);
+        if (err != NO_ERROR) {
+            fprintf(stderr, "captureScreen failed: %s\n", strerror(-err));
+            return 0;
+        }
+        // touch the pixels, like a real client would
+        volatile uint8_t c = *(uint8_t*)heap->getBase();
+        (void)c;
+    }
+    nsecs_t duration = systemTime() - start;
+    return count / (duration / 1e9);
+}
+
+static double benchBuffer(const sp<ISurfaceComposer>& composer,
+        uint32_t w, uint32_t h, int count)
+{
+    // the client's own buffer, reused for every capture
+    sp<GraphicBuffer> buffer(new GraphicBuffer(w, h, PIXEL_FORMAT_RGBA_8888,
+            GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_SW_READ_OFTEN));
+    if (buffer->initCheck() != NO_ERROR) {
+        fprintf(stderr, "couldn't allocate a %ux%u buffer\n", w, h);
+        return 0;
+    }
+    nsecs_t start = systemTime();
+    for (int i=0 ; i<count ; i++) {
+        int32_t fence;
+        status_t err = composer->captureScreenToBuffer(0, buffer, &fence,
+                0, 0x7fffffff);
+        if (err == NO_ERROR) {
+            err = composer->waitForScreenCapture(fence);
+        }
+        if (err != NO_ERROR) {
+            fprintf(stderr, "captureScreenToBuffer failed: %s\n",
+                    strerror(-err));
+            return 0;
+        }
+        // touch the pixels, like a real client would
+        void* vaddr;
+        if (buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN, &vaddr) == NO_ERROR) {
+            volatile uint8_t c = *(uint8_t*)vaddr;
+            (void)c;
+            buffer->unlock();
+        }
+    }
+    nsecs_t duration = systemTime() - start;
+    return count / (duration / 1e9);
+}
+
+static double benchAsync(const sp<ISurfaceComposer>& composer,
+        uint32_t w, uint32_t h, int count)
+{
+    // keep one capture in flight: record capture i, then collect i-1
+    nsecs_t start = systemTime();
+    int32_t pending = 0;
+    for (int i=0 ; i<=count ; i++) {
+        int32_t token = 0;
+        if (i < count) {
+            status_t err = composer->captureScreenAsync(0, &token,
+                    w, h, 0, 0x7fffffff);
+            if (err != NO_ERROR) {
+                fprintf(stderr, "captureScreenAsync failed: %s\n",
+                        strerror(-err));
+                return 0;
+            }
+        }
+        if (pending) {
+            sp<IMemoryHeap> heap;
+            uint32_t cw, ch;
+            PixelFormat f;
+            status_t err = composer->collectScreenCapture(pending, &heap,
+                    &cw, &ch, &f);
+            if (err != NO_ERROR) {
+                fprintf(stderr, "collectScreenCapture failed: %s\n",
+                        strerror(-err));
+                return 0;
+            }
+            volatile uint8_t c = *(uint8_t*)heap->getBase();
+            (void)c;
+        }
+        pending = token;
+    }
+    nsecs_t duration = systemTime() - start;
+    return count / (duration / 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    int count = 100;
+    if (argc == 2) {
+        count = atoi(argv[1]);
+    }
+    if (count <= 0) {
+        printf("usage: %s [captures-per-size]\n", argv[0]);
+        exit(0);
+    }
+
+    ProcessState::self()->startThreadPool();
+
+    const String16 name("SurfaceFlinger");
+    sp<ISurfaceComposer> composer;
+    getService(name, &composer);
+    if (composer == 0) {
+        fprintf(stderr, "couldn't find SurfaceFlinger\n");
+        exit(1);
+    }
+
+    // the capture size is in the display's native orientation,
+    // a full-size capture tells us what it is.
+    sp<IMemoryHeap> heap;
+    uint32_t hw_w, hw_h;
+    PixelFormat f;
+    status_t err = composer->captureScreen(0, &heap, &hw_w, &hw_h, &f,
+            0, 0, 0, 0x7fffffff);
+    if (err != NO_ERROR) {
+        fprintf(stderr, "screen capture failed: %s\n", strerror(-err));
+        exit(1);
+    }
+    heap.clear();
+
+    static const int divisors[] = { 1, 2, 4, 8 };
+    printf("%-12s %12s %12s %12s\n", "size", "heap/s", "buffer/s", "async/s");
+    for (size_t i=0 ; i<sizeof(divisors)/sizeof(*divisors) ; i++) {
+        uint32_t w = hw_w / divisors[i];
+        uint32_t h = hw_h / divisors[i];
+        char size[32];
+        snprintf(size, sizeof(size), "%ux%u", w, h);
+        double heapRate = benchHeap(composer, w, h, count);
+        double bufferRate = benchBuffer(composer, w, h, count);
+        double asyncRate = benchAsync(composer, w, h, count);
+        printf("%-12s %12.1f %12.1f %12.1f\n", size,
+                heapRate, bufferRate, asyncRate);
+    }
+
+    return 0;
+}
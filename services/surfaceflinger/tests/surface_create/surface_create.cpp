@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cutils/memory.h>
+
+#include <utils/Log.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+
+#include <gui/ISurfaceComposer.h>
+#include <gui/Surface.h>
+#include <gui/SurfaceComposerClient.h>
+
+using namespace android;
+
+/*
+ * Creates and destroys surfaces from several threads at once, each with
+ * its own connection to SurfaceFlinger like the apps of a launch storm,
+ * while posting frames to a surface on top as fast as SurfaceFlinger
+ * lets us, so that it keeps composing. Reports how many surfaces were
+ * created per second and how long each creation took.
+ *
+ * Run it with debug.sf.async_create set to 0 and then 1 to compare.
+ */
+
+class CreateThread : public Thread {
+public:
+    CreateThread(int index) : Thread(false), mIndex(index) { }
+
+    const Vector<nsecs_t>& getLatencies() const { return mLatencies; }
+
+private:
+    virtual bool threadLoop() {
+        sp<SurfaceComposerClient> client = new SurfaceComposerClient();
+        while (!exitPending()) {
+            const nsecs_t start = systemTime();
+            sp<SurfaceControl> layer = client->createSurface(
+                    String8("surface-create"), 0, 64, 64,
+                    PIXEL_FORMAT_RGBX_8888);
+            const nsecs_t end = systemTime();
+            if (layer == 0) {
+                fprintf(stderr, "thread %d: couldn't create surface\n",
+                        mIndex);
+                break;
+            }
+            mLatencies.add(end - start);
+            layer->clear();
+        }
+        client->dispose();
+        return false;
+    }
+
+    const int mIndex;
+    Vector<nsecs_t> mLatencies;
+};
+
+static int compare(const void* a, const void* b)
+{
+    const nsecs_t lhs = *static_cast<const nsecs_t*>(a);
+    const nsecs_t rhs = *static_cast<const nsecs_t*>(b);
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    int numThreads = 4;
+    int seconds = 10;
+    if (argc > 1) numThreads = atoi(argv[1]);
+    if (argc > 2) seconds = atoi(argv[2]);
+    if (numThreads <= 0 || seconds <= 0) {
+        printf("usage: %s [threads] [seconds]\n", argv[0]);
+        exit(0);
+    }
+
+    // set up the thread-pool
+    sp<ProcessState> proc(ProcessState::self());
+    ProcessState::self()->startThreadPool();
+
+    // the surface that keeps SurfaceFlinger composing
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient();
+    sp<SurfaceControl> control = client->createSurface(
+            String8("surface-create-pacing"), 0, 256, 256,
+            PIXEL_FORMAT_RGB_565);
+    SurfaceComposerClient::openGlobalTransaction();
+    control->setLayer(100000);
+    SurfaceComposerClient::closeGlobalTransaction();
+    sp<Surface> surface = control->getSurface();
+
+    Vector< sp<CreateThread> > threads;
+    for (int i=0 ; i<numThreads ; i++) {
+        sp<CreateThread> thread = new CreateThread(i);
+        thread->run("SurfaceCreate");
+        threads.add(thread);
+    }
+
+    const nsecs_t start = systemTime();
+    const nsecs_t end = start + s2ns(seconds);
+    uint32_t frames = 0;
+    uint16_t color = 0;
+    while (systemTime() < end) {
+        Surface::SurfaceInfo si;
+        if (surface->lock(&si) != NO_ERROR) {
+            fprintf(stderr, "lock failed\n");
+            break;
+        }
+        ssize_t bpr = si.s * bytesPerPixel(si.format);
+        android_memset16((uint16_t*)si.bits, color++, bpr*si.h);
+        surface->unlockAndPost();
+        frames++;
+    }
+
+    Vector<nsecs_t> latencies;
+    for (int i=0 ; i<numThreads ; i++) {
+        threads[i]->requestExitAndWait();
+        latencies.appendVector(threads[i]->getLatencies());
+    }
+    const double elapsed = (systemTime() - start) / 1e9;
+
+    const size_t count = latencies.size();
+    if (!count) {
+        fprintf(stderr, "no surfaces\n");
+        exit(1);
+    }
+    nsecs_t* sorted = latencies.editArray();
+    qsort(sorted, count, sizeof(nsecs_t), compare);
+    nsecs_t total = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        total += sorted[i];
+    }
+
+    printf("surfaces: %u in %.1fs (%.1f/s), %d threads\n",
+            uint32_t(count), elapsed, count / elapsed, numThreads);
+    printf("frames posted meanwhile: %u (%.1f/s)\n", frames, frames / elapsed);
+    printf("createSurface(): mean=%.2f ms, p50=%.2f ms, p99=%.2f ms, "
+            "max=%.2f ms\n",
+            (total / count) / 1e6,
+            sorted[count / 2] / 1e6,
+            sorted[(count * 99) / 100] / 1e6,
+            sorted[count - 1] / 1e6);
+
+    client->dispose();
+    return 0;
+}
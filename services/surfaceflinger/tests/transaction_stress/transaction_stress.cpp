@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cutils/memory.h>
+
+#include <utils/Log.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+
+#include <ui/DisplayInfo.h>
+
+#include <gui/ISurfaceComposer.h>
+#include <gui/Surface.h>
+#include <gui/SurfaceComposerClient.h>
+
+using namespace android;
+
+/*
+ * Sends transactions to SurfaceFlinger at a fixed rate, shuffling the
+ * position and Z-order of a bunch of small layers, while posting frames
+ * to a surface on top of them as fast as SurfaceFlinger lets us. The time
+ * between two posted frames tells how regularly SurfaceFlinger composes
+ * under that transaction load.
+ *
+ * Run it with debug.sf.pipelined_transactions set to 0 and then 1 to
+ * compare.
+ */
+
+class TransactionThread : public Thread {
+public:
+    TransactionThread(const Vector< sp<SurfaceControl> >& layers,
+            int rate, int batch)
+        : Thread(false), mLayers(layers), mRate(rate), mBatch(batch),
+          mTransactions(0) {
+    }
+
+    int getTransactionCount() const { return mTransactions; }
+
+private:
+    virtual bool threadLoop() {
+        const nsecs_t period = s2ns(1) / mRate;
+        nsecs_t next = systemTime();
+        while (!exitPending()) {
+            SurfaceComposerClient::openGlobalTransaction();
+            for (int i=0 ; i<mBatch ; i++) {
+                const sp<SurfaceControl>& layer(
+                        mLayers[(mTransactions + i) % mLayers.size()]);
+                layer->setPosition(rand() % 256, rand() % 256);
+                layer->setLayer(1000 + rand() % mLayers.size());
+            }
+            SurfaceComposerClient::closeGlobalTransaction();
+            mTransactions++;
+
+            next += period;
+            const nsecs_t now = systemTime();
+            if (next > now) {
+                usleep(ns2us(next - now));
+            } else if (now - next > ms2ns(100)) {
+                // we can't keep up, don't try to catch up
+                next = now;
+            }
+        }
+        return false;
+    }
+
+    Vector< sp<SurfaceControl> > mLayers;
+    const int mRate;
+    const int mBatch;
+    volatile int mTransactions;
+};
+
+static int compare(const void* a, const void* b)
+{
+    const nsecs_t lhs = *static_cast<const nsecs_t*>(a);
+    const nsecs_t rhs = *static_cast<const nsecs_t*>(b);
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    int rate = 2000;        // transactions per second
+    int seconds = 10;
+    int numLayers = 50;
+    int batch = 10;         // layers touched by each transaction
+    if (argc > 1) rate = atoi(argv[1]);
+    if (argc > 2) seconds = atoi(argv[2]);
+    if (argc > 3) numLayers = atoi(argv[3]);
+    if (argc > 4) batch = atoi(argv[4]);
+    if (rate <= 0 || seconds <= 0 || numLayers <= 0 || batch <= 0) {
+        printf("usage: %s [transactions/s] [seconds] [layers] "
+                "[layers-per-transaction]\n", argv[0]);
+        exit(0);
+    }
+
+    // set up the thread-pool
+    sp<ProcessState> proc(ProcessState::self());
+    ProcessState::self()->startThreadPool();
+
+    // create a client to surfaceflinger
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient();
+
+    DisplayInfo info;
+    SurfaceComposerClient::getDisplayInfo(0, &info);
+    const nsecs_t refreshPeriod = nsecs_t(1e9 / (info.fps ? info.fps : 60));
+
+    Vector< sp<SurfaceControl> > layers;
+    SurfaceComposerClient::openGlobalTransaction();
+    for (int i=0 ; i<numLayers ; i++) {
+        sp<SurfaceControl> layer = client->createSurface(
+                String8("transaction-stress"), 0, 32, 32,
+                PIXEL_FORMAT_RGB_565, ISurfaceComposer::eFXSurfaceDim);
+        if (layer == 0) {
+            fprintf(stderr, "couldn't create layer %d\n", i);
+            exit(1);
+        }
+        layer->setLayer(1000 + i);
+        layer->setAlpha(0.25f);
+        layers.add(layer);
+    }
+
+    sp<SurfaceControl> control = client->createSurface(
+            String8("transaction-stress-pacing"), 0, 64, 64,
+            PIXEL_FORMAT_RGB_565);
+    control->setLayer(100000);
+    SurfaceComposerClient::closeGlobalTransaction();
+    sp<Surface> surface = control->getSurface();
+
+    sp<TransactionThread> thread = new TransactionThread(layers, rate, batch);
+    thread->run("TransactionStress");
+
+    // post frames back to back, each lock() waits for SurfaceFlinger to
+    // release a buffer, i.e. to compose.
+    Vector<nsecs_t> intervals;
+    const nsecs_t end = systemTime() + s2ns(seconds);
+    nsecs_t last = 0;
+    uint16_t color = 0;
+    while (systemTime() < end) {
+        Surface::SurfaceInfo si;
+        if (surface->lock(&si) != NO_ERROR) {
+            fprintf(stderr, "lock failed\n");
+            break;
+        }
+        ssize_t bpr = si.s * bytesPerPixel(si.format);
+        android_memset16((uint16_t*)si.bits, color++, bpr*si.h);
+        surface->unlockAndPost();
+        const nsecs_t now = systemTime();
+        if (last) {
+            intervals.add(now - last);
+        }
+        last = now;
+    }
+
+    thread->requestExitAndWait();
+
+    const size_t count = intervals.size();
+    if (!count) {
+        fprintf(stderr, "no frames\n");
+        exit(1);
+    }
+    nsecs_t* sorted = intervals.editArray();
+    qsort(sorted, count, sizeof(nsecs_t), compare);
+    size_t late = 0;
+    nsecs_t total = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        total += sorted[i];
+        if (sorted[i] > (refreshPeriod * 3) / 2) {
+            late++;
+        }
+    }
+
+    printf("transactions: %d in %ds (%.1f/s), %d layers, %d per transaction\n",
+            thread->getTransactionCount(), seconds,
+            thread->getTransactionCount() / double(seconds),
+            numLayers, batch);
+    printf("frames: %u, refresh period: %.2f ms\n",
+            uint32_t(count + 1), refreshPeriod / 1e6);
+    printf("frame interval: mean=%.2f ms, p50=%.2f ms, p99=%.2f ms, "
+            "max=%.2f ms\n",
+            (total / count) / 1e6,
+            sorted[count / 2] / 1e6,
+            sorted[(count * 99) / 100] / 1e6,
+            sorted[count - 1] / 1e6);
+    printf("late frames (> 1.5 refresh periods): %u (%.1f%%)\n",
+            uint32_t(late), (100.0 * late) / count);
+
+    client->dispose();
+    return 0;
+}
@@ -16,3 +16,21 @@ LOCAL_MODULE:= test-vsync-events
 LOCAL_MODULE_TAGS := tests
 
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	vsync_latency.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils \
+	libbinder \
+    libui \
+    libgui
+
+LOCAL_MODULE:= test-vsync-latency
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/memory.h>
+#include <cutils/properties.h>
+
+#include <utils/Looper.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+
+#include <ui/DisplayInfo.h>
+
+#include <gui/DisplayEventReceiver.h>
+#include <gui/ISurfaceComposer.h>
+#include <gui/Surface.h>
+#include <gui/SurfaceComposerClient.h>
+
+using namespace android;
+
+/*
+ * Measures touch-to-display latency with synthetic producers.
+ *
+ * A thread plays the touchscreen: it reports "touches" at random times.
+ * The tracking surface renders a frame for the pending touch on each vsync
+ * event it receives, like an application would through the Choreographer,
+ * while other surfaces keep SurfaceFlinger busy by posting frames as fast
+ * as they can. The time from a touch to the frame being queued is measured
+ * here; the time from queueing to display comes from SurfaceFlinger's
+ * frame timeline for the tracking surface.
+ *
+ * Compare runs with different debug.sf.vsync_app_phase_ns and
+ * debug.sf.vsync_sf_phase_ns (SurfaceFlinger needs to be restarted to pick
+ * them up).
+ */
+
+static const char* const kTrackingName = "vsync-latency";
+
+class Touchscreen : public Thread {
+public:
+    Touchscreen(nsecs_t period)
+        : Thread(false), mPeriod(period), mPending(0), mTouches(0) {
+    }
+
+    // time of the oldest touch not rendered yet, or 0
+    nsecs_t consume() {
+        Mutex::Autolock _l(mLock);
+        nsecs_t touch = mPending;
+        mPending = 0;
+        return touch;
+    }
+
+    uint32_t getTouchCount() const { return mTouches; }
+
+private:
+    virtual bool threadLoop() {
+        while (!exitPending()) {
+            // touch panels report at a rate unrelated to the display's
+            usleep(ns2us(mPeriod / 2 + rand() % (mPeriod * 2)));
+            Mutex::Autolock _l(mLock);
+            if (!mPending) {
+                mPending = systemTime();
+            }
+            mTouches++;
+        }
+        return false;
+    }
+
+    const nsecs_t mPeriod;
+    Mutex mLock;
+    nsecs_t mPending;
+    volatile uint32_t mTouches;
+};
+
+class LoadThread : public Thread {
+public:
+    LoadThread(const sp<Surface>& surface)
+        : Thread(false), mSurface(surface) {
+    }
+
+private:
+    virtual bool threadLoop() {
+        uint16_t color = 0;
+        while (!exitPending()) {
+            Surface::SurfaceInfo si;
+            if (mSurface->lock(&si) != NO_ERROR) {
+                break;
+            }
+            ssize_t bpr = si.s * bytesPerPixel(si.format);
+            android_memset16((uint16_t*)si.bits, color++, bpr*si.h);
+            mSurface->unlockAndPost();
+        }
+        return false;
+    }
+
+    sp<Surface> mSurface;
+};
+
+struct Tracker {
+    DisplayEventReceiver* receiver;
+    sp<Surface> surface;
+    Touchscreen* touchscreen;
+    Vector<nsecs_t> touchToQueue;
+    Vector<nsecs_t> vsyncToWakeup;
+    uint16_t color;
+};
+
+static int onVsync(int fd, int events, void* data)
+{
+    Tracker* t = static_cast<Tracker*>(data);
+    DisplayEventReceiver::Event buffer[8];
+    ssize_t n;
+    nsecs_t vsync = 0;
+    while ((n = t->receiver->getEvents(buffer, 8)) > 0) {
+        for (ssize_t i=0 ; i<n ; i++) {
+            if (buffer[i].header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+                vsync = buffer[i].header.timestamp;
+            }
+        }
+    }
+    if (!vsync) {
+        return 1;
+    }
+    t->vsyncToWakeup.add(systemTime() - vsync);
+
+    const nsecs_t touch = t->touchscreen->consume();
+    if (touch) {
+        Surface::SurfaceInfo si;
+        if (t->surface->lock(&si) == NO_ERROR) {
+            ssize_t bpr = si.s * bytesPerPixel(si.format);
+            android_memset16((uint16_t*)si.bits, t->color++, bpr*si.h);
+            t->surface->unlockAndPost();
+            t->touchToQueue.add(systemTime() - touch);
+        }
+    }
+    return 1;
+}
+
+static int compare(const void* a, const void* b)
+{
+    const nsecs_t lhs = *static_cast<const nsecs_t*>(a);
+    const nsecs_t rhs = *static_cast<const nsecs_t*>(b);
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+static void printPercentiles(const char* what, Vector<nsecs_t>& samples)
+{
+    const size_t count = samples.size();
+    if (!count) {
+        printf("%s: no samples\n", what);
+        return;
+    }
+    nsecs_t* sorted = samples.editArray();
+    qsort(sorted, count, sizeof(nsecs_t), compare);
+    printf("%s: p50=%.1fms, p95=%.1fms, p99=%.1fms, max=%.1fms\n", what,
+            sorted[count / 2] / 1e6,
+            sorted[(count * 95) / 100] / 1e6,
+            sorted[(count * 99) / 100] / 1e6,
+            sorted[count - 1] / 1e6);
+}
+
+// runs "dumpsys SurfaceFlinger <args>" and returns its output
+static String8 dumpSurfaceFlinger(const char* arg0, const char* arg1)
+{
+    String8 result;
+    sp<IBinder> binder = defaultServiceManager()->checkService(
+            String16("SurfaceFlinger"));
+    FILE* f = tmpfile();
+    if (binder == 0 || f == NULL) {
+        return result;
+    }
+    Vector<String16> args;
+    args.add(String16(arg0));
+    args.add(String16(arg1));
+    binder->dump(fileno(f), args);
+    rewind(f);
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        result.append(line);
+    }
+    fclose(f);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = 10;
+    int producers = 3;      // tracking surface included
+    if (argc > 1) seconds = atoi(argv[1]);
+    if (argc > 2) producers = atoi(argv[2]);
+    if (seconds <= 0 || producers <= 0) {
+        printf("usage: %s [seconds] [producers]\n", argv[0]);
+        exit(0);
+    }
+
+    sp<ProcessState> proc(ProcessState::self());
+    ProcessState::self()->startThreadPool();
+
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient();
+
+    DisplayInfo info;
+    SurfaceComposerClient::getDisplayInfo(0, &info);
+    const nsecs_t refreshPeriod = nsecs_t(1e9 / (info.fps ? info.fps : 60));
+
+    SurfaceComposerClient::openGlobalTransaction();
+    sp<SurfaceControl> tracking = client->createSurface(
+            String8(kTrackingName), 0, 64, 64, PIXEL_FORMAT_RGB_565);
+    if (tracking == 0) {
+        fprintf(stderr, "couldn't create the tracking surface\n");
+        exit(1);
+    }
+    tracking->setLayer(100001);
+    Vector< sp<SurfaceControl> > loads;
+    for (int i=1 ; i<producers ; i++) {
+        sp<SurfaceControl> load = client->createSurface(
+                String8("vsync-latency-load"), 0, 256, 256,
+                PIXEL_FORMAT_RGB_565);
+        if (load == 0) {
+            fprintf(stderr, "couldn't create load surface %d\n", i);
+            exit(1);
+        }
+        load->setLayer(100000);
+        load->setPosition(32 * i, 32 * i);
+        loads.add(load);
+    }
+    SurfaceComposerClient::closeGlobalTransaction();
+
+    // only count the frames of this run
+    dumpSurfaceFlinger("--latency-clear", kTrackingName);
+
+    Vector< sp<LoadThread> > loadThreads;
+    for (size_t i=0 ; i<loads.size() ; i++) {
+        sp<LoadThread> thread = new LoadThread(loads[i]->getSurface());
+        thread->run("VSyncLatencyLoad");
+        loadThreads.add(thread);
+    }
+    sp<Touchscreen> touchscreen = new Touchscreen(refreshPeriod);
+    touchscreen->run("VSyncLatencyTouch");
+
+    DisplayEventReceiver receiver;
+    Tracker tracker;
+    tracker.receiver = &receiver;
+    tracker.surface = tracking->getSurface();
+    tracker.touchscreen = touchscreen.get();
+    tracker.color = 0;
+
+    sp<Looper> loop = new Looper(false);
+    loop->addFd(receiver.getFd(), 0, ALOOPER_EVENT_INPUT, onVsync, &tracker);
+    receiver.setVsyncRate(1);
+
+    const nsecs_t end = systemTime() + s2ns(seconds);
+    nsecs_t now;
+    while ((now = systemTime()) < end) {
+        loop->pollOnce(ns2ms(end - now) + 1);
+    }
+
+    touchscreen->requestExitAndWait();
+    for (size_t i=0 ; i<loadThreads.size() ; i++) {
+        loadThreads[i]->requestExitAndWait();
+    }
+
+    char app[PROPERTY_VALUE_MAX], sf[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.vsync_app_phase_ns", app, "default");
+    property_get("debug.sf.vsync_sf_phase_ns", sf, "default");
+    printf("refresh period: %.2f ms, phase offsets (ns): app=%s, "
+            "SurfaceFlinger=%s\n", refreshPeriod / 1e6, app, sf);
+    printf("touches: %u, frames: %u, load producers: %u\n",
+            touchscreen->getTouchCount(),
+            uint32_t(tracker.touchToQueue.size()), uint32_t(loads.size()));
+    printPercentiles("vsync-to-wakeup", tracker.vsyncToWakeup);
+    printPercentiles("touch-to-queue", tracker.touchToQueue);
+
+    // the display side, as SurfaceFlinger measured it
+    String8 histogram(dumpSurfaceFlinger("--latency-histogram", kTrackingName));
+    const char* queueToDisplay = strstr(histogram.string(), "queue-to-display");
+    if (queueToDisplay) {
+        const char* eol = strchr(queueToDisplay, '\n');
+        printf("%.*s\n", eol ? int(eol - queueToDisplay) : int(strlen(queueToDisplay)),
+                queueToDisplay);
+    } else {
+        printf("queue-to-display: not available\n");
+    }
+    printf("touch-to-display is the sum of touch-to-queue and "
+            "queue-to-display\n");
+
+    client->dispose();
+    return 0;
+}